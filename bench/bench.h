@@ -0,0 +1,77 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Common helpers for the flinux benchmark programs
+ *
+ * Each benchmark runs a loop for a fixed number of iterations and prints a
+ * line of the form "<name> <nanoseconds per iteration>" on stdout, which is
+ * parsed by run.sh. The iteration counts can be scaled with the BENCH_SCALE
+ * environment variable to get quick (e.g. 0.1) or more stable runs.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static inline double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline long bench_iterations(long count)
+{
+	const char *scale = getenv("BENCH_SCALE");
+	if (scale)
+	{
+		long n = (long)(count * atof(scale));
+		return n > 0 ? n : 1;
+	}
+	return count;
+}
+
+static inline void bench_report(const char *name, long iterations, double elapsed)
+{
+	printf("%s %.1f\n", name, elapsed / iterations);
+	fflush(stdout);
+}
+
+static inline void bench_fail(const char *name, const char *what)
+{
+	fprintf(stderr, "%s: %s failed.\n", name, what);
+	exit(1);
+}
+
+/* Run |body| |count| times, report the average time of one iteration */
+#define BENCH(name, count, ...) \
+	do \
+	{ \
+		long bench_n_ = bench_iterations(count); \
+		double bench_start_ = bench_now(); \
+		for (long bench_i_ = 0; bench_i_ < bench_n_; bench_i_++) \
+		{ \
+			__VA_ARGS__; \
+		} \
+		bench_report(name, bench_n_, bench_now() - bench_start_); \
+	} while (0)
@@ -0,0 +1,83 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Code patterns which are expensive to translate
+ * These do not enter the kernel, the overhead comes from the dbt alone. */
+
+#include "bench.h"
+
+#define INNER	1000
+
+typedef unsigned (*op_t)(unsigned);
+
+static unsigned op_add(unsigned x) { return x + 3; }
+static unsigned op_mul(unsigned x) { return x * 7; }
+static unsigned op_xor(unsigned x) { return x ^ 0x5A5A; }
+static unsigned op_shift(unsigned x) { return (x << 3) | (x >> 29); }
+
+/* Keep the compiler from resolving the targets */
+static op_t volatile ops[4] = { op_add, op_mul, op_xor, op_shift };
+
+static __attribute__((noinline)) unsigned fib(unsigned n)
+{
+	return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+static __attribute__((noinline)) unsigned dispatch(const unsigned char *code, int len)
+{
+	unsigned acc = 0;
+	for (int i = 0; i < len; i++)
+	{
+		switch (code[i])
+		{
+		case 0: acc += 1; break;
+		case 1: acc -= 3; break;
+		case 2: acc *= 5; break;
+		case 3: acc ^= 0x55; break;
+		case 4: acc <<= 1; break;
+		case 5: acc >>= 1; break;
+		case 6: acc |= 0x100; break;
+		case 7: acc &= 0xFFFF; break;
+		case 8: acc += acc >> 4; break;
+		default: acc = ~acc; break;
+		}
+	}
+	return acc;
+}
+
+volatile unsigned sink;
+
+int main()
+{
+	unsigned x = 1;
+	BENCH("dbt_indirect_call", 100000,
+		for (int j = 0; j < INNER; j++)
+			x = ops[j & 3](x));
+	sink = x;
+
+	/* fib(20) makes 21891 calls and returns */
+	BENCH("dbt_call_return", 200, sink = fib(20));
+
+	unsigned char code[INNER];
+	for (int i = 0; i < INNER; i++)
+		code[i] = (i * 7 + i / 3) % 10;
+	BENCH("dbt_switch", 100000, sink = dispatch(code, INNER));
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* File system metadata operations */
+
+#include "bench.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main()
+{
+	const char *path = "bench_fs.tmp";
+	int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fd < 0)
+		bench_fail("fs", "creating test file");
+	close(fd);
+
+	BENCH("open_close", 20000,
+		if ((fd = open(path, O_RDONLY)) < 0)
+			bench_fail("open_close", "open()");
+		close(fd));
+	struct stat st;
+	BENCH("stat", 50000,
+		if (stat(path, &st) < 0)
+			bench_fail("stat", "stat()"));
+	fd = open(path, O_RDONLY);
+	BENCH("fstat", 100000, fstat(fd, &st));
+	close(fd);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Benchmarks of flinux's own platform independent code, running natively
+ * on the host. Built by run.sh together with the sources under src/, the
+ * kernel heap runs on the malloc based mm replacement in shim/mm.c. */
+
+#include "bench.h"
+
+#include <lib/path.h>
+#include <lib/rbtree.h>
+#include <lib/vtparse.h>
+#include <lib/vtscan.h>
+#include <heap.h>
+#include <str.h>
+#include <vsprintf.h>
+
+#include <stdint.h>
+
+#define NODE_COUNT	65536
+#define TEXT_SIZE	65536
+
+struct node
+{
+	struct rb_node tree;
+	uint32_t key;
+};
+
+static int node_cmp(const struct rb_node *l, const struct rb_node *r)
+{
+	uint32_t left = rb_entry(l, struct node, tree)->key;
+	uint32_t right = rb_entry(r, struct node, tree)->key;
+	return left < right ? -1 : left > right;
+}
+
+static struct node nodes[NODE_COUNT];
+
+static void bench_rbtree()
+{
+	/* Pseudo random distinct keys */
+	for (uint32_t i = 0; i < NODE_COUNT; i++)
+		nodes[i].key = i * 2654435761U;
+	struct rb_tree tree;
+	long n = bench_iterations(20);
+	double insert = 0, find = 0, remove = 0;
+	for (long r = 0; r < n; r++)
+	{
+		rb_init(&tree);
+		double start = bench_now();
+		for (int i = 0; i < NODE_COUNT; i++)
+			rb_add(&tree, &nodes[i].tree, node_cmp);
+		insert += bench_now() - start;
+
+		start = bench_now();
+		for (int i = 0; i < NODE_COUNT; i++)
+		{
+			struct node probe;
+			probe.key = nodes[(i * 7) % NODE_COUNT].key;
+			if (!rb_find(&tree, &probe.tree, node_cmp))
+				bench_fail("rbtree_find", "rb_find()");
+		}
+		find += bench_now() - start;
+
+		start = bench_now();
+		for (int i = 0; i < NODE_COUNT; i++)
+			rb_remove(&tree, &nodes[i].tree);
+		remove += bench_now() - start;
+		if (!rb_empty(&tree))
+			bench_fail("rbtree_remove", "rb_remove()");
+	}
+	bench_report("rbtree_insert", n * NODE_COUNT, insert);
+	bench_report("rbtree_find", n * NODE_COUNT, find);
+	bench_report("rbtree_remove", n * NODE_COUNT, remove);
+}
+
+static char text[TEXT_SIZE], text_out[TEXT_SIZE * 2];
+static uint16_t text16[TEXT_SIZE];
+
+/* Fill text with a repeated pattern, returns the length in bytes */
+static int make_text(const char *pattern)
+{
+	int len = strlen(pattern), size = 0;
+	while (size + len < TEXT_SIZE)
+	{
+		memcpy(text + size, pattern, len);
+		size += len;
+	}
+	return size;
+}
+
+/* Reports the time per KB of UTF-8 text */
+static void bench_utf(const char *name, const char *pattern)
+{
+	char name8[64], name16[64];
+	ksprintf(name8, "%s_utf8_to_utf16", name);
+	ksprintf(name16, "%s_utf16_to_utf8", name);
+	int size = make_text(pattern);
+	int len16 = 0;
+	long n = bench_iterations(5000);
+	double start = bench_now();
+	for (long i = 0; i < n; i++)
+		if ((len16 = utf8_to_utf16(text, size, text16, TEXT_SIZE)) <= 0)
+			bench_fail(name8, "utf8_to_utf16()");
+	bench_report(name8, n * size / 1024, bench_now() - start);
+	start = bench_now();
+	for (long i = 0; i < n; i++)
+		if (utf16_to_utf8(text16, len16, text_out, sizeof(text_out)) != size)
+			bench_fail(name16, "utf16_to_utf8()");
+	bench_report(name16, n * size / 1024, bench_now() - start);
+}
+
+static volatile int sink;
+
+static void bench_misc()
+{
+	BENCH("wcwidth", 1000000,
+		sink = wcwidth(bench_i_ & 0x1FFFF));
+	char buf[256];
+	BENCH("ksprintf", 1000000,
+		sink = ksprintf(buf, "%s(%d, 0x%x, %p)\n", "mmap", (int)bench_i_, 0x1000, buf));
+
+	int size = make_text("The quick brown fox jumps over the lazy dog. ");
+	text[size - 1] = '\n';
+	BENCH("vt_scan_ascii_64k", 20000,
+		sink = (int)vt_scan_ascii(text, size));
+	BENCH("vt_find_control_64k", 20000,
+		sink = (int)vt_find_control(text, size));
+}
+
+static void bench_path()
+{
+	char buf[256];
+	BENCH("path_normalize", 1000000,
+		sink = path_normalize("/home/user/src/flinux", "../flinux/./src/syscall/../fs//winfs.c", buf));
+	BENCH("path_normalize_abs", 1000000,
+		sink = path_normalize("/", "/usr/lib/x86_64-linux-gnu/libc.so.6", buf));
+}
+
+#define HEAP_OBJECTS	4096
+
+static void *heap_objects[HEAP_OBJECTS];
+
+static void bench_heap()
+{
+	heap_init();
+	BENCH("kmalloc_kfree_64", 1000000,
+		kfree(kmalloc(64), 64));
+	/* Spans several buckets, kfree() looks up the bucket of each object */
+	long n = bench_iterations(200);
+	double start = bench_now();
+	for (long r = 0; r < n; r++)
+	{
+		for (int i = 0; i < HEAP_OBJECTS; i++)
+			if (!(heap_objects[i] = kmalloc(256)))
+				bench_fail("kmalloc_256", "kmalloc()");
+		for (int i = 0; i < HEAP_OBJECTS; i++)
+			kfree(heap_objects[i], 256);
+	}
+	bench_report("kmalloc_256", n * HEAP_OBJECTS, bench_now() - start);
+}
+
+/* Counters of the VT parser callbacks */
+static long vt_printed, vt_controls, vt_sequences;
+
+static void vt_print(const char *buf, size_t count)
+{
+	vt_printed += count;
+}
+
+static void vt_execute(char ch)
+{
+	vt_controls++;
+}
+
+static void vt_escape(char intermediate, char ch)
+{
+	vt_sequences++;
+}
+
+static void vt_csi(struct vt_parser *parser, char ch)
+{
+	vt_sequences++;
+}
+
+static void vt_osc(int command, const char *string, int len)
+{
+	vt_sequences++;
+}
+
+static const struct vt_callbacks vt_counters = {
+	.print = vt_print,
+	.execute = vt_execute,
+	.escape = vt_escape,
+	.csi = vt_csi,
+	.osc = vt_osc,
+};
+
+/* Load a recorded terminal stream (e.g. from "script -q /dev/null make"), returns the size */
+static int load_stream(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		bench_fail("vt_parse", path);
+	int size = (int)fread(text, 1, TEXT_SIZE, f);
+	fclose(f);
+	return size;
+}
+
+/* Parse a stream like colored compiler output, or the file in BENCH_VT_STREAM */
+static void bench_vt()
+{
+	const char *path = getenv("BENCH_VT_STREAM");
+	int size;
+	if (path)
+		size = load_stream(path);
+	else
+		size = make_text("\x1B]0;make\x07src/fs/console.c:1234:5: \x1B[01;35mwarning:\x1B[0m unused variable "
+			"\xE2\x80\x98\x1B[01mconsole_file\x1B[0m\xE2\x80\x99 [\x1B[01;35m-Wunused-variable\x1B[0m]\r\n"
+			"\tconsole_file = NULL;\r\n\x1B(0qqqq\x1B(B\x1B[K\r\n");
+	struct vt_parser parser;
+	vt_parser_init(&parser);
+	vt_printed = vt_controls = vt_sequences = 0;
+	long n = bench_iterations(5000);
+	double start = bench_now();
+	for (long i = 0; i < n; i++)
+		vt_parse(&parser, &vt_counters, text, size);
+	double elapsed = bench_now() - start;
+	if (!path && (vt_printed == 0 || vt_controls == 0 || vt_sequences == 0 || parser.state != VT_GROUND))
+		bench_fail("vt_parse", "vt_parse()");
+	bench_report("vt_parse", n * size / 1024, elapsed);
+}
+
+int main()
+{
+	bench_rbtree();
+	bench_utf("ascii", "The quick brown fox jumps over the lazy dog. ");
+	bench_utf("mixed", "Gr\xc3\xbc\xc3\x9f Gott \xe4\xbd\xa0\xe5\xa5\xbd\xe4\xb8\x96\xe7\x95\x8c \xf0\x9f\x98\x80 ");
+	bench_misc();
+	bench_path();
+	bench_heap();
+	bench_vt();
+	return 0;
+}
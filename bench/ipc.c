@@ -0,0 +1,82 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Pipe and socket throughput
+ * The reported time is per BUFFER_SIZE chunk sent from a child process. */
+
+#include "bench.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE	65536
+
+static char buffer[BUFFER_SIZE];
+
+static void transfer(const char *name, int fds[2], long count)
+{
+	long n = bench_iterations(count);
+	double start = bench_now();
+	pid_t pid = fork();
+	if (pid < 0)
+		bench_fail(name, "fork()");
+	if (pid == 0)
+	{
+		close(fds[0]);
+		for (long i = 0; i < n; i++)
+			for (size_t done = 0; done < BUFFER_SIZE;)
+			{
+				ssize_t r = write(fds[1], buffer + done, BUFFER_SIZE - done);
+				if (r <= 0)
+					_exit(1);
+				done += r;
+			}
+		_exit(0);
+	}
+	close(fds[1]);
+	size_t total = 0;
+	for (;;)
+	{
+		ssize_t r = read(fds[0], buffer, BUFFER_SIZE);
+		if (r < 0)
+			bench_fail(name, "read()");
+		if (r == 0)
+			break;
+		total += r;
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	if (total != (size_t)n * BUFFER_SIZE)
+		bench_fail(name, "transfer");
+	bench_report(name, n, bench_now() - start);
+}
+
+int main()
+{
+	int fds[2];
+	if (pipe(fds) < 0)
+		bench_fail("pipe", "pipe()");
+	transfer("pipe_64k", fds, 20000);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		bench_fail("socket", "socketpair()");
+	transfer("socket_64k", fds, 20000);
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Memory management */
+
+#include "bench.h"
+
+#include <sys/mman.h>
+
+#define CHURN_SIZE	(256 * 1024)
+#define FAULT_SIZE	(16 * 1024 * 1024)
+#define PAGE_SIZE	4096
+
+int main()
+{
+	BENCH("mmap_munmap", 20000,
+		void *p = mmap(NULL, CHURN_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			bench_fail("mmap_munmap", "mmap()");
+		munmap(p, CHURN_SIZE));
+
+	/* Time per page of first touch on fresh anonymous memory */
+	long n = bench_iterations(20);
+	double elapsed = 0;
+	for (long i = 0; i < n; i++)
+	{
+		char *p = mmap(NULL, FAULT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			bench_fail("page_fault", "mmap()");
+		double start = bench_now();
+		for (size_t off = 0; off < FAULT_SIZE; off += PAGE_SIZE)
+			p[off] = 1;
+		elapsed += bench_now() - start;
+		munmap(p, FAULT_SIZE);
+	}
+	bench_report("page_fault", n * (FAULT_SIZE / PAGE_SIZE), elapsed);
+	return 0;
+}
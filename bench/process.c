@@ -0,0 +1,57 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Process creation */
+
+#include "bench.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+	/* Child of the fork_exec benchmark */
+	if (argc > 1 && !strcmp(argv[1], "--exit"))
+		return 0;
+
+	BENCH("fork_exit", 200,
+		pid_t pid = fork();
+		if (pid < 0)
+			bench_fail("fork_exit", "fork()");
+		if (pid == 0)
+			_exit(0);
+		waitpid(pid, NULL, 0));
+
+	BENCH("fork_exec", 100,
+		pid_t pid = fork();
+		if (pid < 0)
+			bench_fail("fork_exec", "fork()");
+		if (pid == 0)
+		{
+			execl("/proc/self/exe", argv[0], "--exit", NULL);
+			execl(argv[0], argv[0], "--exit", NULL);
+			_exit(1);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			bench_fail("fork_exec", "execve()"));
+	return 0;
+}
@@ -0,0 +1,162 @@
+#!/bin/sh
+#
+# This file is part of Foreign Linux.
+#
+# Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Benchmark driver
+#
+# Typical usage:
+#   1. On a Linux host, build the static programs and record a baseline:
+#        bench/run.sh -m32 -o baseline.txt
+#   2. Copy the bench directory (with the bin-* subdirectory) and the
+#      baseline into a flinux environment and run from a shell inside it:
+#        bench/run.sh -m32 -n -b baseline.txt
+#      This prints the overhead ratio of each benchmark against the baseline.
+#
+# The "host" benchmark is not run by default. It builds the platform
+# independent parts of flinux (ChaCha20, rb-tree, UTF conversions, vsprintf,
+# wcwidth, VT scanning and parsing, path normalization, the kernel heap and
+# the io_uring rings) natively against shim/Windows.h and shim/mm.c, to
+# measure them on Linux:
+#   bench/run.sh -o before.txt host; (change code); bench/run.sh -b before.txt host
+#
+# With -t, the unit tests of these parts (test_*.c) are built and run
+# natively instead, e.g. the wcwidth table is compared against glibc and
+# ChaCha20 is checked with the RFC 8439 test vectors. test_logcollector.cpp
+# tests the flog log collector (flog/src/LogCollector.cpp), which is built
+# with -Wall -Wextra -Werror by ${CXX:-c++}. The exit status is
+# nonzero if any test fails, for use in CI:
+#   bench/run.sh -t
+#   bench/run.sh -t rbtree str
+# The host programs are built with -Wall -Werror.
+#
+# The VT parser is fed with a synthetic stream of compiler output by default.
+# To use a recorded terminal stream instead, set BENCH_VT_STREAM to its path.
+
+usage()
+{
+	echo "Usage: $0 [-m32|-m64] [-n] [-o output] [-b baseline] [-s scale] [benchmark...]"
+	echo "       $0 -t [-m32|-m64] [test...]"
+	echo "  -m32, -m64   Build and run i386 or x86-64 programs (default: -m64)"
+	echo "  -n           Do not build, use the existing binaries"
+	echo "  -o output    Save the results to this file"
+	echo "  -b baseline  Compare with results saved from a native run"
+	echo "  -s scale     Scale iteration counts (BENCH_SCALE)"
+	echo "  -t           Build and run unit tests of the host code instead"
+	exit 1
+}
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+ARCH=64
+BUILD=1
+OUTPUT=
+BASELINE=
+PROGRAMS="syscall fs process ipc mm signal dbt"
+TEST=0
+TESTS="chacha20 heap io_uring logcollector path rbtree str vt wcwidth"
+
+while [ $# -gt 0 ]; do
+	case "$1" in
+	-m32) ARCH=32 ;;
+	-m64) ARCH=64 ;;
+	-n) BUILD=0 ;;
+	-o) OUTPUT=$2; shift ;;
+	-b) BASELINE=$2; shift ;;
+	-s) BENCH_SCALE=$2; export BENCH_SCALE; shift ;;
+	-t) TEST=1 ;;
+	-h|--help) usage ;;
+	-*) usage ;;
+	*) break ;;
+	esac
+	shift
+done
+BIN_DIR="$BENCH_DIR/bin-$ARCH"
+SRC_DIR="$BENCH_DIR/../src"
+
+# Build a program from platform independent flinux sources
+build_host()
+{
+	${CC:-cc} -m$ARCH -O2 -Wall -Werror -I"$BENCH_DIR/shim" -I"$SRC_DIR" -include "$BENCH_DIR/shim/Windows.h" \
+		-o "$BIN_DIR/$1" "$BENCH_DIR/$1.c" "$SRC_DIR/lib/chacha20.c" "$SRC_DIR/lib/rbtree.c" \
+		"$SRC_DIR/lib/path.c" "$SRC_DIR/lib/uring.c" "$SRC_DIR/lib/vtparse.c" "$SRC_DIR/lib/vtscan.c" "$SRC_DIR/heap.c" "$SRC_DIR/str.c" \
+		"$SRC_DIR/vsprintf.c" "$SRC_DIR/wcwidth.c" "$BENCH_DIR/shim/mm.c"
+}
+
+# Build a C++ test of the flog log collector, which only depends on the standard library
+build_flog()
+{
+	${CXX:-c++} -m$ARCH -O2 -Wall -Wextra -Werror -I"$BENCH_DIR/../flog/src" \
+		-o "$BIN_DIR/$1" "$BENCH_DIR/$1.cpp" "$BENCH_DIR/../flog/src/LogCollector.cpp"
+}
+
+if [ $TEST -eq 1 ]; then
+	[ $# -gt 0 ] && TESTS="$*"
+	mkdir -p "$BIN_DIR" || exit 1
+	FAILED=0
+	for t in $TESTS; do
+		if [ -f "$BENCH_DIR/test_$t.cpp" ]; then
+			BUILD_TEST=build_flog
+		else
+			BUILD_TEST=build_host
+		fi
+		if $BUILD_TEST "test_$t" && "$BIN_DIR/test_$t"; then
+			echo "$t: passed"
+		else
+			echo "$t: FAILED"
+			FAILED=1
+		fi
+	done
+	exit $FAILED
+fi
+
+[ $# -gt 0 ] && PROGRAMS="$*"
+
+if [ $BUILD -eq 1 ]; then
+	mkdir -p "$BIN_DIR" || exit 1
+	for p in $PROGRAMS; do
+		if [ "$p" = host ]; then
+			build_host host || exit 1
+		else
+			${CC:-cc} -m$ARCH -static -O2 -Wall -o "$BIN_DIR/$p" "$BENCH_DIR/$p.c" || exit 1
+		fi
+	done
+fi
+
+RESULTS=$(mktemp) || exit 1
+trap 'rm -f "$RESULTS"' EXIT
+# Programs create their temporary files in the current directory
+cd "$BIN_DIR" || exit 1
+for p in $PROGRAMS; do
+	"./$p" >> "$RESULTS" || echo "$p: failed" >&2
+done
+
+[ -n "$OUTPUT" ] && cp "$RESULTS" "$OUTPUT"
+
+if [ -n "$BASELINE" ]; then
+	printf "%-20s %14s %14s %8s\n" "benchmark" "baseline(ns)" "current(ns)" "ratio"
+	awk 'NR == FNR { base[$1] = $2; next }
+		{
+			if ($1 in base && base[$1] > 0)
+				printf "%-20s %14.1f %14.1f %8.2f\n", $1, base[$1], $2, $2 / base[$1]
+			else
+				printf "%-20s %14s %14.1f %8s\n", $1, "-", $2, "-"
+		}' "$BASELINE" "$RESULTS"
+else
+	printf "%-20s %14s\n" "benchmark" "time(ns)"
+	awk '{ printf "%-20s %14.1f\n", $1, $2 }' "$RESULTS"
+fi
@@ -0,0 +1,49 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Minimal Windows.h replacement for building the platform independent parts
+ * of flinux on a Linux host. Only covers what host.c links with.
+ * It is also force included for the MSVC keywords used by those sources. */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#define __forceinline	inline __attribute__((always_inline))
+
+typedef void *HANDLE;
+typedef struct _CONTEXT *PCONTEXT;
+#define STD_OUTPUT_HANDLE	((unsigned)-11)
+
+static inline HANDLE GetStdHandle(unsigned handle)
+{
+	return stdout;
+}
+
+static inline int WriteFile(HANDLE handle, const void *buffer, unsigned size, unsigned *written, void *overlapped)
+{
+	return fwrite(buffer, 1, size, handle) == size;
+}
+
+static inline int FlushFileBuffers(HANDLE handle)
+{
+	return fflush(handle) == 0;
+}
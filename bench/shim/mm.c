@@ -0,0 +1,87 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Host replacements of the mm functions used by heap.c
+ * syscall/mm.h is not included, its Linux types clash with the C library's. */
+
+#include <common/errno.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define BLOCK_SIZE	0x10000
+#define PAGE_SIZE	0x1000
+#define MAX_MAPPINGS	256
+
+struct file;
+
+int shim_mapped_blocks;
+static struct
+{
+	char *addr;
+	size_t len;
+} mappings[MAX_MAPPINGS];
+
+/* Whether [addr, addr + size) lies within a single mapping */
+int shim_is_mapped(const void *addr, size_t size)
+{
+	for (int i = 0; i < MAX_MAPPINGS; i++)
+		if (mappings[i].addr && (const char *)addr >= mappings[i].addr
+			&& (const char *)addr + size <= mappings[i].addr + mappings[i].len)
+			return 1;
+	return 0;
+}
+
+void *mm_static_alloc(size_t size)
+{
+	return calloc(1, size);
+}
+
+/* Only anonymous allocations. mm only guarantees page alignment, the result is
+ * deliberately one page past a block boundary so the callers cannot rely on more. */
+void *mm_mmap(void *addr, size_t len, int prot, int flags, int internal_flags, struct file *f, intptr_t offset_pages)
+{
+	for (int i = 0; i < MAX_MAPPINGS; i++)
+		if (!mappings[i].addr)
+		{
+			char *p = aligned_alloc(BLOCK_SIZE, len + PAGE_SIZE);
+			if (!p)
+				return (void *)-ENOMEM;
+			mappings[i].addr = p + PAGE_SIZE;
+			mappings[i].len = len;
+			shim_mapped_blocks++;
+			return mappings[i].addr;
+		}
+	return (void *)-ENOMEM;
+}
+
+int mm_munmap(void *addr, size_t len)
+{
+	for (int i = 0; i < MAX_MAPPINGS; i++)
+		if (mappings[i].addr == addr)
+		{
+			free(mappings[i].addr - PAGE_SIZE);
+			mappings[i].addr = NULL;
+			shim_mapped_blocks--;
+			return 0;
+		}
+	return -EINVAL;
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Signal delivery */
+
+#include "bench.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t received;
+
+static void handler(int sig)
+{
+	received++;
+}
+
+int main()
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL) < 0)
+		bench_fail("signal", "sigaction()");
+	pid_t pid = getpid();
+	/* kill() to self delivers the signal before returning */
+	BENCH("signal_roundtrip", 100000, kill(pid, SIGUSR1));
+	if (received != bench_iterations(100000))
+		bench_fail("signal_roundtrip", "signal delivery");
+	return 0;
+}
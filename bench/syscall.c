@@ -0,0 +1,36 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* System call entry overhead */
+
+#include "bench.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int main()
+{
+	/* getppid() is never cached by the C library */
+	BENCH("syscall_null", 1000000, syscall(SYS_getppid));
+	BENCH("syscall_getpid", 1000000, syscall(SYS_getpid));
+	struct timespec ts;
+	BENCH("clock_gettime", 1000000, clock_gettime(CLOCK_MONOTONIC, &ts));
+	return 0;
+}
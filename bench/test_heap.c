@@ -0,0 +1,106 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Unit tests of the kernel heap pools, on top of the mm replacement in shim/mm.c */
+
+#include <heap.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE	0x10000
+#define MAX_OBJECTS	8192
+
+extern int shim_mapped_blocks;
+int shim_is_mapped(const void *addr, size_t size);
+
+static int failed;
+
+static void check(int cond, const char *what)
+{
+	if (!cond)
+	{
+		printf("heap: %s\n", what);
+		failed++;
+	}
+}
+
+static char *objects[MAX_OBJECTS];
+
+/* Allocate enough objects of size for several buckets, then free them in the given order */
+static void test_pool(int size, int stride)
+{
+	int count = 3 * BLOCK_SIZE / size + 1;
+	if (count > MAX_OBJECTS)
+		count = MAX_OBJECTS;
+	int mapped = shim_mapped_blocks;
+	for (int i = 0; i < count; i++)
+	{
+		objects[i] = kmalloc(size);
+		if (!objects[i] || (uintptr_t)objects[i] % sizeof(void *))
+		{
+			check(0, "kmalloc() returns a NULL or unaligned object");
+			return;
+		}
+		check(shim_is_mapped(objects[i], size), "kmalloc() object crosses the end of its bucket");
+		memset(objects[i], (char)i, size);
+	}
+	check(shim_mapped_blocks > mapped + 1, "kmalloc() does not chain buckets");
+	/* Objects must not overlap each other or the bucket headers */
+	int ok = 1;
+	for (int i = 0; i < count; i++)
+		for (int j = 0; j < size; j++)
+			ok &= objects[i][j] == (char)i;
+	check(ok, "kmalloc() objects overlap");
+	/* Free objects in every bucket, including those past the first page */
+	for (int i = 0; i < stride; i++)
+		for (int j = i; j < count; j += stride)
+			kfree(objects[j], size);
+	/* Each pool keeps one empty bucket */
+	check(shim_mapped_blocks - mapped <= 1, "kfree() does not release empty buckets");
+}
+
+static void test_reuse()
+{
+	int mapped = shim_mapped_blocks;
+	char *a = kmalloc(100), *b = kmalloc(100);
+	check(a != b, "kmalloc() returns the same object twice");
+	kfree(a, 100);
+	check(kmalloc(128) == a, "kmalloc() does not reuse a freed object of the same pool");
+	kfree(a, 128);
+	kfree(b, 100);
+	check(shim_mapped_blocks == mapped, "kmalloc() does not use the bucket kept by the pool");
+	check(kmalloc(16385) == NULL, "kmalloc() of an oversized object");
+}
+
+int main()
+{
+	heap_init();
+	for (int size = 16; size <= 16384; size *= 2)
+	{
+		test_pool(size, 1);
+		test_pool(size, 7);
+		test_pool(size - 1, 3);
+	}
+	test_pool(1, 5);
+	test_reuse();
+	return failed > 0;
+}
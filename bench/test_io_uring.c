@@ -0,0 +1,198 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Unit tests of the io_uring submission and completion rings */
+
+#include <common/errno.h>
+#include <lib/uring.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SQ_ENTRIES	8
+#define CQ_ENTRIES	4
+
+static int failed;
+
+static void check(int cond, const char *what)
+{
+	if (!cond)
+	{
+		printf("io_uring: %s\n", what);
+		failed++;
+	}
+}
+
+static struct uring ring;
+static void *sq, *cq;
+static struct io_uring_sqe sqes[SQ_ENTRIES];
+
+static void setup(uint32_t start)
+{
+	free(sq);
+	free(cq);
+	sq = calloc(1, uring_sq_size(SQ_ENTRIES));
+	cq = calloc(1, uring_cq_size(CQ_ENTRIES));
+	memset(sqes, 0, sizeof(sqes));
+	uring_init(&ring, sq, cq, sqes, SQ_ENTRIES, CQ_ENTRIES);
+	/* Start at the given position to test wrap around */
+	ring.sq_head = ring.sq->head = ring.sq->tail = start;
+	ring.cq_tail = ring.cq->head = ring.cq->tail = start;
+}
+
+/* Queue an entry like liburing, the result of a request is taken from its off field */
+static void queue(uint64_t user_data, uint8_t flags, int32_t res)
+{
+	uint32_t tail = ring.sq->tail;
+	uint32_t index = tail % SQ_ENTRIES;
+	sqes[index].opcode = IORING_OP_NOP;
+	sqes[index].flags = flags;
+	sqes[index].off = (uint64_t)(int64_t)res;
+	sqes[index].user_data = user_data;
+	ring.sq->array[tail & ring.sq->ring_mask] = index;
+	ring.sq->tail = tail + 1;
+}
+
+/* Submit and execute queued entries, returns the number of submitted entries */
+static uint32_t submit(uint32_t to_submit, int *linked)
+{
+	struct uring_submit s;
+	struct io_uring_sqe sqe;
+	int l, i = 0;
+	uring_submit_begin(&s, &ring, to_submit);
+	while (uring_submit_next(&s, &sqe, &l))
+	{
+		if (linked)
+			linked[i++] = l;
+		uring_submit_complete(&s, &sqe, (int32_t)sqe.off);
+	}
+	return uring_submit_end(&s);
+}
+
+/* Consume the next completion */
+static int reap(uint64_t user_data, int32_t res)
+{
+	volatile struct uring_cq *c = ring.cq;
+	if (c->head == c->tail)
+		return 0;
+	volatile struct io_uring_cqe *cqe = &c->cqes[c->head & c->ring_mask];
+	int ok = cqe->user_data == user_data && cqe->res == res;
+	c->head++;
+	return ok;
+}
+
+static void test_submit(uint32_t start)
+{
+	setup(start);
+	check(ring.sq->ring_entries == SQ_ENTRIES && ring.cq->ring_mask == CQ_ENTRIES - 1, "ring sizes");
+	queue(1, 0, 0);
+	queue(2, 0, -EBADF);
+	queue(3, 0, 7);
+	check(submit(2, NULL) == 2, "to_submit limits submitted entries");
+	check(ring.sq->head == start + 2, "sq head after partial submit");
+	check(submit(8, NULL) == 1, "remaining entry submitted");
+	check(ring.sq->head == ring.sq->tail, "sq head after submit");
+	check(uring_cq_ready(&ring) == 3 && ring.cq->tail == start + 3, "cq tail");
+	check(reap(1, 0) && reap(2, -EBADF) && reap(3, 7), "completions in order");
+	check(uring_cq_ready(&ring) == 0 && ring.completions == 3, "all completions reaped");
+	check(submit(8, NULL) == 0, "empty submission queue");
+}
+
+static void test_dropped()
+{
+	setup(0);
+	queue(1, 0, 0);
+	ring.sq->array[0] = SQ_ENTRIES;
+	queue(2, 0, 0);
+	check(submit(8, NULL) == 1, "invalid index is not submitted");
+	check(ring.sq->dropped == 1 && ring.sq->head == 2, "invalid index is dropped");
+	check(reap(2, 0) && uring_cq_ready(&ring) == 0, "valid entry completed");
+}
+
+static void test_overflow()
+{
+	setup(0xFFFFFFFEU);
+	for (int i = 0; i < CQ_ENTRIES; i++)
+		check(uring_post(&ring, i, 0), "post to a queue with room");
+	check(!uring_post(&ring, 4, 0) && !uring_post(&ring, 5, 0), "post to a full queue");
+	check(ring.cq->overflow == 2 && ring.completions == 6, "overflow counted");
+	check(uring_cq_ready(&ring) == CQ_ENTRIES, "full queue keeps its entries");
+	check(reap(0, 0), "oldest completion kept");
+	check(uring_post(&ring, 6, 0), "post after the guest made room");
+	check(reap(1, 0) && reap(2, 0) && reap(3, 0) && reap(6, 0), "completions after overflow");
+}
+
+static void test_skip_success()
+{
+	setup(0);
+	queue(1, IOSQE_CQE_SKIP_SUCCESS, 0);
+	queue(2, IOSQE_CQE_SKIP_SUCCESS, -EINVAL);
+	queue(3, 0, 0);
+	check(submit(8, NULL) == 3, "entries submitted");
+	check(reap(2, -EINVAL) && reap(3, 0) && uring_cq_ready(&ring) == 0, "successful completion skipped");
+	check(ring.completions == 2, "skipped completion not counted");
+}
+
+static void test_link()
+{
+	int linked[8];
+	setup(0);
+	/* A failed request cancels the rest of its chain, but not the next chain */
+	queue(1, IOSQE_IO_LINK, 0);
+	queue(2, IOSQE_IO_LINK, -EIO);
+	queue(3, IOSQE_IO_LINK, 0);
+	queue(4, 0, 0);
+	check(submit(8, linked) == 4, "chain submitted");
+	check(linked[0] && linked[1], "executed entries of the chain are reported linked");
+	check(reap(1, 0) && reap(2, -EIO), "chain runs until a failure");
+	check(reap(3, -ECANCELED) && reap(4, -ECANCELED), "rest of the chain canceled");
+	queue(5, 0, 0);
+	check(submit(8, linked) == 1 && !linked[0], "entry after the chain is not linked");
+	check(reap(5, 0), "entry after the chain executed");
+
+	/* A failed hard link does not break the chain */
+	setup(0);
+	queue(1, IOSQE_IO_HARDLINK, -EIO);
+	queue(2, 0, 0);
+	check(submit(8, linked) == 2, "hard link chain submitted");
+	check(linked[0] && linked[1], "hard link chain entries linked");
+	check(reap(1, -EIO) && reap(2, 0), "hard link continues after failure");
+
+	/* The last entry of a failed chain ends it */
+	setup(0);
+	queue(1, IOSQE_IO_LINK, -EIO);
+	queue(2, 0, 0);
+	queue(3, IOSQE_IO_LINK, 0);
+	queue(4, 0, 0);
+	check(submit(8, NULL) == 4, "two chains submitted");
+	check(reap(1, -EIO) && reap(2, -ECANCELED) && reap(3, 0) && reap(4, 0), "second chain runs");
+}
+
+int main()
+{
+	test_submit(0);
+	test_submit(0xFFFFFFFFU);
+	test_dropped();
+	test_overflow();
+	test_skip_success();
+	test_link();
+	return failed > 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Unit tests of the flog log collector: line parsing, level and pid filters,
+ * partial lines and file rotation. Log files are written to a temporary directory. */
+
+#include "LogCollector.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int failed;
+static std::string directory;
+
+static void check(bool cond, const char *what)
+{
+	if (!cond)
+	{
+		printf("logcollector: %s\n", what);
+		failed++;
+	}
+}
+
+/* A log line as written by flinux */
+static std::string Line(char type, const char *message)
+{
+	return std::string("[12:34:56.789] (") + type + type + ") " + message + "\n";
+}
+
+static std::string Path(uint32_t pid, int index)
+{
+	std::string path = directory + "/flog-" + std::to_string(pid);
+	if (index > 0)
+		path += "." + std::to_string(index);
+	return path + ".log";
+}
+
+/* Contents of a log file, or "<none>" if it does not exist */
+static std::string ReadFile(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return "<none>";
+	std::string data;
+	char buf[4096];
+	size_t r;
+	while ((r = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.append(buf, r);
+	fclose(f);
+	return data;
+}
+
+static void Cleanup(uint32_t pid)
+{
+	for (int i = 0; i < 10; i++)
+		remove(Path(pid, i).c_str());
+}
+
+static void Write(LogCollector &collector, uint32_t pid, const std::string &data)
+{
+	collector.Write(pid, data.data(), data.size());
+}
+
+static LogCollectorOptions Options(char minLevel)
+{
+	LogCollectorOptions options;
+	options.directory = directory;
+	options.minLevel = minLevel;
+	return options;
+}
+
+static void TestParseType()
+{
+	std::string line = Line('I', "message");
+	check(LogCollector::ParseType(line.data(), line.size()) == 'I', "ParseType() of an info line");
+	line = Line('E', "");
+	check(LogCollector::ParseType(line.data(), line.size()) == 'E', "ParseType() of an empty error line");
+	line = "[12:34:56.789] (WW)";
+	check(LogCollector::ParseType(line.data(), line.size()) == 'W', "ParseType() of a line without message");
+	check(LogCollector::ParseType(line.data(), line.size() - 1) == 0, "ParseType() of a truncated header");
+	const char *invalid[] = {
+		"[12:34:56.789] (IW) mixed type\n",
+		"[12:34:56.789] (XX) unknown type\n",
+		"12:34:56.789]] (II) no bracket\n",
+		"[12:34:56.789]  (II) misplaced\n",
+		"plain text from log_raw() call\n",
+	};
+	for (const char *s : invalid)
+		check(LogCollector::ParseType(s, strlen(s)) == 0, "ParseType() accepts an invalid header");
+	check(LogCollector::GetLevel('D') < LogCollector::GetLevel('I') && LogCollector::GetLevel('I') < LogCollector::GetLevel('W')
+		&& LogCollector::GetLevel('W') < LogCollector::GetLevel('E'), "GetLevel() order");
+	check(LogCollector::GetLevel('X') == -1, "GetLevel() of an unknown type");
+}
+
+static void TestLevelFilter()
+{
+	const uint32_t pid = 100;
+	Cleanup(pid);
+	LogCollector collector(Options('W'));
+	collector.AddClient(pid);
+	/* Headerless lines (e.g. from log_raw()) inherit the level of the previous line */
+	Write(collector, pid, Line('I', "info") + "info continued\n" + Line('E', "error") + "error continued\n"
+		+ Line('D', "debug") + "debug continued\n" + Line('W', "warning"));
+	collector.RemoveClient(pid);
+	check(ReadFile(Path(pid, 0)) == Line('E', "error") + "error continued\n" + Line('W', "warning"), "level filter output");
+	check(collector.GetStats().levelFilteredLines == 4, "level filtered line count");
+	check(collector.GetStats().lines == 3, "written line count with level filter");
+	Cleanup(pid);
+}
+
+static void TestPartialLines()
+{
+	/* Both the unfiltered fast path and the line by line path */
+	for (char minLevel : { 'D', 'I' })
+	{
+		const uint32_t pid = 200;
+		Cleanup(pid);
+		LogCollector collector(Options(minLevel));
+		collector.AddClient(pid);
+		std::string data = Line('I', "first") + Line('D', "second") + Line('E', "third") + "unterminated";
+		/* Split everywhere, including inside the headers used by the level filter */
+		for (size_t split = 1; split < data.size(); split += 7)
+		{
+			Write(collector, pid, data.substr(0, split));
+			Write(collector, pid, data.substr(split));
+			collector.Flush();
+			/* The unterminated line is carried over and completed by the next write */
+			Write(collector, pid, " line\n");
+		}
+		collector.RemoveClient(pid);
+		std::string line = Line('I', "first") + (minLevel == 'D' ? Line('D', "second") : "") + Line('E', "third") + "unterminated line\n";
+		std::string expected;
+		for (size_t split = 1; split < data.size(); split += 7)
+			expected += line;
+		check(ReadFile(Path(pid, 0)) == expected, minLevel == 'D' ? "partial lines without level filter" : "partial lines with level filter");
+		Cleanup(pid);
+	}
+
+	/* An incomplete last line is terminated when the client disconnects */
+	const uint32_t pid = 201;
+	Cleanup(pid);
+	LogCollector collector(Options('D'));
+	collector.AddClient(pid);
+	Write(collector, pid, Line('I', "done") + "[12:34:56.789] (II) crash");
+	collector.RemoveClient(pid);
+	check(ReadFile(Path(pid, 0)) == Line('I', "done") + Line('I', "crash"), "partial line on disconnect");
+	Cleanup(pid);
+}
+
+static void TestPidFilter()
+{
+	LogCollectorOptions options = Options('D');
+	options.pids.insert(300);
+	Cleanup(300);
+	Cleanup(301);
+	LogCollector collector(options);
+	collector.AddClient(300);
+	collector.AddClient(301);
+	std::string line = Line('I', "message");
+	Write(collector, 300, line);
+	Write(collector, 301, line);
+	/* Data of a client which never connected is discarded as well */
+	Write(collector, 302, line);
+	collector.RemoveClient(300);
+	collector.RemoveClient(301);
+	check(ReadFile(Path(300, 0)) == line, "pid filter keeps the selected process");
+	check(ReadFile(Path(301, 0)) == "<none>", "pid filter creates a file for a filtered process");
+	check(collector.GetStats().pidFilteredBytes == 2 * line.size(), "pid filtered byte count");
+	check(collector.GetStats().clients == 2, "client count");
+	Cleanup(300);
+}
+
+static void TestRotation()
+{
+	for (int maxFiles : { 2, 0 })
+	{
+		const uint32_t pid = 400;
+		Cleanup(pid);
+		LogCollectorOptions options = Options('D');
+		options.maxFileSize = 80;
+		options.maxFiles = maxFiles;
+		std::vector<std::string> created;
+		options.onFileCreated = [&](const std::string &path) { created.push_back(path); };
+		LogCollector collector(options);
+		collector.AddClient(pid);
+		/* 40 byte lines, two fill a file exactly */
+		std::vector<std::string> lines;
+		for (int i = 0; i < 9; i++)
+		{
+			char message[32];
+			snprintf(message, sizeof(message), "line %d of 40 bytes.", i);
+			lines.push_back(Line('I', message));
+			Write(collector, pid, lines.back());
+		}
+		collector.RemoveClient(pid);
+		check(lines[0].size() == 40, "test line size");
+		check(collector.GetStats().rotations == 4, "rotation count");
+		check(created.size() == 5, "onFileCreated() count");
+		check(ReadFile(Path(pid, 0)) == lines[8], "current file after rotation");
+		if (maxFiles == 2)
+		{
+			check(ReadFile(Path(pid, 1)) == lines[6] + lines[7], "first rotated file");
+			check(ReadFile(Path(pid, 2)) == lines[4] + lines[5], "second rotated file");
+			check(ReadFile(Path(pid, 3)) == "<none>", "files over maxFiles are removed");
+		}
+		else
+			check(ReadFile(Path(pid, 1)) == "<none>", "rotation without maxFiles keeps a file");
+		Cleanup(pid);
+	}
+
+	/* A line larger than maxFileSize still goes into a file of its own */
+	const uint32_t pid = 401;
+	Cleanup(pid);
+	LogCollectorOptions options = Options('D');
+	options.maxFileSize = 10;
+	options.maxFiles = 1;
+	LogCollector collector(options);
+	collector.AddClient(pid);
+	std::string line = Line('E', "longer than the maximum file size");
+	Write(collector, pid, line);
+	Write(collector, pid, line);
+	collector.RemoveClient(pid);
+	check(ReadFile(Path(pid, 0)) == line && ReadFile(Path(pid, 1)) == line, "rotation of oversized lines");
+	Cleanup(pid);
+}
+
+int main()
+{
+	const char *tmp = getenv("TMPDIR");
+	std::string dir = std::string(tmp ? tmp : "/tmp") + "/flog-test-XXXXXX";
+	if (!mkdtemp(&dir[0]))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	directory = dir;
+	TestParseType();
+	TestLevelFilter();
+	TestPartialLines();
+	TestPidFilter();
+	TestRotation();
+	rmdir(directory.c_str());
+	return failed > 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Unit tests of the lexical path normalization used by resolve_path() */
+
+#include <lib/path.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define PATH_MAX	4096
+
+static int failed;
+
+static void check(int cond, const char *what)
+{
+	if (!cond)
+	{
+		printf("path: %s\n", what);
+		failed++;
+	}
+}
+
+static void check_normalize(const char *dirpath, const char *pathname, const char *expected)
+{
+	char out[PATH_MAX];
+	int len = path_normalize(dirpath, pathname, out);
+	if (strcmp(out, expected) || len != (int)strlen(expected))
+	{
+		printf("path: \"%s\" in \"%s\" gives \"%s\", expected \"%s\"\n", pathname, dirpath, out, expected);
+		failed++;
+	}
+}
+
+static void test_normalize()
+{
+	check_normalize("/home/user", "a/b", "/home/user/a/b");
+	check_normalize("/home/user/", "a", "/home/user/a");
+	check_normalize("/", "a", "/a");
+	check_normalize("/home/user", "/etc//passwd", "/etc/passwd");
+	check_normalize("/home/user", "//", "/");
+	check_normalize("/home/user", "x/", "/home/user/x");
+	check_normalize("/home/user", "./x/./y/.", "/home/user/x/y");
+	check_normalize("/home/user", ".", "/home/user");
+	check_normalize("/home/user", "x/../y", "/home/user/y");
+	check_normalize("/home/user", "..", "/home");
+	check_normalize("/home/user", "../", "/home");
+	check_normalize("/home/user", "../..", "/");
+	check_normalize("/home/user", "../../../..", "/");
+	check_normalize("/", "..", "/");
+	check_normalize("/", "../a/..", "/");
+	/* Only exact "." and ".." components are special */
+	check_normalize("/a", "...", "/a/...");
+	check_normalize("/a", ".hidden/..x/x..", "/a/.hidden/..x/x..");
+}
+
+static void test_aliased()
+{
+	/* resolve_path() normalizes symlink targets in place */
+	char buf[PATH_MAX] = "/usr/lib/x86_64";
+	int len = path_normalize(buf, "../../share/./doc", buf);
+	check(!strcmp(buf, "/usr/share/doc") && len == 14, "path_normalize() with aliased dirpath");
+}
+
+static void test_components()
+{
+	/* path_next() stops after each non final component for the caller to resolve it */
+	char out[PATH_MAX];
+	const char *pathname = "a/./b/../c//d";
+	char *end = path_start("/", &pathname, out);
+	check(end == out, "path_start() of the root");
+	check(path_next(&pathname, out, &end) == PATH_COMPONENT && end - out == 2 && !memcmp(out, "/a", 2), "first component");
+	check(path_next(&pathname, out, &end) == PATH_COMPONENT && end - out == 4 && !memcmp(out, "/a/b", 4), "second component");
+	check(path_next(&pathname, out, &end) == PATH_COMPONENT && end - out == 4 && !memcmp(out, "/a/c", 4), "component after \"..\"");
+	check(path_next(&pathname, out, &end) == PATH_END && *pathname == 0, "final component");
+	check(path_finish(out, end) == 6 && !strcmp(out, "/a/c/d"), "path_finish()");
+
+	/* Symlink resolution drops the component just appended */
+	strcpy(out, "/a/link");
+	check(path_remove_last(out, out + 7) == out + 2, "path_remove_last()");
+	check(path_remove_last(out, out + 2) == out, "path_remove_last() of a top level component");
+	check(path_remove_last(out, out) == out, "path_remove_last() of the root");
+}
+
+int main()
+{
+	test_normalize();
+	test_aliased();
+	test_components();
+	return failed > 0;
+}
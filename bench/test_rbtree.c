@@ -0,0 +1,153 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Unit tests of the rb-tree: ordering, lookups and the red-black invariants */
+
+#include <lib/rbtree.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define NODE_COUNT	1000
+
+struct node
+{
+	struct rb_node tree;
+	uint32_t key;
+};
+
+static int node_cmp(const struct rb_node *l, const struct rb_node *r)
+{
+	uint32_t left = rb_entry(l, struct node, tree)->key;
+	uint32_t right = rb_entry(r, struct node, tree)->key;
+	return left < right ? -1 : left > right;
+}
+
+static struct node nodes[NODE_COUNT];
+static int failed;
+
+static void check(int cond, const char *what)
+{
+	if (!cond)
+	{
+		printf("rbtree: %s\n", what);
+		failed++;
+	}
+}
+
+/* The color is kept in the lowest bit of _parent, 1 is red */
+#define node_is_red(node)	((node) && ((node)->_parent & 1))
+#define node_parent(node)	((struct rb_node *)((node)->_parent & ~(size_t)1))
+
+/* Returns the black height of the subtree, or -1 if an invariant is broken */
+static int check_subtree(struct rb_node *node, struct rb_node *parent)
+{
+	if (node == NULL)
+		return 1;
+	if (node_parent(node) != parent)
+		return -1;
+	if (node_is_red(node) && (node_is_red(node->left) || node_is_red(node->right)))
+		return -1;
+	int left = check_subtree(node->left, node);
+	int right = check_subtree(node->right, node);
+	if (left < 0 || left != right)
+		return -1;
+	return left + !node_is_red(node);
+}
+
+/* Check the invariants, and that walking in both directions visits count nodes in order */
+static void check_tree(struct rb_tree *tree, int count)
+{
+	check(!node_is_red(tree->root), "root is red");
+	check(check_subtree(tree->root, NULL) > 0, "red-black invariants violated");
+	int n = 0;
+	uint32_t last = 0;
+	for (struct rb_node *cur = rb_first(tree); cur; cur = rb_next(cur))
+	{
+		uint32_t key = rb_entry(cur, struct node, tree)->key;
+		check(n == 0 || key > last, "rb_next() not ascending");
+		last = key;
+		n++;
+	}
+	check(n == count, "rb_first()/rb_next() node count");
+	n = 0;
+	for (struct rb_node *cur = rb_last(tree); cur; cur = rb_prev(cur))
+	{
+		uint32_t key = rb_entry(cur, struct node, tree)->key;
+		check(n == 0 || key < last, "rb_prev() not descending");
+		last = key;
+		n++;
+	}
+	check(n == count, "rb_last()/rb_prev() node count");
+}
+
+int main()
+{
+	struct rb_tree tree;
+	rb_init(&tree);
+	check(rb_empty(&tree), "new tree is not empty");
+	check(rb_first(&tree) == NULL && rb_last(&tree) == NULL, "empty tree has nodes");
+
+	/* Distinct even keys in pseudo random order */
+	for (uint32_t i = 0; i < NODE_COUNT; i++)
+	{
+		nodes[i].key = ((i * 7919) % NODE_COUNT) * 2;
+		rb_add(&tree, &nodes[i].tree, node_cmp);
+	}
+	check_tree(&tree, NODE_COUNT);
+
+	struct node probe;
+	for (uint32_t key = 0; key < NODE_COUNT * 2; key++)
+	{
+		probe.key = key;
+		struct rb_node *found = rb_find(&tree, &probe.tree, node_cmp);
+		if (key % 2 == 0)
+			check(found && rb_entry(found, struct node, tree)->key == key, "rb_find() misses a key");
+		else
+			check(found == NULL, "rb_find() finds an absent key");
+		/* Lower bound is the first node >= key, upper bound the last node <= key */
+		struct rb_node *lower = rb_lower_bound(&tree, &probe.tree, node_cmp);
+		struct rb_node *upper = rb_upper_bound(&tree, &probe.tree, node_cmp);
+		uint32_t even = key & ~1U;
+		if (key == NODE_COUNT * 2 - 1)
+			check(lower == NULL, "rb_lower_bound() past the last node");
+		else
+			check(lower && rb_entry(lower, struct node, tree)->key == (key + 1) / 2 * 2, "rb_lower_bound()");
+		check(upper && rb_entry(upper, struct node, tree)->key == even, "rb_upper_bound()");
+	}
+	probe.key = 0;
+	check(rb_upper_bound(&tree, &probe.tree, node_cmp) == &nodes[0].tree, "rb_upper_bound() of the first node");
+
+	/* Remove every other node in insertion order */
+	for (int i = 0; i < NODE_COUNT; i += 2)
+		rb_remove(&tree, &nodes[i].tree);
+	check_tree(&tree, NODE_COUNT / 2);
+	for (int i = 0; i < NODE_COUNT; i++)
+	{
+		probe.key = nodes[i].key;
+		struct rb_node *found = rb_find(&tree, &probe.tree, node_cmp);
+		check(i % 2 ? found == &nodes[i].tree : found == NULL, "rb_find() after rb_remove()");
+	}
+
+	for (int i = 1; i < NODE_COUNT; i += 2)
+		rb_remove(&tree, &nodes[i].tree);
+	check(rb_empty(&tree), "tree is not empty after removing all nodes");
+	return failed > 0;
+}
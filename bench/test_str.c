@@ -0,0 +1,200 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Unit tests of the UTF-8/UTF-16 conversions and ksprintf() */
+
+#include <str.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_TEXT	256
+
+static int failed;
+
+static void check(int cond, const char *what)
+{
+	if (!cond)
+	{
+		printf("str: %s\n", what);
+		failed++;
+	}
+}
+
+/* Straightforward reference encoders */
+static int encode_utf8(const uint32_t *codepoints, int count, char *out)
+{
+	int len = 0;
+	for (int i = 0; i < count; i++)
+	{
+		uint32_t c = codepoints[i];
+		if (c < 0x80)
+			out[len++] = (char)c;
+		else if (c < 0x800)
+		{
+			out[len++] = (char)(0xC0 | (c >> 6));
+			out[len++] = (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			out[len++] = (char)(0xE0 | (c >> 12));
+			out[len++] = (char)(0x80 | ((c >> 6) & 0x3F));
+			out[len++] = (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			out[len++] = (char)(0xF0 | (c >> 18));
+			out[len++] = (char)(0x80 | ((c >> 12) & 0x3F));
+			out[len++] = (char)(0x80 | ((c >> 6) & 0x3F));
+			out[len++] = (char)(0x80 | (c & 0x3F));
+		}
+	}
+	return len;
+}
+
+static int encode_utf16(const uint32_t *codepoints, int count, uint16_t *out)
+{
+	int len = 0;
+	for (int i = 0; i < count; i++)
+	{
+		uint32_t c = codepoints[i];
+		if (c < 0x10000)
+			out[len++] = (uint16_t)c;
+		else
+		{
+			out[len++] = (uint16_t)(0xD800 | ((c - 0x10000) >> 10));
+			out[len++] = (uint16_t)(0xDC00 | ((c - 0x10000) & 0x3FF));
+		}
+	}
+	return len;
+}
+
+/* Convert text in both directions, in both the counting and converting modes */
+static void check_conversion(const uint32_t *codepoints, int count)
+{
+	char utf8[MAX_TEXT * 4], out8[MAX_TEXT * 4];
+	uint16_t utf16[MAX_TEXT * 2], out16[MAX_TEXT * 2];
+	int len8 = encode_utf8(codepoints, count, utf8);
+	int len16 = encode_utf16(codepoints, count, utf16);
+	check(utf8_to_utf16(utf8, len8, NULL, 0) == len16, "utf8_to_utf16() length");
+	check(utf8_to_utf16(utf8, len8, out16, MAX_TEXT * 2) == len16
+		&& !memcmp(out16, utf16, len16 * sizeof(uint16_t)), "utf8_to_utf16() output");
+	check(utf16_to_utf8(utf16, len16, NULL, 0) == len8, "utf16_to_utf8() length");
+	check(utf16_to_utf8(utf16, len16, out8, MAX_TEXT * 4) == len8
+		&& !memcmp(out8, utf8, len8), "utf16_to_utf8() output");
+}
+
+static void test_utf()
+{
+	static const uint32_t others[] = { 0xE9, 0x7FF, 0x800, 0x4E2D, 0xFFFD, 0x10000, 0x1F600, 0x10FFFF };
+	uint32_t codepoints[MAX_TEXT];
+	/* ASCII runs of every length around the 16 character blocks, followed by a non ASCII character */
+	for (int len = 0; len < 48; len++)
+	{
+		for (int i = 0; i < len; i++)
+			codepoints[i] = 0x20 + (i * 13) % 0x5F;
+		for (int j = 0; j < sizeof(others) / sizeof(others[0]); j++)
+		{
+			codepoints[len] = others[j];
+			for (int i = len + 1; i < len + 20; i++)
+				codepoints[i] = 'a' + i % 26;
+			check_conversion(codepoints, len);
+			check_conversion(codepoints, len + 1);
+			check_conversion(codepoints, len + 20);
+		}
+	}
+
+	/* Truncated and invalid sequences */
+	uint16_t out16[16];
+	check(utf8_to_utf16("\xE4\xB8", 2, out16, 16) == -1, "utf8_to_utf16() accepts a truncated sequence");
+	check(utf8_to_utf16("\x80", 1, out16, 16) == -1, "utf8_to_utf16() accepts a lone continuation byte");
+	check(utf8_to_utf16("\xF8\x80\x80\x80\x80", 5, out16, 16) == -1, "utf8_to_utf16() accepts a 5 byte sequence");
+}
+
+static void test_utf_filename()
+{
+	/* Long enough to be converted by blocks of 16 */
+	const char *name = "dir/with:colon*and?question<mark>|pipe\"quote";
+	uint16_t utf16[64];
+	char utf8[64];
+	int len = (int)strlen(name);
+	int len16 = utf8_to_utf16_filename(name, len, utf16, 64);
+	check(len16 == len, "utf8_to_utf16_filename() length");
+	int ok = 1;
+	for (int i = 0; i < len; i++)
+	{
+		if (name[i] == '/')
+			ok &= utf16[i] == '\\';
+		else if (strchr(":*?<>|\"", name[i]))
+			ok &= utf16[i] == (0xF000 | name[i]);
+		else
+			ok &= utf16[i] == name[i];
+	}
+	check(ok, "utf8_to_utf16_filename() output");
+	/* Private use characters are mapped back, path separators stay */
+	int len8 = utf16_to_utf8_filename(utf16, len16, utf8, 64);
+	check(len8 == len, "utf16_to_utf8_filename() length");
+	ok = 1;
+	for (int i = 0; i < len; i++)
+		ok &= utf8[i] == (name[i] == '/' ? '\\' : name[i]);
+	check(ok, "utf16_to_utf8_filename() output");
+}
+
+static void check_format(const char *expected, const char *result, int len)
+{
+	if (strcmp(result, expected) || len != (int)strlen(expected))
+	{
+		printf("str: ksprintf() gives \"%s\", expected \"%s\"\n", result, expected);
+		failed++;
+	}
+}
+
+static void test_ksprintf()
+{
+	char buf[256];
+	int len;
+	len = ksprintf(buf, "%d %d %d", 0, 42, -42);
+	check_format("0 42 -42", buf, len);
+	len = ksprintf(buf, "%d %d", INT_MAX, INT_MIN);
+	check_format("2147483647 -2147483648", buf, len);
+	len = ksprintf(buf, "%u %o %x %X", 4294967295U, 8, 0xdeadbeef, 0xdeadbeef);
+	check_format("4294967295 10 deadbeef DEADBEEF", buf, len);
+	len = ksprintf(buf, "%lld %lld %llu %llx", (int64_t)INT64_MAX, (int64_t)INT64_MIN, (uint64_t)UINT64_MAX, (uint64_t)0x123456789abcdefULL);
+	check_format("9223372036854775807 -9223372036854775808 18446744073709551615 123456789abcdef", buf, len);
+	len = ksprintf(buf, "[%5d] [%05d] [%08x] [%2d]", 42, 42, 0xbeef, 12345);
+	check_format("[   42] [00042] [0000beef] [12345]", buf, len);
+	len = ksprintf(buf, "%s %c%c %% %s", "str", 'o', 'k', (const char *)NULL);
+	check_format("str ok % ", buf, len);
+	len = ksprintf(buf, "%p", (void *)0x1234);
+	check_format(sizeof(void *) == 8 ? "0000000000001234" : "00001234", buf, len);
+	/* Line feeds are written as CR LF */
+	len = ksprintf(buf, "a\nb");
+	check_format("a\r\nb", buf, len);
+}
+
+int main()
+{
+	test_utf();
+	test_utf_filename();
+	test_ksprintf();
+	return failed > 0;
+}
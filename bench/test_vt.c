@@ -0,0 +1,192 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Unit tests of the VT byte scanners and the VT output parser */
+
+#include <lib/vtparse.h>
+#include <lib/vtscan.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_TEXT	80
+#define MAX_LOG		1024
+
+static int failed;
+
+static void check(int cond, const char *what)
+{
+	if (!cond)
+	{
+		printf("vt: %s\n", what);
+		failed++;
+	}
+}
+
+static void test_scan()
+{
+	static const unsigned char controls[] = { 0x00, 0x07, 0x0A, 0x1B, 0x1F };
+	static const unsigned char non_ascii[] = { 0x7F, 0x80, 0xC3, 0xFF };
+	char buf[MAX_TEXT];
+	/* Every length and position around the 16 byte blocks */
+	for (int len = 0; len < MAX_TEXT; len++)
+	{
+		for (int i = 0; i < len; i++)
+			buf[i] = 0x20 + (i * 7) % 0x5F;
+		check(vt_find_control(buf, len) == len, "vt_find_control() in printable text");
+		check(vt_scan_ascii(buf, len) == len, "vt_scan_ascii() in printable text");
+		for (int pos = 0; pos < len; pos++)
+		{
+			char saved = buf[pos];
+			for (int j = 0; j < sizeof(controls); j++)
+			{
+				buf[pos] = controls[j];
+				check(vt_find_control(buf, len) == pos, "vt_find_control() misses a control character");
+				check(vt_scan_ascii(buf, len) == pos, "vt_scan_ascii() misses a control character");
+			}
+			for (int j = 0; j < sizeof(non_ascii); j++)
+			{
+				buf[pos] = non_ascii[j];
+				check(vt_find_control(buf, len) == len, "vt_find_control() stops at a non control character");
+				check(vt_scan_ascii(buf, len) == pos, "vt_scan_ascii() misses a non ASCII character");
+			}
+			buf[pos] = saved;
+		}
+	}
+}
+
+/* Parser events are recorded as text, printed runs as is and other events in angle brackets,
+ * so that the log does not depend on how the text is split into runs */
+static char event_log[MAX_LOG];
+static int event_log_len;
+
+static void log_append(const char *buf, size_t count)
+{
+	if (event_log_len + count < MAX_LOG)
+	{
+		memcpy(event_log + event_log_len, buf, count);
+		event_log_len += (int)count;
+	}
+	event_log[event_log_len] = 0;
+}
+
+static void on_print(const char *buf, size_t count)
+{
+	log_append(buf, count);
+}
+
+static void on_execute(char ch)
+{
+	char event[16];
+	log_append(event, sprintf(event, "<X%02x>", (unsigned char)ch));
+}
+
+static void on_escape(char intermediate, char ch)
+{
+	char event[16];
+	if (intermediate)
+		log_append(event, sprintf(event, "<E%c%c>", intermediate, ch));
+	else
+		log_append(event, sprintf(event, "<E%c>", ch));
+}
+
+static void on_csi(struct vt_parser *parser, char ch)
+{
+	char event[256];
+	int len = sprintf(event, "<C");
+	if (parser->prefix)
+		event[len++] = parser->prefix;
+	for (int i = 0; i <= parser->param_count; i++)
+		len += sprintf(event + len, i ? ";%d" : "%d", parser->params[i]);
+	len += sprintf(event + len, "%c>", ch);
+	log_append(event, len);
+}
+
+static void on_osc(int command, const char *string, int len)
+{
+	char event[VT_MAX_STRING + 32];
+	log_append(event, sprintf(event, "<O%d;%.*s>", command, len, string));
+}
+
+static const struct vt_callbacks callbacks = {
+	.print = on_print,
+	.execute = on_execute,
+	.escape = on_escape,
+	.csi = on_csi,
+	.osc = on_osc,
+};
+
+struct parse_case
+{
+	const char *input;
+	const char *events;
+};
+
+static const struct parse_case cases[] = {
+	{ "hello\r\nworld", "hello<X0d><X0a>world" },
+	{ "\a\x01", "<X07><X01>" },
+	{ "\xe4\xb8\xad\xe6\x96\x87 text", "\xe4\xb8\xad\xe6\x96\x87 text" },
+	{ "\x1b[1;31mred\x1b[0m", "<C1;31m>red<C0m>" },
+	{ "\x1b[m\x1b[;5H", "<C0m><C0;5H>" },
+	{ "\x1b[?25l\x1b[>c", "<C?25l><C>0c>" },
+	{ "\x1b(B\x1b""7\x1b#8\x1b""c", "<E(B><E7><E#8><Ec>" },
+	{ "\x1b]0;window title\atext", "<O0;window title>text" },
+	{ "\x1b]2;\a", "<O2;>" },
+	/* Format effectors are executed in the middle of a sequence */
+	{ "\x1b[1\n2H", "<X0a><C12H>" },
+	/* Escape aborts the current sequence */
+	{ "\x1b[12\x1b[3J\x1b]0;tit\x1b[K", "<C3J><C0K>" },
+};
+
+static void test_parse()
+{
+	for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		const struct parse_case *c = &cases[i];
+		size_t len = strlen(c->input);
+		struct vt_parser parser;
+		/* In one go, then byte by byte to check the state carried between calls */
+		for (int split = 0; split < 2; split++)
+		{
+			vt_parser_init(&parser);
+			event_log_len = 0;
+			event_log[0] = 0;
+			if (split)
+			{
+				for (size_t j = 0; j < len; j++)
+					vt_parse(&parser, &callbacks, c->input + j, 1);
+			}
+			else
+				vt_parse(&parser, &callbacks, c->input, len);
+			if (strcmp(event_log, c->events))
+			{
+				printf("vt: case %d%s gives \"%s\", expected \"%s\"\n", i, split ? " byte by byte" : "", event_log, c->events);
+				failed++;
+			}
+		}
+	}
+}
+
+int main()
+{
+	test_scan();
+	test_parse();
+	return failed > 0;
+}
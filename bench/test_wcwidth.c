@@ -0,0 +1,66 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Compares flinux's wcwidth() with the one of glibc for every code point
+ *
+ * Code points which glibc considers not printable (unassigned, private use,
+ * controls) are skipped. If glibc uses a newer Unicode version than the
+ * table, newly assigned characters are reported as well; regenerate the table
+ * with tools/gen_wcwidth.py on a newer Python in that case.
+ */
+
+#include <str.h>
+
+#include <locale.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* <wchar.h> is not included as its wcwidth() conflicts with ours, use
+ * wcswidth() on a single character instead */
+int wcswidth(const wchar_t *s, size_t n);
+
+int main()
+{
+	if (!setlocale(LC_CTYPE, "C.UTF-8"))
+	{
+		printf("wcwidth: C.UTF-8 locale not available, skipped.\n");
+		return 0;
+	}
+	int checked = 0, failed = 0;
+	for (uint32_t ucs = 0; ucs <= 0x10FFFF; ucs++)
+	{
+		if (ucs >= 0xD800 && ucs <= 0xDFFF)
+			continue;
+		wchar_t ch = ucs;
+		int expected = wcswidth(&ch, 1);
+		if (expected < 0)
+			continue;
+		checked++;
+		int width = wcwidth(ucs);
+		if (width != expected)
+		{
+			if (failed < 20)
+				printf("wcwidth: U+%04X: got %d, glibc %d\n", ucs, width, expected);
+			failed++;
+		}
+	}
+	printf("wcwidth: %d of %d code points differ from glibc.\n", failed, checked);
+	return failed > 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "HeadlessCollector.h"
+
+#include <winioctl.h>
+
+#define FLUSH_INTERVAL	1000 /* ms */
+
+static HANDLE hStopEvent;
+
+static BOOL WINAPI ConsoleCtrlHandler(DWORD dwCtrlType)
+{
+	SetEvent(hStopEvent);
+	return TRUE;
+}
+
+/* Turn on NTFS compression for a newly created log file */
+static void CompressFile(const std::string &path)
+{
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+	USHORT format = COMPRESSION_FORMAT_DEFAULT;
+	DWORD bytes;
+	if (!DeviceIoControl(hFile, FSCTL_SET_COMPRESSION, &format, sizeof(format), NULL, 0, &bytes, NULL))
+		fprintf(stderr, "Enabling compression on %s failed, error code: %d\n", path.c_str(), GetLastError());
+	CloseHandle(hFile);
+}
+
+static std::string ToString(const wchar_t *str)
+{
+	char buffer[MAX_PATH * 2];
+	int r = WideCharToMultiByte(CP_ACP, 0, str, -1, buffer, sizeof(buffer), NULL, NULL);
+	return r ? buffer : "";
+}
+
+HeadlessCollector::HeadlessCollector(const LogCollectorOptions &options)
+	: m_collector(options)
+{
+}
+
+void HeadlessCollector::PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: flog --headless [options]\n"
+		"  --dir <directory>   Directory for log files (default: current directory)\n"
+		"  --max-size <MB>     Rotate a log file when it grows over this size (default: 64)\n"
+		"  --max-files <n>     Rotated files kept per process (default: 4)\n"
+		"  --compress          Store log files NTFS compressed\n"
+		"  --pid <pid>         Only collect logs of this process, can be repeated\n"
+		"  --level <D|I|W|E>   Lowest log level to keep (default: D)\n");
+}
+
+bool HeadlessCollector::ParseOptions(int argc, wchar_t **argv, LogCollectorOptions &options)
+{
+	for (int i = 2; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (!wcscmp(argv[i], L"--dir") && hasValue)
+			options.directory = ToString(argv[++i]);
+		else if (!wcscmp(argv[i], L"--max-size") && hasValue)
+			options.maxFileSize = _wtoi64(argv[++i]) * 1024 * 1024;
+		else if (!wcscmp(argv[i], L"--max-files") && hasValue)
+			options.maxFiles = _wtoi(argv[++i]);
+		else if (!wcscmp(argv[i], L"--compress"))
+			options.onFileCreated = CompressFile;
+		else if (!wcscmp(argv[i], L"--pid") && hasValue)
+			options.pids.insert((uint32_t)_wtoi(argv[++i]));
+		else if (!wcscmp(argv[i], L"--level") && hasValue)
+		{
+			options.minLevel = (char)towupper(argv[++i][0]);
+			if (LogCollector::GetLevel(options.minLevel) < 0)
+				return false;
+		}
+		else
+			return false;
+	}
+	return options.maxFileSize > 0 && options.maxFiles >= 0;
+}
+
+void HeadlessCollector::Run()
+{
+	hStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	m_hDataEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+	SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+	m_logServer.Start(this);
+	fprintf(stderr, "flog: collecting logs, press Ctrl+C to stop.\n");
+	HANDLE handles[2] = { hStopEvent, m_hDataEvent };
+	for (;;)
+	{
+		DWORD r = WaitForMultipleObjects(2, handles, FALSE, FLUSH_INTERVAL);
+		if (r == WAIT_OBJECT_0)
+			break;
+		else if (r == WAIT_OBJECT_0 + 1)
+			ProcessEvents();
+		else
+			m_collector.Flush();
+	}
+	m_logServer.Stop();
+	ProcessEvents();
+	m_collector.Flush();
+	fprintf(stderr, "%s", m_collector.FormatStats().c_str());
+	SetConsoleCtrlHandler(ConsoleCtrlHandler, FALSE);
+	CloseHandle(m_hDataEvent);
+	CloseHandle(hStopEvent);
+}
+
+/* Called on a log server thread */
+void HeadlessCollector::OnLogAvailable()
+{
+	SetEvent(m_hDataEvent);
+}
+
+void HeadlessCollector::ProcessEvents()
+{
+	m_logServer.ConsumeEvents(m_events);
+	for (LogBuffer *event : m_events)
+	{
+		switch (event->type)
+		{
+		case LOG_CLIENT_CONNECTED: m_collector.AddClient(event->pid); break;
+		case LOG_DATA: m_collector.Write(event->pid, event->data, event->length); break;
+		case LOG_CLIENT_DISCONNECTED: m_collector.RemoveClient(event->pid); break;
+		}
+	}
+	m_logServer.ReleaseEvents(m_events);
+}
@@ -0,0 +1,46 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "LogCollector.h"
+#include "LogServer.h"
+
+/* Collects logs into files without a GUI, for servers and CI */
+class HeadlessCollector: private LogSink
+{
+public:
+	HeadlessCollector(const LogCollectorOptions &options);
+
+	/* Run until Ctrl+C or Ctrl+Break is received */
+	void Run();
+
+	/* Parse command line options, returns false on invalid options */
+	static bool ParseOptions(int argc, wchar_t **argv, LogCollectorOptions &options);
+	static void PrintUsage();
+
+private:
+	virtual void OnLogAvailable() override;
+	void ProcessEvents();
+
+	LogServer m_logServer;
+	HANDLE m_hDataEvent;
+	std::vector<LogBuffer *> m_events;
+	LogCollector m_collector;
+};
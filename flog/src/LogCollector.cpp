@@ -0,0 +1,233 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file does not use the precompiled header, keep it portable */
+
+#define _CRT_SECURE_NO_WARNINGS
+#include "LogCollector.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define FILE_BUFFER_SIZE	262144
+
+LogCollector::LogCollector(const LogCollectorOptions &options)
+	: m_options(options), m_minLevel(std::max(GetLevel(options.minLevel), 0))
+{
+}
+
+LogCollector::~LogCollector()
+{
+	for (auto &i : m_clients)
+	{
+		if (!i.second.partial.empty())
+			WriteLine(i.first, i.second, i.second.partial.data(), i.second.partial.size());
+		CloseFile(i.second);
+	}
+}
+
+int LogCollector::GetLevel(char type)
+{
+	switch (type)
+	{
+	case 'D': return 0;
+	case 'I': return 1;
+	case 'W': return 2;
+	case 'E': return 3;
+	default: return -1;
+	}
+}
+
+/* Log lines from flinux look like "[hh:mm:ss.mmm] (II) message" */
+char LogCollector::ParseType(const char *line, size_t length)
+{
+	if (length < 19 || line[0] != '[' || line[13] != ']' || line[15] != '(' || line[18] != ')')
+		return 0;
+	if (line[16] != line[17] || GetLevel(line[16]) < 0)
+		return 0;
+	return line[16];
+}
+
+std::string LogCollector::GetFilePath(uint32_t pid, int index) const
+{
+	std::string path = m_options.directory + "/flog-" + std::to_string(pid);
+	if (index > 0)
+		path += "." + std::to_string(index);
+	return path + ".log";
+}
+
+bool LogCollector::OpenFile(uint32_t pid, Client &client)
+{
+	std::string path = GetFilePath(pid, 0);
+	client.file = fopen(path.c_str(), "ab");
+	if (!client.file)
+		return false;
+	setvbuf(client.file, nullptr, _IOFBF, FILE_BUFFER_SIZE);
+	fseek(client.file, 0, SEEK_END);
+	long size = ftell(client.file);
+	client.size = size > 0 ? size : 0;
+	if (client.size == 0 && m_options.onFileCreated)
+		m_options.onFileCreated(path);
+	return true;
+}
+
+void LogCollector::CloseFile(Client &client)
+{
+	if (client.file)
+	{
+		fclose(client.file);
+		client.file = nullptr;
+	}
+}
+
+void LogCollector::Rotate(uint32_t pid, Client &client)
+{
+	CloseFile(client);
+	if (m_options.maxFiles > 0)
+	{
+		/* flog-pid.log -> flog-pid.1.log -> ... -> flog-pid.<maxFiles>.log */
+		remove(GetFilePath(pid, m_options.maxFiles).c_str());
+		for (int i = m_options.maxFiles - 1; i >= 0; i--)
+			rename(GetFilePath(pid, i).c_str(), GetFilePath(pid, i + 1).c_str());
+	}
+	else
+		remove(GetFilePath(pid, 0).c_str());
+	m_stats.rotations++;
+	OpenFile(pid, client);
+}
+
+void LogCollector::WriteData(uint32_t pid, Client &client, const char *data, size_t length, uint64_t lines)
+{
+	if (client.size > 0 && client.size + length > m_options.maxFileSize)
+		Rotate(pid, client);
+	if (!client.file || fwrite(data, 1, length, client.file) != length)
+	{
+		m_stats.droppedLines += lines;
+		m_stats.droppedBytes += length;
+		return;
+	}
+	client.size += length;
+	m_stats.lines += lines;
+	m_stats.bytes += length;
+}
+
+void LogCollector::WriteLine(uint32_t pid, Client &client, const char *line, size_t length)
+{
+	/* Lines without a header (e.g. from log_raw()) take the level of the previous line */
+	char type = ParseType(line, length);
+	if (type)
+		client.keep = GetLevel(type) >= m_minLevel;
+	if (!client.keep)
+	{
+		m_stats.levelFilteredLines++;
+		return;
+	}
+	WriteData(pid, client, line, length, 1);
+	if (length == 0 || line[length - 1] != '\n')
+		WriteData(pid, client, "\n", 1, 0);
+}
+
+void LogCollector::AddClient(uint32_t pid)
+{
+	m_stats.clients++;
+	if (!m_options.pids.empty() && !m_options.pids.count(pid))
+		return;
+	Client &client = m_clients[pid];
+	if (client.connections++ == 0 && !client.file)
+		OpenFile(pid, client);
+}
+
+void LogCollector::Write(uint32_t pid, const char *data, size_t length)
+{
+	auto it = m_clients.find(pid);
+	if (it == m_clients.end())
+	{
+		m_stats.pidFilteredBytes += length;
+		return;
+	}
+	Client &client = it->second;
+	if (m_minLevel == 0 && client.partial.empty())
+	{
+		/* Fast path: no level filter, write all complete lines at once */
+		const char *end = data + length;
+		const char *last = data + length;
+		while (last > data && last[-1] != '\n')
+			last--;
+		if (last > data)
+		{
+			uint64_t lines = std::count(data, last, '\n');
+			WriteData(pid, client, data, last - data, lines);
+		}
+		client.partial.assign(last, end);
+		return;
+	}
+	const char *end = data + length;
+	while (data < end)
+	{
+		const char *newline = (const char *)memchr(data, '\n', end - data);
+		if (!newline)
+		{
+			client.partial.append(data, end);
+			break;
+		}
+		if (client.partial.empty())
+			WriteLine(pid, client, data, newline - data + 1);
+		else
+		{
+			client.partial.append(data, newline + 1);
+			WriteLine(pid, client, client.partial.data(), client.partial.size());
+			client.partial.clear();
+		}
+		data = newline + 1;
+	}
+}
+
+void LogCollector::RemoveClient(uint32_t pid)
+{
+	auto it = m_clients.find(pid);
+	if (it == m_clients.end())
+		return;
+	Client &client = it->second;
+	if (--client.connections > 0)
+		return;
+	if (!client.partial.empty())
+	{
+		WriteLine(pid, client, client.partial.data(), client.partial.size());
+		client.partial.clear();
+	}
+	CloseFile(client);
+	m_clients.erase(it);
+}
+
+void LogCollector::Flush()
+{
+	for (auto &i : m_clients)
+		if (i.second.file)
+			fflush(i.second.file);
+}
+
+std::string LogCollector::FormatStats() const
+{
+	return "clients: " + std::to_string(m_stats.clients)
+		+ ", written: " + std::to_string(m_stats.lines) + " lines (" + std::to_string(m_stats.bytes) + " bytes)"
+		+ ", rotations: " + std::to_string(m_stats.rotations) + "\n"
+		+ "filtered: " + std::to_string(m_stats.levelFilteredLines) + " lines by level, "
+		+ std::to_string(m_stats.pidFilteredBytes) + " bytes by pid\n"
+		+ "dropped: " + std::to_string(m_stats.droppedLines) + " lines (" + std::to_string(m_stats.droppedBytes) + " bytes)\n";
+}
@@ -0,0 +1,104 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+/* Headless log collector core
+ * Writes the log of each flinux process to its own file with size based
+ * rotation, applying pid and level filters. Only depends on the C++ standard
+ * library so it can be built and tested on any host.
+ */
+
+struct LogCollectorOptions
+{
+	LogCollectorOptions(): directory("."), maxFileSize(64 * 1024 * 1024), maxFiles(4), minLevel('D') {}
+
+	std::string directory;
+	uint64_t maxFileSize; /* Rotate when the current file grows over this size */
+	int maxFiles; /* Number of rotated files kept per process */
+	std::set<uint32_t> pids; /* Only collect these processes, empty for all */
+	char minLevel; /* Lowest level to keep, one of 'D', 'I', 'W', 'E' */
+	/* Called on every newly created log file, e.g. to enable file system compression */
+	std::function<void(const std::string &path)> onFileCreated;
+};
+
+struct LogCollectorStats
+{
+	LogCollectorStats(): clients(0), lines(0), bytes(0), levelFilteredLines(0), pidFilteredBytes(0),
+		droppedLines(0), droppedBytes(0), rotations(0) {}
+
+	uint64_t clients; /* Connections accepted */
+	uint64_t lines, bytes; /* Written to log files */
+	uint64_t levelFilteredLines; /* Discarded by the level filter */
+	uint64_t pidFilteredBytes; /* Discarded by the pid filter */
+	uint64_t droppedLines, droppedBytes; /* Lost due to file errors */
+	uint64_t rotations;
+};
+
+class LogCollector
+{
+public:
+	explicit LogCollector(const LogCollectorOptions &options);
+	~LogCollector();
+
+	void AddClient(uint32_t pid);
+	void Write(uint32_t pid, const char *data, size_t length);
+	void RemoveClient(uint32_t pid);
+	/* Flush buffered data of all open log files */
+	void Flush();
+
+	const LogCollectorStats &GetStats() const { return m_stats; }
+	std::string FormatStats() const;
+
+	/* Severity of a log line type character, -1 if unknown */
+	static int GetLevel(char type);
+	/* Get the type character of a log line, 0 if the line has no log header */
+	static char ParseType(const char *line, size_t length);
+
+private:
+	struct Client
+	{
+		Client(): connections(0), file(nullptr), size(0), keep(true) {}
+
+		int connections;
+		FILE *file;
+		uint64_t size;
+		bool keep; /* Whether the current line passes the level filter */
+		std::string partial; /* Incomplete last line */
+	};
+
+	std::string GetFilePath(uint32_t pid, int index) const;
+	bool OpenFile(uint32_t pid, Client &client);
+	void CloseFile(Client &client);
+	void Rotate(uint32_t pid, Client &client);
+	void WriteData(uint32_t pid, Client &client, const char *data, size_t length, uint64_t lines);
+	void WriteLine(uint32_t pid, Client &client, const char *line, size_t length);
+
+	LogCollectorOptions m_options;
+	int m_minLevel;
+	LogCollectorStats m_stats;
+	std::map<uint32_t, Client> m_clients;
+};
@@ -27,15 +27,40 @@ static DWORD WINAPI ThreadProc(LPVOID lpParameter)
 	return 0;
 }
 
+static LogBuffer *NewBuffer(int capacity)
+{
+	LogBuffer *buffer = (LogBuffer *)::operator new(sizeof(LogBuffer) + capacity);
+	buffer->capacity = capacity;
+	buffer->data = (char *)(buffer + 1);
+	return buffer;
+}
+
+static void DeleteBuffer(LogBuffer *buffer)
+{
+	::operator delete(buffer);
+}
+
 LogServer::~LogServer()
 {
 	Stop();
+	LogBuffer *buffer;
+	while (m_events.try_pop(buffer))
+		DeleteBuffer(buffer);
+	while (m_freeBuffers.try_pop(buffer))
+		DeleteBuffer(buffer);
 }
 
-void LogServer::Start(HWND hMainWnd)
+void LogServer::Start(LogSink *sink)
 {
-	m_hMainWnd = hMainWnd;
-	m_hWorker = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	m_sink = sink;
+	/* One worker per core, each client only has one outstanding operation at a time */
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	DWORD count = info.dwNumberOfProcessors;
+	m_hCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, NULL, count);
+	AddClient();
+	for (DWORD i = 0; i < count; i++)
+		m_workers.push_back(CreateThread(NULL, 0, ThreadProc, this, 0, NULL));
 	m_started = true;
 }
 
@@ -43,9 +68,83 @@ void LogServer::Stop()
 {
 	if (m_started)
 	{
-		PostQueuedCompletionStatus(m_hCompletionPort, 0, NULL, NULL);
-		WaitForSingleObject(m_hWorker, INFINITE);
+		for (size_t i = 0; i < m_workers.size(); i++)
+			PostQueuedCompletionStatus(m_hCompletionPort, 0, NULL, NULL);
+		WaitForMultipleObjects((DWORD)m_workers.size(), m_workers.data(), TRUE, INFINITE);
+		for (HANDLE hWorker : m_workers)
+			CloseHandle(hWorker);
+		m_workers.clear();
+		for (auto const &client : m_clients)
+		{
+			CloseHandle(client->hPipe);
+			FreeBuffer(client->buffer);
+		}
+		m_clients.clear();
+		CloseHandle(m_hCompletionPort);
+		m_started = false;
+	}
+}
+
+/* Allocate a read buffer of LOG_READ_BUFFER_SIZE */
+LogBuffer *LogServer::AllocateBuffer()
+{
+	LogBuffer *buffer;
+	if (m_freeBuffers.try_pop(buffer))
+	{
+		m_freeCount--;
+		return buffer;
 	}
+	return NewBuffer(LOG_READ_BUFFER_SIZE);
+}
+
+/* Allocate an event just large enough for its data */
+LogBuffer *LogServer::AllocateEvent(LogEventType type, uint32_t pid, const char *data, int length)
+{
+	LogBuffer *event = NewBuffer(length);
+	event->type = type;
+	event->pid = pid;
+	event->length = length;
+	if (length)
+		memcpy(event->data, data, length);
+	return event;
+}
+
+void LogServer::FreeBuffer(LogBuffer *buffer)
+{
+	if (!buffer)
+		return;
+	/* Keep a limited number of read buffers for reuse, the rest go back to the heap */
+	if (buffer->capacity == LOG_READ_BUFFER_SIZE && m_freeCount++ < LOG_MAX_FREE_BUFFERS)
+		m_freeBuffers.push(buffer);
+	else
+	{
+		if (buffer->capacity == LOG_READ_BUFFER_SIZE)
+			m_freeCount--;
+		DeleteBuffer(buffer);
+	}
+}
+
+void LogServer::PushEvent(LogBuffer *buffer)
+{
+	m_events.push(buffer);
+	if (!m_notified.exchange(true))
+		m_sink->OnLogAvailable();
+}
+
+void LogServer::ConsumeEvents(std::vector<LogBuffer *> &events)
+{
+	/* Reset before draining, events pushed from now on notify again */
+	m_notified = false;
+	LogBuffer *buffer;
+	while (m_events.try_pop(buffer))
+		events.push_back(buffer);
+}
+
+void LogServer::ReleaseEvents(std::vector<LogBuffer *> &events)
+{
+	for (LogBuffer *buffer : events)
+		FreeBuffer(buffer);
+	events.clear();
 }
 
 void LogServer::AddClient()
@@ -56,22 +155,37 @@ void LogServer::AddClient()
 		PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_REJECT_REMOTE_CLIENTS,
 		PIPE_UNLIMITED_INSTANCES, 32, LOG_BUFFER_SIZE, 0, nullptr);
 	memset(&client->overlapped, 0, sizeof(client->overlapped));
+	client->buffer = nullptr;
+	client->pending = 0;
 
 	/* Associate it with IOCP */
 	client->op = OP_CONNECT;
 
-	CreateIoCompletionPort(client->hPipe, m_hCompletionPort, (ULONG_PTR)client.get(), 0);
-	if (!ConnectNamedPipe(client->hPipe, &client->overlapped) && GetLastError() == ERROR_PIPE_CONNECTED)
+	Client *p = client.get();
+	{
+		std::lock_guard<std::mutex> lock(m_clientsMutex);
+		m_clients.push_back(std::move(client));
+	}
+	CreateIoCompletionPort(p->hPipe, m_hCompletionPort, (ULONG_PTR)p, 0);
+	if (!ConnectNamedPipe(p->hPipe, &p->overlapped) && GetLastError() == ERROR_PIPE_CONNECTED)
 	{
 		/* Post a connection notification */
-		PostQueuedCompletionStatus(m_hCompletionPort, 0, (ULONG_PTR)client.get(), &client->overlapped);
+		PostQueuedCompletionStatus(m_hCompletionPort, 0, (ULONG_PTR)p, &p->overlapped);
 	}
-	m_clients.push_back(std::move(client));
 }
 
 void LogServer::RemoveClient(Client *client)
 {
+	if (client->op == OP_READ)
+	{
+		/* Deliver the incomplete last line */
+		if (client->pending)
+			PushEvent(AllocateEvent(LOG_DATA, client->pid, client->buffer->data, client->pending));
+		PushEvent(AllocateEvent(LOG_CLIENT_DISCONNECTED, client->pid, nullptr, 0));
+	}
+	FreeBuffer(client->buffer);
 	CloseHandle(client->hPipe);
+	std::lock_guard<std::mutex> lock(m_clientsMutex);
 	for (auto i = m_clients.begin(); i != m_clients.end(); ++i)
 		if (i->get() == client)
 		{
@@ -80,6 +194,56 @@ void LogServer::RemoveClient(Client *client)
 		}
 }
 
+void LogServer::ReadClient(Client *client)
+{
+	client->buffer->type = LOG_DATA;
+	client->buffer->pid = client->pid;
+	if (!ReadFile(client->hPipe, client->buffer->data + client->pending, LOG_READ_BUFFER_SIZE - client->pending, NULL, &client->overlapped)
+		&& GetLastError() != ERROR_IO_PENDING)
+	{
+		/* No completion packet is queued when the read fails immediately */
+		RemoveClient(client);
+	}
+}
+
+/* Hand the complete lines in the buffer over to the consumer, without copying
+ * unless they are small enough to keep reading into the same buffer */
+void LogServer::CompleteRead(Client *client, int bytes)
+{
+	LogBuffer *buffer = client->buffer;
+	int total = client->pending + bytes;
+	int end = total;
+	while (end > 0 && buffer->data[end - 1] != '\n')
+		end--;
+	if (end == 0)
+	{
+		if (total < LOG_READ_BUFFER_SIZE)
+		{
+			/* No complete line yet, continue filling this buffer */
+			client->pending = total;
+			ReadClient(client);
+			return;
+		}
+		/* Overlong line, deliver it as is */
+		end = total;
+	}
+	client->pending = total - end;
+	if (end <= LOG_COPY_SIZE)
+	{
+		PushEvent(AllocateEvent(LOG_DATA, client->pid, buffer->data, end));
+		memmove(buffer->data, buffer->data + end, client->pending);
+	}
+	else
+	{
+		/* Move the incomplete last line to a fresh buffer for the next read */
+		client->buffer = AllocateBuffer();
+		memcpy(client->buffer->data, buffer->data + end, client->pending);
+		buffer->length = end;
+		PushEvent(buffer);
+	}
+	ReadClient(client);
+}
+
 /* Communication sequence
  * Client              Server
  * Connect      ->
@@ -103,9 +267,6 @@ struct Request
 
 void LogServer::RunWorker()
 {
-	m_hCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, NULL, 1);
-	AddClient();
-
 	for (;;)
 	{
 		DWORD bytes;
@@ -126,7 +287,8 @@ void LogServer::RunWorker()
 			else
 			{
 				client->op = OP_READ_REQUEST;
-				ReadFile(client->hPipe, client->buffer, sizeof(Request), NULL, &client->overlapped);
+				client->buffer = AllocateBuffer();
+				ReadFile(client->hPipe, client->buffer->data, sizeof(Request), NULL, &client->overlapped);
 			}
 			AddClient();
 			break;
@@ -138,7 +300,7 @@ void LogServer::RunWorker()
 				RemoveClient(client);
 			else
 			{
-				Request *request = (Request *)client->buffer;
+				Request *request = (Request *)client->buffer->data;
 				if (request->magic != PROTOCOL_MAGIC || request->version != PROTOCOL_VERSION)
 					RemoveClient(client); /* TODO: Error message */
 				else
@@ -146,8 +308,8 @@ void LogServer::RunWorker()
 					client->pid = request->pid;
 					client->tid = request->tid;
 					client->op = OP_READ;
-					SendMessageW(m_hMainWnd, WM_NEWCLIENT, (WPARAM)client->pid, 0);
-					ReadFile(client->hPipe, client->buffer, LOG_BUFFER_SIZE, NULL, &client->overlapped);
+					PushEvent(AllocateEvent(LOG_CLIENT_CONNECTED, client->pid, nullptr, 0));
+					ReadClient(client);
 				}
 			}
 			break;
@@ -158,19 +320,9 @@ void LogServer::RunWorker()
 			if (!succeed)
 				RemoveClient(client);
 			else
-			{
-				LogMessage msg;
-				msg.pid = client->pid;
-				msg.buffer = client->buffer;
-				msg.length = bytes;
-				SendMessageW(m_hMainWnd, WM_LOGRECEIVE, (WPARAM)&msg, 0);
-				ReadFile(client->hPipe, client->buffer, LOG_BUFFER_SIZE, NULL, &client->overlapped);
-			}
+				CompleteRead(client, bytes);
 			break;
 		}
 		}
 	}
-	for (auto const &client : m_clients)
-		CloseHandle(client->hPipe);
-	CloseHandle(m_hCompletionPort);
 }
@@ -19,26 +19,55 @@
 
 #pragma once
 
-#define LOG_BUFFER_SIZE	65536
+#define LOG_BUFFER_SIZE			65536 /* Pipe buffer size */
+#define LOG_READ_BUFFER_SIZE	262144
+#define LOG_COPY_SIZE			16384 /* Data events up to this size are copied out of the read buffer */
+#define LOG_MAX_FREE_BUFFERS	16 /* Maximum number of pooled read buffers */
 
-#define WM_NEWCLIENT	WM_USER + 1
-#define WM_LOGRECEIVE	WM_USER + 2
+#define WM_LOGRECEIVE	WM_USER + 1
 
-struct LogMessage
+enum LogEventType
 {
+	LOG_CLIENT_CONNECTED,
+	LOG_DATA,
+	LOG_CLIENT_DISCONNECTED,
+};
+
+/* A log event
+ * For LOG_DATA events, data contains only complete lines unless a single
+ * line does not fit in a read buffer. Read buffers are handed over as is
+ * and pooled by the log server, other events are sized to their payload. */
+struct LogBuffer
+{
+	LogEventType type;
 	uint32_t pid;
 	int length;
-	char *buffer;
+	int capacity;
+	char *data; /* Storage follows the structure in the same allocation */
+};
+
+/* Receiver of log server notifications */
+class LogSink
+{
+public:
+	/* New events are available, called on a worker thread.
+	 * It is not called again until the sink calls ConsumeEvents() */
+	virtual void OnLogAvailable() = 0;
 };
 
 class LogServer
 {
 public:
+	LogServer(): m_started(false), m_notified(false), m_freeCount(0) {}
 	~LogServer();
 
-	void Start(HWND hMainWnd);
+	void Start(LogSink *sink);
 	void Stop();
 
+	/* Take all pending events in arrival order, they must be given back by ReleaseEvents() */
+	void ConsumeEvents(std::vector<LogBuffer *> &events);
+	void ReleaseEvents(std::vector<LogBuffer *> &events);
+
 private:
 	enum ClientOp
 	{
@@ -52,18 +81,30 @@ private:
 		ClientOp op;
 		uint32_t pid, tid;
 		OVERLAPPED overlapped;
-		char buffer[LOG_BUFFER_SIZE];
+		LogBuffer *buffer; /* Current read buffer */
+		int pending; /* Bytes of incomplete line at the start of buffer */
 	};
 
 	void AddClient();
 	void RemoveClient(Client *client);
+	void ReadClient(Client *client);
+	void CompleteRead(Client *client, int bytes);
 	void RunWorker();
 
-	HANDLE m_hWorker;
+	LogBuffer *AllocateBuffer();
+	LogBuffer *AllocateEvent(LogEventType type, uint32_t pid, const char *data, int length);
+	void FreeBuffer(LogBuffer *buffer);
+	void PushEvent(LogBuffer *buffer);
+
+	std::vector<HANDLE> m_workers;
 	bool m_started;
-	HWND m_hMainWnd;
+	LogSink *m_sink;
 	HANDLE m_hCompletionPort;
+	std::mutex m_clientsMutex;
 	std::vector<std::unique_ptr<Client>> m_clients;
+	concurrency::concurrent_queue<LogBuffer *> m_events, m_freeBuffers;
+	std::atomic<bool> m_notified;
+	std::atomic<int> m_freeCount;
 
 	friend DWORD WINAPI ThreadProc(LPVOID lpParameter);
 };
@@ -19,13 +19,41 @@
 
 #include "pch.h"
 
+#include "HeadlessCollector.h"
 #include "MainWindow.h"
 
 #pragma comment(linker, "/manifestdependency:\"type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0'\
 	processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 
+static int RunHeadless(int argc, wchar_t **argv)
+{
+	/* flog is a GUI application, attach to the console of the launching shell or create one */
+	FILE *console;
+	if (AttachConsole(ATTACH_PARENT_PROCESS) || AllocConsole())
+		freopen_s(&console, "CONOUT$", "w", stderr);
+	LogCollectorOptions options;
+	if (!HeadlessCollector::ParseOptions(argc, argv, options))
+	{
+		HeadlessCollector::PrintUsage();
+		return 1;
+	}
+	HeadlessCollector collector(options);
+	collector.Run();
+	return 0;
+}
+
 int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
 {
+	int argc;
+	wchar_t **argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	if (argv && argc > 1 && !wcscmp(argv[1], L"--headless"))
+	{
+		int r = RunHeadless(argc, argv);
+		LocalFree(argv);
+		return r;
+	}
+	LocalFree(argv);
+
 	CAppModule Module;
 	Module.Init(NULL, hInstance);
 
@@ -41,10 +41,16 @@ LRESULT MainWindow::OnCreate(LPCREATESTRUCT cs)
 	m_splitter.SetSplitterExtendedStyle(0);
 	m_splitter.m_bFullDrag = FALSE;
 
-	m_logServer.Start(*this);
+	m_logServer.Start(this);
 	return 0;
 }
 
+/* Called on a log server thread, the events are processed on the UI thread */
+void MainWindow::OnLogAvailable()
+{
+	PostMessageW(WM_LOGRECEIVE, 0, 0);
+}
+
 void MainWindow::OnClose()
 {
 	DestroyWindow();
@@ -55,9 +61,8 @@ void MainWindow::OnDestroy()
 	PostQuitMessage(0);
 }
 
-LRESULT MainWindow::OnNewClient(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled)
+void MainWindow::AddClient(uint32_t pid)
 {
-	uint32_t pid = (uint32_t)wParam;
 	WCHAR text[256];
 	wsprintfW(text, L"PID: %d\n", pid);
 	HTREEITEM item = m_processTree.InsertItem(TVIF_TEXT, text, 0, 0, TVIS_BOLD, TVIS_BOLD, 0, NULL, NULL);
@@ -69,25 +74,49 @@ LRESULT MainWindow::OnNewClient(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &b
 	if (m_splitter.GetSplitterPane(SPLIT_PANE_RIGHT) == m_defaultLogViewer)
 		SetCurrentLogViewer(client->logViewer);
 	m_clients.push_back(std::move(client));
-	return 0;
 }
 
 LRESULT MainWindow::OnLogReceive(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled)
 {
-	LogMessage *msg = (LogMessage *)wParam;
-	WCHAR wbuffer[LOG_BUFFER_SIZE + 1];
-	int r = MultiByteToWideChar(CP_UTF8, 0, msg->buffer, msg->length, wbuffer, LOG_BUFFER_SIZE + 1);
-	if (r)
+	m_logServer.ConsumeEvents(m_events);
+	/* Append all data of a client in one go, appending to an edit control is expensive */
+	for (size_t i = 0; i < m_events.size(); i++)
 	{
-		wbuffer[r] = 0;
-		for (auto const &client : m_clients)
-			if (client->pid == msg->pid)
+		LogBuffer *event = m_events[i];
+		if (event->type == LOG_CLIENT_CONNECTED)
+			AddClient(event->pid);
+		if (event->type != LOG_DATA || event->length == 0)
+			continue;
+		size_t length = 0;
+		for (size_t j = i; j < m_events.size(); j++)
+			if (m_events[j]->type == LOG_DATA && m_events[j]->pid == event->pid)
+				length += m_events[j]->length;
+		if (m_textBuffer.size() < length + 1)
+			m_textBuffer.resize(length + 1);
+		int r = 0;
+		for (size_t j = i; j < m_events.size(); j++)
+		{
+			LogBuffer *e = m_events[j];
+			if (e->type == LOG_DATA && e->pid == event->pid && e->length > 0)
 			{
-				client->logViewer.AppendText(wbuffer, TRUE, FALSE);
-				if (m_splitter.GetSplitterPane(SPLIT_PANE_RIGHT) != client->logViewer)
-					m_processTree.SetItemState(client->item, TVIS_BOLD, TVIS_BOLD);
+				r += MultiByteToWideChar(CP_UTF8, 0, e->data, e->length, m_textBuffer.data() + r, (int)(m_textBuffer.size() - r));
+				/* Mark as consumed */
+				e->length = 0;
 			}
+		}
+		if (r)
+		{
+			m_textBuffer[r] = 0;
+			for (auto const &client : m_clients)
+				if (client->pid == event->pid)
+				{
+					client->logViewer.AppendText(m_textBuffer.data(), TRUE, FALSE);
+					if (m_splitter.GetSplitterPane(SPLIT_PANE_RIGHT) != client->logViewer)
+						m_processTree.SetItemState(client->item, TVIS_BOLD, TVIS_BOLD);
+				}
+		}
 	}
+	m_logServer.ReleaseEvents(m_events);
 	bHandled = TRUE;
 	return 0;
 }
@@ -21,14 +21,13 @@
 
 #include "LogServer.h"
 
-class MainWindow: public CFrameWindowImpl<MainWindow>
+class MainWindow: public CFrameWindowImpl<MainWindow>, private LogSink
 {
 public:
 	BEGIN_MSG_MAP(MainWindow)
 		MSG_WM_CREATE(OnCreate)
 		MSG_WM_CLOSE(OnClose)
 		MSG_WM_DESTROY(OnDestroy)
-		MESSAGE_HANDLER(WM_NEWCLIENT, OnNewClient)
 		MESSAGE_HANDLER(WM_LOGRECEIVE, OnLogReceive)
 		NOTIFY_CODE_HANDLER_EX(TVN_ITEMCHANGED, OnTreeItemChange)
 		CHAIN_MSG_MAP(CFrameWindowImpl<MainWindow>)
@@ -37,11 +36,13 @@ public:
 	LRESULT OnCreate(LPCREATESTRUCTW cs);
 	void OnClose();
 	void OnDestroy();
-	LRESULT OnNewClient(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
 	LRESULT OnLogReceive(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
 	LRESULT OnTreeItemChange(LPNMHDR pnmh);
 	
 private:
+	virtual void OnLogAvailable() override;
+
+	void AddClient(uint32_t pid);
 	void InitLogViewer(CEdit &logViewer);
 	void SetCurrentLogViewer(CEdit &logViewer);
 
@@ -57,4 +58,7 @@ private:
 		CEdit logViewer;
 	};
 	std::vector<std::unique_ptr<Client>> m_clients;
+	/* Reused between batches of log events */
+	std::vector<LogBuffer *> m_events;
+	std::vector<WCHAR> m_textBuffer;
 };
@@ -6,3 +6,32 @@
 #define SEEK_DATA		3		/* seek to the next data */
 #define SEEK_HOLE		4		/* seek to the next hole */
 #define SEEK_MAX		SEEK_HOLE
+
+/* mount() flags */
+#define MS_RDONLY		1		/* Mount read-only */
+#define MS_NOSUID		2		/* Ignore suid and sgid bits */
+#define MS_NODEV		4		/* Disallow access to device special files */
+#define MS_NOEXEC		8		/* Disallow program execution */
+#define MS_SYNCHRONOUS	16		/* Writes are synced at once */
+#define MS_REMOUNT		32		/* Alter flags of a mounted FS */
+#define MS_MANDLOCK		64		/* Allow mandatory locks on an FS */
+#define MS_DIRSYNC		128		/* Directory modifications are synchronous */
+#define MS_NOATIME		1024	/* Do not update access times. */
+#define MS_NODIRATIME	2048	/* Do not update directory access times */
+#define MS_BIND			4096
+#define MS_MOVE			8192
+#define MS_REC			16384
+#define MS_SILENT		32768
+#define MS_UNBINDABLE	(1 << 17)	/* change to unbindable */
+#define MS_PRIVATE		(1 << 18)	/* change to private */
+#define MS_SLAVE		(1 << 19)	/* change to slave */
+#define MS_SHARED		(1 << 20)	/* change to shared */
+#define MS_RELATIME		(1 << 21)	/* Update atime relative to mtime/ctime. */
+#define MS_MGC_VAL		0xC0ED0000
+#define MS_MGC_MSK		0xFFFF0000
+
+/* umount2() flags */
+#define MNT_FORCE		0x00000001	/* Attempt to forcibily umount */
+#define MNT_DETACH		0x00000002	/* Just detach from the tree */
+#define MNT_EXPIRE		0x00000004	/* Mark for expiry */
+#define UMOUNT_NOFOLLOW	0x00000008	/* Don't follow symlink on umount */
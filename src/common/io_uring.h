@@ -0,0 +1,201 @@
+#pragma once
+
+#include <stdint.h>
+
+/* IO submission data structure (Submission Queue Entry) */
+struct io_uring_sqe
+{
+	uint8_t opcode;		/* type of operation for this sqe */
+	uint8_t flags;		/* IOSQE_ flags */
+	uint16_t ioprio;	/* ioprio for the request */
+	int32_t fd;			/* file descriptor to do IO on */
+	union
+	{
+		uint64_t off;	/* offset into file */
+		uint64_t addr2;
+	};
+	uint64_t addr;		/* pointer to buffer or iovecs */
+	uint32_t len;		/* buffer size or number of iovecs */
+	union
+	{
+		uint32_t rw_flags;
+		uint32_t fsync_flags;
+		uint16_t poll_events;	/* compatibility */
+		uint32_t poll32_events;	/* word-reversed for BE */
+		uint32_t sync_range_flags;
+		uint32_t msg_flags;
+		uint32_t timeout_flags;
+		uint32_t accept_flags;
+		uint32_t cancel_flags;
+		uint32_t open_flags;
+		uint32_t statx_flags;
+		uint32_t fadvise_advice;
+	};
+	uint64_t user_data;	/* data to be passed back at completion time */
+	union
+	{
+		uint16_t buf_index;	/* index into fixed buffers, if used */
+		uint64_t __pad2[3];
+	};
+};
+
+#define IOSQE_FIXED_FILE		(1U << 0)	/* use fixed fileset */
+#define IOSQE_IO_DRAIN			(1U << 1)	/* issue after inflight IO */
+#define IOSQE_IO_LINK			(1U << 2)	/* links next sqe */
+#define IOSQE_IO_HARDLINK		(1U << 3)	/* like LINK, but stronger */
+#define IOSQE_ASYNC				(1U << 4)	/* always go async */
+#define IOSQE_BUFFER_SELECT		(1U << 5)	/* select buffer from sqe->buf_group */
+#define IOSQE_CQE_SKIP_SUCCESS	(1U << 6)	/* don't post CQE if request succeeded */
+
+/* io_uring_setup() flags */
+#define IORING_SETUP_IOPOLL		(1U << 0)	/* io_context is polled */
+#define IORING_SETUP_SQPOLL		(1U << 1)	/* SQ poll thread */
+#define IORING_SETUP_SQ_AFF		(1U << 2)	/* sq_thread_cpu is valid */
+#define IORING_SETUP_CQSIZE		(1U << 3)	/* app defines CQ size */
+#define IORING_SETUP_CLAMP		(1U << 4)	/* clamp SQ/CQ ring sizes */
+#define IORING_SETUP_ATTACH_WQ	(1U << 5)	/* attach to existing wq */
+
+#define IORING_OP_NOP				0
+#define IORING_OP_READV				1
+#define IORING_OP_WRITEV			2
+#define IORING_OP_FSYNC				3
+#define IORING_OP_READ_FIXED		4
+#define IORING_OP_WRITE_FIXED		5
+#define IORING_OP_POLL_ADD			6
+#define IORING_OP_POLL_REMOVE		7
+#define IORING_OP_SYNC_FILE_RANGE	8
+#define IORING_OP_SENDMSG			9
+#define IORING_OP_RECVMSG			10
+#define IORING_OP_TIMEOUT			11
+#define IORING_OP_TIMEOUT_REMOVE	12
+#define IORING_OP_ACCEPT			13
+#define IORING_OP_ASYNC_CANCEL		14
+#define IORING_OP_LINK_TIMEOUT		15
+#define IORING_OP_CONNECT			16
+#define IORING_OP_FALLOCATE			17
+#define IORING_OP_OPENAT			18
+#define IORING_OP_CLOSE				19
+#define IORING_OP_FILES_UPDATE		20
+#define IORING_OP_STATX				21
+#define IORING_OP_READ				22
+#define IORING_OP_WRITE				23
+#define IORING_OP_FADVISE			24
+#define IORING_OP_MADVISE			25
+#define IORING_OP_SEND				26
+#define IORING_OP_RECV				27
+#define IORING_OP_LAST				28
+
+/* sqe->fsync_flags */
+#define IORING_FSYNC_DATASYNC	(1U << 0)
+
+/* sqe->timeout_flags */
+#define IORING_TIMEOUT_ABS		(1U << 0)
+
+/* IO completion data structure (Completion Queue Entry) */
+struct io_uring_cqe
+{
+	uint64_t user_data;	/* sqe->data submission passed back */
+	int32_t res;		/* result code for this event */
+	uint32_t flags;
+};
+
+/* Magic offsets for the application to mmap the data it needs */
+#define IORING_OFF_SQ_RING		0ULL
+#define IORING_OFF_CQ_RING		0x8000000ULL
+#define IORING_OFF_SQES			0x10000000ULL
+
+/* Filled with the offset for mmap(2) */
+struct io_sqring_offsets
+{
+	uint32_t head;
+	uint32_t tail;
+	uint32_t ring_mask;
+	uint32_t ring_entries;
+	uint32_t flags;
+	uint32_t dropped;
+	uint32_t array;
+	uint32_t resv1;
+	uint64_t resv2;
+};
+
+/* sq_ring->flags */
+#define IORING_SQ_NEED_WAKEUP	(1U << 0)	/* needs io_uring_enter wakeup */
+#define IORING_SQ_CQ_OVERFLOW	(1U << 1)	/* CQ ring is overflown */
+
+struct io_cqring_offsets
+{
+	uint32_t head;
+	uint32_t tail;
+	uint32_t ring_mask;
+	uint32_t ring_entries;
+	uint32_t overflow;
+	uint32_t cqes;
+	uint32_t flags;
+	uint32_t resv1;
+	uint64_t resv2;
+};
+
+/* io_uring_enter(2) flags */
+#define IORING_ENTER_GETEVENTS	(1U << 0)
+#define IORING_ENTER_SQ_WAKEUP	(1U << 1)
+#define IORING_ENTER_SQ_WAIT	(1U << 2)
+
+/* Passed in for io_uring_setup(2). Copied back with updated info on success */
+struct io_uring_params
+{
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t flags;
+	uint32_t sq_thread_cpu;
+	uint32_t sq_thread_idle;
+	uint32_t features;
+	uint32_t wq_fd;
+	uint32_t resv[3];
+	struct io_sqring_offsets sq_off;
+	struct io_cqring_offsets cq_off;
+};
+
+/* io_uring_params->features flags */
+#define IORING_FEAT_SINGLE_MMAP		(1U << 0)
+#define IORING_FEAT_NODROP			(1U << 1)
+#define IORING_FEAT_SUBMIT_STABLE	(1U << 2)
+#define IORING_FEAT_RW_CUR_POS		(1U << 3)
+#define IORING_FEAT_CUR_PERSONALITY	(1U << 4)
+
+/* io_uring_register(2) opcodes and arguments */
+#define IORING_REGISTER_BUFFERS			0
+#define IORING_UNREGISTER_BUFFERS		1
+#define IORING_REGISTER_FILES			2
+#define IORING_UNREGISTER_FILES			3
+#define IORING_REGISTER_EVENTFD			4
+#define IORING_UNREGISTER_EVENTFD		5
+#define IORING_REGISTER_FILES_UPDATE	6
+#define IORING_REGISTER_EVENTFD_ASYNC	7
+#define IORING_REGISTER_PROBE			8
+#define IORING_REGISTER_PERSONALITY		9
+#define IORING_UNREGISTER_PERSONALITY	10
+
+struct io_uring_probe_op
+{
+	uint8_t op;
+	uint8_t resv;
+	uint16_t flags;	/* IO_URING_OP_* flags */
+	uint32_t resv2;
+};
+
+struct io_uring_probe
+{
+	uint8_t last_op;	/* last opcode supported */
+	uint8_t ops_len;	/* length of ops[] array below */
+	uint16_t resv;
+	uint32_t resv2[3];
+	struct io_uring_probe_op ops[];
+};
+
+#define IO_URING_OP_SUPPORTED	(1U << 0)
+
+struct __kernel_timespec
+{
+	int64_t tv_sec;
+	int64_t tv_nsec;
+};
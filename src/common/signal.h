@@ -138,6 +138,12 @@ struct sigaction
 #define SIGRTMIN		32
 #define SIGRTMAX		_NSIG
 
+#define SI_KERNEL		0x80	/* sent by the kernel, e.g. general protection faults */
+
+/* si_code values for SIGSEGV */
+#define SEGV_MAPERR		1	/* address not mapped to object */
+#define SEGV_ACCERR		2	/* invalid permissions for mapped object */
+
 #define SA_NOCLDSTOP	0x00000001u
 #define SA_NOCLDWAIT	0x00000002u
 #define SA_SIGINFO		0x00000004u
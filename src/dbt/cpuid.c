@@ -21,6 +21,7 @@
 #include <str.h>
 
 #include <intrin.h>
+#include <stdbool.h>
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
@@ -183,7 +184,7 @@ static struct cpuinfo_feature cpuinfo_features_00000001_ecx[] =
 	{ FEATURE_TSC_DEADLINE, "tsc_deadline_timer" },
 	{ FEATURE_AES, "aes" },
 	{ FEATURE_XSAVE, "xsave" },
-	//{ FEATURE_OSXSAVE, "osxsave" },
+	{ FEATURE_OSXSAVE, "osxsave" },
 	{ FEATURE_AVX, "avx" },
 	{ FEATURE_F16C, "f16c" },
 	{ FEATURE_RDRAND, "rdrand" },
@@ -256,13 +257,17 @@ static struct cpuinfo_feature cpuinfo_features_80000001_ecx[] =
 #define FEATURE_RTM				BIT(11)	/* Restricted Transactional Memory */
 #define FEATURE_MPX				BIT(14)	/* Memory Protection Extension */
 #define FEATURE_AVX512F			BIT(16)	/* AVX-512 Foundation */
+#define FEATURE_AVX512DQ		BIT(17)	/* AVX-512 Doubleword and Quadword instructions */
 #define FEATURE_RDSEED			BIT(18)	/* RDSEED instruction */
 #define FEATURE_ADX				BIT(19)	/* ADCX and ADOX instructions */
 #define FEATURE_SMAP			BIT(20)	/* Supervisor Mode Access Prevention */
+#define FEATURE_AVX512IFMA		BIT(21)	/* AVX-512 Integer Fused Multiply-Add instructions */
 #define FEATURE_CLFLUSHOPT		BIT(23)	/* CLFLUSHOPT instruction */
 #define FEATURE_AVX512PF		BIT(26)	/* AVX-512 Prefetch */
 #define FEATURE_AVX512ER		BIT(27)	/* AVX-512 Exponential and Reciprocal */
 #define FEATURE_AVX512CD		BIT(28)	/* AVX-512 Conflict Detection */
+#define FEATURE_AVX512BW		BIT(30)	/* AVX-512 Byte and Word instructions */
+#define FEATURE_AVX512VL		BIT(31)	/* AVX-512 Vector Length extensions */
 static struct cpuinfo_feature cpuinfo_features_7_0_ebx[] =
 {
 	{ FEATURE_FSGSBASE, "fsgsbase" },
@@ -277,17 +282,65 @@ static struct cpuinfo_feature cpuinfo_features_7_0_ebx[] =
 	{ FEATURE_RTM, "rtm" },
 	{ FEATURE_MPX, "mpx" },
 	{ FEATURE_AVX512F, "avx512f" },
+	{ FEATURE_AVX512DQ, "avx512dq" },
 	{ FEATURE_RDSEED, "rdseed" },
 	{ FEATURE_ADX, "adx" },
 	{ FEATURE_SMAP, "smap" },
+	{ FEATURE_AVX512IFMA, "avx512ifma" },
 	{ FEATURE_CLFLUSHOPT, "clflushopt" },
 	{ FEATURE_AVX512PF, "avx512pf" },
 	{ FEATURE_AVX512ER, "avx512er" },
 	{ FEATURE_AVX512CD, "avx512cd" },
+	{ FEATURE_AVX512BW, "avx512bw" },
+	{ FEATURE_AVX512VL, "avx512vl" },
 };
 
+/* EAX = 7, Sub-leaf 0, ECX */
+#define FEATURE_AVX512VBMI		BIT(1)	/* AVX-512 Vector Bit Manipulation instructions */
+#define FEATURE_AVX512VBMI2		BIT(6)	/* AVX-512 Vector Bit Manipulation instructions 2 */
+#define FEATURE_AVX512VNNI		BIT(11)	/* AVX-512 Vector Neural Network instructions */
+#define FEATURE_AVX512BITALG	BIT(12)	/* AVX-512 VPOPCNT[B,W] and VPSHUFBITQMB instructions */
+#define FEATURE_AVX512VPOPCNTDQ	BIT(14)	/* AVX-512 VPOPCNT[D,Q] instructions */
+static struct cpuinfo_feature cpuinfo_features_7_0_ecx[] =
+{
+	{ FEATURE_AVX512VBMI, "avx512vbmi" },
+	{ FEATURE_AVX512VBMI2, "avx512_vbmi2" },
+	{ FEATURE_AVX512VNNI, "avx512_vnni" },
+	{ FEATURE_AVX512BITALG, "avx512_bitalg" },
+	{ FEATURE_AVX512VPOPCNTDQ, "avx512_vpopcntdq" },
+};
+
+/* EAX = 0x0D, Sub-leaf 1, EAX */
+#define FEATURE_XSAVEOPT		BIT(0)	/* XSAVEOPT instruction */
+#define FEATURE_XSAVEC			BIT(1)	/* XSAVEC instruction */
+#define FEATURE_XGETBV1			BIT(2)	/* XGETBV with ECX = 1 */
+#define FEATURE_XSAVES			BIT(3)	/* XSAVES/XRSTORS instructions */
+
+/* XCR0 state components */
+#define XSTATE_X87				BIT(0)
+#define XSTATE_SSE				BIT(1)
+#define XSTATE_YMM				BIT(2)
+#define XSTATE_OPMASK			BIT(5)
+#define XSTATE_ZMM_HI256		BIT(6)
+#define XSTATE_HI16_ZMM			BIT(7)
+
+/* Get the XCR0 state components the OS saves on context switch, 0 if XSAVE is not enabled */
+static uint64_t dbt_get_os_xstate()
+{
+	int cpuinfo[4];
+	__cpuid(cpuinfo, 1);
+	if (!(cpuinfo[2] & FEATURE_OSXSAVE))
+		return 0;
+	return _xgetbv(0);
+}
+
 void dbt_cpuid(int eax, int ecx, struct cpuid_t *cpuid)
 {
+	uint64_t xstate = dbt_get_os_xstate();
+	/* AVX needs the OS to preserve YMM state, AVX-512 additionally needs opmask and ZMM state */
+	bool avx = (xstate & (XSTATE_SSE | XSTATE_YMM)) == (XSTATE_SSE | XSTATE_YMM);
+	bool avx512 = avx && (xstate & (XSTATE_OPMASK | XSTATE_ZMM_HI256 | XSTATE_HI16_ZMM))
+		== (XSTATE_OPMASK | XSTATE_ZMM_HI256 | XSTATE_HI16_ZMM);
 	int cpuinfo[4];
 	__cpuidex(cpuinfo, eax, ecx);
 	cpuid->eax = cpuinfo[0];
@@ -309,7 +362,7 @@ void dbt_cpuid(int eax, int ecx, struct cpuid_t *cpuid)
 			| FEATURE_MCE
 			| FEATURE_CX8
 			| FEATURE_APIC
-			//| FEATURE_SEP
+			| FEATURE_SEP
 			| FEATURE_MTRR
 			| FEATURE_PGE
 			| FEATURE_MCA
@@ -342,7 +395,7 @@ void dbt_cpuid(int eax, int ecx, struct cpuid_t *cpuid)
 			| FEATURE_TM2
 			| FEATURE_SSSE3
 			| FEATURE_CNXT_ID
-			//| FEATURE_FMA
+			| FEATURE_FMA
 			//| FEATURE_CMPXCHG16B
 			| FEATURE_XTPR
 			| FEATURE_PDCM
@@ -355,13 +408,15 @@ void dbt_cpuid(int eax, int ecx, struct cpuid_t *cpuid)
 			| FEATURE_POPCNT
 			| FEATURE_TSC_DEADLINE
 			//| FEATURE_AES
-			//| FEATURE_XSAVE
-			//| FEATURE_OSXSAVE
-			//| FEATURE_AVX
-			//| FEATURE_F16C
+			| FEATURE_XSAVE
+			| FEATURE_OSXSAVE
+			| FEATURE_AVX
+			| FEATURE_F16C
 			//| FEATURE_RDRAND
 			| FEATURE_HYPERVISOR
 			);
+		if (!avx)
+			cpuid->ecx &= ~(FEATURE_FMA | FEATURE_XSAVE | FEATURE_OSXSAVE | FEATURE_AVX | FEATURE_F16C);
 	}
 	else if (eax == 0x80000001)
 	{
@@ -414,30 +469,136 @@ void dbt_cpuid(int eax, int ecx, struct cpuid_t *cpuid)
 			cpuid->ebx &= (0
 				//| FEATURE_FSGSBASE
 				| FEATURE_TSC_ADJUST
-				//| FEATURE_BMI1
+				| FEATURE_BMI1
 				//| FEATURE_HLE
-				//| FEATURE_AVX2
+				| FEATURE_AVX2
 				| FEATURE_SMEP
-				//| FEATURE_BMI2
+				| FEATURE_BMI2
 				| FEATURE_ERMS
 				//| FEATURE_INVPCID
 				//| FEATURE_RTM
 				//| FEATURE_MPX
-				//| FEATURE_AVX512F
+				| FEATURE_AVX512F
+				| FEATURE_AVX512DQ
 				//| FEATURE_RDSEED
 				//| FEATURE_ADX
 				//| FEATURE_SMAP
+				| FEATURE_AVX512IFMA
 				//| FEATURE_CLFLUSHOPT
 				//| FEATURE_AVX512PF
 				//| FEATURE_AVX512ER
-				//| FEATURE_AVX512CD
+				| FEATURE_AVX512CD
+				| FEATURE_AVX512BW
+				| FEATURE_AVX512VL
 				);
-			cpuid->ecx = 0;
+			cpuid->ecx &= (0
+				| FEATURE_AVX512VBMI
+				| FEATURE_AVX512VBMI2
+				| FEATURE_AVX512VNNI
+				| FEATURE_AVX512BITALG
+				| FEATURE_AVX512VPOPCNTDQ
+				);
+			if (!avx)
+				cpuid->ebx &= ~FEATURE_AVX2;
+			if (!avx512)
+			{
+				cpuid->ebx &= ~(FEATURE_AVX512F | FEATURE_AVX512DQ | FEATURE_AVX512IFMA | FEATURE_AVX512CD
+					| FEATURE_AVX512BW | FEATURE_AVX512VL);
+				cpuid->ecx = 0;
+			}
 			cpuid->edx = 0;
 		}
 		else
 			cpuid->eax = cpuid->ebx = cpuid->ecx = cpuid->edx = 0;
 	}
+	else if (eax == 0x0D)
+	{
+		/* Processor extended state enumeration */
+		if (!avx)
+			cpuid->eax = cpuid->ebx = cpuid->ecx = cpuid->edx = 0;
+		else if (ecx == 0x01)
+		{
+			/* XSAVES and XRSTORS are privileged */
+			cpuid->eax &= (0
+				| FEATURE_XSAVEOPT
+				| FEATURE_XSAVEC
+				| FEATURE_XGETBV1
+				//| FEATURE_XSAVES
+				);
+			cpuid->ebx = cpuid->ecx = cpuid->edx = 0;
+		}
+	}
+}
+
+/* Masked CPUID results, looked up by dbt_cpuid_fast in x86_trampoline.asm without leaving translated code.
+ * Each basic and extended leaf below 32 has one slot. Leaves which depend on the sub-leaf only have sub-leaf 0
+ * cached, other sub-leaves go through dbt_cpuid(). Keep the layout in sync with dbt_cpuid_fast.
+ */
+struct cpuid_cache_entry
+{
+	uint32_t leaf; /* 0xFFFFFFFF if the slot is empty */
+	uint32_t subleaf_mask; /* 0 if the leaf ignores ECX */
+	uint32_t subleaf;
+	uint32_t reserved;
+	struct cpuid_t cpuid;
+};
+
+#define CPUID_CACHE_SLOTS		64
+#define CPUID_CACHE_SLOT(leaf)	(((leaf) & 0x1F) | (((leaf) >> 26) & 0x20))
+struct cpuid_cache_entry dbt_cpuid_cache[CPUID_CACHE_SLOTS];
+
+static bool cpuid_leaf_has_subleaf(uint32_t leaf)
+{
+	/* Unknown leaves are assumed to have sub-leaves, which is always correct */
+	switch (leaf)
+	{
+	case 0x00: case 0x01: case 0x02: case 0x03: case 0x05: case 0x06: case 0x15: case 0x16:
+	case 0x80000000: case 0x80000001: case 0x80000002: case 0x80000003: case 0x80000004:
+	case 0x80000005: case 0x80000006: case 0x80000007: case 0x80000008:
+		return false;
+	default:
+		return true;
+	}
+}
+
+void dbt_get_xstate(uint64_t *mask, uint32_t *size)
+{
+	uint64_t xstate = dbt_get_os_xstate();
+	/* Same condition as the AVX feature bits in dbt_cpuid() */
+	if ((xstate & (XSTATE_SSE | XSTATE_YMM)) != (XSTATE_SSE | XSTATE_YMM))
+	{
+		*mask = 0;
+		*size = 0;
+		return;
+	}
+	*mask = xstate & (XSTATE_X87 | XSTATE_SSE | XSTATE_YMM | XSTATE_OPMASK | XSTATE_ZMM_HI256 | XSTATE_HI16_ZMM);
+	/* Size of the XSAVE area for all components enabled in XCR0, enough for our subset */
+	int cpuinfo[4];
+	__cpuidex(cpuinfo, 0x0D, 0);
+	*size = cpuinfo[1];
+}
+
+static void dbt_cpuid_cache_leaves(uint32_t first, uint32_t last)
+{
+	for (uint32_t leaf = first; leaf <= last && leaf - first < 0x20; leaf++)
+	{
+		struct cpuid_cache_entry *entry = &dbt_cpuid_cache[CPUID_CACHE_SLOT(leaf)];
+		entry->leaf = leaf;
+		entry->subleaf_mask = cpuid_leaf_has_subleaf(leaf) ? 0xFFFFFFFF : 0;
+		entry->subleaf = 0;
+		dbt_cpuid(leaf, 0, &entry->cpuid);
+	}
+}
+
+void dbt_cpuid_init()
+{
+	for (int i = 0; i < CPUID_CACHE_SLOTS; i++)
+		dbt_cpuid_cache[i].leaf = 0xFFFFFFFF;
+	int cpuinfo[4];
+	__cpuid(cpuinfo, 0);
+	dbt_cpuid_cache_leaves(0, cpuinfo[0]);
+	__cpuid(cpuinfo, 0x80000000);
+	dbt_cpuid_cache_leaves(0x80000000, cpuinfo[0]);
 }
 
 int dbt_get_cpuinfo(char *buf)
@@ -468,6 +629,9 @@ int dbt_get_cpuinfo(char *buf)
 	for (int i = 0; i < ARRAYSIZE(cpuinfo_features_7_0_ebx); i++)
 		if (cpuid_7_0.ebx & cpuinfo_features_7_0_ebx[i].mask)
 			buf += ksprintf(buf, " %s", cpuinfo_features_7_0_ebx[i].name);
+	for (int i = 0; i < ARRAYSIZE(cpuinfo_features_7_0_ecx); i++)
+		if (cpuid_7_0.ecx & cpuinfo_features_7_0_ecx[i].mask)
+			buf += ksprintf(buf, " %s", cpuinfo_features_7_0_ecx[i].name);
 	
 	return buf - buf_original;
 }
@@ -30,6 +30,11 @@ struct cpuid_t
 	uint32_t edx;
 };
 
+/* Fill the table of masked CPUID results used by translated CPUID instructions */
+void dbt_cpuid_init();
 /* Singature used in dbt trampoline */
 void dbt_cpuid(int eax, int ecx, struct cpuid_t *cpuid);
 int dbt_get_cpuinfo(char *buf);
+/* Get the XSAVE state components of the features exposed to the guest and the size of their save area.
+ * mask is 0 if the OS does not enable AVX state, in which case FXSAVE is sufficient. */
+void dbt_get_xstate(uint64_t *mask, uint32_t *size);
@@ -62,6 +62,7 @@
 
 /* ModR/M flags */
 #define MODRM_PURE_REGISTER	1
+#define MODRM_DISP32		2 /* Never encode displacement as disp8, for EVEX compressed disp8*N */
 
 struct modrm_rm_t
 {
@@ -266,7 +267,7 @@ static __forceinline void gen_modrm_sib(uint8_t **out, int r, struct modrm_rm_t
 		log_error("gen_modrm(): rsp or r12 cannot be used as an index register.\n");
 		return;
 	}
-	int is_disp8 = (((int8_t)rm.disp) == rm.disp);
+	int is_disp8 = !(rm.flags & MODRM_DISP32) && (((int8_t)rm.disp) == rm.disp);
 	if (rm.base == -1 && rm.index == -1) /* disp32 */
 	{
 		gen_modrm(out, 0, r, 5);
@@ -354,6 +355,13 @@ static __forceinline void gen_shr_rm_32(uint8_t **out, struct modrm_rm_t rm, uin
 	gen_byte(out, imm8);
 }
 
+static __forceinline void gen_cmp_rm_imm8_32(uint8_t **out, struct modrm_rm_t rm, int8_t imm8)
+{
+	gen_byte(out, 0x83);
+	gen_modrm_sib(out, 7, rm);
+	gen_byte(out, imm8);
+}
+
 static __forceinline void gen_xor_r_rm_32(uint8_t **out, int r, struct modrm_rm_t rm)
 {
 	gen_byte(out, 0x33);
@@ -422,6 +430,12 @@ static __forceinline void gen_jcc(uint8_t **out, int cond, size_t dest)
 	gen_dword(out, rel);
 }
 
+static __forceinline void gen_jcc_rel8(uint8_t **out, int cond, int8_t rel)
+{
+	gen_byte(out, 0x70 + cond);
+	gen_byte(out, rel);
+}
+
 static __forceinline void gen_jecxz_rel(uint8_t **out, int8_t rel)
 {
 	gen_byte(out, 0xE3);
@@ -477,6 +491,7 @@ struct dbt_data
 	int tls_kernel_esp_offset; /* saved kernel stack pointer */
 	int tls_esp_offset; /* saved user stack pointer */
 	int tls_eip_offset; /* saved instruction pointer */
+	const uint16_t *tls_selector_offsets; /* fs offset of the TLS slot of each gs selector */
 	/* Trampolines */
 	void *run_trampoline;
 	void *restore_fork_trampoline;
@@ -500,7 +515,7 @@ extern void dbt_sieve_fallback();
 extern void dbt_save_simd_state();
 extern void dbt_restore_simd_state();
 
-extern void dbt_cpuid_internal();
+extern void dbt_cpuid_fast();
 extern void syscall_handler();
 
 static struct dbt_data *const dbt = &_dbt;
@@ -727,6 +742,8 @@ void dbt_init()
 	dbt->tls_return_addr_offset = tls_kernel_entry_to_offset(TLS_ENTRY_RETURN_ADDR);
 	dbt->tls_kernel_esp_offset = tls_kernel_entry_to_offset(TLS_ENTRY_KERNEL_ESP);
 	dbt->tls_esp_offset = tls_kernel_entry_to_offset(TLS_ENTRY_ESP);
+	dbt->tls_selector_offsets = tls_get_selector_offset_table();
+	dbt_cpuid_init();
 	dbt_gen_tables();
 	log_info("dbt subsystem initialized.\n");
 }
@@ -993,6 +1010,10 @@ struct instruction_t
 	int lock_prefix;
 	int escape_0x0f;
 	uint8_t escape_byte2; /* 0x38 or 0x3A */
+	uint8_t *vex; /* VEX/EVEX prefix in original code, including the leading 0xC4/0xC5/0x62 byte */
+	int vex_bytes; /* Length of VEX/EVEX prefix, 0 if not present */
+	int vex_vvvv; /* Register encoded in VEX.vvvv */
+	int evex;
 	int r;
 	struct modrm_rm_t rm;
 	int imm_bytes;
@@ -1012,6 +1033,8 @@ static int find_unused_register(struct instruction_t *ins)
 		used_regs |= REG_MASK(ins->rm.base);
 	if (ins->rm.index != -1)
 		used_regs |= REG_MASK(ins->rm.index);
+	if (ins->vex_bytes)
+		used_regs |= REG_MASK(ins->vex_vvvv);
 #define TEST_REG(r) do { if ((used_regs & REG_MASK(r)) == 0) return r; } while (0)
 	/* We really don't want to use esp or ebp as a temporary register */
 	TEST_REG(EAX);
@@ -1054,7 +1077,9 @@ static void dbt_copy_instruction(uint8_t **out, uint8_t **code, struct instructi
 		gen_byte(out, ins->rep_prefix);
 	if (ins->segment_prefix && ins->segment_prefix != PREFIX_GS)
 		gen_byte(out, ins->segment_prefix);
-	if (ins->escape_0x0f)
+	if (ins->vex_bytes)
+		gen_copy(out, ins->vex, ins->vex_bytes);
+	else if (ins->escape_0x0f)
 	{
 		gen_byte(out, 0x0f);
 		if (ins->escape_byte2)
@@ -1167,11 +1192,52 @@ static bool dbt_gen_ret_trampoline(uint8_t **out, struct syscall_context *contex
 	return false;
 }
 
+/* Inline system call entry, returns to next_pc in the same block unless a signal became pending */
+static bool dbt_gen_syscall(uint8_t **out, uint8_t *next_pc, DWORD current_ip, struct syscall_context *context)
+{
+	/* dbt_deliver_signal() sets the return address to the signal trampoline if a signal arrives */
+	/* mov fs:[return_addr], 0 */
+	gen_fs_prefix(out);
+	gen_mov_rm_imm32(out, modrm_rm_disp(dbt->tls_return_addr_offset), 0);
+	if (context && context->eip <= (DWORD)*out)
+	{
+		context->eip = current_ip;
+		return true;
+	}
+	gen_push_imm32(out, (size_t)next_pc);
+	if (context && context->eip == (DWORD)*out)
+	{
+		context->esp += 4;
+		context->eip = current_ip;
+		return true;
+	}
+	gen_call(out, &syscall_handler);
+	/* The system call is done, next_pc is still on the stack */
+	/* cmp fs:[return_addr], 0 */
+	gen_fs_prefix(out);
+	gen_cmp_rm_imm8_32(out, modrm_rm_disp(dbt->tls_return_addr_offset), 0);
+	/* jz done */
+	gen_jcc_rel8(out, 4, 5);
+	/* Deliver the signal through the usual path */
+	gen_jmp(out, &dbt_find_indirect_internal);
+	if (context && context->eip <= (DWORD)*out)
+	{
+		context->esp += 4;
+		context->eip = (DWORD)next_pc;
+		return true;
+	}
+	/* done: lea esp, [esp+4] */
+	gen_lea(out, ESP, modrm_rm_mreg(ESP, 4));
+	return false;
+}
+
 static void dbt_log_opcode(struct instruction_t *ins)
 {
 	log_info("Opcode: 0x%02x\n", ins->opcode);
 	log_info("Escape_0F: %d\n", ins->escape_0x0f);
 	log_info("Escape byte2: 0x%02x\n", ins->escape_byte2);
+	if (ins->vex_bytes)
+		log_info("VEX: %d bytes, EVEX: %d\n", ins->vex_bytes, ins->evex);
 	log_info("R: %d\n", ins->r);
 	log_info("Lock: %d\n", ins->lock_prefix);
 	log_info("rep: %d\n", ins->rep_prefix);
@@ -1253,6 +1319,8 @@ static struct dbt_block *dbt_translate(size_t pc, struct syscall_context *contex
 		ins.opsize_prefix = 0;
 		ins.segment_prefix = 0;
 		ins.lock_prefix = 0;
+		ins.vex_bytes = 0;
+		ins.evex = 0;
 		/* Handle prefixes. According to x86 doc, they can appear in any order */
 		for (;;)
 		{
@@ -1318,7 +1386,62 @@ done_prefix:
 		ins.escape_0x0f = 0;
 		ins.escape_byte2 = 0;
 
-		if (ins.opcode == 0x0F)
+		if ((ins.opcode == 0xC4 || ins.opcode == 0xC5 || ins.opcode == 0x62) && GET_MODRM_MOD(*code) == 3)
+		{
+			/* VEX or EVEX prefix. LES, LDS and BOUND do not accept a register operand, which is how the
+			 * prefixes are distinguished in 32-bit mode. The R, X, B and V' extension bits are ignored. */
+			ins.vex = code - 1;
+			int map;
+			if (ins.opcode == 0xC5)
+			{
+				uint8_t vex1 = parse_byte(&code);
+				map = VEX_MAP_0F;
+				ins.vex_vvvv = (~vex1 >> 3) & 7;
+			}
+			else if (ins.opcode == 0xC4)
+			{
+				uint8_t vex1 = parse_byte(&code);
+				uint8_t vex2 = parse_byte(&code);
+				map = vex1 & 0x1F;
+				ins.vex_vvvv = (~vex2 >> 3) & 7;
+			}
+			else
+			{
+				uint8_t evex1 = parse_byte(&code);
+				uint8_t evex2 = parse_byte(&code);
+				parse_byte(&code); /* z, L'L, b, V', aaa */
+				map = evex1 & 7;
+				ins.vex_vvvv = (~evex2 >> 3) & 7;
+				ins.evex = 1;
+			}
+			ins.vex_bytes = (int)(code - ins.vex);
+			if (ins.opsize_prefix || ins.rep_prefix || ins.lock_prefix)
+			{
+				/* #UD by architecture */
+				log_error("Invalid opcode.\n");
+				__debugbreak();
+			}
+			/* Record the implied escape bytes for dbt_log_opcode() */
+			ins.escape_0x0f = 1;
+			ins.escape_byte2 = map == VEX_MAP_0F38 ? 0x38 : map == VEX_MAP_0F3A ? 0x3A : 0;
+			ins.opcode = parse_byte(&code);
+			if (map == VEX_MAP_0F)
+			{
+				if (ins.opcode == 0x77 && !ins.evex)
+					ins.desc = &vex_inst_no_modrm;
+				else if (vex_0x0F_imm8[ins.opcode >> 5] & (1 << (ins.opcode & 31)))
+					ins.desc = &vex_inst_imm8;
+				else
+					ins.desc = &vex_inst;
+			}
+			else if (map == VEX_MAP_0F38)
+				ins.desc = &vex_inst;
+			else if (map == VEX_MAP_0F3A)
+				ins.desc = &vex_inst_imm8;
+			else
+				ins.desc = &vex_inst_unknown;
+		}
+		else if (ins.opcode == 0x0F)
 		{
 			ins.escape_0x0f = 1;
 			ins.opcode = parse_byte(&code);
@@ -1342,7 +1465,13 @@ done_prefix:
 
 	inst_mandatory_reentry:
 		if (ins.desc->has_modrm)
+		{
+			uint8_t modrm = *code;
 			parse_modrm(&code, &ins.r, &ins.rm);
+			/* EVEX scales disp8 by the memory operand size, so keep the original displacement width */
+			if (ins.evex && GET_MODRM_MOD(modrm) != 1 && GET_MODRM_MOD(modrm) != 3)
+				ins.rm.flags |= MODRM_DISP32;
+		}
 		
 	inst_extension_reentry:
 		ins.imm_bytes = ins.desc->imm_bytes;
@@ -1729,15 +1858,33 @@ done_prefix:
 				log_error("INT 0x%x not supported.\n", id);
 				__debugbreak();
 			}
-			gen_push_imm32(&out, (size_t)code);
-			if (context && context->eip == (DWORD)out)
+			if (dbt_gen_syscall(&out, code, current_ip, context))
+				goto end_block;
+			break;
+		}
+
+		case INST_SYSENTER:
+		{
+			/* Linux passes the 6th argument in [ebp] and returns to the instruction after sysenter in the vdso,
+			 * which pops the saved ebp, edx and ecx. We return to the next instruction in the same way. */
+			/* mov fs:[scratch], ebp */
+			gen_fs_prefix(&out);
+			gen_mov_rm_r_32(&out, modrm_rm_disp(dbt->tls_scratch_offset), EBP);
+			/* mov ebp, [ebp] */
+			gen_mov_r_rm_32(&out, EBP, modrm_rm_mreg(EBP, 0));
+			if (context && context->eip <= (DWORD)out)
 			{
-				context->esp += 4;
+				context->ebp = __readfsdword(dbt->tls_scratch_offset);
 				context->eip = current_ip;
 				goto end_block;
 			}
-			gen_jmp(&out, &syscall_handler);
-			goto end_block;
+			if (dbt_gen_syscall(&out, code, current_ip, context))
+			{
+				if (context->eip == current_ip)
+					context->ebp = __readfsdword(dbt->tls_scratch_offset);
+				goto end_block;
+			}
+			break;
 		}
 
 		case INST_MOV_FROM_SEG:
@@ -1794,37 +1941,26 @@ done_prefix:
 
 			/* mov temp_reg, |rm| */
 			gen_mov_r_rm_32(&out, temp_reg, ins.rm);
-
-			/* This is very ugly and inefficient, but anyway this instruction should not be used very often */
-			gen_pushfd(&out);
+			/* movzx temp_reg, temp_reg16 */
+			gen_movzx_r32_rm16(&out, temp_reg, modrm_rm_reg(temp_reg));
 
 			/* mov fs:[gs], temp_reg */
 			gen_fs_prefix(&out);
 			gen_mov_rm_r_32(&out, modrm_rm_disp(dbt->tls_gs_offset), temp_reg);
 
-			/* call tls_slot_to_offset() to get the offset */
-			gen_shr_rm_32(&out, modrm_rm_reg(temp_reg), 3);
-			gen_push_rm(&out, modrm_rm_reg(0));
-			gen_push_rm(&out, modrm_rm_reg(1));
-			gen_push_rm(&out, modrm_rm_reg(2));
-			gen_push_rm(&out, modrm_rm_reg(temp_reg));
-			gen_call(&out, &tls_user_entry_to_offset);
-			
-			/* mov temp_reg, fs:eax */
+			/* Look up the fs offset of the TLS slot, none of these touch the flags
+			 * Invalid selectors give TLS_INVALID_SELECTOR_OFFSET, the load below faults on them,
+			 * see dbt_is_invalid_gs_load() */
+			/* movzx temp_reg, [selector_offsets + temp_reg * 2] */
+			gen_movzx_r32_rm16(&out, temp_reg, modrm_rm_mscale(-1, temp_reg, 1, (int32_t)dbt->tls_selector_offsets));
+
+			/* mov temp_reg, fs:[temp_reg] */
 			gen_fs_prefix(&out);
-			gen_mov_r_rm_32(&out, temp_reg, modrm_rm_mreg(0, 0));
+			gen_mov_r_rm_32(&out, temp_reg, modrm_rm_mreg(temp_reg, 0));
 			/* mov fs:[gs_addr], temp_reg */
 			gen_fs_prefix(&out);
 			gen_mov_rm_r_32(&out, modrm_rm_disp(dbt->tls_gs_addr_offset), temp_reg);
 
-			/* Clean up */
-			gen_lea(&out, 4, modrm_rm_mreg(4, 4));
-			gen_pop_rm(&out, modrm_rm_reg(2));
-			gen_pop_rm(&out, modrm_rm_reg(1));
-			gen_pop_rm(&out, modrm_rm_reg(0));
-
-			gen_popfd(&out);
-
 			/* mov temp_reg, fs:[scratch] */
 			gen_fs_prefix(&out);
 			gen_mov_r_rm_32(&out, temp_reg, modrm_rm_disp(dbt->tls_scratch_offset));
@@ -1834,7 +1970,7 @@ done_prefix:
 		case INST_CPUID:
 		{
 			/* TODO: Fix context */
-			gen_call(&out, &dbt_cpuid_internal);
+			gen_call(&out, &dbt_cpuid_fast);
 			break;
 		}
 		}
@@ -1904,6 +2040,19 @@ void dbt_find_direct(size_t pc, size_t patch_addr)
 	dbt_set_return_addr(pc, block_start);
 }
 
+/* __kernel_vsyscall(), 32-bit glibc calls it through gs:0x10 for every system call.
+ * The int 0x80 is translated to an inline system call entry like everywhere else. */
+static const uint8_t dbt_vsyscall[] =
+{
+	0xCD, 0x80, /* int 0x80 */
+	0xC3, /* ret */
+};
+
+size_t dbt_get_vsyscall()
+{
+	return (size_t)dbt_vsyscall;
+}
+
 void __declspec(noreturn) dbt_run(size_t pc, size_t sp)
 {
 	size_t entrypoint = (size_t)dbt_find(pc);
@@ -1918,6 +2067,28 @@ void __declspec(noreturn) dbt_restore_fork_context(struct syscall_context *ctx)
 	((void(*)(struct syscall_context *ctx))dbt->restore_fork_trampoline)(ctx);
 }
 
+int dbt_is_invalid_gs_load(CONTEXT *context)
+{
+	uint8_t *code = (uint8_t *)context->Eip;
+	if (code < dbt->internal_trampoline_end || code >= dbt->out)
+		return 0;
+	/* mov temp_reg, fs:[temp_reg] */
+	if (code[0] != 0x64 || code[1] != 0x8B || (code[2] >> 6) != 0)
+		return 0;
+	DWORD value;
+	switch (code[2] & 7)
+	{
+	case EAX: value = context->Eax; break;
+	case ECX: value = context->Ecx; break;
+	case EDX: value = context->Edx; break;
+	case EBX: value = context->Ebx; break;
+	case ESI: value = context->Esi; break;
+	case EDI: value = context->Edi; break;
+	default: return 0;
+	}
+	return value == TLS_INVALID_SELECTOR_OFFSET;
+}
+
 void dbt_deliver_signal(HANDLE thread, CONTEXT *context)
 {
 	THREAD_BASIC_INFORMATION info;
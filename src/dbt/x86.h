@@ -49,8 +49,13 @@ void dbt_reset();
 void dbt_shutdown();
 
 void __declspec(noreturn) dbt_run(size_t pc, size_t sp);
+/* Address of __kernel_vsyscall() for AT_SYSINFO */
+size_t dbt_get_vsyscall();
 void __declspec(noreturn) dbt_restore_fork_context(struct syscall_context *context);
 
+/* Whether the exception is the fs load of a translated mov to gs with an invalid selector */
+int dbt_is_invalid_gs_load(CONTEXT *context);
+
 /* Deliver the signal to the main thread's context
  * This function can only called from the signal thread */
 void dbt_deliver_signal(HANDLE thread, CONTEXT *context);
@@ -52,6 +52,7 @@
 #define INST_MOV_FROM_SEG		(INST_TYPE_SPECIAL + 25)
 #define INST_MOV_TO_SEG			(INST_TYPE_SPECIAL + 26)
 #define INST_CPUID				(INST_TYPE_SPECIAL + 27)
+#define INST_SYSENTER			(INST_TYPE_SPECIAL + 28)
 
 #define REG_AX			0x00000001 /* AL, AH, AX, EAX, RAX register */
 #define REG_CX			0x00000002 /* CL, CH, CX, ECX, RCX register */
@@ -330,7 +331,7 @@ static const struct instruction_desc one_byte_inst[256] =
 #else
 	/* 0x60: PUSHA_PUSHAD */ INST(READ(REG_AX | REG_CX | REG_DX | REG_BX | REG_SP | REG_BP | REG_SI | REG_DI), WRITE(REG_SP))
 	/* 0x61: POPA/POPAD */ INST(READ(REG_SP), WRITE(REG_AX | REG_CX | REG_DX | REG_BX | REG_SP | REG_BP | REG_SI | REG_DI))
-	/* 0x62: BOUND r?, m?&? */ INST(MODRM(), READ(MODRM_R | MODRM_RM_M))
+	/* 0x62: BOUND r?, m?&?; EVEX prefix when ModR/M.mod == 3 */ INST(MODRM(), READ(MODRM_R | MODRM_RM_M))
 	/* 0x63: ARPL r/m16, r16 */ INST(MODRM(), READ(MODRM_R | MODRM_RM), WRITE(MODRM_R | MODRM_RM))
 #endif
 	/* 0x64: FS segment prefix */ INVALID()
@@ -446,8 +447,8 @@ static const struct instruction_desc one_byte_inst[256] =
 	/* 0xC4: INVALID */ INVALID()
 	/* 0xC5: INVALID */ INVALID()
 #else
-	/* 0xC4: LES r?, m16:? */ UNSUPPORTED()
-	/* 0xC5: LDS r?, m16:? */ UNSUPPORTED()
+	/* 0xC4: LES r?, m16:?; 3-byte VEX prefix when ModR/M.mod == 3 */ UNSUPPORTED()
+	/* 0xC5: LDS r?, m16:?; 2-byte VEX prefix when ModR/M.mod == 3 */ UNSUPPORTED()
 #endif
 	/* 0xC6: */ EXTENSION(C6)
 	/* 0xC7: */ EXTENSION(C7)
@@ -835,21 +836,48 @@ static const struct instruction_desc mandatory_0x0F7F[4] =
 	/* F2: ??? */ UNKNOWN()
 };
 
+static const struct instruction_desc extension_0x01[8] =
+{
+	/* 0: SGDT m */ UNSUPPORTED()
+	/* 1: SIDT m */ UNSUPPORTED()
+	/* 2: mem: LGDT m16&32
+	      r: XGETBV (0F 01 D0); XSETBV (0F 01 D1) */ INST(MODRM(), READ(REG_AX | REG_CX | REG_DX), WRITE(REG_AX | REG_DX))
+	/* 3: LIDT m16&32 */ UNSUPPORTED()
+	/* 4: SMSW r/m16; SMSW r32/m16 */ UNSUPPORTED()
+	/* 5: ??? */ UNKNOWN()
+	/* 6: LMSW r/m16 */ UNSUPPORTED()
+	/* 7: INVLPG m; RDTSCP (0F 01 F9) */ UNSUPPORTED()
+};
+
 static const struct instruction_desc extension_0xAE[8] =
 {
 	/* 0: FXSAVE */ INST(MODRM(), WRITE(MODRM_RM_M))
 	/* 1: FXRSTOR */ INST(MODRM(), READ(MODRM_RM_M))
 	/* 2: LDMXCSR m32 */ INST(MODRM(), READ(MODRM_RM_M))
 	/* 3: STMXCSR m32 */ INST(MODRM(), WRITE(MODRM_RM_M))
-	/* 4: mem: XSAVE mem */ INST(MODRM(), WRITE(MODRM_RM_M))
+	/* 4: mem: XSAVE mem */ INST(MODRM(), READ(REG_AX | REG_DX), WRITE(MODRM_RM_M))
 	/* 5: r: LFENCE (0F AE E8)
-	      mem: XRSTOR mem*/ INST(MODRM(), READ(MODRM_RM_M))
+	      mem: XRSTOR mem*/ INST(MODRM(), READ(REG_AX | REG_DX | MODRM_RM_M))
 	/* 6: r: MFENCE (0F AE F0)
-	      mem: XSAVEOPT mem */ INST(MODRM(), WRITE(MODRM_RM_M))
+	      mem: XSAVEOPT mem */ INST(MODRM(), READ(REG_AX | REG_DX), WRITE(MODRM_RM_M))
 	/* 7: r: SFENCE (0F AE F8)
 	      mem: CLFLUSH m8 */ INST(MODRM(), READ(MODRM_RM_M))
 };
 
+static const struct instruction_desc extension_0xC7[8] =
+{
+	/* 0: ??? */ UNKNOWN()
+	/* 1: CMPXCHG8B m64 */ INST(MODRM(), READ(REG_AX | REG_CX | REG_DX | REG_BX | MODRM_RM_M), WRITE(REG_AX | REG_DX | MODRM_RM_M))
+	/* 2: ??? */ UNKNOWN()
+	/* 3: XRSTORS mem */ INST(MODRM(), PRIVILEGED())
+	/* 4: XSAVEC mem */ INST(MODRM(), READ(REG_AX | REG_DX), WRITE(MODRM_RM_M))
+	/* 5: XSAVES mem */ INST(MODRM(), PRIVILEGED())
+	/* 6: r: RDRAND r?
+	      mem: VMPTRLD m64 */ UNSUPPORTED()
+	/* 7: r: RDSEED r?
+	      mem: VMPTRST m64 */ UNSUPPORTED()
+};
+
 static const struct instruction_desc mandatory_0x0FB8[4] =
 {
 	/* 00: ??? */ UNKNOWN()
@@ -934,14 +962,7 @@ static const struct instruction_desc two_byte_inst[256] =
 	3: LTR r/m16
 	4: VERR r/m16
 	5: VERW r/m16 */ UNSUPPORTED()
-	/* 0x01: [GRP7]
-	0: SGDT m
-	1: SIDT m
-	2: LGDT m16&32; LGDT m16&64
-	3: LIDT m16&32; LIDT m16&64
-	4: SMSW r/m16; SMSW r32/m16
-	6: LMSW r/m16
-	7: INVLPG */ UNSUPPORTED()
+	/* 0x01: [GRP7] */ EXTENSION(0x01)
 	/* 0x02: LAR r16, r16/m16; LAR reg, r32/m16 */ UNSUPPORTED()
 	/* 0x03: LSL r?, r?/m16 */ UNSUPPORTED()
 	/* 0x04: ??? */ UNKNOWN()
@@ -998,7 +1019,7 @@ static const struct instruction_desc two_byte_inst[256] =
 	/* 0x31: RDTSC */ INST(WRITE(REG_AX | REG_DX))
 	/* 0x32: RDMSR */ INST(PRIVILEGED(), READ(REG_CX), WRITE(REG_AX | REG_DX))
 	/* 0x33: RDPMC */ INST(READ(REG_CX), WRITE(REG_AX | REG_DX))
-	/* 0x34: SYSENTER */ UNSUPPORTED()
+	/* 0x34: SYSENTER */ SPECIAL(INST_SYSENTER, READ(REG_AX | REG_CX | REG_DX | REG_BX | REG_SP | REG_BP | REG_SI | REG_DI), WRITE(REG_AX | REG_BP))
 	/* 0x35: SYSEXIT */ UNSUPPORTED()
 	/* 0x36: ??? */ UNKNOWN()
 	/* 0x37: ??? */ UNKNOWN()
@@ -1152,9 +1173,7 @@ static const struct instruction_desc two_byte_inst[256] =
 	/* 0xC4: PINSRW ?mm1, r32/m16, imm8 */ INST(MODRM(), IMM(1), READ(MODRM_R | MODRM_RM), WRITE(MODRM_R))
 	/* 0xC5: PEXTRW reg, ?mm, imm8 */ INST(MODRM(), IMM(1), READ(MODRM_RM_R), WRITE(MODRM_R))
 	/* 0xC6: MANDATORY */ MANDATORY(0x0FC6)
-	/* 0xC7:
-	1: CMPXCHG8B m64/m128
-	5: XSAVES mem; XSAVES64 mem */ UNSUPPORTED()
+	/* 0xC7: [GRP9] */ EXTENSION(0xC7)
 	/* NOTE: The read and write information of these are not very accurate */
 	/* 0xC8: BSWAP ?AX/R8? */ INST(READ(REG_AX | REG_R8), WRITE(REG_AX | REG_R8))
 	/* 0xC9: BSWAP ?CX/R9? */ INST(READ(REG_CX | REG_R9), WRITE(REG_CX | REG_R9))
@@ -1736,3 +1755,26 @@ static const struct instruction_desc three_byte_inst_0x3A[256] =
 	/* 0xFE: ??? */ UNKNOWN()
 	/* 0xFF: ??? */ UNKNOWN()
 };
+
+/* VEX and EVEX encoded instructions
+ * The opcode map is given by the prefix instead of escape bytes. Every opcode in maps 0F, 0F38 and 0F3A has a
+ * ModR/M byte, except VZEROUPPER/VZEROALL (VEX 0F 77). Map 0F3A always has an imm8, map 0F38 never has one,
+ * and in map 0F only the opcodes marked in vex_0x0F_imm8 below have one.
+ * Register usage is not tracked per opcode, find_unused_register() conservatively treats the ModR/M and
+ * VEX.vvvv operands as general purpose registers, which covers BMI1/BMI2, VMOVD, VPEXTR and VPINSR.
+ */
+#define VEX_MAP_0F				1
+#define VEX_MAP_0F38			2
+#define VEX_MAP_0F3A			3
+
+static const struct instruction_desc vex_inst = { .type = INST_TYPE_NORMAL, MODRM() };
+static const struct instruction_desc vex_inst_imm8 = { .type = INST_TYPE_NORMAL, MODRM(), IMM(1) };
+static const struct instruction_desc vex_inst_no_modrm = { .type = INST_TYPE_NORMAL };
+static const struct instruction_desc vex_inst_unknown = { .type = INST_TYPE_UNKNOWN };
+
+/* Map 0F opcodes with an imm8: 0x70-0x73 (PSHUF*, shift by immediate), 0xC2 (CMP*), 0xC4 (PINSRW),
+ * 0xC5 (PEXTRW), 0xC6 (SHUFP*) */
+static const uint32_t vex_0x0F_imm8[8] =
+{
+	0x00000000, 0x00000000, 0x00000000, 0x000F0000, 0x00000000, 0x00000000, 0x00000074, 0x00000000,
+};
@@ -104,6 +104,38 @@ dbt_cpuid_internal PROC
 	ret
 dbt_cpuid_internal ENDP
 
+; Look up the leaf in dbt_cpuid_cache, call dbt_cpuid_internal on a miss
+; Entry layout: leaf, subleaf mask, subleaf, reserved, eax, ebx, ecx, edx
+EXTERN dbt_cpuid_cache: DWORD
+dbt_cpuid_fast PROC
+	pushfd
+	; slot = (leaf & 1Fh) | ((leaf >> 26) & 20h)
+	mov edx, eax
+	shr edx, 26
+	and edx, 20h
+	mov ebx, eax
+	and ebx, 1Fh
+	or edx, ebx
+	shl edx, 5
+	lea edx, [dbt_cpuid_cache + edx]
+	cmp eax, [edx]
+	jne cpuid_miss
+	mov ebx, ecx
+	and ebx, [edx + 4]
+	cmp ebx, [edx + 8]
+	jne cpuid_miss
+	popfd
+	mov eax, [edx + 16]
+	mov ebx, [edx + 20]
+	mov ecx, [edx + 24]
+	mov edx, [edx + 28]
+	ret
+
+cpuid_miss:
+	popfd
+	jmp dbt_cpuid_internal
+dbt_cpuid_fast ENDP
+
 EXTERN sys_unimplemented_imp:NEAR
 sys_unimplemented PROC
 	push eax
@@ -143,17 +175,15 @@ sys_clone PROC
 sys_clone ENDP
 
 EXTERN syscall_table: DWORD
+; System call entry, returns to the translated code with the original pc still on the stack
+; stack: return address, original pc
 syscall_handler PROC
 	; save context
 	push ecx
 	push edx
-	; test validity
-	cmp eax, 359
-	jae out_of_range
-
 	; push esp and eip context in case of fork()
-	push [esp + 8]
-	lea edx, [esp + 16]
+	push [esp + 12]
+	lea edx, [esp + 20]
 	push edx
 	mov edx, [esp + 8]
 	; push arguments
@@ -163,6 +193,9 @@ syscall_handler PROC
 	push edx
 	push ecx
 	push ebx
+	; test validity
+	cmp eax, 428
+	jae out_of_range
 	; call syscall
 	call [syscall_table + eax * 4]
 syscall_done::
@@ -170,13 +203,10 @@ syscall_done::
 	; restore context
 	pop edx
 	pop ecx
-	jmp dbt_find_indirect_internal
+	ret
 
 out_of_range:
 	call sys_unimplemented
-	pop edx
-	pop ecx
-	jmp dbt_find_indirect_internal
 syscall_handler ENDP
 
 ; TODO: Thread safety
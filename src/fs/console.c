@@ -24,6 +24,8 @@
 #include <common/termios.h>
 #include <fs/console.h>
 #include <fs/virtual.h>
+#include <lib/vtparse.h>
+#include <lib/vtscan.h>
 #include <syscall/mm.h>
 #include <syscall/process.h>
 #include <syscall/sig.h>
@@ -45,12 +47,23 @@
  * The basic assumption is that no other Win32 console applications are writing
  * to the same console simultaneously. The only thing we need to take care of is
  * when user changes the size of the window during application operation.
+ *
+ * Output is not drawn with individual console API calls. Instead each process keeps
+ * a private copy of the console window (the virtual screen), which is loaded on the
+ * first drawing operation. Escape sequences are applied to the copy in memory, and the
+ * dirty rectangle is written back with one WriteConsoleOutputW() before releasing the
+ * console lock. Lines scrolled out of the window are kept in the copy until the flush so
+ * they still end up in the scrollback.
+ *
+ * The copy is kept across operations. Every process which changes the screen buffer
+ * increments a shared generation number, and the copy is only reloaded if the number
+ * or the size of the buffer changed since the copy was last in sync. If the memory of the
+ * copy can not be allocated, drawing operations fall back to direct console API calls.
  */
 
-#define CONSOLE_MAX_PARAMS	16
+#define SCREEN_MAX_SCROLL	256 /* Maximum lines scrolled out of the window between two flushes */
 #define MAX_INPUT			256
 #define MAX_CANON			256
-#define MAX_STRING			256
 #define DEFAULT_ATTRIBUTE	0
 
 typedef uint32_t (*charset_func)(uint32_t ch);
@@ -94,20 +107,35 @@ struct console_data
 	int utf8_buf_size;
 	struct console_cursor saved_cursor;
 	int saved_top;
+	/* Incremented whenever the screen buffer is changed, see console_screen */
+	uint32_t screen_generation;
 
 	/* escape sequence processor */
-	int params[CONSOLE_MAX_PARAMS];
-	int param_count;
-	int string_len;
-	char string_buffer[MAX_STRING];
+	struct vt_parser parser;
 	char input_buffer[MAX_INPUT];
 	size_t input_buffer_head, input_buffer_tail;
-	char csi_prefix; /* prefix after CSI, e.g. '?', '>' */
-	void (*processor)(char ch);
 };
 
 static struct console_data *console;
 
+/* Virtual screen, private to the current process, only accessed while holding the console lock */
+struct console_screen
+{
+	CHAR_INFO *cells;
+	size_t capacity; /* Number of allocated cells */
+	int valid; /* Whether the copy is loaded */
+	uint32_t generation; /* Value of console->screen_generation when the copy was last in sync */
+	int width, height; /* Size of the window when the copy is loaded */
+	int buffer_height; /* Height of the screen buffer when the copy is loaded */
+	int base; /* Buffer row of the first row in the copy */
+	int rows; /* Number of rows in the copy: window height + lines scrolled out since the last flush */
+	int dirty_left, dirty_right, dirty_top, dirty_bottom; /* Dirty rectangle in copy rows */
+	int attr_dirty; /* Whether console->attr needs to be set as the text attribute */
+	int window_left, window_right, window_top; /* Position of the real console window, window_top is -1 if unknown */
+};
+
+static struct console_screen screen;
+
 static uint32_t default_charset(uint32_t ch)
 {
 	return ch;
@@ -149,6 +177,7 @@ static BOOL WINAPI console_ctrlc_handler(DWORD dwCtrlType)
 	return TRUE;
 }
 
+static WORD get_text_attribute();
 static void save_cursor();
 void console_init()
 {
@@ -231,6 +260,7 @@ void console_init()
 	console->cursor_key_mode = 0;
 	console->origin_mode = 0;
 	console->wraparound_mode = 1;
+	console->attr = get_text_attribute();
 
 	/* Only essential values are initialized here, others are automatically set to the correct value in console_retrieve_state() */
 	console->at_right_margin = 0;
@@ -241,7 +271,7 @@ void console_init()
 	save_cursor();
 
 	console->input_buffer_head = console->input_buffer_tail = 0;
-	console->processor = NULL;
+	vt_parser_init(&console->parser);
 
 	SetConsoleMode(in, ENABLE_PROCESSED_INPUT | ENABLE_WINDOW_INPUT);
 	SetConsoleMode(out, ENABLE_PROCESSED_OUTPUT);
@@ -273,6 +303,10 @@ int console_fork(HANDLE process)
 void console_afterfork()
 {
 	SetConsoleCtrlHandler(console_ctrlc_handler, TRUE);
+	/* The memory of the virtual screen is not inherited */
+	screen.cells = NULL;
+	screen.capacity = 0;
+	screen.valid = 0;
 }
 
 static void console_lock()
@@ -365,10 +399,249 @@ static WORD get_text_attribute()
 	return attr;
 }
 
+/* Transfer rows of the virtual screen from/to the console, starting at copy row `first' and buffer row `row' */
+static void screen_transfer(int first, int count, int row, int left, int right, BOOL write)
+{
+	/* Older conhost versions fail for transfers larger than 64KB */
+	int band = max(1, 8192 / screen.width);
+	COORD size;
+	size.X = screen.width;
+	size.Y = screen.rows;
+	while (count > 0)
+	{
+		int n = min(count, band);
+		COORD coord;
+		coord.X = left;
+		coord.Y = first;
+		SMALL_RECT rect;
+		rect.Left = left;
+		rect.Right = right;
+		rect.Top = row;
+		rect.Bottom = row + n - 1;
+		if (write)
+			WriteConsoleOutputW(console->out, screen.cells, size, coord, &rect);
+		else
+			ReadConsoleOutputW(console->out, screen.cells, size, coord, &rect);
+		first += n;
+		row += n;
+		count -= n;
+	}
+}
+
+static void screen_clear_dirty()
+{
+	screen.dirty_left = screen.width;
+	screen.dirty_right = -1;
+	screen.dirty_top = screen.rows;
+	screen.dirty_bottom = -1;
+}
+
+/* Load the virtual screen, returns 0 if the memory can not be allocated */
+static int screen_load()
+{
+	size_t capacity = (size_t)console->width * (console->height + SCREEN_MAX_SCROLL);
+	if (screen.capacity < capacity)
+	{
+		if (screen.cells)
+			VirtualFree(screen.cells, 0, MEM_RELEASE);
+		screen.cells = (CHAR_INFO *)VirtualAlloc(NULL, capacity * sizeof(CHAR_INFO), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!screen.cells)
+		{
+			log_error("console: VirtualAlloc() failed, error code: %d, drawing directly.\n", GetLastError());
+			screen.capacity = 0;
+			return 0;
+		}
+		screen.capacity = capacity;
+	}
+	screen.width = console->width;
+	screen.height = console->height;
+	screen.buffer_height = console->buffer_height;
+	screen.base = console->top;
+	screen.rows = console->height;
+	screen_transfer(0, screen.rows, screen.base, 0, screen.width - 1, FALSE);
+	screen_clear_dirty();
+	screen.valid = 1;
+	screen.generation = console->screen_generation;
+	return 1;
+}
+
+/* Make sure the virtual screen is loaded, returns 0 if drawing must be done with console API calls directly */
+static int screen_ensure()
+{
+	return screen.valid || screen_load();
+}
+
+/* Write back the dirty part of the virtual screen to the console */
+static void screen_flush()
+{
+	if (screen.attr_dirty)
+	{
+		SetConsoleTextAttribute(console->out, console->attr);
+		screen.attr_dirty = 0;
+	}
+	if (!screen.valid)
+		return;
+	int scrolled = screen.rows - screen.height;
+	/* Buffer row of the first row in the copy after the flush */
+	int first_row = console->top - scrolled;
+	if (first_row < screen.base || screen.dirty_top <= screen.dirty_bottom)
+	{
+		/* We are changing the screen buffer, copies of other processes are outdated now */
+		screen.generation = ++console->screen_generation;
+	}
+	if (first_row < screen.base)
+	{
+		/* The screen buffer is full, scroll its content up like conhost does on a line feed */
+		int lines = screen.base - first_row;
+		if (lines < console->buffer_height)
+		{
+			CHAR_INFO fill_char;
+			fill_char.Attributes = console->attr;
+			fill_char.Char.UnicodeChar = L' ';
+			SMALL_RECT rect;
+			rect.Left = 0;
+			rect.Right = screen.width - 1;
+			rect.Top = lines;
+			rect.Bottom = console->buffer_height - 1;
+			COORD origin;
+			origin.X = 0;
+			origin.Y = 0;
+			ScrollConsoleScreenBufferW(console->out, &rect, NULL, origin, &fill_char);
+		}
+	}
+	if (screen.dirty_top <= screen.dirty_bottom)
+	{
+		/* Rows pushed out of the top of the screen buffer are lost */
+		int top = max(screen.dirty_top, -first_row);
+		if (top <= screen.dirty_bottom)
+			screen_transfer(top, screen.dirty_bottom - top + 1, first_row + top, screen.dirty_left, screen.dirty_right, TRUE);
+	}
+	if (scrolled > 0)
+	{
+		memmove(screen.cells, screen.cells + scrolled * screen.width, screen.height * screen.width * sizeof(CHAR_INFO));
+		screen.rows = screen.height;
+	}
+	screen.base = console->top;
+	screen_clear_dirty();
+}
+
+/* Flush the virtual screen and move the console window and caret to the emulated position */
+static void console_flush()
+{
+	screen_flush();
+	if (console->top != screen.window_top)
+	{
+		SMALL_RECT rect;
+		rect.Left = screen.window_left;
+		rect.Right = screen.window_right;
+		rect.Top = console->top;
+		rect.Bottom = console->top + console->height - 1;
+		SetConsoleWindowInfo(console->out, TRUE, &rect);
+		screen.window_top = console->top;
+	}
+	COORD pos;
+	pos.X = console->x;
+	pos.Y = console->y + console->top;
+	SetConsoleCursorPosition(console->out, pos);
+}
+
+/* Get a row of the virtual screen in window coordinate, the screen must be loaded by screen_ensure() */
+static CHAR_INFO *screen_row(int y)
+{
+	return screen.cells + (screen.rows - screen.height + y) * screen.width;
+}
+
+/* Mark a rectangle in window coordinate as dirty */
+static void screen_invalidate(int left, int right, int top, int bottom)
+{
+	int offset = screen.rows - screen.height;
+	screen.dirty_left = min(screen.dirty_left, left);
+	screen.dirty_right = max(screen.dirty_right, right);
+	screen.dirty_top = min(screen.dirty_top, top + offset);
+	screen.dirty_bottom = max(screen.dirty_bottom, bottom + offset);
+}
+
+/* Fill `count' cells starting at the given window position, wrapping at line end */
+static void screen_fill(int x, int y, int count, WCHAR ch, WORD attr)
+{
+	count = min(count, (console->height - y) * console->width - x);
+	if (count <= 0)
+		return;
+	if (!screen_ensure())
+	{
+		COORD pos;
+		pos.X = x;
+		pos.Y = y + console->top;
+		DWORD written;
+		FillConsoleOutputCharacterW(console->out, ch, count, pos, &written);
+		FillConsoleOutputAttribute(console->out, attr, count, pos, &written);
+		console->screen_generation++;
+		return;
+	}
+	CHAR_INFO *cell = screen_row(y) + x;
+	for (int i = 0; i < count; i++)
+	{
+		cell[i].Char.UnicodeChar = ch;
+		cell[i].Attributes = attr;
+	}
+	int bottom = y + (x + count - 1) / console->width;
+	if (bottom == y)
+		screen_invalidate(x, x + count - 1, y, y);
+	else
+		screen_invalidate(0, console->width - 1, y, bottom);
+}
+
+/* The whole window moves down one line in the screen buffer
+ * buffer_full tells whether console->top is already at the bottom of the screen buffer thus can
+ * not move, in which case the content of the buffer is scrolled up instead.
+ */
+static void screen_scroll_window(int buffer_full)
+{
+	if (!screen_ensure())
+	{
+		if (buffer_full)
+		{
+			CHAR_INFO fill_char;
+			fill_char.Attributes = console->attr;
+			fill_char.Char.UnicodeChar = L' ';
+			SMALL_RECT rect;
+			rect.Left = 0;
+			rect.Right = console->width - 1;
+			rect.Top = 1;
+			rect.Bottom = console->buffer_height - 1;
+			COORD origin;
+			origin.X = 0;
+			origin.Y = 0;
+			ScrollConsoleScreenBufferW(console->out, &rect, NULL, origin, &fill_char);
+		}
+	}
+	else
+	{
+		/* A full buffer is detected and scrolled in screen_flush() */
+		if (screen.rows == screen.height + SCREEN_MAX_SCROLL)
+			screen_flush();
+		screen.rows++;
+	}
+	screen_fill(0, console->height - 1, console->width, L' ', console->attr);
+}
+
+/* Invalidate the virtual screen after operations which touch the console directly */
+static void screen_discard()
+{
+	screen_flush();
+	screen.valid = 0;
+	console->screen_generation++;
+}
+
 static void console_retrieve_state()
 {
+	/* Normally nothing is dirty here, every operation flushes before releasing the lock */
+	screen_flush();
 	CONSOLE_SCREEN_BUFFER_INFO info;
 	GetConsoleScreenBufferInfo(console->out, &info);
+	screen.window_left = info.srWindow.Left;
+	screen.window_right = info.srWindow.Right;
+	screen.window_top = info.srWindow.Top;
 	int new_width = info.dwSize.X;
 	int new_height = info.srWindow.Bottom - info.srWindow.Top + 1;
 	if (console->width != new_width || console->height != new_height)
@@ -397,7 +670,14 @@ static void console_retrieve_state()
 		console->x = info.dwCursorPosition.X;
 		console->y = info.dwCursorPosition.Y - console->top;
 		console->at_right_margin = 0;
+		/* It may have written something as well */
+		console->screen_generation++;
 	}
+	/* Keep the virtual screen unless someone else changed the screen buffer or its size */
+	if (screen.valid && (screen.generation != console->screen_generation
+		|| screen.width != console->width || screen.height != console->height
+		|| screen.buffer_height != console->buffer_height || screen.base != console->top))
+		screen.valid = 0;
 	if (console->height <= console->scroll_bottom)
 	{
 		/* The current window height is smaller than the scrolling region,
@@ -418,24 +698,29 @@ static void backspace(BOOL erase)
 	{
 		console->at_right_margin = 0;
 		console->x--;
-		COORD pos;
-		pos.X = console->x;
-		pos.Y = console->y + console->top;
 		if (erase && console->x)
 		{
-			DWORD bytes_written;
-			WriteConsoleOutputCharacterA(console->out, " ", 1, pos, &bytes_written);
+			if (screen_ensure())
+			{
+				screen_row(console->y)[console->x].Char.UnicodeChar = L' ';
+				screen_invalidate(console->x, console->x, console->y, console->y);
+			}
+			else
+			{
+				COORD pos;
+				pos.X = console->x;
+				pos.Y = console->y + console->top;
+				DWORD written;
+				FillConsoleOutputCharacterW(console->out, L' ', 1, pos, &written);
+				console->screen_generation++;
+			}
 		}
-		SetConsoleCursorPosition(console->out, pos);
 	}
 }
 
 static void set_pos(int x, int y)
 {
-	COORD pos;
-	pos.X = x;
-	pos.Y = y + console->top;
-	SetConsoleCursorPosition(console->out, pos);
+	/* The caret is moved in console_flush() */
 	console->x = x;
 	console->y = y;
 	console->at_right_margin = 0;
@@ -443,6 +728,7 @@ static void set_pos(int x, int y)
 
 static void console_set_size(int width, int height)
 {
+	screen_discard();
 	console->top = min(console->top, console->buffer_height - height);
 	COORD size;
 	size.X = width;
@@ -465,6 +751,9 @@ static void console_set_size(int width, int height)
 		SetConsoleWindowInfo(console->out, TRUE, &rect);
 		SetConsoleScreenBufferSize(console->out, size);
 	}
+	screen.window_left = 0;
+	screen.window_right = width - 1;
+	screen.window_top = console->top;
 	set_pos(console->x, console->y);
 	console->width = width;
 	console->height = height;
@@ -485,6 +774,12 @@ static void save_cursor()
 	console->saved_top = console->top;
 }
 
+static void update_text_attribute()
+{
+	console->attr = get_text_attribute();
+	screen.attr_dirty = 1;
+}
+
 static void restore_cursor()
 {
 	console->x = console->saved_cursor.x;
@@ -498,20 +793,28 @@ static void restore_cursor()
 	console->origin_mode = console->saved_cursor.origin_mode;
 	console->wraparound_mode = console->saved_cursor.wraparound_mode;
 
-	console->top = console->saved_top;
+	if (console->top != console->saved_top)
+	{
+		/* The window is moved, the virtual screen no longer matches */
+		screen_discard();
+		console->top = console->saved_top;
+	}
 	set_pos(console->x, console->y);
-
-	SetConsoleTextAttribute(console->out, get_text_attribute());
+	update_text_attribute();
 }
 
 static void switch_to_normal_buffer()
 {
+	screen_discard();
+	screen.window_top = -1;
 	console->out = console->normal_buffer;
 	SetConsoleActiveScreenBuffer(console->out);
 }
 
 static void switch_to_alternate_buffer()
 {
+	screen_discard();
+	screen.window_top = -1;
 	console->out = console->alternate_buffer;
 	SetConsoleActiveScreenBuffer(console->out);
 }
@@ -536,30 +839,57 @@ static void move_down(int count)
 	set_pos(console->x, min(console->y + count, console->height - 1));
 }
 
-static void erase_screen_lines(int top, int bottom)
-{
-	int len = (bottom - top + 1) * console->width;
-	COORD pos;
-	pos.X = 0;
-	pos.Y = console->top + top;
-	DWORD written;
-	FillConsoleOutputAttribute(console->out, DEFAULT_ATTRIBUTE, len, pos, &written);
-}
-
+/* Move the content of a rectangle by the given offset, clipped to the rectangle, same as ScrollConsoleScreenBufferW() */
 static void scroll(int left, int right, int top, int bottom, int xoffset, int yoffset)
 {
-	CHAR_INFO fill_char;
-	fill_char.Attributes = DEFAULT_ATTRIBUTE;
-	fill_char.Char.UnicodeChar = L' ';
-	SMALL_RECT rect;
-	rect.Left = left;
-	rect.Right = right;
-	rect.Top = console->top + top;
-	rect.Bottom = console->top + bottom;
-	COORD origin;
-	origin.X = left + xoffset;
-	origin.Y = console->top + top + yoffset;
-	ScrollConsoleScreenBufferW(console->out, &rect, &rect, origin, &fill_char);
+	left = max(left, 0);
+	right = min(right, console->width - 1);
+	top = max(top, 0);
+	bottom = min(bottom, console->height - 1);
+	if (left > right || top > bottom)
+		return;
+	if (!screen_ensure())
+	{
+		SMALL_RECT rect;
+		rect.Left = left;
+		rect.Right = right;
+		rect.Top = top + console->top;
+		rect.Bottom = bottom + console->top;
+		COORD origin;
+		origin.X = left + xoffset;
+		origin.Y = top + yoffset + console->top;
+		CHAR_INFO fill_char;
+		fill_char.Attributes = DEFAULT_ATTRIBUTE;
+		fill_char.Char.UnicodeChar = L' ';
+		ScrollConsoleScreenBufferW(console->out, &rect, &rect, origin, &fill_char);
+		console->screen_generation++;
+		return;
+	}
+	/* Columns in the rectangle which receive content */
+	int copy_left = max(left, left + xoffset);
+	int copy_right = min(right, right + xoffset);
+	/* Process rows in the direction such that source rows are not yet overwritten */
+	int step = yoffset > 0 ? -1 : 1;
+	for (int y = yoffset > 0 ? bottom : top; y >= top && y <= bottom; y += step)
+	{
+		CHAR_INFO *row = screen_row(y);
+		int src_y = y - yoffset;
+		int fill_left = left, fill_right = right;
+		if (src_y >= top && src_y <= bottom && copy_left <= copy_right)
+		{
+			memmove(row + copy_left, screen_row(src_y) + copy_left - xoffset, (copy_right - copy_left + 1) * sizeof(CHAR_INFO));
+			if (xoffset > 0)
+				fill_right = copy_left - 1;
+			else
+				fill_left = copy_right + 1;
+		}
+		for (int x = fill_left; x <= fill_right; x++)
+		{
+			row[x].Char.UnicodeChar = L' ';
+			row[x].Attributes = DEFAULT_ATTRIBUTE;
+		}
+	}
+	screen_invalidate(left, right, top, bottom);
 }
 
 static BOOL is_inside_scroll_area()
@@ -579,8 +909,6 @@ static void scroll_down(int count)
 
 static void cr()
 {
-	DWORD bytes_written;
-	WriteConsoleA(console->out, "\r", 1, &bytes_written, NULL);
 	console->x = 0;
 	console->at_right_margin = 0;
 }
@@ -589,12 +917,13 @@ static void nl()
 {
 	if (console->scroll_full_screen || console->y < console->scroll_bottom)
 	{
-		DWORD bytes_written;
-		WriteConsoleA(console->out, "\n", 1, &bytes_written, NULL);
 		if (console->y == console->height - 1)
 		{
 			/* The entire screen is scrolled */
-			console->top = min(console->top + 1, console->buffer_height - console->height);
+			int buffer_full = console->top + console->height >= console->buffer_height;
+			if (!buffer_full)
+				console->top++;
+			screen_scroll_window(buffer_full);
 		}
 		else
 			console->y++;
@@ -627,6 +956,7 @@ static void write_normal(const char *buf, int size)
 
 	charset_func charset = console->charset == 0? console->g0_charset: console->g1_charset;
 	WCHAR data[1024];
+	char widths[1024];
 	int len = 0, displen = 0;
 	int i = 0;
 	while (i < size)
@@ -634,12 +964,26 @@ static void write_normal(const char *buf, int size)
 		if (console->at_right_margin && console->wraparound_mode)
 			crnl();
 		/* Write to line end at most */
-		int line_remain = min(size - i, console->width - console->x);
+		int line_remain = min(min(size - i, console->width - console->x), 1023);
 		len = 0;
 		displen = 0;
 		int seqlen = -1;
 		while (displen < line_remain && i < size)
 		{
+			if (console->utf8_buf_size == 0 && charset == default_charset)
+			{
+				/* Fast path for plain ASCII: no decoding, width lookup or charset translation needed */
+				int n = (int)vt_scan_ascii(buf + i, min(size - i, line_remain - displen));
+				for (int j = 0; j < n; j++)
+				{
+					widths[len] = 1;
+					data[len++] = (unsigned char)buf[i + j];
+				}
+				i += n;
+				displen += n;
+				if (n > 0)
+					continue;
+			}
 			console->utf8_buf[console->utf8_buf_size++] = buf[i++];
 			if (console->utf8_buf_size == 1)
 				seqlen = utf8_get_sequence_len(console->utf8_buf[0]);
@@ -661,6 +1005,7 @@ static void write_normal(const char *buf, int size)
 							break;
 						}
 						displen += l;
+						widths[len] = l;
 						data[len++] = charset(codepoint);
 					}
 				}
@@ -671,10 +1016,44 @@ static void write_normal(const char *buf, int size)
 		if (console->insert_mode && console->x + displen < console->width)
 			scroll(console->x, console->width - 1, console->y, console->y, displen, 0);
 		
-		DWORD chars_written;
-		WriteConsoleW(console->out, data, len, &chars_written, NULL);
+		/* Without the virtual screen, the cells are prepared here and written directly */
+		CHAR_INFO direct_cells[1024];
+		int direct = !screen_ensure();
+		CHAR_INFO *cells = direct ? direct_cells : screen_row(console->y) + console->x;
+		int x = console->x, n = 0;
+		for (int j = 0; j < len && x < console->width; j++)
+		{
+			cells[n].Char.UnicodeChar = data[j];
+			if (widths[j] == 2 && x + 1 < console->width)
+			{
+				/* Double width character occupies two cells */
+				cells[n].Attributes = console->attr | COMMON_LVB_LEADING_BYTE;
+				n++, x++;
+				cells[n].Char.UnicodeChar = data[j];
+				cells[n].Attributes = console->attr | COMMON_LVB_TRAILING_BYTE;
+			}
+			else
+				cells[n].Attributes = console->attr;
+			n++, x++;
+		}
+		if (n > 0 && direct)
+		{
+			COORD size, coord;
+			size.X = n;
+			size.Y = 1;
+			coord.X = 0;
+			coord.Y = 0;
+			SMALL_RECT rect;
+			rect.Left = console->x;
+			rect.Right = x - 1;
+			rect.Top = rect.Bottom = console->y + console->top;
+			WriteConsoleOutputW(console->out, direct_cells, size, coord, &rect);
+			console->screen_generation++;
+		}
+		else if (n > 0)
+			screen_invalidate(console->x, x - 1, console->y, console->y);
 		console->x += displen;
-		if (console->x == console->width)
+		if (console->x >= console->width)
 		{
 			console->x--;
 			console->at_right_margin = 1;
@@ -687,27 +1066,26 @@ static void write_normal(const char *buf, int size)
 #define ERASE_SCREEN_BEGIN_TO_END	2
 static void erase_screen(int mode)
 {
-	COORD start;
-	int count;
+	int x, y, count;
 	if (mode == 0)
 	{
 		/* Erase current line to bottom */
-		start.X = console->x;
-		start.Y = console->y + console->top;
-		count = (console->width - console->x + 1) + (console->height - console->y - 1) * console->width;
+		x = console->x;
+		y = console->y;
+		count = (console->width - console->x) + (console->height - console->y - 1) * console->width;
 	}
 	else if (mode == 1)
 	{
 		/* Erase top to current line */
-		start.X = 0;
-		start.Y = console->top;
+		x = 0;
+		y = 0;
 		count = console->y * console->width + console->x + 1;
 	}
 	else if (mode == 2)
 	{
 		/* Erase entire screen */
-		start.X = 0;
-		start.Y = console->top;
+		x = 0;
+		y = 0;
 		count = console->width * console->height;
 	}
 	else
@@ -715,9 +1093,7 @@ static void erase_screen(int mode)
 		log_error("erase_screen(): Invalid mode %d\n", mode);
 		return;
 	}
-	DWORD num_written;
-	FillConsoleOutputAttribute(console->out, get_text_attribute(console), count, start, &num_written);
-	FillConsoleOutputCharacterW(console->out, L' ', count, start, &num_written);
+	screen_fill(x, y, count, L' ', console->attr);
 }
 
 #define ERASE_LINE_CUR_TO_END		0
@@ -725,25 +1101,23 @@ static void erase_screen(int mode)
 #define ERASE_LINE_BEGIN_TO_END		2
 static void erase_line(int mode)
 {
-	COORD start;
-	start.Y = console->y + console->top;
-	int count;
+	int x, count;
 	if (mode == 0)
 	{
 		/* Erase to end */
-		start.X = console->x;
+		x = console->x;
 		count = console->width - console->x;
 	}
 	else if (mode == 1)
 	{
 		/* Erase to begin */
-		start.X = 0;
+		x = 0;
 		count = console->x + 1;
 	}
 	else if (mode == 2)
 	{
 		/* Erase whole line */
-		start.X = 0;
+		x = 0;
 		count = console->width;
 	}
 	else
@@ -751,9 +1125,7 @@ static void erase_line(int mode)
 		log_error("erase_line(): Invalid mode %d\n", mode);
 		return;
 	}
-	DWORD num_written;
-	FillConsoleOutputAttribute(console->out, get_text_attribute(console), count, start, &num_written);
-	FillConsoleOutputCharacterW(console->out, L' ', count, start, &num_written);
+	screen_fill(x, console->y, count, L' ', console->attr);
 }
 
 static void insert_line(int count)
@@ -889,159 +1261,123 @@ static void change_private_mode(int mode, int set)
 }
 
 /* Handler for control sequencie introducer, "ESC [" */
-static void control_escape_csi(char ch)
+static void control_escape_csi(struct vt_parser *parser, char ch)
 {
 	switch (ch)
 	{
-	case '0':
-	case '1':
-	case '2':
-	case '3':
-	case '4':
-	case '5':
-	case '6':
-	case '7':
-	case '8':
-	case '9':
-		console->params[console->param_count] = 10 * console->params[console->param_count] + (ch - '0');
-		break;
-
-	case ';':
-		if (console->param_count + 1 == CONSOLE_MAX_PARAMS)
-			log_error("Too many console parameters.\n");
-		else
-			console->param_count++;
-		break;
-
 	case 'A': /* CUU */
-		move_up(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
+		move_up(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	case 'B': /* CUD */
 	case 'e': /* VPR */
-		move_down(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
+		move_down(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	case 'C': /* CUF */
 	case 'a': /* HPR */
-		move_right(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
+		move_right(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	case 'D': /* CUB */
-		move_left(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
+		move_left(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	case 'd': /* VPA */
 	{
-		int y = console->params[0]? console->params[0]: 1;
+		int y = parser->params[0]? parser->params[0]: 1;
 		if (y > console->height)
 			y = console->height;
 		set_pos(console->x, y - 1);
-		console->processor = NULL;
 		break;
 	}
 
 	case 'G': /* CHA */
 	case '`': /* HPA */
 	{
-		int x = console->params[0] ? console->params[0] : 1;
+		int x = parser->params[0] ? parser->params[0] : 1;
 		if (x > console->width)
 			x = console->width;
 		set_pos(x - 1, console->y);
-		console->processor = NULL;
 		break;
 	}
 
 	case 'H':
 	case 'f':
 		/* Zero or one both represents the first row/column */
-		if (console->params[0] > 0)
-			console->params[0]--;
-		if (console->params[1] > 0)
-			console->params[1]--;
+		if (parser->params[0] > 0)
+			parser->params[0]--;
+		if (parser->params[1] > 0)
+			parser->params[1]--;
 		if (console->origin_mode)
-			set_pos(console->params[1], console->scroll_top + console->params[0]);
+			set_pos(parser->params[1], console->scroll_top + parser->params[0]);
 		else
-			set_pos(console->params[1], console->params[0]);
-		console->processor = NULL;
+			set_pos(parser->params[1], parser->params[0]);
 		break;
 
 	case 'h':
-		if (console->csi_prefix == '?')
-			for (int i = 0; i <= console->param_count; i++)
-				change_private_mode(console->params[i], 1);
+		if (parser->prefix == '?')
+			for (int i = 0; i <= parser->param_count; i++)
+				change_private_mode(parser->params[i], 1);
 		else
-			for (int i = 0; i <= console->param_count; i++)
-				change_mode(console->params[i], 1);
-		console->processor = NULL;
+			for (int i = 0; i <= parser->param_count; i++)
+				change_mode(parser->params[i], 1);
 		break;
 
 	case 'J':
-		erase_screen(console->params[0]);
-		console->processor = NULL;
+		erase_screen(parser->params[0]);
 		break;
 
 	case 'K':
-		erase_line(console->params[0]);
-		console->processor = NULL;
+		erase_line(parser->params[0]);
 		break;
 
 	case 'l':
-		if (console->csi_prefix == '?')
-			for (int i = 0; i <= console->param_count; i++)
-				change_private_mode(console->params[i], 0);
+		if (parser->prefix == '?')
+			for (int i = 0; i <= parser->param_count; i++)
+				change_private_mode(parser->params[i], 0);
 		else
-			for (int i = 0; i <= console->param_count; i++)
-				change_mode(console->params[i], 0);
-		console->processor = NULL;
+			for (int i = 0; i <= parser->param_count; i++)
+				change_mode(parser->params[i], 0);
 		break;
 
 	case 'L': /* IL */
-		insert_line(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
+		insert_line(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	case 'M': /* DL */
-		delete_line(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
+		delete_line(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	case '@': /* ICH */
-		insert_character(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
+		insert_character(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	case 'P': /* DCH */
-		delete_character(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
+		delete_character(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	case 'c':
-		if (console->csi_prefix == '>') /* DA2 */
+		if (parser->prefix == '>') /* DA2 */
 		{
-			if (console->params[0] == 0)
+			if (parser->params[0] == 0)
 				console_add_input("\x1B[>61;95;0c", 11);
 			else
 				log_warning("DA2 parameter is not zero.\n");
 		}
 		else /* DA1 */
 		{
-			if (console->params[0] == 0)
+			if (parser->params[0] == 0)
 				log_error("DA1 not supported.\n");
 			else
 				log_warning("DA1 parameter is not zero.\n");
 		}
-		console->processor = NULL;
 		break;
 
 	case 'm':
-		for (int i = 0; i <= console->param_count; i++)
+		for (int i = 0; i <= parser->param_count; i++)
 		{
-			switch (console->params[i])
+			switch (parser->params[i])
 			{
 			case 0: /* Reset */
 				console->bright = 0;
@@ -1074,7 +1410,7 @@ static void control_escape_csi(char ch)
 			case 35:
 			case 36:
 			case 37:
-				console->foreground = console->params[i] - 30;
+				console->foreground = parser->params[i] - 30;
 				break;
 
 			case 40:
@@ -1085,89 +1421,54 @@ static void control_escape_csi(char ch)
 			case 45:
 			case 46:
 			case 47:
-				console->background = console->params[i] - 40;
+				console->background = parser->params[i] - 40;
 				break;
 
 			default:
-				log_error("Unknown console attribute: %d\n", console->params[i]);
+				log_error("Unknown console attribute: %d\n", parser->params[i]);
 			}
 		}
 		/* Set updated text attribute */
-		SetConsoleTextAttribute(console->out, get_text_attribute(console));
-		console->processor = NULL;
+		update_text_attribute();
 		break;
 
 	case 'r':
-		if (console->params[0] == 0)
-			console->params[0] = 1;
-		if (console->params[1] == 0)
-			console->params[1] = console->height;
-		console->scroll_full_screen = (console->params[0] == 1 && console->params[1] == console->height);
-		console->scroll_top = console->params[0] - 1;
-		console->scroll_bottom = console->params[1] - 1;
+		if (parser->params[0] == 0)
+			parser->params[0] = 1;
+		if (parser->params[1] == 0)
+			parser->params[1] = console->height;
+		console->scroll_full_screen = (parser->params[0] == 1 && parser->params[1] == console->height);
+		console->scroll_top = parser->params[0] - 1;
+		console->scroll_bottom = parser->params[1] - 1;
 		set_pos(0, 0);
-		console->processor = NULL;
 		break;
 
 	case 'S': /* SU */
-		scroll_up(console->params[0]? console->params[0]: 1);
-		console->processor = NULL;
-		break;
-
-	case '?':
-		console->csi_prefix = '?';
-		break;
-
-	case '>':
-		console->csi_prefix = '?';
+		scroll_up(parser->params[0]? parser->params[0]: 1);
 		break;
 
 	default:
 		log_error("control_escape_csi(): Unhandled character %c\n", ch);
-		console->processor = NULL;
 	}
 }
 
 /* Handler for operating system commands, "ESC ]" */
-static void control_escape_osc(char ch)
+static void control_escape_osc(int command, const char *string, int len)
 {
-	if (console->string_len == -1)
-	{
-		if (ch == ';')
-		{
-			console->string_len = 0;
-			return;
-		}
-		else if (ch >= '0' && ch <= '9')
-		{
-			console->params[0] = console->params[0] * 10 + (ch - '0');
-			return;
-		}
-	}
-	else if (ch == 7) /* BEL, marks the end */
+	if (command == 0 || command == 2) /* Change window title (and icon name) */
 	{
-		if (console->params[0] == 0 || console->params[0] == 2) /* Change window title (and icon name) */
+		WCHAR title[VT_MAX_STRING + 1];
+		int r = utf8_to_utf16(string, len, title, VT_MAX_STRING + 1);
+		if (r < 0)
 		{
-			WCHAR title[MAX_STRING + 1];
-			int r = utf8_to_utf16(console->string_buffer, console->string_len, title, MAX_STRING + 1);
-			if (r < 0)
-			{
-				log_error("Invalid UTF-8 sequence.\n");
-				return;
-			}
-			title[r] = 0;
-			SetConsoleTitleW(title);
-			console->processor = NULL;
+			log_error("Invalid UTF-8 sequence.\n");
 			return;
 		}
+		title[r] = 0;
+		SetConsoleTitleW(title);
 	}
 	else
-	{
-		console->string_buffer[console->string_len++] = ch;
-		return;
-	}
-	log_error("control_escape_osc(): Unhandled character %c\n", ch);
-	console->processor = NULL;
+		log_error("control_escape_osc(): Unhandled command %d\n", command);
 }
 
 static void control_escape_sharp(char ch)
@@ -1178,18 +1479,12 @@ static void control_escape_sharp(char ch)
 	{
 		/* DECALN: DEC screen alignment test */
 		/* Fill screen with 'E' */
-		COORD start;
-		start.X = 0;
-		start.Y = 0;
-		DWORD bytes_written;
-		FillConsoleOutputAttribute(console->out, get_text_attribute(), console->width * console->height, start, &bytes_written);
-		FillConsoleOutputCharacterW(console->out, L'E', console->width * console->height, start, &bytes_written);
-		console->processor = NULL;
+		screen_fill(0, 0, console->width * console->height, L'E', console->attr);
+		break;
 	}
 
 	default:
 		log_error("control_escape_sharp(): Unhandled character %c\n", ch);
-		console->processor = NULL;
 	}
 }
 
@@ -1200,7 +1495,6 @@ static void control_escape_set_default_character_set(char ch)
 		console->g0_charset = c;
 	else
 		log_warning("console: set default character set: %c, ignored.\n", ch);
-	console->processor = NULL;
 }
 
 static void control_escape_set_alternate_character_set(char ch)
@@ -1210,35 +1504,34 @@ static void control_escape_set_alternate_character_set(char ch)
 		console->g1_charset = c;
 	else
 		log_warning("console: set alternate character set: %c, ignored.\n", ch);
-	console->processor = NULL;
 }
 
-static void control_escape(char ch)
+/* Handler for escape sequences other than CSI and OSC */
+static void control_escape(char intermediate, char ch)
 {
+	if (intermediate == '(')
+	{
+		control_escape_set_default_character_set(ch);
+		return;
+	}
+	if (intermediate == ')')
+	{
+		control_escape_set_alternate_character_set(ch);
+		return;
+	}
+	if (intermediate == '#')
+	{
+		control_escape_sharp(ch);
+		return;
+	}
 	switch (ch)
 	{
-	case '[':
-		for (int i = 0; i < CONSOLE_MAX_PARAMS; i++)
-			console->params[i] = 0;
-		console->param_count = 0;
-		console->csi_prefix = 0;
-		console->processor = control_escape_csi;
-		break;
-
-	case ']':
-		console->params[0] = 0;
-		console->string_len = -1;
-		console->processor = control_escape_osc;
-		break;
-
 	case 'D': /* IND */
 		nl();
-		console->processor = NULL;
 		break;
 
 	case 'E': /* NEL */
 		crnl();
-		console->processor = NULL;
 		break;
 
 	case 'M': /* RI */
@@ -1246,34 +1539,18 @@ static void control_escape(char ch)
 			scroll_down(1);
 		else
 			set_pos(console->x, console->y - 1);
-		console->processor = NULL;
-		break;
-
-	case '(':
-		console->processor = control_escape_set_default_character_set;
-		break;
-
-	case ')':
-		console->processor = control_escape_set_alternate_character_set;
-		break;
-
-	case '#':
-		console->processor = control_escape_sharp;
 		break;
 
 	case '7': /* DECSC */
 		save_cursor();
-		console->processor = NULL;
 		break;
 
 	case '8': /* DECRC */
 		restore_cursor();
-		console->processor = NULL;
 		break;
 
 	default:
 		log_error("control_escape(): Unhandled character %c\n", ch);
-		console->processor = NULL;
 	}
 }
 
@@ -1354,6 +1631,7 @@ static size_t console_read(struct file *f, void *b, size_t count)
 		{
 			INPUT_RECORD ir;
 			DWORD read;
+			console_flush();
 			if (signal_wait(1, &console->in, INFINITE) == WAIT_INTERRUPTED)
 			{
 				if (bytes_read == 0)
@@ -1419,6 +1697,7 @@ static size_t console_read(struct file *f, void *b, size_t count)
 		{
 			if (bytes_read > 0 && bytes_read >= vmin)
 				break;
+			console_flush();
 			if ((vmin == 0 && vtime == 0)			/* Polling read */
 				|| (vtime > 0 && bytes_read > 0))	/* Read with interbyte timeout. Apply after reading first character */
 			{
@@ -1528,11 +1807,65 @@ static size_t console_read(struct file *f, void *b, size_t count)
 	}
 read_done:
 	/* This will make the caret immediately visible */
-	set_pos(console->x, console->y);
+	console_flush();
 	console_unlock();
 	return bytes_read;
 }
 
+/* Handler for C0 control characters */
+static void control_character(char ch)
+{
+	if (ch == '\t')
+	{
+		int x = (console->x + 8) & ~7;
+		if (x < console->width)
+			set_pos(x, console->y);
+		else
+			set_pos(console->width - 1, console->y);
+	}
+	else if (ch == '\b')
+		backspace(FALSE);
+	else if (ch == '\r')
+	{
+		if (console->termios.c_oflag & OCRNL)
+			nl();
+		else
+			cr();
+	}
+	else if (ch == '\n' || ch == '\v' || ch == '\f')
+	{
+		if (console->termios.c_oflag & ONLCR)
+			crnl();
+		else
+			nl();
+	}
+	else if (ch == 0x0E)
+	{
+		/* Shift Out */
+		console->charset = 1;
+	}
+	else if (ch == 0x0F)
+	{
+		/* Shift In */
+		console->charset = 0;
+	}
+	else
+		log_error("Unhandled control character '\\x%x'\n", (unsigned char)ch);
+}
+
+static void write_text(const char *buf, size_t count)
+{
+	write_normal(buf, (int)count);
+}
+
+static const struct vt_callbacks console_vt_callbacks = {
+	.print = write_text,
+	.execute = control_character,
+	.escape = control_escape,
+	.csi = control_escape_csi,
+	.osc = control_escape_osc,
+};
+
 static size_t console_write(struct file *f, const void *b, size_t count)
 {
 	const char *buf = (const char *)b;
@@ -1540,77 +1873,9 @@ static size_t console_write(struct file *f, const void *b, size_t count)
 
 	console_lock();
 	console_retrieve_state();
-	#define OUTPUT() \
-		if (last != -1) \
-		{ \
-			write_normal(buf + last, i - last); \
-			last = -1; \
-		}
-	size_t last = -1;
-	size_t i;
-	for (i = 0; i < count; i++)
-	{
-		unsigned char ch = buf[i];
-		if (ch == 0x1B) /* Escape */
-		{
-			OUTPUT();
-			console->processor = control_escape;
-		}
-		else if (ch == '\t')
-		{
-			OUTPUT();
-			int x = (console->x + 8) & ~7;
-			if (x < console->width)
-				set_pos(x, console->y);
-			else
-				set_pos(console->width - 1, console->y);
-		}
-		else if (ch == '\b')
-		{
-			OUTPUT();
-			backspace(FALSE);
-		}
-		else if (ch == '\r')
-		{
-			OUTPUT();
-			if (console->termios.c_oflag & OCRNL)
-				nl();
-			else
-				cr();
-		}
-		else if (ch == '\n' || ch == '\v' || ch == '\f')
-		{
-			OUTPUT();
-			if (console->termios.c_oflag & ONLCR)
-				crnl();
-			else
-				nl();
-		}
-		else if (ch == 0x0E)
-		{
-			/* Shift Out */
-			OUTPUT();
-			console->charset = 1;
-		}
-		else if (ch == 0x0F)
-		{
-			/* Shift In */
-			OUTPUT();
-			console->charset = 0;
-		}
-		else if (console->processor)
-			console->processor(ch);
-		else if (ch < 0x20)
-		{
-			OUTPUT();
-			log_error("Unhandled control character '\\x%x'\n", ch);
-		}
-		else if (last == -1)
-			last = i;
-	}
-	OUTPUT();
-	/* This will make the caret immediately visible */
-	set_pos(console->x, console->y);
+	vt_parse(&console->parser, &console_vt_callbacks, buf, count);
+	/* Draw the output and make the caret immediately visible */
+	console_flush();
 	console_unlock();
 #if 0
 	char str[4096];
@@ -1687,6 +1952,7 @@ static int console_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 	{
 		const struct winsize *win = (const struct winsize *)arg;
 		console_set_size(win->ws_col, win->ws_row);
+		console_flush();
 		r = 0;
 		break;
 	}
@@ -20,6 +20,7 @@
 #include <fs/console.h>
 #include <fs/devfs.h>
 #include <fs/null.h>
+#include <fs/pty.h>
 #include <fs/random.h>
 #include <fs/virtual.h>
 
@@ -32,6 +33,8 @@ static const struct virtualfs_directory_desc devfs =
 		VIRTUALFS_ENTRY("urandom", urandom_desc)
 		VIRTUALFS_ENTRY("console", console_desc)
 		VIRTUALFS_ENTRY("tty", console_desc)
+		VIRTUALFS_ENTRY("ptmx", ptmx_desc)
+		VIRTUALFS_ENTRY("pts", pts_desc)
 		VIRTUALFS_ENTRY_END()
 	}
 };
@@ -23,6 +23,7 @@
 #include <common/poll.h>
 #include <fs/eventfd.h>
 #include <syscall/mm.h>
+#include <syscall/sig.h>
 #include <heap.h>
 #include <log.h>
 
@@ -35,14 +36,25 @@
 #define EFD_CLOEXEC O_CLOEXEC
 #define EFD_NONBLOCK O_NONBLOCK
 
+/* The counter lives in a shared mapping so it survives fork()
+ * All operations on it are lock-free. The readable event is a manual reset event which is
+ * signaled exactly when the counter is non-zero, it is only touched on zero-to-nonzero and
+ * nonzero-to-zero transitions. The writable event is only signaled when a writer is blocked on
+ * counter overflow, which is very unlikely to happen in practice.
+ */
+struct eventfd_shared
+{
+	volatile LONG64 value;
+	volatile LONG write_waiters;
+};
+
 struct eventfd_file
 {
 	struct file efd_base_file;
-	uint64_t *efd_value;
+	struct eventfd_shared *efd_shared;
 	HANDLE efd_handle;
-	HANDLE efd_mutex;
-	HANDLE efd_sem_canread;
-	HANDLE efd_sem_canwrite;
+	HANDLE efd_event_readable;
+	HANDLE efd_event_writable;
 	int efd_flags;
 };
 
@@ -50,43 +62,45 @@ static const struct file_ops eventfd_ops;
 
 int eventfd_alloc(struct file **eventfdfile, uint64_t count, int flags)
 {
-	if (flags & (EFD_SEMAPHORE))
+	if (flags & ~(EFD_SEMAPHORE | EFD_CLOEXEC | EFD_NONBLOCK))
 	{
-		log_error("eventfd: EFD_SEMAPHORE is unsupported!\n");
+		log_error("eventfd: Unknown flags: %x\n", flags);
 		return -EINVAL;
 	}
 
-	struct eventfd_file *efd = kmalloc(sizeof(struct eventfd_file));
-	efd->efd_base_file.op_vtable = &eventfd_ops;
-	efd->efd_base_file.ref = 1;
-	efd->efd_base_file.flags = O_RDWR;
-
 	SECURITY_ATTRIBUTES attrs;
 	attrs.nLength = sizeof(SECURITY_ATTRIBUTES);
 	attrs.lpSecurityDescriptor = NULL;
 	attrs.bInheritHandle = TRUE;
 
-	efd->efd_handle = CreateFileMapping(NULL, &attrs, PAGE_READWRITE, 0, 8, NULL);
-	if (efd->efd_handle == NULL)
+	HANDLE handle = CreateFileMapping(NULL, &attrs, PAGE_READWRITE, 0, sizeof(struct eventfd_shared), NULL);
+	if (handle == NULL)
 	{
 		log_error("eventfd: Can't create handle: %u\n", GetLastError());
 		return -ENOMEM;
 	}
 
-	efd->efd_value = MapViewOfFile(efd->efd_handle, FILE_MAP_ALL_ACCESS, 0, 0, 8);
-	if (efd->efd_value == NULL)
+	struct eventfd_shared *shared = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(struct eventfd_shared));
+	if (shared == NULL)
 	{
 		log_error("eventfd: Can't map handle: %u\n", GetLastError());
+		CloseHandle(handle);
 		return -ENOMEM;
 	}
 
-	efd->efd_mutex = CreateMutex(&attrs, FALSE, NULL);
-	efd->efd_sem_canread = CreateSemaphore(&attrs, 0, 1, NULL);
-	efd->efd_sem_canwrite = CreateSemaphore(&attrs, 1, 1, NULL);
-
-	*efd->efd_value = count;
+	struct eventfd_file *efd = kmalloc(sizeof(struct eventfd_file));
+	efd->efd_base_file.op_vtable = &eventfd_ops;
+	efd->efd_base_file.ref = 1;
+	efd->efd_base_file.flags = O_RDWR | (flags & EFD_NONBLOCK);
+	efd->efd_handle = handle;
+	efd->efd_shared = shared;
+	efd->efd_event_readable = CreateEventW(&attrs, TRUE, count > 0, NULL);
+	efd->efd_event_writable = CreateEventW(&attrs, FALSE, FALSE, NULL);
 	efd->efd_flags = flags;
 
+	shared->value = count;
+	shared->write_waiters = 0;
+
 	*eventfdfile = (struct file *)efd;
 
 	return 0;
@@ -98,21 +112,18 @@ static int eventfd_close(struct file *f)
 
 	log_info("eventfd: close(%p)\n", f);
 
-	BOOL rv = UnmapViewOfFile(efd->efd_value);
-	if (rv)
+	if (!UnmapViewOfFile(efd->efd_shared))
 	{
 		log_error("eventfd: can't unmap handle during close\n");
 	}
 
-	rv = CloseHandle(efd->efd_handle);
-	if (rv)
+	if (!CloseHandle(efd->efd_handle))
 	{
 		log_error("eventfd: can't close handle during close\n");
 	}
 
-	CloseHandle(efd->efd_mutex);
-	CloseHandle(efd->efd_sem_canread);
-	CloseHandle(efd->efd_sem_canwrite);
+	CloseHandle(efd->efd_event_readable);
+	CloseHandle(efd->efd_event_writable);
 
 	kfree(efd, sizeof(struct eventfd_file));
 	return 0;
@@ -121,14 +132,15 @@ static int eventfd_close(struct file *f)
 static int eventfd_get_poll_status(struct file *f)
 {
 	struct eventfd_file *efd = (struct eventfd_file *)f;
+	uint64_t value = efd->efd_shared->value;
 	int events = 0;
 
-	if (*efd->efd_value < EVENTFD_VALUE_MAX)
+	if (value < EVENTFD_VALUE_MAX)
 	{
 		events |= LINUX_POLLOUT;
 	}
 
-	if (*efd->efd_value > 0)
+	if (value > 0)
 	{
 		events |= LINUX_POLLIN;
 	}
@@ -136,18 +148,27 @@ static int eventfd_get_poll_status(struct file *f)
 	return events;
 }
 
+static HANDLE eventfd_get_poll_handle(struct file *f, int *poll_events)
+{
+	struct eventfd_file *efd = (struct eventfd_file *)f;
+
+	*poll_events = LINUX_POLLIN;
+	return efd->efd_event_readable;
+}
+
 static void eventfd_after_fork(struct file *f)
 {
 	struct eventfd_file *efd = (struct eventfd_file *)f;
 
 	log_info("eventfd: after_fork\n");
 
-	efd->efd_value = MapViewOfFile(efd->efd_handle, FILE_MAP_ALL_ACCESS, 0, 0, 8);
+	efd->efd_shared = MapViewOfFile(efd->efd_handle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(struct eventfd_shared));
 }
 
 static size_t eventfd_read(struct file *f, void *buf, size_t count)
 {
 	struct eventfd_file *efd = (struct eventfd_file *)f;
+	struct eventfd_shared *shared = efd->efd_shared;
 
 	log_info("eventfd: read(%p, %p, %u)\n", f, buf, count);
 
@@ -156,38 +177,59 @@ static size_t eventfd_read(struct file *f, void *buf, size_t count)
 		return -EINVAL;
 	}
 
-	WaitForSingleObject(efd->efd_mutex, INFINITE);
-
-	while (*efd->efd_value == 0)
+	uint64_t value, new_value;
+	for (;;)
 	{
-		ReleaseMutex(efd->efd_mutex);
-
-		if (efd->efd_flags & EFD_NONBLOCK)
+		value = shared->value;
+		if (value == 0)
 		{
-			return -EAGAIN;
+			if (f->flags & O_NONBLOCK)
+			{
+				return -EAGAIN;
+			}
+			/* The event may be left signaled by a writer racing with a draining reader,
+			 * reset it and check the counter again, so we do not spin on a stale event */
+			ResetEvent(efd->efd_event_readable);
+			if (shared->value > 0)
+			{
+				SetEvent(efd->efd_event_readable);
+				continue;
+			}
+			if (signal_wait(1, &efd->efd_event_readable, INFINITE) == WAIT_INTERRUPTED)
+			{
+				return -EINTR;
+			}
+			continue;
 		}
-		else
+		new_value = (efd->efd_flags & EFD_SEMAPHORE) ? value - 1 : 0;
+		if ((uint64_t)InterlockedCompareExchange64(&shared->value, new_value, value) == value)
 		{
-			WaitForSingleObject(efd->efd_sem_canread, INFINITE);
+			break;
 		}
-
-		WaitForSingleObject(efd->efd_mutex, INFINITE);
 	}
 
-	uint64_t* output = (uint64_t *)buf;
-
-	*output = *efd->efd_value;
-	*efd->efd_value = 0;
-
-	ReleaseSemaphore(efd->efd_sem_canwrite, 1, NULL);
-	ReleaseMutex(efd->efd_mutex);
+	if (new_value == 0)
+	{
+		ResetEvent(efd->efd_event_readable);
+		/* A writer may have raised the counter before we reset the event */
+		if (shared->value > 0)
+		{
+			SetEvent(efd->efd_event_readable);
+		}
+	}
+	if (shared->write_waiters > 0)
+	{
+		SetEvent(efd->efd_event_writable);
+	}
 
+	*(uint64_t *)buf = (efd->efd_flags & EFD_SEMAPHORE) ? 1 : value;
 	return 8;
 }
 
 static size_t eventfd_write(struct file *f, const void *buf, size_t count)
 {
 	struct eventfd_file *efd = (struct eventfd_file *)f;
+	struct eventfd_shared *shared = efd->efd_shared;
 
 	log_info("eventfd: write(%p, %p, %u)\n", f, buf, count);
 
@@ -196,35 +238,53 @@ static size_t eventfd_write(struct file *f, const void *buf, size_t count)
 		return -EINVAL;
 	}
 
-	WaitForSingleObject(efd->efd_mutex, INFINITE);
-
-	const uint64_t* input = (const uint64_t *)buf;
-	while (*efd->efd_value + *input > EVENTFD_VALUE_MAX)
+	uint64_t input = *(const uint64_t *)buf;
+	if (input > EVENTFD_VALUE_MAX)
 	{
-		ReleaseMutex(efd->efd_mutex);
+		return -EINVAL;
+	}
 
-		if (efd->efd_flags & EFD_NONBLOCK)
+	uint64_t value;
+	for (;;)
+	{
+		value = shared->value;
+		if (input > EVENTFD_VALUE_MAX - value)
 		{
-			return -EAGAIN;
+			if (f->flags & O_NONBLOCK)
+			{
+				return -EAGAIN;
+			}
+			/* Announce ourselves before checking the counter again, so a reader will not miss us */
+			InterlockedIncrement(&shared->write_waiters);
+			DWORD result = WAIT_OBJECT_0;
+			if (input > EVENTFD_VALUE_MAX - shared->value)
+			{
+				result = signal_wait(1, &efd->efd_event_writable, INFINITE);
+			}
+			InterlockedDecrement(&shared->write_waiters);
+			if (result == WAIT_INTERRUPTED)
+			{
+				return -EINTR;
+			}
+			continue;
 		}
-		else
+		if ((uint64_t)InterlockedCompareExchange64(&shared->value, value + input, value) == value)
 		{
-			WaitForSingleObject(efd->efd_sem_canwrite, INFINITE);
+			break;
 		}
-
-		WaitForSingleObject(efd->efd_mutex, INFINITE);
 	}
 
-	*efd->efd_value += *input;
-
-	ReleaseSemaphore(efd->efd_sem_canread, 1, NULL);
-	ReleaseMutex(efd->efd_mutex);
+	if (value == 0 && input > 0)
+	{
+		SetEvent(efd->efd_event_readable);
+	}
 
 	return 8;
 }
 
 static const struct file_ops eventfd_ops = {
 	.get_poll_status = eventfd_get_poll_status,
+	.get_poll_handle = eventfd_get_poll_handle,
 	.after_fork = eventfd_after_fork,
 	.close = eventfd_close,
 	.read = eventfd_read,
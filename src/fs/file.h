@@ -54,6 +54,14 @@ struct file_ops
 	int (*getdents)(struct file *f, void *dirent, size_t count, getdents_callback *fill_callback);
 	int (*ioctl)(struct file *f, unsigned int cmd, unsigned long arg);
 	int (*statfs)(struct file *f, struct statfs64 *buf);
+	/* Get the section object backing a BLOCK_SIZE aligned offset of the file, for MAP_SHARED.
+	 * The offset of the block inside the section is returned in section_offset.
+	 * The handle is owned by the file system, duplicate it to keep it around. */
+	HANDLE (*get_section)(struct file *f, loff_t offset, loff_t *section_offset);
+	/* Allocate or deallocate space, mode is a combination of FALLOC_FL_* flags, parameters are validated by the caller */
+	int (*fallocate)(struct file *f, int mode, loff_t offset, loff_t len);
+	/* Access pattern hint, advice is one of POSIX_FADV_*, parameters are validated by the caller */
+	int (*fadvise)(struct file *f, loff_t offset, loff_t len, int advice);
 };
 
 struct file
@@ -65,7 +73,7 @@ struct file
 
 struct file_system
 {
-	struct file_system *next;
+	struct file_system *next; /* File system shadowed by this one at the same mountpoint */
 	const char *mountpoint;
 	int (*open)(struct file_system *fs, const char *path, int flags, int mode, struct file **fp, char *target, int buflen);
 	int (*symlink)(struct file_system *fs, const char *target, const char *linkpath);
@@ -74,4 +82,9 @@ struct file_system
 	int (*rename)(struct file_system *fs, struct file *f, const char *newpath);
 	int (*mkdir)(struct file_system *fs, const char *pathname, int mode);
 	int (*rmdir)(struct file_system *fs, const char *pathname);
+	void (*after_fork)(struct file_system *fs);
+	/* Change options of a mounted file system, flags and data are passed from mount() with MS_REMOUNT */
+	int (*remount)(struct file_system *fs, unsigned long flags, const void *data);
+	/* Used by vfs: whether mountpoint is allocated by mount() and should be freed on unmount */
+	int mountpoint_allocated;
 };
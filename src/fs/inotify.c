@@ -0,0 +1,504 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <common/errno.h>
+#include <common/fcntl.h>
+#include <common/inotify.h>
+#include <common/poll.h>
+#include <fs/inotify.h>
+#include <fs/winfs.h>
+#include <lib/slist.h>
+#include <syscall/mm.h>
+#include <syscall/sig.h>
+#include <syscall/vfs.h>
+#include <heap.h>
+#include <log.h>
+#include <str.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+/* FIONREAD is commented out in common/ioctls.h as it clashes with winsock */
+#define INOTIFY_FIONREAD		0x541B
+
+/* Size of the ReadDirectoryChangesW() buffer of each watch */
+#define INOTIFY_BUFFER_SIZE		4096
+/* Size of the pending event queue */
+#define INOTIFY_QUEUE_SIZE		16384
+
+/* Watches are backed by overlapped ReadDirectoryChangesW() requests on the watched directory
+ * (or the parent directory when watching a single file). All requests of an inotify instance
+ * share one manual reset event, which is exposed as the poll handle. Completed requests are
+ * translated into Linux events and reissued lazily on read() or poll(). An idle watch thus
+ * costs nothing but a pending kernel request.
+ */
+struct inotify_watch
+{
+	struct slist list;
+	int wd;
+	uint32_t mask;
+	int is_dir;
+	HANDLE handle; /* Directory handle, NULL if changes of the target can not be watched */
+	OVERLAPPED overlapped;
+	char *buffer;
+	int pathlen; /* Windows path of the directory */
+	int namelen; /* File name inside the directory when watching a file, 0 when watching a directory */
+	WCHAR path[]; /* Directory path followed by file name */
+};
+
+struct inotify_file
+{
+	struct file base_file;
+	HANDLE event;
+	struct slist watches;
+	int next_wd;
+	uint32_t cookie;
+	int queue_len;
+	int last_event; /* Offset of the last queued event, -1 if the queue is empty */
+	char *queue;
+};
+
+static const struct file_ops inotify_ops;
+
+static HANDLE inotify_create_event()
+{
+	/* Not inheritable, the fork child reopens everything */
+	return CreateEventW(NULL, TRUE, FALSE, NULL);
+}
+
+static DWORD inotify_get_filter(uint32_t mask)
+{
+	DWORD filter = 0;
+	if (mask & (IN_CREATE | IN_DELETE | IN_MOVE | IN_DELETE_SELF | IN_MOVE_SELF))
+		filter |= FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME;
+	if (mask & IN_MODIFY)
+		filter |= FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+	if (mask & IN_ATTRIB)
+		filter |= FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SECURITY;
+	if (mask & IN_ACCESS)
+		filter |= FILE_NOTIFY_CHANGE_LAST_ACCESS;
+	return filter;
+}
+
+static int inotify_open_directory(struct inotify_watch *w)
+{
+	WCHAR path[PATH_MAX];
+	if (w->pathlen + 5 > PATH_MAX)
+		return 0;
+	memcpy(path, L"\\\\?\\", 4 * sizeof(WCHAR));
+	memcpy(path + 4, w->path, w->pathlen * sizeof(WCHAR));
+	path[w->pathlen + 4] = 0;
+	w->handle = CreateFileW(path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (w->handle == INVALID_HANDLE_VALUE)
+	{
+		log_warning("inotify: CreateFileW() failed, error code: %d\n", GetLastError());
+		w->handle = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+static void inotify_close_directory(struct inotify_watch *w)
+{
+	if (!w->handle)
+		return;
+	/* Wait for the cancellation, the kernel may still write to the buffer until then */
+	DWORD bytes;
+	if (CancelIoEx(w->handle, &w->overlapped) || GetLastError() != ERROR_NOT_FOUND)
+		GetOverlappedResult(w->handle, &w->overlapped, &bytes, TRUE);
+	CloseHandle(w->handle);
+	w->handle = NULL;
+}
+
+static int inotify_issue(struct inotify_file *ino, struct inotify_watch *w)
+{
+	memset(&w->overlapped, 0, sizeof(OVERLAPPED));
+	w->overlapped.hEvent = ino->event;
+	if (!ReadDirectoryChangesW(w->handle, w->buffer, INOTIFY_BUFFER_SIZE, FALSE, inotify_get_filter(w->mask),
+		NULL, &w->overlapped, NULL))
+	{
+		log_warning("inotify: ReadDirectoryChangesW() failed, error code: %d\n", GetLastError());
+		return 0;
+	}
+	return 1;
+}
+
+static void inotify_queue_event(struct inotify_file *ino, int wd, uint32_t mask, uint32_t cookie, const char *name, int namelen)
+{
+	uint32_t len = namelen ? ALIGN_TO(namelen + 1, sizeof(struct inotify_event)) : 0;
+	/* Coalesce identical consecutive events, as Linux does */
+	if (ino->last_event >= 0)
+	{
+		struct inotify_event *last = (struct inotify_event *)(ino->queue + ino->last_event);
+		if (last->wd == wd && last->mask == mask && last->cookie == cookie && last->len == len
+			&& !memcmp(last->name, name, namelen))
+			return;
+		if (last->mask == IN_Q_OVERFLOW)
+			return;
+	}
+	/* Always leave room for an overflow event */
+	if (ino->queue_len + 2 * sizeof(struct inotify_event) + len > INOTIFY_QUEUE_SIZE)
+	{
+		wd = -1;
+		mask = IN_Q_OVERFLOW;
+		cookie = 0;
+		namelen = 0;
+		len = 0;
+	}
+	struct inotify_event *e = (struct inotify_event *)(ino->queue + ino->queue_len);
+	e->wd = wd;
+	e->mask = mask;
+	e->cookie = cookie;
+	e->len = len;
+	memcpy(e->name, name, namelen);
+	memset(e->name + namelen, 0, len - namelen);
+	ino->last_event = ino->queue_len;
+	ino->queue_len += sizeof(struct inotify_event) + len;
+	SetEvent(ino->event);
+}
+
+static void inotify_free_watch(struct inotify_watch *w)
+{
+	inotify_close_directory(w);
+	kfree(w->buffer, INOTIFY_BUFFER_SIZE);
+	kfree(w, sizeof(struct inotify_watch) + (w->pathlen + w->namelen) * sizeof(WCHAR));
+}
+
+/* Translate the content of a completed request, returns 0 if the watch should be removed */
+static int inotify_translate(struct inotify_file *ino, struct inotify_watch *w, DWORD bytes)
+{
+	const WCHAR *watch_name = w->path + w->pathlen;
+	int removed = 0;
+	for (FILE_NOTIFY_INFORMATION *info = (FILE_NOTIFY_INFORMATION *)w->buffer;;
+		info = (FILE_NOTIFY_INFORMATION *)((char *)info + info->NextEntryOffset))
+	{
+		int namelen = info->FileNameLength / sizeof(WCHAR);
+		uint32_t mask, cookie = 0;
+		switch (info->Action)
+		{
+		case FILE_ACTION_ADDED: mask = IN_CREATE; break;
+		case FILE_ACTION_REMOVED: mask = IN_DELETE; break;
+		case FILE_ACTION_MODIFIED: mask = (w->mask & IN_MODIFY) ? IN_MODIFY : IN_ATTRIB; break;
+		case FILE_ACTION_RENAMED_OLD_NAME: mask = IN_MOVED_FROM; cookie = ++ino->cookie; break;
+		case FILE_ACTION_RENAMED_NEW_NAME: mask = IN_MOVED_TO; cookie = ino->cookie; break;
+		default: mask = 0;
+		}
+		char name[PATH_MAX];
+		int len = 0;
+		if (w->namelen)
+		{
+			/* Watching a single file, only look at events of that file */
+			if (namelen != w->namelen || memcmp(info->FileName, watch_name, namelen * sizeof(WCHAR)))
+				mask = 0;
+			else if (mask == IN_DELETE)
+				mask = IN_DELETE_SELF;
+			else if (mask == IN_MOVED_FROM)
+			{
+				mask = IN_MOVE_SELF;
+				cookie = 0;
+			}
+			else if (mask != IN_MODIFY && mask != IN_ATTRIB)
+				mask = 0;
+		}
+		else if (mask)
+		{
+			len = utf16_to_utf8_filename(info->FileName, namelen, name, PATH_MAX);
+			if (mask == IN_CREATE || mask == IN_MOVED_TO)
+			{
+				WCHAR path[PATH_MAX];
+				if (w->pathlen + namelen + 6 <= PATH_MAX)
+				{
+					memcpy(path, L"\\\\?\\", 4 * sizeof(WCHAR));
+					memcpy(path + 4, w->path, w->pathlen * sizeof(WCHAR));
+					int plen = 4 + w->pathlen;
+					if (path[plen - 1] != L'\\')
+						path[plen++] = L'\\';
+					memcpy(path + plen, info->FileName, namelen * sizeof(WCHAR));
+					path[plen + namelen] = 0;
+					DWORD attributes = GetFileAttributesW(path);
+					if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY))
+						mask |= IN_ISDIR;
+				}
+			}
+		}
+		if (mask & w->mask & IN_ALL_EVENTS)
+		{
+			inotify_queue_event(ino, w->wd, mask, cookie, name, len);
+			if (w->mask & IN_ONESHOT)
+				removed = 1;
+		}
+		if (mask & IN_DELETE_SELF)
+			removed = 1;
+		if (!info->NextEntryOffset)
+			break;
+	}
+	return !removed;
+}
+
+/* Collect completed requests and reissue them */
+static void inotify_collect(struct inotify_file *ino)
+{
+	/* Reset before checking, so a completion happening after this is not lost */
+	ResetEvent(ino->event);
+	slist_iterate_safe(&ino->watches, prev, cur)
+	{
+		struct inotify_watch *w = slist_entry(cur, struct inotify_watch, list);
+		if (!w->handle || !HasOverlappedIoCompleted(&w->overlapped))
+			continue;
+		DWORD bytes;
+		int keep;
+		if (!GetOverlappedResult(w->handle, &w->overlapped, &bytes, FALSE))
+		{
+			/* The watched directory is gone */
+			if (w->is_dir && (w->mask & IN_DELETE_SELF))
+				inotify_queue_event(ino, w->wd, IN_DELETE_SELF, 0, NULL, 0);
+			keep = 0;
+		}
+		else if (bytes == 0)
+		{
+			/* The buffer overflowed, changes are lost */
+			inotify_queue_event(ino, -1, IN_Q_OVERFLOW, 0, NULL, 0);
+			keep = 1;
+		}
+		else
+			keep = inotify_translate(ino, w, bytes);
+		if (keep && inotify_issue(ino, w))
+			continue;
+		inotify_queue_event(ino, w->wd, IN_IGNORED, 0, NULL, 0);
+		slist_remove(prev, cur);
+		inotify_free_watch(w);
+	}
+	if (ino->queue_len)
+		SetEvent(ino->event);
+}
+
+int inotify_alloc(struct file **f, int flags)
+{
+	if (flags & ~(IN_CLOEXEC | IN_NONBLOCK))
+		return -EINVAL;
+	struct inotify_file *ino = (struct inotify_file *)kmalloc(sizeof(struct inotify_file));
+	ino->base_file.op_vtable = &inotify_ops;
+	ino->base_file.ref = 1;
+	ino->base_file.flags = O_RDONLY | (flags & IN_NONBLOCK);
+	ino->event = inotify_create_event();
+	slist_init(&ino->watches);
+	ino->next_wd = 1;
+	ino->cookie = 0;
+	ino->queue_len = 0;
+	ino->last_event = -1;
+	ino->queue = (char *)kmalloc(INOTIFY_QUEUE_SIZE);
+	*f = (struct file *)ino;
+	return 0;
+}
+
+int inotify_is_inotify(struct file *f)
+{
+	return f->op_vtable == &inotify_ops;
+}
+
+int inotify_add_watch(struct file *f, struct file *target, uint32_t mask)
+{
+	struct inotify_file *ino = (struct inotify_file *)f;
+	if (!(mask & IN_ALL_EVENTS))
+		return -EINVAL;
+	struct newstat stat;
+	if (!target->op_vtable->stat || target->op_vtable->stat(target, &stat) < 0)
+		return -EACCES;
+	int is_dir = S_ISDIR(stat.st_mode);
+	if ((mask & IN_ONLYDIR) && !is_dir)
+		return -ENOTDIR;
+
+	WCHAR path[PATH_MAX];
+	int pathlen = 0, namelen = 0;
+	if (winfs_is_winfile(target))
+		pathlen = winfs_get_windows_path(target, path, PATH_MAX);
+	if (pathlen == 0)
+	{
+		/* Changes of other file systems (e.g. tmpfs) are not reported. Fail like an
+		 * exhausted watch limit, which makes tail -F and friends fall back to polling */
+		log_warning("inotify: Changes of the target file can not be watched.\n");
+		return -ENOSPC;
+	}
+	if (!is_dir)
+	{
+		/* Watch the parent directory and filter by file name */
+		int i = pathlen;
+		while (i > 0 && path[i - 1] != L'\\')
+			i--;
+		namelen = pathlen - i;
+		/* Keep the trailing backslash of a volume root */
+		pathlen = (i > 1 && path[i - 2] != L':') ? i - 1 : i;
+		memmove(path + pathlen, path + i, namelen * sizeof(WCHAR));
+	}
+
+	/* Existing watch on the same target */
+	slist_iterate(&ino->watches, prev, cur)
+	{
+		struct inotify_watch *w = slist_entry(cur, struct inotify_watch, list);
+		if (w->pathlen == pathlen && w->namelen == namelen && w->is_dir == is_dir
+			&& !memcmp(w->path, path, (pathlen + namelen) * sizeof(WCHAR)))
+		{
+			if (mask & IN_MASK_ADD)
+				w->mask |= mask & ~IN_MASK_ADD;
+			else
+				w->mask = mask;
+			/* The new filter only applies to the next request */
+			return w->wd;
+		}
+	}
+
+	struct inotify_watch *w = (struct inotify_watch *)kmalloc(sizeof(struct inotify_watch) + (pathlen + namelen) * sizeof(WCHAR));
+	w->wd = ino->next_wd++;
+	w->mask = mask & ~IN_MASK_ADD;
+	w->is_dir = is_dir;
+	w->handle = NULL;
+	w->buffer = (char *)kmalloc(INOTIFY_BUFFER_SIZE);
+	w->pathlen = pathlen;
+	w->namelen = namelen;
+	memcpy(w->path, path, (pathlen + namelen) * sizeof(WCHAR));
+	if (inotify_open_directory(w) && !inotify_issue(ino, w))
+		inotify_close_directory(w);
+	slist_add(&ino->watches, &w->list);
+	return w->wd;
+}
+
+int inotify_rm_watch(struct file *f, int wd)
+{
+	struct inotify_file *ino = (struct inotify_file *)f;
+	slist_iterate(&ino->watches, prev, cur)
+	{
+		struct inotify_watch *w = slist_entry(cur, struct inotify_watch, list);
+		if (w->wd == wd)
+		{
+			slist_remove(prev, cur);
+			inotify_free_watch(w);
+			inotify_queue_event(ino, wd, IN_IGNORED, 0, NULL, 0);
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int inotify_close(struct file *f)
+{
+	struct inotify_file *ino = (struct inotify_file *)f;
+	slist_iterate_safe(&ino->watches, prev, cur)
+	{
+		struct inotify_watch *w = slist_entry(cur, struct inotify_watch, list);
+		slist_remove(prev, cur);
+		inotify_free_watch(w);
+	}
+	CloseHandle(ino->event);
+	kfree(ino->queue, INOTIFY_QUEUE_SIZE);
+	kfree(ino, sizeof(struct inotify_file));
+	return 0;
+}
+
+static int inotify_get_poll_status(struct file *f)
+{
+	struct inotify_file *ino = (struct inotify_file *)f;
+	inotify_collect(ino);
+	return ino->queue_len ? LINUX_POLLIN : 0;
+}
+
+static HANDLE inotify_get_poll_handle(struct file *f, int *poll_events)
+{
+	struct inotify_file *ino = (struct inotify_file *)f;
+	*poll_events = LINUX_POLLIN;
+	return ino->event;
+}
+
+static void inotify_after_fork(struct file *f)
+{
+	/* Neither the handles nor the pending requests belong to us, start over */
+	struct inotify_file *ino = (struct inotify_file *)f;
+	ino->event = inotify_create_event();
+	slist_iterate(&ino->watches, prev, cur)
+	{
+		struct inotify_watch *w = slist_entry(cur, struct inotify_watch, list);
+		if (w->handle && inotify_open_directory(w) && !inotify_issue(ino, w))
+		{
+			CloseHandle(w->handle);
+			w->handle = NULL;
+		}
+	}
+	if (ino->queue_len)
+		SetEvent(ino->event);
+}
+
+static size_t inotify_read(struct file *f, void *buf, size_t count)
+{
+	struct inotify_file *ino = (struct inotify_file *)f;
+	inotify_collect(ino);
+	while (ino->queue_len == 0)
+	{
+		if (f->flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (signal_wait(1, &ino->event, INFINITE) == WAIT_INTERRUPTED)
+			return -EINTR;
+		inotify_collect(ino);
+	}
+	/* Only return whole events */
+	int size = 0;
+	while (size < ino->queue_len)
+	{
+		struct inotify_event *e = (struct inotify_event *)(ino->queue + size);
+		int event_size = sizeof(struct inotify_event) + e->len;
+		if (size + event_size > count)
+			break;
+		size += event_size;
+	}
+	if (size == 0)
+		return -EINVAL;
+	memcpy(buf, ino->queue, size);
+	memmove(ino->queue, ino->queue + size, ino->queue_len - size);
+	ino->queue_len -= size;
+	if (ino->queue_len == 0)
+	{
+		ino->last_event = -1;
+		ResetEvent(ino->event);
+	}
+	else
+		ino->last_event -= size;
+	return size;
+}
+
+static int inotify_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+	struct inotify_file *ino = (struct inotify_file *)f;
+	if (cmd == INOTIFY_FIONREAD)
+	{
+		if (!mm_check_write((int *)arg, sizeof(int)))
+			return -EFAULT;
+		inotify_collect(ino);
+		*(int *)arg = ino->queue_len;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+static const struct file_ops inotify_ops = {
+	.get_poll_status = inotify_get_poll_status,
+	.get_poll_handle = inotify_get_poll_handle,
+	.after_fork = inotify_after_fork,
+	.close = inotify_close,
+	.read = inotify_read,
+	.ioctl = inotify_ioctl,
+};
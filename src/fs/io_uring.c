@@ -0,0 +1,1141 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <common/errno.h>
+#include <common/fcntl.h>
+#include <common/io_uring.h>
+#include <common/poll.h>
+#include <common/socket.h>
+#include <common/uio.h>
+#include <fs/io_uring.h>
+#include <fs/socket.h>
+#include <fs/winfs.h>
+#include <lib/core.h>
+#include <lib/uring.h>
+#include <syscall/mm.h>
+#include <syscall/sig.h>
+#include <syscall/syscall.h>
+#include <syscall/vfs.h>
+#include <heap.h>
+#include <log.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <limits.h>
+
+#define IO_URING_MAX_ENTRIES		4096
+#define IO_URING_MAX_FILES			1024
+#define IO_URING_MAX_BUFFERS		512
+
+/* Emulation of io_uring
+ *
+ * The submission and completion rings live in a section object. The guest maps it with
+ * mmap(MAP_SHARED) at the IORING_OFF_* offsets (served by get_section()), and we access it
+ * through our own view. Each ring occupies a separate block aligned region of the section.
+ * Consuming the submission queue and posting completions is done by lib/uring.c.
+ *
+ * There are no kernel worker threads, requests are submitted in io_uring_enter().
+ * Reads and writes at an explicit offset on winfs files, and send, recv and accept on sockets
+ * are started as overlapped operations on a completion port shared by all rings of the process.
+ * Other requests on files which could block (pipes, eventfd, etc) are first checked for readiness
+ * with get_poll_status(). If the file is not ready, its poll handle is waited on by the thread pool,
+ * which queues a packet to the completion port when it becomes signaled, and the request is
+ * retried then. Requests in a link chain and requests on regular files at the current position
+ * are executed synchronously.
+ *
+ * Completion packets are handled when any ring is entered or polled. Each ring has an event which
+ * is signaled by its overlapped operations and poll waits, io_uring_enter(IORING_ENTER_GETEVENTS)
+ * waits on it. The event may be signaled a bit before the packet is queued, such requests are
+ * detected by io_uring_completing() so the wait does not miss them.
+ */
+
+/* Types of in flight requests */
+#define IO_URING_REQUEST_TIMEOUT	0
+#define IO_URING_REQUEST_POLL		1 /* Waits for the poll handle of its file */
+#define IO_URING_REQUEST_OVERLAPPED	2 /* Overlapped read or write on a winfs file */
+#define IO_URING_REQUEST_SOCKET		3 /* Overlapped operation on a socket */
+
+struct io_uring_request
+{
+	OVERLAPPED overlapped;
+	struct io_uring_request *prev, *next;
+	struct io_uring_file *ring; /* NULL if the ring is closed, freed when the completion packet arrives */
+	struct io_uring_sqe sqe;
+	struct file *f; /* Referenced, NULL for timeouts */
+	int type;
+	int events; /* Poll: events the request is waiting for */
+	HANDLE handle; /* Poll: the registered wait, overlapped: the file handle */
+	volatile LONG fired; /* Poll: the completion packet is queued */
+	uint64_t deadline; /* Timeouts: GetTickCount64() value when it expires */
+	uint32_t start; /* Timeouts: completion count at submission */
+	struct socket_accept accept;
+};
+
+struct io_uring_file
+{
+	struct file base_file;
+	HANDLE section;
+	char *view;
+	size_t section_size, sq_size, cq_offset, cq_size, sqes_offset, sqes_size;
+	struct uring uring;
+	uint32_t notified; /* Completion count when the event and eventfd were last signaled */
+	HANDLE event; /* Signaled when a request makes progress or a completion is posted */
+	struct file *eventfd;
+	struct io_uring_request *requests; /* In flight requests */
+	int files_count;
+	struct file **files;
+	int buffers_count;
+	struct iovec *buffers;
+};
+
+static const struct file_ops io_uring_ops;
+
+/* Completion port of all rings of this process, created on first use */
+static HANDLE io_uring_port;
+
+extern intptr_t sys_close(int fd);
+
+static uint32_t round_up_pow2(uint32_t x)
+{
+	uint32_t r = 1;
+	while (r < x)
+		r <<= 1;
+	return r;
+}
+
+void io_uring_afterfork()
+{
+	/* The port is not inherited, the rings drop the requests of the parent in io_uring_after_fork() */
+	io_uring_port = NULL;
+}
+
+static HANDLE io_uring_get_port()
+{
+	if (!io_uring_port)
+	{
+		io_uring_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+		if (!io_uring_port)
+			log_error("io_uring: CreateIoCompletionPort() failed, error code: %d\n", GetLastError());
+	}
+	return io_uring_port;
+}
+
+static int io_uring_map(struct io_uring_file *ring)
+{
+	ring->view = (char *)MapViewOfFile(ring->section, FILE_MAP_ALL_ACCESS, 0, 0, ring->section_size);
+	if (!ring->view)
+	{
+		log_error("io_uring: MapViewOfFile() failed, error code: %d\n", GetLastError());
+		return 0;
+	}
+	uring_attach(&ring->uring, ring->view, ring->view + ring->cq_offset, (struct io_uring_sqe *)(ring->view + ring->sqes_offset));
+	return 1;
+}
+
+/* Signal the event and the registered eventfd if there are new completions */
+static void io_uring_notify(struct io_uring_file *ring)
+{
+	if (ring->notified == ring->uring.completions)
+		return;
+	ring->notified = ring->uring.completions;
+	SetEvent(ring->event);
+	if (ring->eventfd)
+	{
+		uint64_t value = 1;
+		ring->eventfd->op_vtable->write(ring->eventfd, &value, sizeof(value));
+	}
+}
+
+static struct file *io_uring_get_file(struct io_uring_file *ring, const struct io_uring_sqe *sqe)
+{
+	if (sqe->flags & IOSQE_FIXED_FILE)
+	{
+		if (sqe->fd < 0 || sqe->fd >= ring->files_count)
+			return NULL;
+		return ring->files[sqe->fd];
+	}
+	return vfs_get(sqe->fd);
+}
+
+/* Poll events a request needs before it can be executed without blocking */
+static int io_uring_wait_events(const struct io_uring_sqe *sqe)
+{
+	switch (sqe->opcode)
+	{
+	case IORING_OP_READV:
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_READ:
+	case IORING_OP_RECV:
+	case IORING_OP_RECVMSG:
+	case IORING_OP_ACCEPT:
+		return LINUX_POLLIN;
+	case IORING_OP_WRITEV:
+	case IORING_OP_WRITE_FIXED:
+	case IORING_OP_WRITE:
+	case IORING_OP_SEND:
+	case IORING_OP_SENDMSG:
+		return LINUX_POLLOUT;
+	case IORING_OP_POLL_ADD:
+		return sqe->poll32_events;
+	default:
+		return 0;
+	}
+}
+
+/* Current poll events of a file, -1 if it can not be determined */
+static int io_uring_poll_file(struct file *f)
+{
+	if (f->op_vtable->get_poll_status)
+		return f->op_vtable->get_poll_status(f);
+	if (f->op_vtable->get_poll_handle)
+	{
+		int e;
+		HANDLE handle = f->op_vtable->get_poll_handle(f, &e);
+		return WaitForSingleObject(handle, 0) == WAIT_OBJECT_0 ? e : 0;
+	}
+	return -1;
+}
+
+static int32_t io_uring_rw(struct file *f, void *buf, size_t count, uint64_t *offset, int write)
+{
+	if (write ? !mm_check_read(buf, count) : !mm_check_write(buf, count))
+		return -EFAULT;
+	size_t r;
+	if (*offset == (uint64_t)-1)
+	{
+		/* Use current file position */
+		if (write ? !f->op_vtable->write : !f->op_vtable->read)
+			return -EINVAL;
+		r = write ? f->op_vtable->write(f, buf, count) : f->op_vtable->read(f, buf, count);
+	}
+	else
+	{
+		if (write ? !f->op_vtable->pwrite : !f->op_vtable->pread)
+			return -ESPIPE;
+		r = write ? f->op_vtable->pwrite(f, buf, count, *offset) : f->op_vtable->pread(f, buf, count, *offset);
+		if ((intptr_t)r > 0)
+			*offset += r;
+	}
+	return (int32_t)r;
+}
+
+static int32_t io_uring_rwv(struct file *f, const struct iovec *iov, uint32_t iovcnt, uint64_t offset, int write)
+{
+	if (!mm_check_read(iov, iovcnt * sizeof(struct iovec)))
+		return -EFAULT;
+	int32_t count = 0;
+	for (uint32_t i = 0; i < iovcnt; i++)
+	{
+		int32_t r = io_uring_rw(f, iov[i].iov_base, iov[i].iov_len, &offset, write);
+		if (r < 0)
+			return count > 0 ? count : r;
+		count += r;
+		if ((size_t)r < iov[i].iov_len)
+			break;
+	}
+	return count;
+}
+
+/* Check the buffer of a READ_FIXED or WRITE_FIXED request lies in its registered buffer */
+static int io_uring_check_fixed(struct io_uring_file *ring, const struct io_uring_sqe *sqe)
+{
+	if (sqe->buf_index >= ring->buffers_count)
+		return 0;
+	struct iovec *buf = &ring->buffers[sqe->buf_index];
+	char *addr = (char *)(uintptr_t)sqe->addr;
+	return addr >= (char *)buf->iov_base && addr + sqe->len <= (char *)buf->iov_base + buf->iov_len;
+}
+
+/* Execute a request which is ready */
+static int32_t io_uring_execute(struct io_uring_file *ring, const struct io_uring_sqe *sqe, struct file *f, int events)
+{
+	uint64_t offset = sqe->off;
+	void *addr = (void *)(uintptr_t)sqe->addr;
+	switch (sqe->opcode)
+	{
+	case IORING_OP_NOP:
+		return 0;
+
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+		return io_uring_rwv(f, (const struct iovec *)addr, sqe->len, offset, sqe->opcode == IORING_OP_WRITEV);
+
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+		if (!io_uring_check_fixed(ring, sqe))
+			return -EFAULT;
+		return io_uring_rw(f, addr, sqe->len, &offset, sqe->opcode == IORING_OP_WRITE_FIXED);
+
+	case IORING_OP_READ:
+	case IORING_OP_WRITE:
+		return io_uring_rw(f, addr, sqe->len, &offset, sqe->opcode == IORING_OP_WRITE);
+
+	case IORING_OP_FSYNC:
+	case IORING_OP_SYNC_FILE_RANGE:
+		if (!f->op_vtable->fsync)
+			return -EINVAL;
+		return f->op_vtable->fsync(f);
+
+	case IORING_OP_POLL_ADD:
+		return events & (sqe->poll32_events | LINUX_POLLERR | LINUX_POLLHUP);
+
+	/* The fd may be closed or reused before a deferred request runs, always use the referenced file */
+	case IORING_OP_SEND:
+		return socket_file_sendto(f, addr, sqe->len, sqe->msg_flags, NULL, 0);
+
+	case IORING_OP_RECV:
+		return socket_file_recvfrom(f, addr, sqe->len, sqe->msg_flags, NULL, NULL);
+
+	case IORING_OP_SENDMSG:
+		return socket_file_sendmsg(f, (const struct msghdr *)addr, sqe->msg_flags);
+
+	case IORING_OP_RECVMSG:
+		return socket_file_recvmsg(f, (struct msghdr *)addr, sqe->msg_flags);
+
+	case IORING_OP_ACCEPT:
+		return socket_file_accept(f, (struct sockaddr *)addr, (int *)(uintptr_t)sqe->addr2, sqe->accept_flags);
+
+	case IORING_OP_FADVISE:
+		return 0;
+
+	default:
+		log_error("io_uring: Unsupported opcode: %d\n", sqe->opcode);
+		return -EINVAL;
+	}
+}
+
+static struct io_uring_request *io_uring_alloc_request(struct io_uring_file *ring, const struct io_uring_sqe *sqe, struct file *f, int type)
+{
+	struct io_uring_request *req = (struct io_uring_request *)kmalloc(sizeof(struct io_uring_request));
+	memset(&req->overlapped, 0, sizeof(OVERLAPPED));
+	req->ring = ring;
+	req->sqe = *sqe;
+	req->f = f;
+	if (f)
+		vfs_ref(f);
+	req->type = type;
+	req->events = 0;
+	req->handle = NULL;
+	req->fired = 0;
+	req->deadline = 0;
+	req->start = ring->uring.completions;
+	req->prev = NULL;
+	req->next = ring->requests;
+	if (ring->requests)
+		ring->requests->prev = req;
+	ring->requests = req;
+	return req;
+}
+
+/* Remove a request from the in flight list of its ring */
+static void io_uring_unlink_request(struct io_uring_request *req)
+{
+	if (req->prev)
+		req->prev->next = req->next;
+	else
+		req->ring->requests = req->next;
+	if (req->next)
+		req->next->prev = req->prev;
+	req->ring = NULL;
+}
+
+static void io_uring_free_request(struct io_uring_request *req)
+{
+	if (req->ring)
+		io_uring_unlink_request(req);
+	if (req->f)
+		vfs_release(req->f);
+	kfree(req, sizeof(struct io_uring_request));
+}
+
+/* Post the completion of an in flight request and free it */
+static void io_uring_finish_request(struct io_uring_request *req, int32_t res)
+{
+	struct io_uring_file *ring = req->ring;
+	uring_complete(&ring->uring, &req->sqe, res);
+	io_uring_free_request(req);
+	io_uring_notify(ring);
+}
+
+/* Runs in a thread pool thread, the request may be freed as soon as the packet is queued */
+static VOID CALLBACK io_uring_poll_callback(PVOID parameter, BOOLEAN timer_or_wait_fired)
+{
+	struct io_uring_request *req = (struct io_uring_request *)parameter;
+	InterlockedExchange(&req->fired, 1);
+	SetEvent(req->ring->event);
+	PostQueuedCompletionStatus(io_uring_port, 0, 0, &req->overlapped);
+}
+
+/* Wait for the poll handle of the file of a poll request */
+static int io_uring_arm_poll(struct io_uring_request *req)
+{
+	int unused;
+	HANDLE handle = req->f->op_vtable->get_poll_handle(req->f, &unused);
+	req->fired = 0;
+	if (!RegisterWaitForSingleObject(&req->handle, handle, io_uring_poll_callback, req, INFINITE, WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD))
+	{
+		log_error("io_uring: RegisterWaitForSingleObject() failed, error code: %d\n", GetLastError());
+		req->handle = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+/* Start a request as an overlapped operation
+ * Returns 1 if started, 0 if it should be executed by the file operations, or a negative errno
+ */
+static int io_uring_start_overlapped(struct io_uring_file *ring, const struct io_uring_sqe *sqe, struct file *f)
+{
+	void *addr = (void *)(uintptr_t)sqe->addr;
+	int write;
+	switch (sqe->opcode)
+	{
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+		if (!io_uring_check_fixed(ring, sqe))
+			return -EFAULT;
+		write = sqe->opcode == IORING_OP_WRITE_FIXED;
+		break;
+	case IORING_OP_READ:
+	case IORING_OP_RECV:
+	case IORING_OP_ACCEPT:
+		write = 0;
+		break;
+	case IORING_OP_WRITE:
+	case IORING_OP_SEND:
+		write = 1;
+		break;
+	default:
+		return 0;
+	}
+	if (sqe->opcode != IORING_OP_ACCEPT && (write ? !mm_check_read(addr, sqe->len) : !mm_check_write(addr, sqe->len)))
+		return -EFAULT;
+
+	struct io_uring_request *req;
+	HANDLE handle = socket_file_get_overlapped_handle(f, io_uring_port);
+	if (handle)
+	{
+		/* MSG_* flags are only handled by the file operations */
+		if ((sqe->opcode == IORING_OP_SEND || sqe->opcode == IORING_OP_RECV) && sqe->msg_flags)
+			return 0;
+		req = io_uring_alloc_request(ring, sqe, f, IO_URING_REQUEST_SOCKET);
+		req->handle = handle;
+		req->overlapped.Internal = STATUS_PENDING;
+		req->overlapped.hEvent = ring->event;
+		int r;
+		if (sqe->opcode == IORING_OP_ACCEPT)
+			r = socket_file_accept_overlapped(f, &req->accept, &req->overlapped);
+		else if (write)
+			r = socket_file_send_overlapped(f, addr, sqe->len, &req->overlapped);
+		else
+			r = socket_file_recv_overlapped(f, addr, sqe->len, &req->overlapped);
+		if (r < 0)
+		{
+			io_uring_free_request(req);
+			return r;
+		}
+		return 1;
+	}
+
+	/* Socket operations on other files fail in the file operations, so do accesses at the current
+	 * position and appending writes, which need the file position */
+	if (sqe->opcode == IORING_OP_SEND || sqe->opcode == IORING_OP_RECV || sqe->opcode == IORING_OP_ACCEPT)
+		return 0;
+	if (sqe->off == (uint64_t)-1 || (write && (f->flags & O_APPEND)))
+		return 0;
+	if (!(handle = winfs_get_overlapped_handle(f, io_uring_port)))
+		return 0;
+	req = io_uring_alloc_request(ring, sqe, f, IO_URING_REQUEST_OVERLAPPED);
+	req->handle = handle;
+	req->overlapped.Internal = STATUS_PENDING;
+	req->overlapped.Offset = sqe->off & 0xFFFFFFFF;
+	req->overlapped.OffsetHigh = sqe->off >> 32ULL;
+	req->overlapped.hEvent = ring->event;
+	DWORD count = (DWORD)min(sqe->len, (uint32_t)INT_MAX);
+	if (write)
+		winfs_cache_invalidate();
+	if (!(write ? WriteFile(handle, addr, count, NULL, &req->overlapped) : ReadFile(handle, addr, count, NULL, &req->overlapped))
+		&& GetLastError() != ERROR_IO_PENDING)
+	{
+		/* No packet is queued, e.g. at end of file, leave it to the file operations */
+		io_uring_free_request(req);
+		return 0;
+	}
+	return 1;
+}
+
+/* Handle the completion packet of a request */
+static void io_uring_handle_packet(struct io_uring_request *req)
+{
+	struct io_uring_file *ring = req->ring;
+	if (!ring)
+	{
+		/* The ring is closed */
+		if (req->type == IO_URING_REQUEST_SOCKET && req->sqe.opcode == IORING_OP_ACCEPT)
+			socket_file_discard_accept(&req->accept);
+		io_uring_free_request(req);
+		return;
+	}
+	int32_t res;
+	switch (req->type)
+	{
+	case IO_URING_REQUEST_POLL:
+	{
+		UnregisterWaitEx(req->handle, NULL);
+		req->handle = NULL;
+		int e = io_uring_poll_file(req->f);
+		if (!(e & (req->events | LINUX_POLLERR | LINUX_POLLHUP)))
+		{
+			/* Another request or a poll() consumed the readiness, wait again */
+			if (io_uring_arm_poll(req))
+				return;
+			res = -ENOMEM;
+		}
+		else
+			res = io_uring_execute(ring, &req->sqe, req->f, e);
+		break;
+	}
+
+	case IO_URING_REQUEST_OVERLAPPED:
+	{
+		DWORD bytes;
+		if (GetOverlappedResult(req->handle, &req->overlapped, &bytes, FALSE))
+			res = (int32_t)bytes;
+		else if (GetLastError() == ERROR_HANDLE_EOF)
+			res = 0;
+		else if (GetLastError() == ERROR_OPERATION_ABORTED)
+			res = -ECANCELED;
+		else
+		{
+			log_warning("io_uring: Overlapped operation failed, error code: %d\n", GetLastError());
+			res = -EIO;
+		}
+		/* Reads of the written range may have been cached before the write finished */
+		if (req->sqe.opcode == IORING_OP_WRITE || req->sqe.opcode == IORING_OP_WRITE_FIXED)
+			winfs_cache_invalidate();
+		break;
+	}
+
+	case IO_URING_REQUEST_SOCKET:
+		if (req->sqe.opcode == IORING_OP_ACCEPT)
+			res = socket_file_accept_result(req->f, &req->accept, &req->overlapped,
+				(struct sockaddr *)(uintptr_t)req->sqe.addr, (int *)(uintptr_t)req->sqe.addr2, req->sqe.accept_flags);
+		else
+			res = socket_file_overlapped_result(req->f, &req->overlapped);
+		break;
+
+	default:
+		log_error("io_uring: Unexpected completion packet.\n");
+		return;
+	}
+	io_uring_finish_request(req, res);
+}
+
+/* Stop an in flight request without posting a completion */
+static void io_uring_stop_request(struct io_uring_request *req)
+{
+	if (req->type == IO_URING_REQUEST_POLL && req->handle)
+	{
+		/* Waits for a running callback */
+		UnregisterWaitEx(req->handle, INVALID_HANDLE_VALUE);
+		req->handle = NULL;
+	}
+	if (req->type == IO_URING_REQUEST_TIMEOUT || (req->type == IO_URING_REQUEST_POLL && !req->fired))
+		io_uring_free_request(req);
+	else
+	{
+		/* A completion packet is or will be queued, the request is freed then */
+		if (req->type != IO_URING_REQUEST_POLL)
+			CancelIoEx(req->handle, &req->overlapped);
+		io_uring_unlink_request(req);
+	}
+}
+
+/* Cancel an in flight request by user_data, timeouts only cancels timeouts */
+static int32_t io_uring_cancel(struct io_uring_file *ring, uint64_t user_data, int timeouts)
+{
+	for (struct io_uring_request *req = ring->requests; req; req = req->next)
+	{
+		if (req->sqe.user_data == user_data && timeouts == (req->sqe.opcode == IORING_OP_TIMEOUT))
+		{
+			if (req->type == IO_URING_REQUEST_OVERLAPPED || req->type == IO_URING_REQUEST_SOCKET)
+			{
+				/* It completes with -ECANCELED, unless it finishes first */
+				CancelIoEx(req->handle, &req->overlapped);
+				return -EALREADY;
+			}
+			uring_post(&ring->uring, user_data, -ECANCELED);
+			io_uring_stop_request(req);
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+/* Handle the completion packets of all rings without waiting, then expire the timeouts of ring */
+static void io_uring_process(struct io_uring_file *ring)
+{
+	if (io_uring_port)
+	{
+		OVERLAPPED_ENTRY entries[64];
+		ULONG count;
+		while (GetQueuedCompletionStatusEx(io_uring_port, entries, 64, &count, 0, FALSE))
+		{
+			for (ULONG i = 0; i < count; i++)
+				io_uring_handle_packet(container_of(entries[i].lpOverlapped, struct io_uring_request, overlapped));
+			if (count < 64)
+				break;
+		}
+	}
+	/* The completion of a timeout may satisfy another one */
+	int progress;
+	do
+	{
+		progress = 0;
+		uint64_t now = GetTickCount64();
+		struct io_uring_request *next;
+		for (struct io_uring_request *req = ring->requests; req; req = next)
+		{
+			next = req->next;
+			if (req->type != IO_URING_REQUEST_TIMEOUT)
+				continue;
+			int32_t res;
+			if (req->sqe.off && ring->uring.completions - req->start >= req->sqe.off)
+				res = 0;
+			else if (now >= req->deadline)
+				res = -ETIME;
+			else
+				continue;
+			io_uring_finish_request(req, res);
+			progress = 1;
+		}
+	} while (progress);
+	io_uring_notify(ring);
+}
+
+/* Whether a request of ring finished but its completion packet is not handled yet */
+static int io_uring_completing(struct io_uring_file *ring)
+{
+	for (struct io_uring_request *req = ring->requests; req; req = req->next)
+	{
+		if (req->type == IO_URING_REQUEST_POLL ? req->fired :
+			req->type != IO_URING_REQUEST_TIMEOUT && HasOverlappedIoCompleted(&req->overlapped))
+			return 1;
+	}
+	return 0;
+}
+
+/* Wait until a request of ring makes progress or the nearest timeout expires, returns 0 if interrupted */
+static int io_uring_wait(struct io_uring_file *ring)
+{
+	uint64_t deadline = (uint64_t)-1;
+	for (struct io_uring_request *req = ring->requests; req; req = req->next)
+		if (req->type == IO_URING_REQUEST_TIMEOUT)
+			deadline = min(deadline, req->deadline);
+	DWORD timeout = INFINITE;
+	if (io_uring_completing(ring))
+		timeout = 0;
+	else if (deadline != (uint64_t)-1)
+	{
+		uint64_t now = GetTickCount64();
+		timeout = now >= deadline ? 0 : (DWORD)min(deadline - now, INFINITE - 1);
+	}
+	return signal_wait(1, &ring->event, timeout) != WAIT_INTERRUPTED;
+}
+
+/* Submit a request, returns 1 and the result if it completes immediately */
+static int io_uring_submit(struct io_uring_file *ring, const struct io_uring_sqe *sqe, int may_defer, int32_t *res)
+{
+	switch (sqe->opcode)
+	{
+	case IORING_OP_TIMEOUT:
+	{
+		const struct __kernel_timespec *ts = (const struct __kernel_timespec *)(uintptr_t)sqe->addr;
+		if (sqe->len != 1 || (sqe->timeout_flags & IORING_TIMEOUT_ABS))
+			goto invalid;
+		if (!mm_check_read(ts, sizeof(struct __kernel_timespec)))
+		{
+			*res = -EFAULT;
+			return 1;
+		}
+		struct io_uring_request *req = io_uring_alloc_request(ring, sqe, NULL, IO_URING_REQUEST_TIMEOUT);
+		req->deadline = GetTickCount64() + ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+		return 0;
+	}
+
+	case IORING_OP_TIMEOUT_REMOVE:
+		*res = io_uring_cancel(ring, sqe->addr, 1);
+		return 1;
+
+	case IORING_OP_POLL_REMOVE:
+	case IORING_OP_ASYNC_CANCEL:
+		*res = io_uring_cancel(ring, sqe->addr, 0);
+		return 1;
+
+	case IORING_OP_CLOSE:
+		if (sqe->flags & IOSQE_FIXED_FILE)
+			goto invalid;
+		*res = (int32_t)sys_close(sqe->fd);
+		return 1;
+
+	case IORING_OP_NOP:
+		*res = 0;
+		return 1;
+
+	case IORING_OP_ACCEPT:
+		if (sqe->accept_flags & ~(O_NONBLOCK | O_CLOEXEC))
+			goto invalid;
+		break;
+	}
+
+	struct file *f = io_uring_get_file(ring, sqe);
+	if (!f)
+	{
+		*res = -EBADF;
+		return 1;
+	}
+	/* The completion port is created again after fork */
+	if (may_defer && !io_uring_get_port())
+		may_defer = 0;
+	if (may_defer)
+	{
+		int r = io_uring_start_overlapped(ring, sqe, f);
+		if (r < 0)
+		{
+			*res = r;
+			return 1;
+		}
+		if (r > 0)
+			return 0;
+	}
+	int events = io_uring_wait_events(sqe);
+	int e = events ? io_uring_poll_file(f) : -1;
+	if (e >= 0 && !(e & (events | LINUX_POLLERR | LINUX_POLLHUP)))
+	{
+		/* Not ready */
+		if (may_defer && f->op_vtable->get_poll_handle)
+		{
+			struct io_uring_request *req = io_uring_alloc_request(ring, sqe, f, IO_URING_REQUEST_POLL);
+			req->events = events;
+			if (io_uring_arm_poll(req))
+				return 0;
+			io_uring_free_request(req);
+		}
+		if (sqe->opcode == IORING_OP_POLL_ADD)
+		{
+			/* Block until ready */
+			int unused;
+			HANDLE handle = f->op_vtable->get_poll_handle ? f->op_vtable->get_poll_handle(f, &unused) : NULL;
+			while (!(e & (events | LINUX_POLLERR | LINUX_POLLHUP)))
+			{
+				if (!handle || signal_wait(1, &handle, INFINITE) == WAIT_INTERRUPTED)
+				{
+					*res = -EINTR;
+					return 1;
+				}
+				e = io_uring_poll_file(f);
+			}
+		}
+		/* Otherwise the operation itself blocks */
+	}
+	if (e < 0)
+		e = LINUX_POLLIN | LINUX_POLLOUT; /* Regular files are always ready */
+	*res = io_uring_execute(ring, sqe, f, e);
+	return 1;
+
+invalid:
+	*res = -EINVAL;
+	return 1;
+}
+
+static int io_uring_submit_all(struct io_uring_file *ring, uint32_t to_submit)
+{
+	struct uring_submit submit;
+	struct io_uring_sqe sqe;
+	int linked;
+	uring_submit_begin(&submit, &ring->uring, to_submit);
+	while (uring_submit_next(&submit, &sqe, &linked))
+	{
+		/* Requests in a link chain are executed in order, they can not be deferred */
+		int32_t res;
+		if (io_uring_submit(ring, &sqe, !linked, &res))
+			uring_submit_complete(&submit, &sqe, res);
+	}
+	return (int)uring_submit_end(&submit);
+}
+
+static int io_uring_close(struct file *f)
+{
+	struct io_uring_file *ring = (struct io_uring_file *)f;
+	while (ring->requests)
+		io_uring_stop_request(ring->requests);
+	for (int i = 0; i < ring->files_count; i++)
+		if (ring->files[i])
+			vfs_release(ring->files[i]);
+	if (ring->files)
+		kfree(ring->files, ring->files_count * sizeof(struct file *));
+	if (ring->buffers)
+		kfree(ring->buffers, ring->buffers_count * sizeof(struct iovec));
+	if (ring->eventfd)
+		vfs_release(ring->eventfd);
+	UnmapViewOfFile(ring->view);
+	CloseHandle(ring->section);
+	CloseHandle(ring->event);
+	kfree(ring, sizeof(struct io_uring_file));
+	return 0;
+}
+
+static int io_uring_get_poll_status(struct file *f)
+{
+	struct io_uring_file *ring = (struct io_uring_file *)f;
+	ResetEvent(ring->event);
+	io_uring_process(ring);
+	if (uring_cq_ready(&ring->uring) > 0)
+	{
+		SetEvent(ring->event);
+		return LINUX_POLLIN | LINUX_POLLOUT;
+	}
+	/* Keep the poll handle signaled until the packet on its way is handled */
+	if (io_uring_completing(ring))
+		SetEvent(ring->event);
+	return LINUX_POLLOUT;
+}
+
+static HANDLE io_uring_get_poll_handle(struct file *f, int *poll_events)
+{
+	struct io_uring_file *ring = (struct io_uring_file *)f;
+	*poll_events = LINUX_POLLIN;
+	return ring->event;
+}
+
+static void io_uring_after_fork(struct file *f)
+{
+	struct io_uring_file *ring = (struct io_uring_file *)f;
+	/* In flight requests belong to the parent, which will complete them */
+	while (ring->requests)
+		io_uring_free_request(ring->requests);
+	io_uring_map(ring);
+	ring->event = CreateEventW(NULL, TRUE, uring_cq_ready(&ring->uring) > 0, NULL);
+}
+
+static HANDLE io_uring_get_section(struct file *f, loff_t offset, loff_t *section_offset)
+{
+	struct io_uring_file *ring = (struct io_uring_file *)f;
+	if (offset >= IORING_OFF_SQES)
+	{
+		if (offset - IORING_OFF_SQES >= ring->sqes_size)
+			return NULL;
+		*section_offset = ring->sqes_offset + (offset - IORING_OFF_SQES);
+	}
+	else if (offset >= IORING_OFF_CQ_RING)
+	{
+		if (offset - IORING_OFF_CQ_RING >= ring->cq_size)
+			return NULL;
+		*section_offset = ring->cq_offset + (offset - IORING_OFF_CQ_RING);
+	}
+	else
+	{
+		if (offset >= ring->sq_size)
+			return NULL;
+		*section_offset = offset;
+	}
+	return ring->section;
+}
+
+static const struct file_ops io_uring_ops = {
+	.get_poll_status = io_uring_get_poll_status,
+	.get_poll_handle = io_uring_get_poll_handle,
+	.after_fork = io_uring_after_fork,
+	.close = io_uring_close,
+	.get_section = io_uring_get_section,
+};
+
+DEFINE_SYSCALL(io_uring_setup, uint32_t, entries, struct io_uring_params *, params)
+{
+	log_info("io_uring_setup(%u, %p)\n", entries, params);
+	if (!mm_check_write(params, sizeof(struct io_uring_params)))
+		return -EFAULT;
+	if (params->flags & ~(IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP))
+	{
+		log_error("io_uring: Unsupported flags: %x\n", params->flags);
+		return -EINVAL;
+	}
+	if (entries == 0)
+		return -EINVAL;
+	if (entries > IO_URING_MAX_ENTRIES)
+	{
+		if (!(params->flags & IORING_SETUP_CLAMP))
+			return -EINVAL;
+		entries = IO_URING_MAX_ENTRIES;
+	}
+	uint32_t sq_entries = round_up_pow2(entries);
+	uint32_t cq_entries = 2 * sq_entries;
+	if (params->flags & IORING_SETUP_CQSIZE)
+	{
+		if (params->cq_entries == 0)
+			return -EINVAL;
+		if (params->cq_entries > 2 * IO_URING_MAX_ENTRIES)
+		{
+			if (!(params->flags & IORING_SETUP_CLAMP))
+				return -EINVAL;
+			params->cq_entries = 2 * IO_URING_MAX_ENTRIES;
+		}
+		cq_entries = round_up_pow2(params->cq_entries);
+		if (cq_entries < sq_entries)
+			return -EINVAL;
+	}
+
+	if (!io_uring_get_port())
+		return -ENOMEM;
+	struct io_uring_file *ring = (struct io_uring_file *)kmalloc(sizeof(struct io_uring_file));
+	ring->sq_size = uring_sq_size(sq_entries);
+	ring->cq_size = uring_cq_size(cq_entries);
+	ring->sqes_size = sq_entries * sizeof(struct io_uring_sqe);
+	ring->cq_offset = ALIGN_TO(ring->sq_size, BLOCK_SIZE);
+	ring->sqes_offset = ring->cq_offset + ALIGN_TO(ring->cq_size, BLOCK_SIZE);
+	ring->section_size = ring->sqes_offset + ALIGN_TO(ring->sqes_size, BLOCK_SIZE);
+
+	SECURITY_ATTRIBUTES attr;
+	attr.nLength = sizeof(SECURITY_ATTRIBUTES);
+	attr.lpSecurityDescriptor = NULL;
+	attr.bInheritHandle = TRUE;
+	ring->section = CreateFileMappingW(INVALID_HANDLE_VALUE, &attr, PAGE_EXECUTE_READWRITE, 0, (DWORD)ring->section_size, NULL);
+	if (!ring->section)
+	{
+		log_error("io_uring: CreateFileMappingW() failed, error code: %d\n", GetLastError());
+		kfree(ring, sizeof(struct io_uring_file));
+		return -ENOMEM;
+	}
+	if (!io_uring_map(ring))
+	{
+		CloseHandle(ring->section);
+		kfree(ring, sizeof(struct io_uring_file));
+		return -ENOMEM;
+	}
+	ring->base_file.op_vtable = &io_uring_ops;
+	ring->base_file.ref = 1;
+	ring->base_file.flags = O_RDWR;
+	/* The section is zero initialized */
+	uring_init(&ring->uring, ring->view, ring->view + ring->cq_offset, (struct io_uring_sqe *)(ring->view + ring->sqes_offset), sq_entries, cq_entries);
+	ring->notified = 0;
+	ring->event = CreateEventW(NULL, TRUE, FALSE, NULL);
+	ring->eventfd = NULL;
+	ring->requests = NULL;
+	ring->files_count = 0;
+	ring->files = NULL;
+	ring->buffers_count = 0;
+	ring->buffers = NULL;
+
+	memset(params->resv, 0, sizeof(params->resv));
+	params->sq_entries = sq_entries;
+	params->cq_entries = cq_entries;
+	params->features = IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_RW_CUR_POS;
+	params->sq_off.head = offsetof(struct uring_sq, head);
+	params->sq_off.tail = offsetof(struct uring_sq, tail);
+	params->sq_off.ring_mask = offsetof(struct uring_sq, ring_mask);
+	params->sq_off.ring_entries = offsetof(struct uring_sq, ring_entries);
+	params->sq_off.flags = offsetof(struct uring_sq, flags);
+	params->sq_off.dropped = offsetof(struct uring_sq, dropped);
+	params->sq_off.array = offsetof(struct uring_sq, array);
+	params->sq_off.resv1 = 0;
+	params->sq_off.resv2 = 0;
+	params->cq_off.head = offsetof(struct uring_cq, head);
+	params->cq_off.tail = offsetof(struct uring_cq, tail);
+	params->cq_off.ring_mask = offsetof(struct uring_cq, ring_mask);
+	params->cq_off.ring_entries = offsetof(struct uring_cq, ring_entries);
+	params->cq_off.overflow = offsetof(struct uring_cq, overflow);
+	params->cq_off.cqes = offsetof(struct uring_cq, cqes);
+	params->cq_off.flags = offsetof(struct uring_cq, flags);
+	params->cq_off.resv1 = 0;
+	params->cq_off.resv2 = 0;
+
+	int fd = vfs_store_file((struct file *)ring, 1);
+	if (fd < 0)
+		vfs_release((struct file *)ring);
+	return fd;
+}
+
+static struct io_uring_file *get_io_uring(int fd)
+{
+	struct file *f = vfs_get(fd);
+	if (!f || f->op_vtable != &io_uring_ops)
+		return NULL;
+	return (struct io_uring_file *)f;
+}
+
+DEFINE_SYSCALL(io_uring_enter, int, fd, uint32_t, to_submit, uint32_t, min_complete, uint32_t, flags, const void *, sig, size_t, sigsz)
+{
+	log_info("io_uring_enter(%d, %u, %u, %x, %p, %u)\n", fd, to_submit, min_complete, flags, sig, sigsz);
+	struct io_uring_file *ring = get_io_uring(fd);
+	if (!ring)
+		return -EBADF;
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP | IORING_ENTER_SQ_WAIT))
+		return -EINVAL;
+	if (sig)
+		log_warning("io_uring: Signal mask not supported.\n");
+	int submitted = io_uring_submit_all(ring, to_submit);
+	io_uring_process(ring);
+	if (flags & IORING_ENTER_GETEVENTS)
+	{
+		min_complete = min(min_complete, ring->uring.cq_entries);
+		for (;;)
+		{
+			ResetEvent(ring->event);
+			io_uring_process(ring);
+			if (uring_cq_ready(&ring->uring) >= min_complete || !ring->requests)
+				break;
+			if (!io_uring_wait(ring))
+				return submitted > 0 ? submitted : -EINTR;
+		}
+	}
+	return submitted;
+}
+
+DEFINE_SYSCALL(io_uring_register, int, fd, uint32_t, opcode, void *, arg, uint32_t, nr_args)
+{
+	log_info("io_uring_register(%d, %u, %p, %u)\n", fd, opcode, arg, nr_args);
+	struct io_uring_file *ring = get_io_uring(fd);
+	if (!ring)
+		return -EBADF;
+	switch (opcode)
+	{
+	case IORING_REGISTER_BUFFERS:
+	{
+		if (ring->buffers)
+			return -EBUSY;
+		if (nr_args == 0 || nr_args > IO_URING_MAX_BUFFERS)
+			return -EINVAL;
+		if (!mm_check_read(arg, nr_args * sizeof(struct iovec)))
+			return -EFAULT;
+		const struct iovec *iov = (const struct iovec *)arg;
+		for (uint32_t i = 0; i < nr_args; i++)
+			if (!mm_check_write(iov[i].iov_base, iov[i].iov_len))
+				return -EFAULT;
+		ring->buffers = (struct iovec *)kmalloc(nr_args * sizeof(struct iovec));
+		memcpy(ring->buffers, iov, nr_args * sizeof(struct iovec));
+		ring->buffers_count = nr_args;
+		return 0;
+	}
+
+	case IORING_UNREGISTER_BUFFERS:
+		if (!ring->buffers)
+			return -ENXIO;
+		kfree(ring->buffers, ring->buffers_count * sizeof(struct iovec));
+		ring->buffers = NULL;
+		ring->buffers_count = 0;
+		return 0;
+
+	case IORING_REGISTER_FILES:
+	{
+		if (ring->files)
+			return -EBUSY;
+		if (nr_args == 0 || nr_args > IO_URING_MAX_FILES)
+			return -EINVAL;
+		if (!mm_check_read(arg, nr_args * sizeof(int32_t)))
+			return -EFAULT;
+		const int32_t *fds = (const int32_t *)arg;
+		struct file **files = (struct file **)kmalloc(nr_args * sizeof(struct file *));
+		for (uint32_t i = 0; i < nr_args; i++)
+		{
+			if (fds[i] == -1)
+				files[i] = NULL;
+			else if (!(files[i] = vfs_get(fds[i])) || files[i] == (struct file *)ring)
+			{
+				for (uint32_t j = 0; j < i; j++)
+					if (files[j])
+						vfs_release(files[j]);
+				kfree(files, nr_args * sizeof(struct file *));
+				return -EBADF;
+			}
+			else
+				vfs_ref(files[i]);
+		}
+		ring->files = files;
+		ring->files_count = nr_args;
+		return 0;
+	}
+
+	case IORING_UNREGISTER_FILES:
+		if (!ring->files)
+			return -ENXIO;
+		for (int i = 0; i < ring->files_count; i++)
+			if (ring->files[i])
+				vfs_release(ring->files[i]);
+		kfree(ring->files, ring->files_count * sizeof(struct file *));
+		ring->files = NULL;
+		ring->files_count = 0;
+		return 0;
+
+	case IORING_REGISTER_EVENTFD:
+	case IORING_REGISTER_EVENTFD_ASYNC:
+	{
+		if (ring->eventfd)
+			return -EBUSY;
+		if (nr_args != 1)
+			return -EINVAL;
+		if (!mm_check_read(arg, sizeof(int32_t)))
+			return -EFAULT;
+		struct file *f = vfs_get(*(int32_t *)arg);
+		if (!f || !f->op_vtable->write)
+			return -EBADF;
+		vfs_ref(f);
+		ring->eventfd = f;
+		return 0;
+	}
+
+	case IORING_UNREGISTER_EVENTFD:
+		if (!ring->eventfd)
+			return -ENXIO;
+		vfs_release(ring->eventfd);
+		ring->eventfd = NULL;
+		return 0;
+
+	case IORING_REGISTER_PROBE:
+	{
+		struct io_uring_probe *probe = (struct io_uring_probe *)arg;
+		if (nr_args > 256)
+			return -EINVAL;
+		size_t size = sizeof(struct io_uring_probe) + nr_args * sizeof(struct io_uring_probe_op);
+		if (!mm_check_write(probe, size))
+			return -EFAULT;
+		memset(probe, 0, size);
+		probe->last_op = IORING_OP_LAST - 1;
+		probe->ops_len = (uint8_t)min(nr_args, IORING_OP_LAST);
+		for (int i = 0; i < probe->ops_len; i++)
+		{
+			probe->ops[i].op = i;
+			switch (i)
+			{
+			case IORING_OP_NOP: case IORING_OP_READV: case IORING_OP_WRITEV: case IORING_OP_FSYNC:
+			case IORING_OP_READ_FIXED: case IORING_OP_WRITE_FIXED: case IORING_OP_POLL_ADD:
+			case IORING_OP_POLL_REMOVE: case IORING_OP_SYNC_FILE_RANGE: case IORING_OP_SENDMSG:
+			case IORING_OP_RECVMSG: case IORING_OP_TIMEOUT: case IORING_OP_TIMEOUT_REMOVE:
+			case IORING_OP_ASYNC_CANCEL: case IORING_OP_CLOSE: case IORING_OP_READ: case IORING_OP_WRITE:
+			case IORING_OP_FADVISE: case IORING_OP_SEND: case IORING_OP_RECV: case IORING_OP_ACCEPT:
+				probe->ops[i].flags = IO_URING_OP_SUPPORTED;
+			}
+		}
+		return 0;
+	}
+
+	default:
+		log_error("io_uring: Unsupported register opcode: %u\n", opcode);
+		return -EINVAL;
+	}
+}
@@ -0,0 +1,1064 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <common/errno.h>
+#include <common/fcntl.h>
+#include <common/ioctls.h>
+#include <common/poll.h>
+#include <common/termios.h>
+#include <fs/pty.h>
+#include <syscall/mm.h>
+#include <syscall/process.h>
+#include <syscall/sig.h>
+#include <heap.h>
+#include <log.h>
+#include <str.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <stdbool.h>
+
+/* _IOR()/_IOW() are not available, these are their expanded values */
+#define PTY_TIOCGPTN		0x80045430
+#define PTY_TIOCSPTLCK		0x40045431
+#define PTY_TIOCSIG			0x40045436
+#define PTY_TIOCGPTLCK		0x80045439
+/* FIONREAD is commented out in common/ioctls.h as it clashes with winsock */
+#define PTY_FIONREAD		0x541B
+
+#define PTY_MAX				64
+#define PTY_BUF_SIZE		4096
+#define PTY_MAX_LINES		64
+#define PTY_SIGNAL_LOG		16
+
+#define PTY_MASTER_MAJOR	5
+#define PTY_MASTER_MINOR	2
+#define PTY_SLAVE_MAJOR		136
+
+/* A pseudo terminal pair lives in a named section shared by every process holding either end.
+ * The master and slave ends exchange data through two byte queues:
+ *   input: written by the master through the line discipline, read by the slave
+ *   output: written by the slave through output processing, read by the master
+ * In canonical mode the completed lines in the input queue are recorded in line_end[],
+ * the bytes after the last completed line form the line being edited.
+ * All fields are protected by the pty mutex.
+ *
+ * Signals generated by the line discipline (ISIG characters, TIOCSIG, window size changes)
+ * are appended to signal_log[]. As we can not signal other processes, every slave end in the
+ * foreground process group picks them up and delivers them to itself on its next read, write or
+ * poll. A blocked slave reader is woken up by the signal event of the next serial, the two events
+ * are alternated so a waiter never sees a stale signaled event.
+ */
+struct pty_queue
+{
+	uint32_t head, tail;
+	char buf[PTY_BUF_SIZE];
+};
+
+struct pty_signal
+{
+	int sig;
+	pid_t pgrp;
+};
+
+struct pty_shared
+{
+	struct termios termios;
+	struct winsize winsize;
+	pid_t fg_pgrp;
+	int locked;
+	int master_count, slave_count;
+	int slave_opened;
+	uint32_t signal_serial;
+	struct pty_signal signal_log[PTY_SIGNAL_LOG];
+	uint32_t line_head, line_tail;
+	uint32_t line_end[PTY_MAX_LINES];
+	struct pty_queue input;
+	struct pty_queue output;
+};
+
+struct pty_handles
+{
+	HANDLE section;
+	HANDLE mutex;
+	HANDLE master_readable;
+	HANDLE master_writable;
+	HANDLE slave_readable;
+	HANDLE slave_writable;
+	HANDLE signal[2];
+};
+
+struct pty_file
+{
+	struct file base_file;
+	struct pty_shared *shared;
+	struct pty_handles h;
+	int index;
+	int is_master;
+};
+
+struct pty_registry
+{
+	volatile LONG bitmap[PTY_MAX / 32];
+};
+
+static struct pty_registry *pty_registry;
+/* Last signal serial seen by this process on each pty */
+static uint32_t pty_signal_seen[PTY_MAX];
+
+static const struct file_ops pty_ops;
+
+void pty_init()
+{
+	pty_registry = (struct pty_registry *)mm_global_shared_alloc(sizeof(struct pty_registry));
+}
+
+static void pty_object_name(WCHAR *name, int index, const char *suffix)
+{
+	char buf[64];
+	ksprintf(buf, "flinux_pty%d_%s", index, suffix);
+	for (int i = 0;; i++)
+		if (!(name[i] = buf[i]))
+			break;
+}
+
+static void pty_close_handles(struct pty_handles *h)
+{
+	HANDLE *handles = (HANDLE *)h;
+	for (int i = 0; i < sizeof(struct pty_handles) / sizeof(HANDLE); i++)
+		if (handles[i])
+			CloseHandle(handles[i]);
+}
+
+/* Create (create == TRUE) or open the named objects of a pty */
+static int pty_get_handles(int index, BOOL create, struct pty_handles *h)
+{
+	static const char *const event_names[] = { "mr", "mw", "sr", "sw", "sig0", "sig1" };
+	SECURITY_ATTRIBUTES attr;
+	attr.nLength = sizeof(SECURITY_ATTRIBUTES);
+	attr.lpSecurityDescriptor = NULL;
+	attr.bInheritHandle = TRUE;
+	WCHAR name[64];
+
+	memset(h, 0, sizeof(struct pty_handles));
+	pty_object_name(name, index, "section");
+	if (create)
+		h->section = CreateFileMappingW(INVALID_HANDLE_VALUE, &attr, PAGE_READWRITE, 0, sizeof(struct pty_shared), name);
+	else
+		h->section = OpenFileMappingW(FILE_MAP_ALL_ACCESS, TRUE, name);
+	pty_object_name(name, index, "mutex");
+	if (create)
+		h->mutex = CreateMutexW(&attr, FALSE, name);
+	else
+		h->mutex = OpenMutexW(SYNCHRONIZE | MUTEX_MODIFY_STATE, TRUE, name);
+	HANDLE *events = &h->master_readable;
+	for (int i = 0; i < 6; i++)
+	{
+		pty_object_name(name, index, event_names[i]);
+		if (create)
+			events[i] = CreateEventW(&attr, TRUE, FALSE, name);
+		else
+			events[i] = OpenEventW(SYNCHRONIZE | EVENT_MODIFY_STATE, TRUE, name);
+	}
+	HANDLE *handles = (HANDLE *)h;
+	for (int i = 0; i < sizeof(struct pty_handles) / sizeof(HANDLE); i++)
+		if (!handles[i])
+		{
+			log_error("pty: Creating or opening objects of pty %d failed, error code: %d\n", index, GetLastError());
+			pty_close_handles(h);
+			return -EIO;
+		}
+	return 0;
+}
+
+static void pty_lock(struct pty_file *pty)
+{
+	WaitForSingleObject(pty->h.mutex, INFINITE);
+}
+
+static void pty_unlock(struct pty_file *pty)
+{
+	ReleaseMutex(pty->h.mutex);
+}
+
+static uint32_t queue_used(struct pty_queue *q)
+{
+	return q->tail - q->head;
+}
+
+static uint32_t queue_free(struct pty_queue *q)
+{
+	return PTY_BUF_SIZE - (q->tail - q->head);
+}
+
+static void queue_put(struct pty_queue *q, char ch)
+{
+	q->buf[q->tail++ % PTY_BUF_SIZE] = ch;
+}
+
+/* Copy out up to count bytes from the queue head */
+static size_t queue_get(struct pty_queue *q, char *buf, size_t count)
+{
+	size_t n = min(count, queue_used(q));
+	for (size_t i = 0; i < n; i++)
+		buf[i] = q->buf[q->head++ % PTY_BUF_SIZE];
+	return n;
+}
+
+/* Start of the line being edited in canonical mode */
+static uint32_t pty_edit_start(struct pty_shared *s)
+{
+	if (s->line_head != s->line_tail)
+		return s->line_end[(s->line_tail - 1) % PTY_MAX_LINES];
+	return s->input.head;
+}
+
+/* Number of bytes the slave can read without blocking, -1 for an empty line (end of file) */
+static int pty_input_available(struct pty_shared *s)
+{
+	if (s->termios.c_lflag & ICANON)
+	{
+		if (s->line_head == s->line_tail)
+			return 0;
+		uint32_t n = s->line_end[s->line_head % PTY_MAX_LINES] - s->input.head;
+		return n == 0 ? -1 : n;
+	}
+	return queue_used(&s->input);
+}
+
+static void pty_flush_input(struct pty_shared *s)
+{
+	s->input.head = s->input.tail;
+	s->line_head = s->line_tail;
+}
+
+static void pty_flush_output(struct pty_shared *s)
+{
+	s->output.head = s->output.tail;
+}
+
+static void pty_set_event(HANDLE event, int signaled)
+{
+	if (signaled)
+		SetEvent(event);
+	else
+		ResetEvent(event);
+}
+
+/* Bring the state events in line with the shared state, call with the pty locked */
+static void pty_update_events(struct pty_file *pty)
+{
+	struct pty_shared *s = pty->shared;
+	pty_set_event(pty->h.master_readable, queue_used(&s->output) > 0 || (s->slave_opened && s->slave_count == 0));
+	pty_set_event(pty->h.master_writable, queue_free(&s->input) > 0 || (s->termios.c_lflag & ICANON));
+	pty_set_event(pty->h.slave_readable, pty_input_available(s) != 0 || s->master_count == 0);
+	pty_set_event(pty->h.slave_writable, queue_free(&s->output) >= 2 || s->master_count == 0);
+}
+
+/* Queue a signal for the foreground process group, call with the pty locked */
+static void pty_post_signal(struct pty_file *pty, int sig)
+{
+	struct pty_shared *s = pty->shared;
+	if (s->fg_pgrp == 0)
+		return;
+	uint32_t serial = ++s->signal_serial;
+	s->signal_log[serial % PTY_SIGNAL_LOG].sig = sig;
+	s->signal_log[serial % PTY_SIGNAL_LOG].pgrp = s->fg_pgrp;
+	ResetEvent(pty->h.signal[(serial + 1) & 1]);
+	SetEvent(pty->h.signal[serial & 1]);
+}
+
+/* Deliver signals queued for our process group since the last check, call with the pty locked */
+static void pty_deliver_signals(struct pty_file *pty)
+{
+	struct pty_shared *s = pty->shared;
+	uint32_t seen = pty_signal_seen[pty->index];
+	if (seen == s->signal_serial)
+		return;
+	if (s->signal_serial - seen > PTY_SIGNAL_LOG)
+		seen = s->signal_serial - PTY_SIGNAL_LOG;
+	pid_t pgrp = process_get_pgid(0);
+	while (seen != s->signal_serial)
+	{
+		seen++;
+		struct pty_signal *signal = &s->signal_log[seen % PTY_SIGNAL_LOG];
+		if (signal->pgrp == pgrp)
+		{
+			struct siginfo info;
+			info.si_signo = signal->sig;
+			info.si_code = 0;
+			info.si_errno = 0;
+			signal_kill(GetCurrentProcessId(), &info);
+		}
+	}
+	pty_signal_seen[pty->index] = seen;
+}
+
+/* Output processing, call with the pty locked and at least 2 bytes free in the output queue */
+static void pty_output_char(struct pty_shared *s, char ch)
+{
+	if (s->termios.c_oflag & OPOST)
+	{
+		if (ch == '\n' && (s->termios.c_oflag & ONLCR))
+		{
+			queue_put(&s->output, '\r');
+			queue_put(&s->output, '\n');
+			return;
+		}
+		if (ch == '\r' && (s->termios.c_oflag & OCRNL))
+			ch = '\n';
+	}
+	queue_put(&s->output, ch);
+}
+
+/* Echo a character, echoes are silently dropped if the master does not drain the output queue */
+static void pty_echo_char(struct pty_shared *s, char ch)
+{
+	if (queue_free(&s->output) < 2)
+		return;
+	if ((s->termios.c_lflag & ECHOCTL) && ((unsigned char)ch < 0x20 || ch == 0x7F) && ch != '\t' && ch != '\n')
+	{
+		queue_put(&s->output, '^');
+		queue_put(&s->output, ch ^ 0x40);
+	}
+	else
+		pty_output_char(s, ch);
+}
+
+static void pty_echo_string(struct pty_shared *s, const char *str)
+{
+	for (; *str; str++)
+		pty_output_char(s, *str);
+}
+
+/* Erase the last character of the edited line, return false if there is nothing to erase */
+static bool pty_erase_char(struct pty_shared *s)
+{
+	uint32_t start = pty_edit_start(s);
+	if (s->input.tail == start)
+		return false;
+	char ch;
+	do
+		ch = s->input.buf[--s->input.tail % PTY_BUF_SIZE];
+	while ((s->termios.c_iflag & IUTF8) && ((unsigned char)ch & 0xC0) == 0x80 && s->input.tail != start);
+	if ((s->termios.c_lflag & ECHO) && (s->termios.c_lflag & ECHOE) && queue_free(&s->output) >= 8)
+	{
+		pty_echo_string(s, "\b \b");
+		if ((s->termios.c_lflag & ECHOCTL) && ((unsigned char)ch < 0x20 || ch == 0x7F) && ch != '\t')
+			pty_echo_string(s, "\b \b");
+	}
+	return true;
+}
+
+static bool pty_is_char(struct pty_shared *s, char ch, int index)
+{
+	return s->termios.c_cc[index] != 0 && ch == s->termios.c_cc[index];
+}
+
+/* Feed a character written to the master through the line discipline, call with the pty locked */
+static void pty_input_char(struct pty_file *pty, char ch)
+{
+	struct pty_shared *s = pty->shared;
+	tcflag_t iflag = s->termios.c_iflag, lflag = s->termios.c_lflag;
+
+	if (iflag & ISTRIP)
+		ch &= 0x7F;
+	if (ch == '\r')
+	{
+		if (iflag & IGNCR)
+			return;
+		if (iflag & ICRNL)
+			ch = '\n';
+	}
+	else if (ch == '\n' && (iflag & INLCR))
+		ch = '\r';
+
+	if (lflag & ISIG)
+	{
+		int sig = 0;
+		if (pty_is_char(s, ch, VINTR))
+			sig = SIGINT;
+		else if (pty_is_char(s, ch, VQUIT))
+			sig = SIGQUIT;
+		else if (pty_is_char(s, ch, VSUSP))
+			sig = SIGTSTP;
+		if (sig)
+		{
+			if (!(lflag & NOFLSH))
+			{
+				pty_flush_input(s);
+				pty_flush_output(s);
+			}
+			if (lflag & ECHO)
+				pty_echo_char(s, ch);
+			pty_post_signal(pty, sig);
+			return;
+		}
+	}
+
+	if (lflag & ICANON)
+	{
+		if (pty_is_char(s, ch, VERASE))
+		{
+			pty_erase_char(s);
+			return;
+		}
+		if ((lflag & IEXTEN) && pty_is_char(s, ch, VWERASE))
+		{
+			uint32_t start = pty_edit_start(s);
+			while (s->input.tail != start && s->input.buf[(s->input.tail - 1) % PTY_BUF_SIZE] == ' ')
+				pty_erase_char(s);
+			while (s->input.tail != start && s->input.buf[(s->input.tail - 1) % PTY_BUF_SIZE] != ' ')
+				pty_erase_char(s);
+			return;
+		}
+		if (pty_is_char(s, ch, VKILL))
+		{
+			if ((lflag & ECHOKE) && (lflag & ECHOE))
+			{
+				while (pty_erase_char(s))
+					;
+				return;
+			}
+			s->input.tail = pty_edit_start(s);
+			if (lflag & ECHO)
+			{
+				pty_echo_char(s, ch);
+				if ((lflag & ECHOK) && queue_free(&s->output) >= 2)
+					pty_output_char(s, '\n');
+			}
+			return;
+		}
+		bool eof = pty_is_char(s, ch, VEOF);
+		if (eof || ch == '\n' || pty_is_char(s, ch, VEOL) || pty_is_char(s, ch, VEOL2))
+		{
+			if (s->line_tail - s->line_head == PTY_MAX_LINES || (!eof && queue_free(&s->input) == 0))
+				return;
+			if (!eof)
+			{
+				queue_put(&s->input, ch);
+				if ((lflag & ECHO) || (ch == '\n' && (lflag & ECHONL)))
+					pty_echo_char(s, ch);
+			}
+			s->line_end[s->line_tail++ % PTY_MAX_LINES] = s->input.tail;
+			return;
+		}
+		/* Always keep room for the line terminator */
+		if (queue_free(&s->input) <= 1)
+			return;
+	}
+	queue_put(&s->input, ch);
+	if (lflag & ECHO)
+		pty_echo_char(s, ch);
+}
+
+static struct pty_file *pty_alloc_file(int index, int is_master, struct pty_handles *h, struct pty_shared *shared, int flags)
+{
+	struct pty_file *pty = (struct pty_file *)kmalloc(sizeof(struct pty_file));
+	pty->base_file.op_vtable = &pty_ops;
+	pty->base_file.ref = 1;
+	pty->base_file.flags = O_LARGEFILE | O_RDWR | (flags & O_NONBLOCK);
+	pty->shared = shared;
+	pty->h = *h;
+	pty->index = index;
+	pty->is_master = is_master;
+	return pty;
+}
+
+static int ptmx_open(int tag, int flags, struct file **fp)
+{
+	/* Allocate a free pty slot */
+	int index = -1;
+	for (int i = 0; i < PTY_MAX && index == -1; i++)
+		if (!InterlockedBitTestAndSet(&pty_registry->bitmap[i / 32], i % 32))
+			index = i;
+	if (index == -1)
+	{
+		log_warning("pty: All %d ptys are in use.\n", PTY_MAX);
+		return -ENOSPC;
+	}
+	struct pty_handles h;
+	int r = pty_get_handles(index, TRUE, &h);
+	if (r < 0)
+	{
+		InterlockedBitTestAndReset(&pty_registry->bitmap[index / 32], index % 32);
+		return r;
+	}
+	struct pty_shared *s = (struct pty_shared *)MapViewOfFile(h.section, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(struct pty_shared));
+	if (!s)
+	{
+		log_error("pty: MapViewOfFile() failed, error code: %d\n", GetLastError());
+		pty_close_handles(&h);
+		InterlockedBitTestAndReset(&pty_registry->bitmap[index / 32], index % 32);
+		return -ENOMEM;
+	}
+	struct pty_file *pty = pty_alloc_file(index, 1, &h, s, flags);
+	pty_lock(pty);
+	memset(s, 0, sizeof(struct pty_shared));
+	s->termios.c_iflag = ICRNL | IXON | IUTF8;
+	s->termios.c_oflag = OPOST | ONLCR;
+	s->termios.c_cflag = CREAD | CS8 | B38400;
+	s->termios.c_lflag = ISIG | ICANON | ECHO | ECHOE | ECHOK | ECHOCTL | ECHOKE | IEXTEN;
+	s->termios.c_cc[VINTR] = 3;
+	s->termios.c_cc[VQUIT] = 28;
+	s->termios.c_cc[VERASE] = 127;
+	s->termios.c_cc[VKILL] = 21;
+	s->termios.c_cc[VEOF] = 4;
+	s->termios.c_cc[VMIN] = 1;
+	s->termios.c_cc[VSTART] = 17;
+	s->termios.c_cc[VSTOP] = 19;
+	s->termios.c_cc[VSUSP] = 26;
+	s->termios.c_cc[VREPRINT] = 18;
+	s->termios.c_cc[VDISCARD] = 15;
+	s->termios.c_cc[VWERASE] = 23;
+	s->termios.c_cc[VLNEXT] = 22;
+	s->winsize.ws_col = 80;
+	s->winsize.ws_row = 24;
+	s->locked = 1;
+	s->master_count = 1;
+	ResetEvent(h.signal[0]);
+	ResetEvent(h.signal[1]);
+	pty_update_events(pty);
+	pty_unlock(pty);
+	log_info("pty: Allocated pty %d\n", index);
+	*fp = (struct file *)pty;
+	return 0;
+}
+
+static int pts_open(int tag, int flags, struct file **fp)
+{
+	struct pty_handles h;
+	int r = pty_get_handles(tag, FALSE, &h);
+	if (r < 0)
+		return r;
+	struct pty_shared *s = (struct pty_shared *)MapViewOfFile(h.section, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(struct pty_shared));
+	if (!s)
+	{
+		log_error("pty: MapViewOfFile() failed, error code: %d\n", GetLastError());
+		pty_close_handles(&h);
+		return -ENOMEM;
+	}
+	struct pty_file *pty = pty_alloc_file(tag, 0, &h, s, flags);
+	pty_lock(pty);
+	if (s->master_count == 0 || s->locked)
+	{
+		pty_unlock(pty);
+		UnmapViewOfFile(s);
+		pty_close_handles(&h);
+		kfree(pty, sizeof(struct pty_file));
+		return -EIO;
+	}
+	s->slave_count++;
+	s->slave_opened = 1;
+	/* Become the controlling terminal */
+	if (s->fg_pgrp == 0 && !(flags & O_NOCTTY))
+		s->fg_pgrp = process_get_pgid(0);
+	pty_signal_seen[tag] = s->signal_serial;
+	pty_update_events(pty);
+	pty_unlock(pty);
+	*fp = (struct file *)pty;
+	return 0;
+}
+
+static int pty_close(struct file *f)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	struct pty_shared *s = pty->shared;
+	pty_lock(pty);
+	if (pty->is_master)
+		s->master_count--;
+	else
+		s->slave_count--;
+	if (s->master_count == 0 && s->slave_count == 0)
+	{
+		log_info("pty: Released pty %d\n", pty->index);
+		InterlockedBitTestAndReset(&pty_registry->bitmap[pty->index / 32], pty->index % 32);
+	}
+	else
+		pty_update_events(pty);
+	pty_unlock(pty);
+	UnmapViewOfFile(s);
+	pty_close_handles(&pty->h);
+	kfree(pty, sizeof(struct pty_file));
+	return 0;
+}
+
+static void pty_after_fork(struct file *f)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	pty->shared = (struct pty_shared *)MapViewOfFile(pty->h.section, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(struct pty_shared));
+	pty_lock(pty);
+	if (pty->is_master)
+		pty->shared->master_count++;
+	else
+		pty->shared->slave_count++;
+	pty_unlock(pty);
+}
+
+static int pty_get_poll_status(struct file *f)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	struct pty_shared *s = pty->shared;
+	int events = 0;
+	pty_lock(pty);
+	if (pty->is_master)
+	{
+		if (queue_used(&s->output) > 0)
+			events |= LINUX_POLLIN;
+		if (queue_free(&s->input) > 0 || (s->termios.c_lflag & ICANON))
+			events |= LINUX_POLLOUT;
+		if (s->slave_opened && s->slave_count == 0)
+			events |= LINUX_POLLHUP;
+	}
+	else
+	{
+		/* A poller blocked on the slave only picks up new signals when it is woken up */
+		pty_deliver_signals(pty);
+		if (pty_input_available(s) != 0)
+			events |= LINUX_POLLIN;
+		if (queue_free(&s->output) >= 2)
+			events |= LINUX_POLLOUT;
+		if (s->master_count == 0)
+			events |= LINUX_POLLHUP;
+	}
+	pty_unlock(pty);
+	return events;
+}
+
+static HANDLE pty_get_poll_handle(struct file *f, int *poll_events)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	*poll_events = LINUX_POLLIN;
+	return pty->is_master ? pty->h.master_readable : pty->h.slave_readable;
+}
+
+static size_t pty_master_read(struct pty_file *pty, char *buf, size_t count)
+{
+	struct pty_shared *s = pty->shared;
+	pty_lock(pty);
+	while (queue_used(&s->output) == 0)
+	{
+		if (s->slave_opened && s->slave_count == 0)
+		{
+			pty_unlock(pty);
+			return -EIO;
+		}
+		pty_unlock(pty);
+		if (pty->base_file.flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (signal_wait(1, &pty->h.master_readable, INFINITE) == WAIT_INTERRUPTED)
+			return -EINTR;
+		pty_lock(pty);
+	}
+	size_t r = queue_get(&s->output, buf, count);
+	pty_update_events(pty);
+	pty_unlock(pty);
+	return r;
+}
+
+static size_t pty_master_write(struct pty_file *pty, const char *buf, size_t count)
+{
+	struct pty_shared *s = pty->shared;
+	size_t written = 0;
+	pty_lock(pty);
+	while (written < count)
+	{
+		/* In canonical mode the line discipline drops overflowing input instead */
+		if (!(s->termios.c_lflag & ICANON) && queue_free(&s->input) == 0)
+		{
+			pty_update_events(pty);
+			pty_unlock(pty);
+			if (pty->base_file.flags & O_NONBLOCK)
+				return written > 0 ? written : -EAGAIN;
+			if (signal_wait(1, &pty->h.master_writable, INFINITE) == WAIT_INTERRUPTED)
+				return written > 0 ? written : -EINTR;
+			pty_lock(pty);
+			continue;
+		}
+		pty_input_char(pty, buf[written++]);
+	}
+	pty_update_events(pty);
+	pty_unlock(pty);
+	return written;
+}
+
+/* Wait until the slave end becomes readable or a new signal is queued */
+static DWORD pty_slave_wait(struct pty_file *pty, DWORD milliseconds)
+{
+	HANDLE handles[2];
+	handles[0] = pty->h.slave_readable;
+	handles[1] = pty->h.signal[(pty_signal_seen[pty->index] + 1) & 1];
+	return signal_wait(2, handles, milliseconds);
+}
+
+static size_t pty_slave_read(struct pty_file *pty, char *buf, size_t count)
+{
+	struct pty_shared *s = pty->shared;
+	size_t bytes_read = 0;
+	pty_lock(pty);
+	for (;;)
+	{
+		pty_deliver_signals(pty);
+		int available = pty_input_available(s);
+		DWORD timeout = INFINITE;
+		if (s->termios.c_lflag & ICANON)
+		{
+			if (available != 0)
+			{
+				/* Return at most one line, an empty line is end of file */
+				if (available > 0)
+					bytes_read = queue_get(&s->input, buf, min(count, (size_t)available));
+				if (s->input.head == s->line_end[s->line_head % PTY_MAX_LINES])
+					s->line_head++;
+				break;
+			}
+			if (s->master_count == 0)
+				break;
+		}
+		else
+		{
+			int vmin = s->termios.c_cc[VMIN];
+			int vtime = s->termios.c_cc[VTIME];
+			if (available > 0)
+				bytes_read += queue_get(&s->input, buf + bytes_read, count - bytes_read);
+			if (bytes_read == count || (bytes_read > 0 && bytes_read >= (size_t)vmin) || s->master_count == 0)
+				break;
+			if (vmin == 0 && vtime == 0) /* Polling read */
+				break;
+			/* Read with timeout. When VMIN is not zero it is an interbyte timeout applied after the first byte */
+			if (vtime > 0 && (vmin == 0 || bytes_read > 0))
+				timeout = vtime * 100;
+		}
+		pty_update_events(pty);
+		pty_unlock(pty);
+		if (pty->base_file.flags & O_NONBLOCK)
+			return bytes_read > 0 ? bytes_read : -EAGAIN;
+		DWORD r = pty_slave_wait(pty, timeout);
+		if (r == WAIT_INTERRUPTED)
+			return bytes_read > 0 ? bytes_read : -EINTR;
+		pty_lock(pty);
+		if (r == WAIT_TIMEOUT)
+		{
+			if (pty_input_available(s) > 0)
+				bytes_read += queue_get(&s->input, buf + bytes_read, count - bytes_read);
+			break;
+		}
+	}
+	pty_update_events(pty);
+	pty_unlock(pty);
+	return bytes_read;
+}
+
+static size_t pty_slave_write(struct pty_file *pty, const char *buf, size_t count)
+{
+	struct pty_shared *s = pty->shared;
+	size_t written = 0;
+	pty_lock(pty);
+	pty_deliver_signals(pty);
+	while (written < count)
+	{
+		if (s->master_count == 0)
+		{
+			pty_unlock(pty);
+			return written > 0 ? written : -EIO;
+		}
+		if (queue_free(&s->output) < 2)
+		{
+			pty_update_events(pty);
+			pty_unlock(pty);
+			if (pty->base_file.flags & O_NONBLOCK)
+				return written > 0 ? written : -EAGAIN;
+			if (signal_wait(1, &pty->h.slave_writable, INFINITE) == WAIT_INTERRUPTED)
+				return written > 0 ? written : -EINTR;
+			pty_lock(pty);
+			continue;
+		}
+		pty_output_char(s, buf[written++]);
+	}
+	pty_update_events(pty);
+	pty_unlock(pty);
+	return written;
+}
+
+static size_t pty_read(struct file *f, void *buf, size_t count)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	if (count == 0)
+		return 0;
+	if (pty->is_master)
+		return pty_master_read(pty, (char *)buf, count);
+	else
+		return pty_slave_read(pty, (char *)buf, count);
+}
+
+static size_t pty_write(struct file *f, const void *buf, size_t count)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	if (count == 0)
+		return 0;
+	if (pty->is_master)
+		return pty_master_write(pty, (const char *)buf, count);
+	else
+		return pty_slave_write(pty, (const char *)buf, count);
+}
+
+static int pty_stat(struct file *f, struct newstat *buf)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	INIT_STRUCT_NEWSTAT_PADDING(buf);
+	buf->st_dev = mkdev(0, 1);
+	buf->st_ino = 0;
+	buf->st_mode = S_IFCHR + (pty->is_master ? 0666 : 0620);
+	buf->st_nlink = 1;
+	buf->st_uid = 0;
+	buf->st_gid = 0;
+	if (pty->is_master)
+		buf->st_rdev = mkdev(PTY_MASTER_MAJOR, PTY_MASTER_MINOR);
+	else
+		buf->st_rdev = mkdev(PTY_SLAVE_MAJOR, pty->index);
+	buf->st_size = 0;
+	buf->st_blksize = PAGE_SIZE;
+	buf->st_blocks = 0;
+	buf->st_atime = 0;
+	buf->st_atime_nsec = 0;
+	buf->st_mtime = 0;
+	buf->st_mtime_nsec = 0;
+	buf->st_ctime = 0;
+	buf->st_ctime_nsec = 0;
+	return 0;
+}
+
+static int pty_getpath(struct file *f, char *buf)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	if (pty->is_master)
+		return ksprintf(buf, "/dev/ptmx");
+	else
+		return ksprintf(buf, "/dev/pts/%d", pty->index);
+}
+
+static int pty_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+	struct pty_file *pty = (struct pty_file *)f;
+	struct pty_shared *s = pty->shared;
+	int r = 0;
+
+	pty_lock(pty);
+	if (!pty->is_master)
+		pty_deliver_signals(pty);
+	switch (cmd)
+	{
+	case TCGETS:
+	{
+		memcpy((struct termios *)arg, &s->termios, sizeof(struct termios));
+		break;
+	}
+
+	case TCSETS:
+	case TCSETSW:
+	case TCSETSF:
+	{
+		const struct termios *t = (const struct termios *)arg;
+		/* Switching between canonical and non canonical mode invalidates completed lines */
+		if ((t->c_lflag ^ s->termios.c_lflag) & ICANON)
+			s->line_head = s->line_tail;
+		memcpy(&s->termios, t, sizeof(struct termios));
+		if (cmd == TCSETSF)
+			pty_flush_input(s);
+		break;
+	}
+
+	case TCFLSH:
+	{
+		if (arg == TCIFLUSH || arg == TCIOFLUSH)
+			pty_flush_input(s);
+		if (arg == TCOFLUSH || arg == TCIOFLUSH)
+			pty_flush_output(s);
+		if (arg > TCIOFLUSH)
+			r = -EINVAL;
+		break;
+	}
+
+	case TCSBRK:
+	case TCSBRKP:
+	case TCXONC:
+		break;
+
+	case TIOCGWINSZ:
+	{
+		memcpy((struct winsize *)arg, &s->winsize, sizeof(struct winsize));
+		break;
+	}
+
+	case TIOCSWINSZ:
+	{
+		const struct winsize *win = (const struct winsize *)arg;
+		if (memcmp(win, &s->winsize, sizeof(struct winsize)))
+		{
+			memcpy(&s->winsize, win, sizeof(struct winsize));
+			pty_post_signal(pty, SIGWINCH);
+		}
+		break;
+	}
+
+	case TIOCGPGRP:
+	{
+		if (s->fg_pgrp == 0)
+			r = -ENOTTY;
+		else
+			*(pid_t *)arg = s->fg_pgrp;
+		break;
+	}
+
+	case TIOCSPGRP:
+	{
+		pid_t pgrp = *(const pid_t *)arg;
+		if (pgrp <= 0)
+			r = -EINVAL;
+		else
+			s->fg_pgrp = pgrp;
+		break;
+	}
+
+	case TIOCSCTTY:
+	{
+		if (s->fg_pgrp == 0)
+			s->fg_pgrp = process_get_pgid(0);
+		break;
+	}
+
+	case TIOCNOTTY:
+		break;
+
+	case PTY_FIONREAD:
+	{
+		if (pty->is_master)
+			*(int *)arg = queue_used(&s->output);
+		else
+			*(int *)arg = max(pty_input_available(s), 0);
+		break;
+	}
+
+	case PTY_TIOCGPTN:
+	{
+		if (!pty->is_master)
+			r = -ENOTTY;
+		else
+			*(unsigned int *)arg = pty->index;
+		break;
+	}
+
+	case PTY_TIOCSPTLCK:
+	{
+		if (!pty->is_master)
+			r = -ENOTTY;
+		else
+			s->locked = *(const int *)arg != 0;
+		break;
+	}
+
+	case PTY_TIOCGPTLCK:
+	{
+		if (!pty->is_master)
+			r = -ENOTTY;
+		else
+			*(int *)arg = s->locked;
+		break;
+	}
+
+	case PTY_TIOCSIG:
+	{
+		if (!pty->is_master || arg == 0 || arg > _NSIG)
+			r = -EINVAL;
+		else
+			pty_post_signal(pty, arg);
+		break;
+	}
+
+	default:
+		log_error("pty: unknown ioctl command: %x\n", cmd);
+		r = -EINVAL;
+		break;
+	}
+	pty_update_events(pty);
+	pty_unlock(pty);
+	return r;
+}
+
+static const struct file_ops pty_ops = {
+	.get_poll_status = pty_get_poll_status,
+	.get_poll_handle = pty_get_poll_handle,
+	.after_fork = pty_after_fork,
+	.close = pty_close,
+	.getpath = pty_getpath,
+	.read = pty_read,
+	.write = pty_write,
+	.stat = pty_stat,
+	.ioctl = pty_ioctl,
+};
+
+struct virtualfs_custom_desc ptmx_desc = VIRTUALFS_CUSTOM_OPEN(mkdev(PTY_MASTER_MAJOR, PTY_MASTER_MINOR), ptmx_open);
+static struct virtualfs_custom_desc pts_slave_desc = VIRTUALFS_CUSTOM_OPEN(mkdev(PTY_SLAVE_MAJOR, 0), pts_open);
+
+static void pts_begin_iter(int dir_tag)
+{
+}
+
+static void pts_end_iter(int dir_tag)
+{
+}
+
+static int pts_iter(int dir_tag, int iter_tag, int *type, char *name, int namelen)
+{
+	while (iter_tag < PTY_MAX && !(pty_registry->bitmap[iter_tag / 32] & (1UL << (iter_tag % 32))))
+		iter_tag++;
+	if (iter_tag == PTY_MAX)
+		return VIRTUALFS_ITER_END;
+	*type = DT_CHR;
+	ksprintf(name, "%d", iter_tag);
+	return iter_tag + 1;
+}
+
+static int pts_lookup(int dir_tag, const char *name, int namelen, int *file_tag, struct virtualfs_desc **desc)
+{
+	int index = 0;
+	if (namelen == 0 || namelen > 2 || (namelen > 1 && name[0] == '0'))
+		return -ENOENT;
+	for (int i = 0; i < namelen; i++)
+	{
+		if (name[i] < '0' || name[i] > '9')
+			return -ENOENT;
+		index = index * 10 + (name[i] - '0');
+	}
+	if (index >= PTY_MAX || !(pty_registry->bitmap[index / 32] & (1UL << (index % 32))))
+		return -ENOENT;
+	*file_tag = index;
+	*desc = (struct virtualfs_desc *)&pts_slave_desc;
+	return 0;
+}
+
+struct virtualfs_directory_desc pts_desc =
+{
+	.type = VIRTUALFS_TYPE_DIRECTORY,
+	.entries = {
+		VIRTUALFS_ENTRY_DYNAMIC(pts_begin_iter, pts_end_iter, pts_iter, pts_lookup)
+		VIRTUALFS_ENTRY_END()
+	}
+};
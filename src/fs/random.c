@@ -18,28 +18,121 @@
  */
 
 #include <fs/file.h>
+#include <fs/random.h>
 #include <fs/virtual.h>
+#include <lib/chacha20.h>
 #include <syscall/syscall.h>
 #include <errno.h>
 #include <log.h>
 
+#include <stdbool.h>
+
 #define SystemFunction036 NTAPI SystemFunction036
 #include <NTSecAPI.h>
 #undef SystemFunction036
 
+/* Per process ChaCha20 generator
+ * The key is seeded from RtlGenRandom() and replaced with fresh system entropy after
+ * RANDOM_RESEED_BYTES of output or RANDOM_RESEED_INTERVAL milliseconds, and after fork.
+ * Every refill generates RANDOM_BUFFER_BLOCKS keystream blocks, the first CHACHA20_KEY_SIZE bytes
+ * of which become the next key (fast key erasure), so earlier output can not be recovered from
+ * the current state. Served bytes are wiped from the buffer.
+ * Requests of at least RANDOM_DIRECT_THRESHOLD bytes are passed to RtlGenRandom() directly.
+ */
+#define RANDOM_BUFFER_BLOCKS		8
+#define RANDOM_BUFFER_SIZE			(RANDOM_BUFFER_BLOCKS * CHACHA20_BLOCK_SIZE)
+#define RANDOM_DIRECT_THRESHOLD		256
+#define RANDOM_RESEED_BYTES			(1024 * 1024)
+#define RANDOM_RESEED_INTERVAL		(5 * 60 * 1000)
+
+struct random_state
+{
+	bool seeded;
+	uint32_t key[CHACHA20_KEY_SIZE / 4];
+	uint8_t buffer[RANDOM_BUFFER_SIZE];
+	size_t available; /* Number of unused bytes at the end of buffer */
+	uint64_t generated; /* Bytes generated since last reseed */
+	ULONGLONG reseed_time;
+};
+
+static struct random_state rng;
+
+static void random_wipe()
+{
+	SecureZeroMemory(&rng, sizeof(struct random_state));
+}
+
+void random_afterfork()
+{
+	/* The child must not repeat the output of its parent */
+	random_wipe();
+}
+
+static bool random_reseed()
+{
+	if (!RtlGenRandom(rng.key, sizeof(rng.key)))
+	{
+		log_error("random: RtlGenRandom() failed.\n");
+		return false;
+	}
+	rng.seeded = true;
+	rng.available = 0;
+	rng.generated = 0;
+	rng.reseed_time = GetTickCount64();
+	return true;
+}
+
+static void random_refill()
+{
+	static const uint32_t nonce[3] = { 0, 0, 0 };
+	for (int i = 0; i < RANDOM_BUFFER_BLOCKS; i++)
+		chacha20_block(rng.key, i, nonce, rng.buffer + i * CHACHA20_BLOCK_SIZE);
+	memcpy(rng.key, rng.buffer, CHACHA20_KEY_SIZE);
+	SecureZeroMemory(rng.buffer, CHACHA20_KEY_SIZE);
+	rng.available = RANDOM_BUFFER_SIZE - CHACHA20_KEY_SIZE;
+	rng.generated += RANDOM_BUFFER_SIZE;
+}
+
+static bool random_get(void *buf, size_t count)
+{
+	if (count >= RANDOM_DIRECT_THRESHOLD)
+		return RtlGenRandom(buf, count);
+	if (!rng.seeded
+		|| rng.generated >= RANDOM_RESEED_BYTES
+		|| GetTickCount64() - rng.reseed_time >= RANDOM_RESEED_INTERVAL)
+	{
+		if (!random_reseed())
+			return false;
+	}
+	uint8_t *out = (uint8_t *)buf;
+	while (count > 0)
+	{
+		if (rng.available == 0)
+			random_refill();
+		size_t n = min(count, rng.available);
+		uint8_t *src = rng.buffer + RANDOM_BUFFER_SIZE - rng.available;
+		memcpy(out, src, n);
+		SecureZeroMemory(src, n);
+		rng.available -= n;
+		out += n;
+		count -= n;
+	}
+	return true;
+}
+
 DEFINE_SYSCALL(getrandom, void *, buf, size_t, buflen, unsigned int, flags)
 {
 	log_info("getrandom(%p, %d, %x)\n", buf, buflen, flags);
 	if (!mm_check_write(buf, buflen))
 		return -EFAULT;
-	if (!RtlGenRandom(buf, buflen))
+	if (!random_get(buf, buflen))
 		return 0;
 	return buflen;
 }
 
 static size_t random_read(int tag, void *buf, size_t count)
 {
-	if (!RtlGenRandom(buf, count))
+	if (!random_get(buf, count))
 		return 0;
 	return count;
 }
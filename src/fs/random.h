@@ -21,5 +21,7 @@
 
 #include <fs/virtual.h>
 
+void random_afterfork();
+
 struct virtualfs_char_desc random_desc;
 struct virtualfs_char_desc urandom_desc;
@@ -39,6 +39,7 @@
 #include <WS2tcpip.h>
 
 #pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "mswsock.lib")
 
 static int translate_address_family(int af)
 {
@@ -96,6 +97,7 @@ static int translate_socket_error(int error)
 	case WSAEHOSTUNREACH: return -EHOSTUNREACH;
 	case WSAENOTEMPTY: return -ENOTEMPTY;
 	case WSAECANCELLED: return -ECANCELED;
+	case WSA_OPERATION_ABORTED: return -ECANCELED;
 	default:
 		log_error("Unhandled WSA error code: %d\n", error);
 		return -EIO;
@@ -172,6 +174,11 @@ void socket_shutdown()
 		WSACleanup();
 }
 
+/* Association of a socket with the I/O completion port of io_uring */
+#define SOCKET_IOCP_NONE		0
+#define SOCKET_IOCP_ASSOCIATED	1
+#define SOCKET_IOCP_FAILED		2 /* e.g. already associated with the port of the parent process */
+
 struct socket_file
 {
 	struct file base_file;
@@ -179,6 +186,7 @@ struct socket_file
 	HANDLE event_handle;
 	int af, type;
 	int events, connect_error;
+	int iocp;
 };
 
 /* Reports current ready state
@@ -222,7 +230,7 @@ static int socket_get_poll_status(struct file *f)
 	struct socket_file *socket_file = (struct socket_file *) f;
 	int e = socket_update_events(socket_file, 0);
 	int ret = 0;
-	if (e & FD_READ)
+	if (e & (FD_READ | FD_ACCEPT))
 		ret |= LINUX_POLLIN;
 	if (e & FD_WRITE)
 		ret |= LINUX_POLLOUT;
@@ -460,10 +468,19 @@ static size_t socket_write(struct file *f, const char *buf, size_t count)
 	return socket_sendto(socket_file, buf, count, 0, NULL, 0);
 }
 
+static void socket_after_fork(struct file *f)
+{
+	struct socket_file *socket_file = (struct socket_file *) f;
+	/* The association with the completion port of the parent can not be changed */
+	if (socket_file->iocp == SOCKET_IOCP_ASSOCIATED)
+		socket_file->iocp = SOCKET_IOCP_FAILED;
+}
+
 struct file_ops socket_ops =
 {
 	.get_poll_status = socket_get_poll_status,
 	.get_poll_handle = socket_get_poll_handle,
+	.after_fork = socket_after_fork,
 	.close = socket_close,
 	.read = socket_read,
 	.write = socket_write,
@@ -490,6 +507,39 @@ static HANDLE init_socket_event(int sock)
 	return handle;
 }
 
+/* Create a socket file for sock and store it in a new file descriptor
+ * flags can contain O_NONBLOCK and O_CLOEXEC. The socket is closed on failure.
+ */
+static int socket_store(SOCKET sock, int af, int type, int flags)
+{
+	HANDLE event_handle = init_socket_event(sock);
+	if (!event_handle)
+	{
+		closesocket(sock);
+		log_error("init_socket_event() failed.\n");
+		return -ENFILE;
+	}
+
+	struct socket_file *f = (struct socket_file *) kmalloc(sizeof(struct socket_file));
+	f->base_file.op_vtable = &socket_ops;
+	f->base_file.ref = 1;
+	f->socket = sock;
+	f->event_handle = event_handle;
+	f->af = af;
+	f->type = type;
+	f->events = 0;
+	f->connect_error = 0;
+	f->iocp = SOCKET_IOCP_NONE;
+	f->base_file.flags = O_RDWR;
+	if ((flags & O_NONBLOCK))
+		f->base_file.flags |= O_NONBLOCK;
+	
+	int fd = vfs_store_file((struct file *)f, (flags & O_CLOEXEC) > 0);
+	if (fd < 0)
+		vfs_release((struct file *)f);
+	return fd;
+}
+
 static int get_sockfd(int fd, struct socket_file **sock)
 {
 	struct file *f = vfs_get(fd);
@@ -568,30 +618,7 @@ DEFINE_SYSCALL(socket, int, domain, int, type, int, protocol)
 		log_warning("socket() failed, error code: %d\n", WSAGetLastError());
 		return translate_socket_error(WSAGetLastError());
 	}
-	HANDLE event_handle = init_socket_event(sock);
-	if (!event_handle)
-	{
-		closesocket(sock);
-		log_error("init_socket_event() failed.\n");
-		return -ENFILE;
-	}
-
-	struct socket_file *f = (struct socket_file *) kmalloc(sizeof(struct socket_file));
-	f->base_file.op_vtable = &socket_ops;
-	f->base_file.ref = 1;
-	f->socket = sock;
-	f->event_handle = event_handle;
-	f->af = domain;
-	f->type = (type & LINUX_SOCK_TYPE_MASK);
-	f->events = 0;
-	f->connect_error = 0;
-	f->base_file.flags = O_RDWR;
-	if ((type & O_NONBLOCK))
-		f->base_file.flags |= O_NONBLOCK;
-	
-	int fd = vfs_store_file((struct file *)f, (type & O_CLOEXEC) > 0);
-	if (fd < 0)
-		vfs_release((struct file *)f);
+	int fd = socket_store(sock, domain, type & LINUX_SOCK_TYPE_MASK, type);
 	log_info("socket fd: %d\n", fd);
 	return fd;
 }
@@ -631,6 +658,102 @@ DEFINE_SYSCALL(connect, int, sockfd, const struct sockaddr *, addr, size_t, addr
 	return 0;
 }
 
+DEFINE_SYSCALL(bind, int, sockfd, const struct sockaddr *, addr, int, addrlen)
+{
+	log_info("bind(%d, %p, %d)\n", sockfd, addr, addrlen);
+	if (addrlen < 0 || addrlen > sizeof(struct sockaddr_storage))
+		return -EINVAL;
+	if (!mm_check_read(addr, addrlen))
+		return -EFAULT;
+	struct socket_file *f;
+	int r = get_sockfd(sockfd, &f);
+	if (r)
+		return r;
+	struct sockaddr_storage addr_storage;
+	int addr_storage_len;
+	if ((addr_storage_len = translate_socket_addr_to_winsock((const struct sockaddr_storage *)addr, &addr_storage, addrlen)) == SOCKET_ERROR)
+		return -EINVAL;
+	if (bind(f->socket, (struct sockaddr *)&addr_storage, addr_storage_len) == SOCKET_ERROR)
+	{
+		log_warning("bind() failed, error code: %d\n", WSAGetLastError());
+		return translate_socket_error(WSAGetLastError());
+	}
+	return 0;
+}
+
+DEFINE_SYSCALL(listen, int, sockfd, int, backlog)
+{
+	log_info("listen(%d, %d)\n", sockfd, backlog);
+	struct socket_file *f;
+	int r = get_sockfd(sockfd, &f);
+	if (r)
+		return r;
+	if (listen(f->socket, backlog) == SOCKET_ERROR)
+	{
+		log_warning("listen() failed, error code: %d\n", WSAGetLastError());
+		return translate_socket_error(WSAGetLastError());
+	}
+	return 0;
+}
+
+static int socket_accept(struct socket_file *f, struct sockaddr *addr, int *addrlen, int flags)
+{
+	if (flags & ~(O_NONBLOCK | O_CLOEXEC))
+		return -EINVAL;
+	struct sockaddr_storage addr_storage;
+	int addr_storage_len = sizeof(struct sockaddr_storage);
+	SOCKET sock = INVALID_SOCKET;
+	int r;
+	while ((r = socket_wait_event(f, FD_ACCEPT, 0)) == 0)
+	{
+		f->events &= ~FD_ACCEPT;
+		sock = accept(f->socket, (struct sockaddr *)&addr_storage, &addr_storage_len);
+		if (sock != INVALID_SOCKET)
+			break;
+		int err = WSAGetLastError();
+		if (err != WSAEWOULDBLOCK)
+		{
+			log_warning("accept() failed, error code: %d\n", err);
+			return translate_socket_error(err);
+		}
+	}
+	if (r)
+		return r;
+	if (addr)
+	{
+		addr_storage_len = translate_socket_addr_to_linux(&addr_storage, addr_storage_len);
+		int copylen = min(*addrlen, addr_storage_len);
+		memcpy(addr, &addr_storage, copylen);
+		*addrlen = addr_storage_len;
+	}
+	/* The accepted socket shares the event of the listening socket until init_socket_event() */
+	return socket_store(sock, f->af, f->type, flags);
+}
+
+DEFINE_SYSCALL(accept4, int, sockfd, struct sockaddr *, addr, int *, addrlen, int, flags)
+{
+	log_info("accept4(%d, %p, %p, 0%o)\n", sockfd, addr, addrlen, flags);
+	if (addr)
+	{
+		if (!mm_check_write(addrlen, sizeof(*addrlen)))
+			return -EFAULT;
+		if (*addrlen < 0)
+			return -EINVAL;
+		if (!mm_check_write(addr, *addrlen))
+			return -EFAULT;
+	}
+	struct socket_file *f;
+	int r = get_sockfd(sockfd, &f);
+	if (r)
+		return r;
+	return socket_accept(f, addr, addrlen, flags);
+}
+
+DEFINE_SYSCALL(accept, int, sockfd, struct sockaddr *, addr, int *, addrlen)
+{
+	return sys_accept4(sockfd, addr, addrlen, 0);
+}
+
 DEFINE_SYSCALL(getsockname, int, sockfd, struct sockaddr *, addr, int *, addrlen)
 {
 	log_info("getsockname(%d, %p, %p)\n", sockfd, addr, addrlen);
@@ -736,23 +859,21 @@ DEFINE_SYSCALL(recv, int, sockfd, void *, buf, size_t, len, int, flags)
 	return socket_recvfrom(f, buf, len, flags, NULL, 0);
 }
 
-DEFINE_SYSCALL(sendto, int, sockfd, const void *, buf, size_t, len, int, flags, const struct sockaddr *, dest_addr, int, addrlen)
+int socket_file_sendto(struct file *f, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, int addrlen)
 {
-	log_info("sendto(%d, %p, %d, %x, %p, %d)\n", sockfd, buf, len, flags, dest_addr, addrlen);
+	if (f->op_vtable != &socket_ops)
+		return -ENOTSOCK;
 	if (!mm_check_read(buf, len))
 		return -EFAULT;
 	if (dest_addr && !mm_check_read(dest_addr, addrlen))
 		return -EFAULT;
-	struct socket_file *f;
-	int r = get_sockfd(sockfd, &f);
-	if (r)
-		return r;
-	return socket_sendto(f, buf, len, flags, dest_addr, addrlen);
+	return socket_sendto((struct socket_file *)f, buf, len, flags, dest_addr, addrlen);
 }
 
-DEFINE_SYSCALL(recvfrom, int, sockfd, void *, buf, size_t, len, int, flags, struct sockaddr *, src_addr, int *, addrlen)
+int socket_file_recvfrom(struct file *f, void *buf, size_t len, int flags, struct sockaddr *src_addr, int *addrlen)
 {
-	log_info("recvfrom(%d, %p, %d, %x, %p, %p)\n", sockfd, buf, len, flags, src_addr, addrlen);
+	if (f->op_vtable != &socket_ops)
+		return -ENOTSOCK;
 	if (!mm_check_write(buf, len))
 		return -EFAULT;
 	if (src_addr)
@@ -762,11 +883,25 @@ DEFINE_SYSCALL(recvfrom, int, sockfd, void *, buf, size_t, len, int, flags, stru
 		if (!mm_check_write(src_addr, *addrlen))
 			return -EFAULT;
 	}
-	struct socket_file *f;
-	int r = get_sockfd(sockfd, &f);
-	if (r)
-		return r;
-	return socket_recvfrom(f, buf, len, flags, src_addr, addrlen);
+	return socket_recvfrom((struct socket_file *)f, buf, len, flags, src_addr, addrlen);
+}
+
+DEFINE_SYSCALL(sendto, int, sockfd, const void *, buf, size_t, len, int, flags, const struct sockaddr *, dest_addr, int, addrlen)
+{
+	log_info("sendto(%d, %p, %d, %x, %p, %d)\n", sockfd, buf, len, flags, dest_addr, addrlen);
+	struct file *f = vfs_get(sockfd);
+	if (!f)
+		return -EBADF;
+	return socket_file_sendto(f, buf, len, flags, dest_addr, addrlen);
+}
+
+DEFINE_SYSCALL(recvfrom, int, sockfd, void *, buf, size_t, len, int, flags, struct sockaddr *, src_addr, int *, addrlen)
+{
+	log_info("recvfrom(%d, %p, %d, %x, %p, %p)\n", sockfd, buf, len, flags, src_addr, addrlen);
+	struct file *f = vfs_get(sockfd);
+	if (!f)
+		return -EBADF;
+	return socket_file_recvfrom(f, buf, len, flags, src_addr, addrlen);
 }
 
 DEFINE_SYSCALL(shutdown, int, sockfd, int, how)
@@ -910,28 +1045,195 @@ DEFINE_SYSCALL(getsockopt, int, sockfd, int, level, int, optname, void *, optval
 	return socket_get_set_sockopt(SYS_GETSOCKOPT, f, level, optname, NULL, 0, optval, optlen);
 }
 
-DEFINE_SYSCALL(sendmsg, int, sockfd, const struct msghdr *, msg, int, flags)
+int socket_file_sendmsg(struct file *f, const struct msghdr *msg, int flags)
 {
-	log_info("sendmsg(%d, %p, %x)\n", sockfd, msg, flags);
+	if (f->op_vtable != &socket_ops)
+		return -ENOTSOCK;
 	if (!mm_check_read_msghdr(msg))
 		return -EFAULT;
-	struct socket_file *f;
-	int r = get_sockfd(sockfd, &f);
-	if (r)
-		return r;
-	return socket_sendmsg(f, msg, flags);
+	return socket_sendmsg((struct socket_file *)f, msg, flags);
 }
 
-DEFINE_SYSCALL(recvmsg, int, sockfd, struct msghdr *, msg, int, flags)
+int socket_file_recvmsg(struct file *f, struct msghdr *msg, int flags)
 {
-	log_info("recvmsg(%d, %p, %x)\n", sockfd, msg, flags);
+	if (f->op_vtable != &socket_ops)
+		return -ENOTSOCK;
 	if (!mm_check_write_msghdr(msg))
 		return -EFAULT;
-	struct socket_file *f;
-	int r = get_sockfd(sockfd, &f);
+	return socket_recvmsg((struct socket_file *)f, msg, flags);
+}
+
+int socket_file_accept(struct file *f, struct sockaddr *addr, int *addrlen, int flags)
+{
+	if (f->op_vtable != &socket_ops)
+		return -ENOTSOCK;
+	if (addr)
+	{
+		if (!mm_check_write(addrlen, sizeof(*addrlen)))
+			return -EFAULT;
+		if (*addrlen < 0)
+			return -EINVAL;
+		if (!mm_check_write(addr, *addrlen))
+			return -EFAULT;
+	}
+	return socket_accept((struct socket_file *)f, addr, addrlen, flags);
+}
+
+C_ASSERT(SOCKET_ACCEPT_ADDRESS_SIZE == sizeof(struct sockaddr_storage) + 16);
+
+HANDLE socket_file_get_overlapped_handle(struct file *f, HANDLE port)
+{
+	if (f->op_vtable != &socket_ops)
+		return NULL;
+	struct socket_file *socket_file = (struct socket_file *) f;
+	if (socket_file->iocp == SOCKET_IOCP_NONE)
+	{
+		if (CreateIoCompletionPort((HANDLE)socket_file->socket, port, 0, 0))
+			socket_file->iocp = SOCKET_IOCP_ASSOCIATED;
+		else
+		{
+			log_warning("CreateIoCompletionPort() failed, error code: %d\n", GetLastError());
+			socket_file->iocp = SOCKET_IOCP_FAILED;
+		}
+	}
+	if (socket_file->iocp != SOCKET_IOCP_ASSOCIATED)
+		return NULL;
+	return (HANDLE)socket_file->socket;
+}
+
+int socket_file_send_overlapped(struct file *f, const void *buf, size_t len, OVERLAPPED *overlapped)
+{
+	struct socket_file *socket_file = (struct socket_file *) f;
+	WSABUF buffer;
+	buffer.len = (ULONG)min(len, (size_t)MAXLONG);
+	buffer.buf = (char *)buf;
+	if (WSASend(socket_file->socket, &buffer, 1, NULL, 0, overlapped, NULL) == SOCKET_ERROR)
+	{
+		int err = WSAGetLastError();
+		if (err != WSA_IO_PENDING)
+		{
+			log_warning("WSASend() failed, error code: %d\n", err);
+			return translate_socket_error(err);
+		}
+	}
+	return 0;
+}
+
+int socket_file_recv_overlapped(struct file *f, void *buf, size_t len, OVERLAPPED *overlapped)
+{
+	struct socket_file *socket_file = (struct socket_file *) f;
+	WSABUF buffer;
+	buffer.len = (ULONG)min(len, (size_t)MAXLONG);
+	buffer.buf = (char *)buf;
+	DWORD flags = 0;
+	socket_file->events &= ~FD_READ;
+	if (WSARecv(socket_file->socket, &buffer, 1, NULL, &flags, overlapped, NULL) == SOCKET_ERROR)
+	{
+		int err = WSAGetLastError();
+		if (err != WSA_IO_PENDING)
+		{
+			log_warning("WSARecv() failed, error code: %d\n", err);
+			return translate_socket_error(err);
+		}
+	}
+	return 0;
+}
+
+int socket_file_accept_overlapped(struct file *f, struct socket_accept *accept, OVERLAPPED *overlapped)
+{
+	struct socket_file *socket_file = (struct socket_file *) f;
+	if (socket_file->type != LINUX_SOCK_STREAM)
+		return -EOPNOTSUPP;
+	SOCKET sock = socket(translate_address_family(socket_file->af), SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET)
+	{
+		log_warning("socket() failed, error code: %d\n", WSAGetLastError());
+		return translate_socket_error(WSAGetLastError());
+	}
+	socket_file->events &= ~FD_ACCEPT;
+	DWORD bytes;
+	if (!AcceptEx(socket_file->socket, sock, accept->buffer, 0, SOCKET_ACCEPT_ADDRESS_SIZE, SOCKET_ACCEPT_ADDRESS_SIZE, &bytes, overlapped))
+	{
+		int err = WSAGetLastError();
+		if (err != WSA_IO_PENDING)
+		{
+			log_warning("AcceptEx() failed, error code: %d\n", err);
+			closesocket(sock);
+			return translate_socket_error(err);
+		}
+	}
+	accept->socket = (uintptr_t)sock;
+	return 0;
+}
+
+int socket_file_overlapped_result(struct file *f, OVERLAPPED *overlapped)
+{
+	struct socket_file *socket_file = (struct socket_file *) f;
+	DWORD bytes, flags;
+	if (!WSAGetOverlappedResult(socket_file->socket, overlapped, &bytes, FALSE, &flags))
+	{
+		int err = WSAGetLastError();
+		log_warning("Overlapped socket operation failed, error code: %d\n", err);
+		return translate_socket_error(err);
+	}
+	return (int)bytes;
+}
+
+int socket_file_accept_result(struct file *f, struct socket_accept *accept, OVERLAPPED *overlapped, struct sockaddr *addr, int *addrlen, int flags)
+{
+	struct socket_file *socket_file = (struct socket_file *) f;
+	SOCKET sock = (SOCKET)accept->socket;
+	int r = socket_file_overlapped_result(f, overlapped);
 	if (r < 0)
+	{
+		closesocket(sock);
 		return r;
-	return socket_recvmsg(f, msg, flags);
+	}
+	/* Make getpeername(), shutdown(), etc work on the accepted socket */
+	if (setsockopt(sock, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (char *)&socket_file->socket, sizeof(SOCKET)) == SOCKET_ERROR)
+		log_warning("setsockopt(SO_UPDATE_ACCEPT_CONTEXT) failed, error code: %d\n", WSAGetLastError());
+	if (addr)
+	{
+		if (!mm_check_write(addrlen, sizeof(*addrlen)) || *addrlen < 0 || !mm_check_write(addr, *addrlen))
+		{
+			closesocket(sock);
+			return -EFAULT;
+		}
+		struct sockaddr *local_addr, *remote_addr;
+		int local_addr_len, remote_addr_len;
+		GetAcceptExSockaddrs(accept->buffer, 0, SOCKET_ACCEPT_ADDRESS_SIZE, SOCKET_ACCEPT_ADDRESS_SIZE,
+			&local_addr, &local_addr_len, &remote_addr, &remote_addr_len);
+		struct sockaddr_storage addr_storage;
+		memcpy(&addr_storage, remote_addr, remote_addr_len);
+		remote_addr_len = translate_socket_addr_to_linux(&addr_storage, remote_addr_len);
+		int copylen = min(*addrlen, remote_addr_len);
+		memcpy(addr, &addr_storage, copylen);
+		*addrlen = remote_addr_len;
+	}
+	return socket_store(sock, socket_file->af, socket_file->type, flags);
+}
+
+void socket_file_discard_accept(struct socket_accept *accept)
+{
+	closesocket((SOCKET)accept->socket);
+}
+
+DEFINE_SYSCALL(sendmsg, int, sockfd, const struct msghdr *, msg, int, flags)
+{
+	log_info("sendmsg(%d, %p, %x)\n", sockfd, msg, flags);
+	struct file *f = vfs_get(sockfd);
+	if (!f)
+		return -EBADF;
+	return socket_file_sendmsg(f, msg, flags);
+}
+
+DEFINE_SYSCALL(recvmsg, int, sockfd, struct msghdr *, msg, int, flags)
+{
+	log_info("recvmsg(%d, %p, %x)\n", sockfd, msg, flags);
+	struct file *f = vfs_get(sockfd);
+	if (!f)
+		return -EBADF;
+	return socket_file_recvmsg(f, msg, flags);
 }
 
 DEFINE_SYSCALL(sendmmsg, int, sockfd, struct mmsghdr *, msgvec, unsigned int, vlen, unsigned int, flags)
@@ -989,9 +1291,18 @@ DEFINE_SYSCALL(socketcall, int, call, uintptr_t *, args)
 	case SYS_SOCKET:
 		return sys_socket(args[0], args[1], args[2]);
 
+	case SYS_BIND:
+		return sys_bind(args[0], (const struct sockaddr *)args[1], args[2]);
+
 	case SYS_CONNECT:
 		return sys_connect(args[0], (const struct sockaddr *)args[1], args[2]);
 
+	case SYS_LISTEN:
+		return sys_listen(args[0], args[1]);
+
+	case SYS_ACCEPT:
+		return sys_accept(args[0], (struct sockaddr *)args[1], (int *)args[2]);
+
 	case SYS_GETSOCKNAME:
 		return sys_getsockname(args[0], (struct sockaddr *)args[1], (int *)args[2]);
 
@@ -1025,6 +1336,9 @@ DEFINE_SYSCALL(socketcall, int, call, uintptr_t *, args)
 	case SYS_RECVMSG:
 		return sys_recvmsg(args[0], (struct msghdr *)args[1], args[2]);
 
+	case SYS_ACCEPT4:
+		return sys_accept4(args[0], (struct sockaddr *)args[1], (int *)args[2], args[3]);
+
 	case SYS_SENDMMSG:
 		return sys_sendmmsg(args[0], (struct mmsghdr *)args[1], args[2], args[3]);
 
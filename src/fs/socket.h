@@ -19,5 +19,46 @@
 
 #pragma once
 
+#include <fs/file.h>
+
+struct sockaddr;
+struct msghdr;
+
 void socket_init();
 void socket_shutdown();
+
+/* Socket operations on a file object instead of a file descriptor, used by io_uring
+ * Return -ENOTSOCK if f is not a socket.
+ */
+int socket_file_sendto(struct file *f, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, int addrlen);
+int socket_file_recvfrom(struct file *f, void *buf, size_t len, int flags, struct sockaddr *src_addr, int *addrlen);
+int socket_file_sendmsg(struct file *f, const struct msghdr *msg, int flags);
+int socket_file_recvmsg(struct file *f, struct msghdr *msg, int flags);
+int socket_file_accept(struct file *f, struct sockaddr *addr, int *addrlen, int flags);
+
+/* AcceptEx() needs room for each address plus 16 bytes */
+#define SOCKET_ACCEPT_ADDRESS_SIZE	(128 + 16)
+
+/* State of an overlapped accept */
+struct socket_accept
+{
+	uintptr_t socket; /* The socket which receives the connection */
+	char buffer[2 * SOCKET_ACCEPT_ADDRESS_SIZE];
+};
+
+/* Overlapped operations completed through an I/O completion port, used by io_uring
+ * socket_file_get_overlapped_handle() associates the socket with port on first use and returns its
+ * handle, or NULL if f is not a socket or can not be associated with port (e.g. it was associated
+ * with the port of the parent process before fork).
+ * The start functions return 0 if a completion packet will be queued, or a negative errno.
+ * The results are fetched with socket_file_overlapped_result() or socket_file_accept_result()
+ * when the completion packet arrives. The latter stores the accepted socket in a new file descriptor.
+ * socket_file_discard_accept() closes the socket of an accept whose result is not wanted.
+ */
+HANDLE socket_file_get_overlapped_handle(struct file *f, HANDLE port);
+int socket_file_send_overlapped(struct file *f, const void *buf, size_t len, OVERLAPPED *overlapped);
+int socket_file_recv_overlapped(struct file *f, void *buf, size_t len, OVERLAPPED *overlapped);
+int socket_file_accept_overlapped(struct file *f, struct socket_accept *accept, OVERLAPPED *overlapped);
+int socket_file_overlapped_result(struct file *f, OVERLAPPED *overlapped);
+int socket_file_accept_result(struct file *f, struct socket_accept *accept, OVERLAPPED *overlapped, struct sockaddr *addr, int *addrlen, int flags);
+void socket_file_discard_accept(struct socket_accept *accept);
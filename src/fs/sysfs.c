@@ -17,17 +17,368 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <common/dirent.h>
+#include <common/errno.h>
 #include <fs/sysfs.h>
 #include <fs/virtual.h>
+#include <syscall/process.h>
 #include <log.h>
+#include <str.h>
 
+#include <stdbool.h>
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <stdlib.h>
+
+/* CPU topology, only processor group 0 is reported */
+#define SYSFS_MAX_CPUS		(sizeof(ULONG_PTR) * 8)
+#define SYSFS_MAX_CACHES	16
+
+#define SYSFS_CACHE_UNIFIED			0
+#define SYSFS_CACHE_INSTRUCTION		1
+#define SYSFS_CACHE_DATA			2
+
+struct sysfs_cache
+{
+	int level;
+	int type;
+	int size;
+	int line_size;
+	int ways;
+	ULONG_PTR shared_mask;
+};
+
+static struct
+{
+	bool initialized;
+	ULONG_PTR cpu_mask;
+	int cpu_count;
+	int cache_count;
+	struct sysfs_cache caches[SYSFS_MAX_CACHES];
+} cpu_topology;
+
+static int sysfs_cache_cmp(const void *a, const void *b)
+{
+	const struct sysfs_cache *l = (const struct sysfs_cache *)a, *r = (const struct sysfs_cache *)b;
+	/* Linux order: data before instruction before unified for each level */
+	if (l->level != r->level)
+		return l->level - r->level;
+	return r->type - l->type;
+}
+
+static void sysfs_init_cpu_topology()
+{
+	if (cpu_topology.initialized)
+		return;
+	cpu_topology.initialized = true;
+
+	ULONG_PTR process_mask, system_mask;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) || !system_mask)
+		system_mask = 1;
+	cpu_topology.cpu_mask = system_mask;
+	for (int i = 0; i < SYSFS_MAX_CPUS; i++)
+		if (system_mask & ((ULONG_PTR)1 << i))
+			cpu_topology.cpu_count = i + 1;
+
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION info[256];
+	DWORD len = sizeof(info);
+	if (!GetLogicalProcessorInformation(info, &len))
+	{
+		log_warning("GetLogicalProcessorInformation() failed, error code: %d\n", GetLastError());
+		return;
+	}
+	for (DWORD i = 0; i < len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); i++)
+	{
+		if (info[i].Relationship != RelationCache || cpu_topology.cache_count == SYSFS_MAX_CACHES)
+			continue;
+		CACHE_DESCRIPTOR *desc = &info[i].Cache;
+		if (desc->Type == CacheTrace)
+			continue;
+		struct sysfs_cache *cache = &cpu_topology.caches[cpu_topology.cache_count++];
+		cache->level = desc->Level;
+		cache->type = desc->Type == CacheData ? SYSFS_CACHE_DATA :
+			desc->Type == CacheInstruction ? SYSFS_CACHE_INSTRUCTION : SYSFS_CACHE_UNIFIED;
+		cache->size = desc->Size;
+		cache->line_size = desc->LineSize;
+		cache->ways = desc->Associativity == CACHE_FULLY_ASSOCIATIVE ? 0 : desc->Associativity;
+		cache->shared_mask = info[i].ProcessorMask;
+	}
+	qsort(cpu_topology.caches, cpu_topology.cache_count, sizeof(struct sysfs_cache), sysfs_cache_cmp);
+}
+
+/* Get the index-th cache of a cpu, tag = cpu * SYSFS_MAX_CACHES + index */
+static struct sysfs_cache *sysfs_get_cache(int tag)
+{
+	int cpu = tag / SYSFS_MAX_CACHES, index = tag % SYSFS_MAX_CACHES;
+	sysfs_init_cpu_topology();
+	for (int i = 0; i < cpu_topology.cache_count; i++)
+		if (cpu_topology.caches[i].shared_mask & ((ULONG_PTR)1 << cpu))
+			if (index-- == 0)
+				return &cpu_topology.caches[i];
+	return NULL;
+}
+
+/* Format a cpu mask as a cpu list like "0-3,6" */
+static int sysfs_format_cpu_list(char *buf, ULONG_PTR mask)
+{
+	int len = 0;
+	for (int i = 0; i < SYSFS_MAX_CPUS; i++)
+	{
+		if (!(mask & ((ULONG_PTR)1 << i)))
+			continue;
+		int j = i;
+		while (j + 1 < SYSFS_MAX_CPUS && (mask & ((ULONG_PTR)1 << (j + 1))))
+			j++;
+		if (len > 0)
+			buf[len++] = ',';
+		if (i == j)
+			len += ksprintf(buf + len, "%d", i);
+		else
+			len += ksprintf(buf + len, "%d-%d", i, j);
+		i = j;
+	}
+	buf[len++] = '\n';
+	buf[len] = 0;
+	return len;
+}
+
+static int cpu_list_getbuflen(int tag)
+{
+	return 512;
+}
+
+/* Only the cpu reported by sched_getaffinity() is online, glibc's get_nprocs() reads this file */
+static void cpu_online_gettext(int tag, char *buf)
+{
+	ksprintf(buf, "%d\n", process_get_cpu());
+}
+
+static void cpu_possible_gettext(int tag, char *buf)
+{
+	sysfs_init_cpu_topology();
+	if (cpu_topology.cpu_count == 1)
+		ksprintf(buf, "0\n");
+	else
+		ksprintf(buf, "0-%d\n", cpu_topology.cpu_count - 1);
+}
+
+static struct virtualfs_text_desc cpu_online_desc = VIRTUALFS_TEXT(cpu_list_getbuflen, cpu_online_gettext);
+static struct virtualfs_text_desc cpu_possible_desc = VIRTUALFS_TEXT(cpu_list_getbuflen, cpu_possible_gettext);
+
+static unsigned int cache_level_get(int tag)
+{
+	return sysfs_get_cache(tag)->level;
+}
+
+static unsigned int cache_line_size_get(int tag)
+{
+	return sysfs_get_cache(tag)->line_size;
+}
+
+static unsigned int cache_ways_get(int tag)
+{
+	return sysfs_get_cache(tag)->ways;
+}
+
+static unsigned int cache_sets_get(int tag)
+{
+	struct sysfs_cache *cache = sysfs_get_cache(tag);
+	if (cache->ways == 0 || cache->line_size == 0)
+		return 1;
+	return cache->size / (cache->ways * cache->line_size);
+}
+
+static int cache_text_getbuflen(int tag)
+{
+	return 512;
+}
+
+static void cache_type_gettext(int tag, char *buf)
+{
+	static const char *const types[] = { "Unified", "Instruction", "Data" };
+	ksprintf(buf, "%s\n", types[sysfs_get_cache(tag)->type]);
+}
+
+static void cache_size_gettext(int tag, char *buf)
+{
+	ksprintf(buf, "%dK\n", sysfs_get_cache(tag)->size / 1024);
+}
+
+static void cache_shared_cpu_map_gettext(int tag, char *buf)
+{
+	/* Hex digits covering all possible cpus, in groups of 32 bits */
+	uint64_t mask = sysfs_get_cache(tag)->shared_mask;
+	int digits = (cpu_topology.cpu_count + 3) / 4;
+	int len = 0;
+	for (int i = digits - 1; i >= 0; i--)
+	{
+		len += ksprintf(buf + len, "%x", (int)((mask >> (i * 4)) & 0xF));
+		if (i > 0 && i % 8 == 0)
+			buf[len++] = ',';
+	}
+	buf[len++] = '\n';
+	buf[len] = 0;
+}
+
+static void cache_shared_cpu_list_gettext(int tag, char *buf)
+{
+	sysfs_format_cpu_list(buf, sysfs_get_cache(tag)->shared_mask);
+}
+
+static struct virtualfs_param_desc cache_level_desc = VIRTUALFS_PARAM_UINT_READONLY(cache_level_get);
+static struct virtualfs_param_desc cache_line_size_desc = VIRTUALFS_PARAM_UINT_READONLY(cache_line_size_get);
+static struct virtualfs_param_desc cache_ways_desc = VIRTUALFS_PARAM_UINT_READONLY(cache_ways_get);
+static struct virtualfs_param_desc cache_sets_desc = VIRTUALFS_PARAM_UINT_READONLY(cache_sets_get);
+static struct virtualfs_text_desc cache_type_desc = VIRTUALFS_TEXT(cache_text_getbuflen, cache_type_gettext);
+static struct virtualfs_text_desc cache_size_desc = VIRTUALFS_TEXT(cache_text_getbuflen, cache_size_gettext);
+static struct virtualfs_text_desc cache_shared_cpu_map_desc = VIRTUALFS_TEXT(cache_text_getbuflen, cache_shared_cpu_map_gettext);
+static struct virtualfs_text_desc cache_shared_cpu_list_desc = VIRTUALFS_TEXT(cache_text_getbuflen, cache_shared_cpu_list_gettext);
+
+static struct virtualfs_directory_desc cache_index_desc =
+{
+	.type = VIRTUALFS_TYPE_DIRECTORY,
+	.entries = {
+		VIRTUALFS_ENTRY("level", cache_level_desc)
+		VIRTUALFS_ENTRY("type", cache_type_desc)
+		VIRTUALFS_ENTRY("size", cache_size_desc)
+		VIRTUALFS_ENTRY("coherency_line_size", cache_line_size_desc)
+		VIRTUALFS_ENTRY("ways_of_associativity", cache_ways_desc)
+		VIRTUALFS_ENTRY("number_of_sets", cache_sets_desc)
+		VIRTUALFS_ENTRY("shared_cpu_map", cache_shared_cpu_map_desc)
+		VIRTUALFS_ENTRY("shared_cpu_list", cache_shared_cpu_list_desc)
+		VIRTUALFS_ENTRY_END()
+	}
+};
+
+/* Parse a "<prefix><number>" entry name, return -1 if it does not match */
+static int sysfs_parse_index(const char *prefix, const char *name, int namelen)
+{
+	int prefixlen = strlen(prefix);
+	if (namelen <= prefixlen || strncmp(name, prefix, prefixlen))
+		return -1;
+	int index = 0;
+	for (int i = prefixlen; i < namelen; i++)
+	{
+		if (name[i] < '0' || name[i] > '9' || index >= 1000)
+			return -1;
+		index = index * 10 + (name[i] - '0');
+	}
+	if (name[prefixlen] == '0' && namelen > prefixlen + 1)
+		return -1;
+	return index;
+}
+
+static void cache_index_begin_iter(int dir_tag)
+{
+}
+
+static void cache_index_end_iter(int dir_tag)
+{
+}
+
+static int cache_index_iter(int dir_tag, int iter_tag, int *type, char *name, int namelen)
+{
+	if (!sysfs_get_cache(dir_tag * SYSFS_MAX_CACHES + iter_tag))
+		return VIRTUALFS_ITER_END;
+	*type = DT_DIR;
+	ksprintf(name, "index%d", iter_tag);
+	return iter_tag + 1;
+}
+
+static int cache_index_open(int dir_tag, const char *name, int namelen, int *file_tag, struct virtualfs_desc **desc)
+{
+	int index = sysfs_parse_index("index", name, namelen);
+	if (index < 0 || index >= SYSFS_MAX_CACHES || !sysfs_get_cache(dir_tag * SYSFS_MAX_CACHES + index))
+		return -ENOENT;
+	*file_tag = dir_tag * SYSFS_MAX_CACHES + index;
+	*desc = (struct virtualfs_desc *)&cache_index_desc;
+	return 0;
+}
+
+static struct virtualfs_directory_desc cpu_cache_desc =
+{
+	.type = VIRTUALFS_TYPE_DIRECTORY,
+	.entries = {
+		VIRTUALFS_ENTRY_DYNAMIC(cache_index_begin_iter, cache_index_end_iter, cache_index_iter, cache_index_open)
+		VIRTUALFS_ENTRY_END()
+	}
+};
+
+static struct virtualfs_directory_desc cpu_desc =
+{
+	.type = VIRTUALFS_TYPE_DIRECTORY,
+	.entries = {
+		VIRTUALFS_ENTRY("cache", cpu_cache_desc)
+		VIRTUALFS_ENTRY_END()
+	}
+};
+
+static void cpu_begin_iter(int dir_tag)
+{
+	sysfs_init_cpu_topology();
+}
+
+static void cpu_end_iter(int dir_tag)
+{
+}
+
+static int cpu_iter(int dir_tag, int iter_tag, int *type, char *name, int namelen)
+{
+	while (iter_tag < SYSFS_MAX_CPUS && !(cpu_topology.cpu_mask & ((ULONG_PTR)1 << iter_tag)))
+		iter_tag++;
+	if (iter_tag == SYSFS_MAX_CPUS)
+		return VIRTUALFS_ITER_END;
+	*type = DT_DIR;
+	ksprintf(name, "cpu%d", iter_tag);
+	return iter_tag + 1;
+}
+
+static int cpu_open(int dir_tag, const char *name, int namelen, int *file_tag, struct virtualfs_desc **desc)
+{
+	sysfs_init_cpu_topology();
+	int cpu = sysfs_parse_index("cpu", name, namelen);
+	if (cpu < 0 || cpu >= SYSFS_MAX_CPUS || !(cpu_topology.cpu_mask & ((ULONG_PTR)1 << cpu)))
+		return -ENOENT;
+	*file_tag = cpu;
+	*desc = (struct virtualfs_desc *)&cpu_desc;
+	return 0;
+}
+
+static struct virtualfs_directory_desc system_cpu_desc =
+{
+	.type = VIRTUALFS_TYPE_DIRECTORY,
+	.entries = {
+		VIRTUALFS_ENTRY("online", cpu_online_desc)
+		VIRTUALFS_ENTRY("possible", cpu_possible_desc)
+		VIRTUALFS_ENTRY("present", cpu_online_desc)
+		VIRTUALFS_ENTRY_DYNAMIC(cpu_begin_iter, cpu_end_iter, cpu_iter, cpu_open)
+		VIRTUALFS_ENTRY_END()
+	}
+};
+
+static struct virtualfs_directory_desc devices_system_desc =
+{
+	.type = VIRTUALFS_TYPE_DIRECTORY,
+	.entries = {
+		VIRTUALFS_ENTRY("cpu", system_cpu_desc)
+		VIRTUALFS_ENTRY_END()
+	}
+};
+
+static struct virtualfs_directory_desc devices_desc =
+{
+	.type = VIRTUALFS_TYPE_DIRECTORY,
+	.entries = {
+		VIRTUALFS_ENTRY("system", devices_system_desc)
+		VIRTUALFS_ENTRY_END()
+	}
+};
 
 static const struct virtualfs_directory_desc sysfs =
 {
 	.type = VIRTUALFS_TYPE_DIRECTORY,
 	.entries = {
+		VIRTUALFS_ENTRY("devices", devices_desc)
 		VIRTUALFS_ENTRY_END()
 	}
 };
@@ -0,0 +1,1631 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <common/errno.h>
+#include <common/fcntl.h>
+#include <common/fs.h>
+#include <common/poll.h>
+#include <fs/tmpfs.h>
+#include <syscall/mm.h>
+#include <syscall/vfs.h>
+#include <datetime.h>
+#include <heap.h>
+#include <log.h>
+#include <rwlock.h>
+#include <str.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <intrin.h>
+
+/* tmpfs: RAM backed file system
+ *
+ * All state of a tmpfs instance lives in two named section objects. Every process opens
+ * both of them, so the content stays alive as long as any process is running.
+ *
+ * The metadata section holds the lock, the inode and directory entry tables and the chunk
+ * allocation bitmap. Each process maps it at a different address, so all references inside
+ * it are table indices. Index 0 is never used in any table, which makes zero initialized
+ * memory a valid empty state.
+ *
+ * The data section is reserved with the maximum size of any instance and divided into
+ * BLOCK_SIZE chunks which hold file content. The size limit of an instance only restricts
+ * the number of chunks in use, so it can be changed by remounting. Free chunks are always kept zeroed, so pages
+ * of a chunk which are never written do not take physical memory. Chunks are exactly one
+ * allocation granularity block, thus they can be mapped directly for MAP_SHARED.
+ *
+ * Open files are not counted in the metadata section, as a process killed without closing
+ * its files would leak the count. Instead every open file holds a handle to a named event of
+ * its inode, and the kernel does the counting. An inode is in use as long as the event exists.
+ *
+ * All object names carry the logon session id, so instances of different logon sessions are
+ * not shared.
+ */
+
+#define TMPFS_MAGIC				0x01021994
+
+#define TMPFS_CHUNK_SIZE		BLOCK_SIZE
+#define TMPFS_PAGES_PER_CHUNK	(TMPFS_CHUNK_SIZE / PAGE_SIZE)
+#define TMPFS_MAX_CHUNKS		65536
+#ifdef _WIN64
+#define TMPFS_DEFAULT_SIZE		0x40000000ULL	/* 1GB */
+#define TMPFS_VIEW_CACHE_SIZE	256
+#else
+#define TMPFS_DEFAULT_SIZE		0x10000000ULL	/* 256MB */
+#define TMPFS_VIEW_CACHE_SIZE	64
+#endif
+
+#define TMPFS_MAX_INODES		8192
+#define TMPFS_MAX_DENTRIES		8192
+#define TMPFS_HASH_SIZE			4096
+#define TMPFS_NAME_MAX			255
+#define TMPFS_ROOT_INODE		1
+
+/* Chunk slots of a file, the first few are stored in the inode, the rest in an indirect chunk */
+#define TMPFS_DIRECT_CHUNKS		8
+#define TMPFS_INDIRECT_CHUNKS	(TMPFS_CHUNK_SIZE / sizeof(uint32_t))
+#define TMPFS_MAX_FILE_SIZE		((uint64_t)(TMPFS_DIRECT_CHUNKS + TMPFS_INDIRECT_CHUNKS) * TMPFS_CHUNK_SIZE)
+
+/* Inode flags */
+#define TMPFS_INODE_MAPPED		1	/* Chunks may be mapped by MAP_SHARED, keep them until the inode is gone */
+
+struct tmpfs_inode
+{
+	uint32_t mode; /* 0 if the inode is free */
+	uint32_t nlink;
+	uint32_t flags;
+	uint64_t size;
+	uint64_t atime, mtime, ctime; /* In FILETIME units */
+	/* Regular files and symlinks */
+	uint32_t chunk_slots; /* Slots at or after this are known to be empty */
+	uint32_t direct[TMPFS_DIRECT_CHUNKS];
+	uint32_t indirect;
+	/* Directories */
+	uint32_t dentry; /* The directory entry pointing to this directory, 0 for root */
+	uint32_t first_child;
+	uint32_t child_count;
+};
+
+struct tmpfs_dentry
+{
+	uint32_t inode; /* 0 if the entry is free */
+	uint32_t parent;
+	uint32_t prev_sibling, next_sibling;
+	uint32_t next_hash;
+	uint32_t generation;
+	uint32_t namelen;
+	char name[TMPFS_NAME_MAX + 1];
+};
+
+struct tmpfs_shared
+{
+	struct rwlock_shared lock;
+	volatile LONG initialized;
+	uint32_t max_chunks;
+	uint32_t used_chunks, used_inodes;
+	/* Where to start searching for free objects */
+	uint32_t chunk_hint, inode_hint, dentry_hint;
+	uint32_t hash[TMPFS_HASH_SIZE];
+	uint32_t chunk_bitmap[TMPFS_MAX_CHUNKS / 32];
+	struct tmpfs_inode inodes[TMPFS_MAX_INODES];
+	struct tmpfs_dentry dentries[TMPFS_MAX_DENTRIES];
+};
+
+/* Per process mapped views of data chunks */
+struct tmpfs_view
+{
+	uint32_t chunk;
+	char *addr;
+};
+
+struct tmpfs
+{
+	struct file_system base_fs;
+	char name[32];
+	/* Prefix of named objects of this instance */
+	char object_prefix[64];
+	uint32_t dev;
+	HANDLE shared_section, data_section;
+	struct tmpfs_shared *shared;
+	struct rwlock lock;
+	struct tmpfs_view views[TMPFS_VIEW_CACHE_SIZE];
+};
+
+struct tmpfs_file
+{
+	struct file base_file;
+	struct tmpfs *fs;
+	uint32_t inode;
+	/* Handle to the named event of the inode, keeps the inode alive */
+	HANDLE inode_ref;
+	/* The directory entry which the file is opened with, used by rename() */
+	uint32_t dentry, dentry_generation;
+	uint64_t offset;
+	/* Current position for getdents() */
+	uint32_t dir_position;
+	uint32_t dir_cursor, dir_cursor_generation;
+	int pathlen;
+	char pathname[]; /* Not necessary null-terminated */
+};
+
+static const struct file_ops tmpfs_ops;
+
+static void tmpfs_object_name(struct tmpfs *fs, WCHAR *buf, const char *suffix)
+{
+	char name[128];
+	ksprintf(name, "%s%s", fs->object_prefix, suffix);
+	for (int i = 0;; i++)
+		if (!(buf[i] = name[i]))
+			break;
+}
+
+static void tmpfs_inode_object_name(struct tmpfs *fs, WCHAR *buf, uint32_t ino)
+{
+	char suffix[32];
+	ksprintf(suffix, "_inode%u", ino);
+	tmpfs_object_name(fs, buf, suffix);
+}
+
+/* Get a reference to an inode for an open file */
+static HANDLE tmpfs_ref_inode(struct tmpfs *fs, uint32_t ino)
+{
+	SECURITY_ATTRIBUTES attr;
+	attr.nLength = sizeof(SECURITY_ATTRIBUTES);
+	attr.bInheritHandle = TRUE;
+	attr.lpSecurityDescriptor = NULL;
+	WCHAR name[128];
+	tmpfs_inode_object_name(fs, name, ino);
+	HANDLE handle = CreateEventW(&attr, TRUE, FALSE, name);
+	if (!handle)
+		log_error("tmpfs: Creating reference of inode %d failed, error code: %d\n", ino, GetLastError());
+	return handle;
+}
+
+/* Check whether any open file in any process references an inode */
+static int tmpfs_inode_in_use(struct tmpfs *fs, uint32_t ino)
+{
+	WCHAR name[128];
+	tmpfs_inode_object_name(fs, name, ino);
+	HANDLE handle = OpenEventW(SYNCHRONIZE, FALSE, name);
+	if (!handle)
+		return GetLastError() != ERROR_FILE_NOT_FOUND;
+	CloseHandle(handle);
+	return 1;
+}
+
+static uint64_t tmpfs_now()
+{
+	FILETIME filetime;
+	GetSystemTimeAsFileTime(&filetime);
+	return ((uint64_t)filetime.dwHighDateTime << 32) | filetime.dwLowDateTime;
+}
+
+static void tmpfs_time_to_unix(uint64_t time, uint64_t *sec, uint64_t *nsec)
+{
+	FILETIME filetime;
+	filetime.dwLowDateTime = (DWORD)time;
+	filetime.dwHighDateTime = (DWORD)(time >> 32);
+	*sec = filetime_to_unix_sec(&filetime);
+	*nsec = filetime_to_unix_nsec(&filetime);
+}
+
+static uint64_t tmpfs_time_from_unix(const struct timespec *time)
+{
+	FILETIME filetime;
+	unix_timespec_to_filetime(time, &filetime);
+	return ((uint64_t)filetime.dwHighDateTime << 32) | filetime.dwLowDateTime;
+}
+
+/* Data chunks */
+
+static char *tmpfs_get_chunk_view(struct tmpfs *fs, uint32_t chunk)
+{
+	struct tmpfs_view *view = &fs->views[chunk % TMPFS_VIEW_CACHE_SIZE];
+	if (view->chunk == chunk)
+		return view->addr;
+	if (view->addr)
+		UnmapViewOfFile(view->addr);
+	view->chunk = 0;
+	uint64_t offset = (uint64_t)(chunk - 1) * TMPFS_CHUNK_SIZE;
+	view->addr = (char *)MapViewOfFile(fs->data_section, FILE_MAP_ALL_ACCESS, (DWORD)(offset >> 32), (DWORD)offset, TMPFS_CHUNK_SIZE);
+	if (!view->addr)
+	{
+		log_error("tmpfs: MapViewOfFile() failed, error code: %d\n", GetLastError());
+		return NULL;
+	}
+	/* The data section is SEC_RESERVE, this is a no-op if the chunk is already committed */
+	if (!VirtualAlloc(view->addr, TMPFS_CHUNK_SIZE, MEM_COMMIT, PAGE_READWRITE))
+	{
+		log_error("tmpfs: Committing chunk %d failed, error code: %d\n", chunk, GetLastError());
+		UnmapViewOfFile(view->addr);
+		view->addr = NULL;
+		return NULL;
+	}
+	view->chunk = chunk;
+	return view->addr;
+}
+
+static int tmpfs_reclaim_orphans(struct tmpfs *fs);
+
+static uint32_t tmpfs_alloc_chunk(struct tmpfs *fs)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	if (shared->used_chunks >= shared->max_chunks && !tmpfs_reclaim_orphans(fs))
+		return 0;
+	uint32_t words = (shared->max_chunks + 31) / 32;
+	for (uint32_t i = 0; i < words; i++)
+	{
+		uint32_t word = (shared->chunk_hint + i) % words;
+		unsigned long mask = ~shared->chunk_bitmap[word];
+		if (word == words - 1 && shared->max_chunks % 32)
+			mask &= (1UL << (shared->max_chunks % 32)) - 1;
+		unsigned long bit;
+		if (_BitScanForward(&bit, mask))
+		{
+			shared->chunk_bitmap[word] |= 1UL << bit;
+			shared->chunk_hint = word;
+			shared->used_chunks++;
+			return word * 32 + bit + 1;
+		}
+	}
+	return 0;
+}
+
+/* Free a chunk, the first used bytes of it may contain data */
+static void tmpfs_free_chunk(struct tmpfs *fs, uint32_t chunk, size_t used)
+{
+	if (used > 0)
+	{
+		char *view = tmpfs_get_chunk_view(fs, chunk);
+		if (!view)
+		{
+			/* We cannot keep free chunks zeroed, leak it */
+			return;
+		}
+		memset(view, 0, used);
+	}
+	fs->shared->chunk_bitmap[(chunk - 1) / 32] &= ~(1UL << ((chunk - 1) % 32));
+	fs->shared->used_chunks--;
+}
+
+/* Get the chunk in a slot of a file, 0 if it is a hole */
+static uint32_t tmpfs_get_slot(struct tmpfs *fs, struct tmpfs_inode *inode, uint32_t slot)
+{
+	if (slot >= inode->chunk_slots)
+		return 0;
+	if (slot < TMPFS_DIRECT_CHUNKS)
+		return inode->direct[slot];
+	if (!inode->indirect)
+		return 0;
+	uint32_t *table = (uint32_t *)tmpfs_get_chunk_view(fs, inode->indirect);
+	if (!table)
+		return 0;
+	return table[slot - TMPFS_DIRECT_CHUNKS];
+}
+
+static int tmpfs_set_slot(struct tmpfs *fs, struct tmpfs_inode *inode, uint32_t slot, uint32_t chunk)
+{
+	if (slot < TMPFS_DIRECT_CHUNKS)
+		inode->direct[slot] = chunk;
+	else
+	{
+		if (!inode->indirect && !(inode->indirect = tmpfs_alloc_chunk(fs)))
+			return 0;
+		uint32_t *table = (uint32_t *)tmpfs_get_chunk_view(fs, inode->indirect);
+		if (!table)
+			return 0;
+		table[slot - TMPFS_DIRECT_CHUNKS] = chunk;
+	}
+	if (chunk && slot >= inode->chunk_slots)
+		inode->chunk_slots = slot + 1;
+	return 1;
+}
+
+/* Get the chunk in a slot of a file, allocate it if it is a hole */
+static uint32_t tmpfs_get_or_alloc_slot(struct tmpfs *fs, struct tmpfs_inode *inode, uint32_t slot)
+{
+	uint32_t chunk = tmpfs_get_slot(fs, inode, slot);
+	if (chunk)
+		return chunk;
+	if (!(chunk = tmpfs_alloc_chunk(fs)))
+		return 0;
+	if (!tmpfs_set_slot(fs, inode, slot, chunk))
+	{
+		tmpfs_free_chunk(fs, chunk, 0);
+		return 0;
+	}
+	return chunk;
+}
+
+/* Free all chunks of a file starting from a slot */
+static void tmpfs_free_chunks(struct tmpfs *fs, struct tmpfs_inode *inode, uint32_t first_slot)
+{
+	for (uint32_t slot = first_slot; slot < inode->chunk_slots; slot++)
+	{
+		uint32_t chunk = tmpfs_get_slot(fs, inode, slot);
+		if (!chunk)
+			continue;
+		size_t used;
+		if (inode->flags & TMPFS_INODE_MAPPED)
+			used = TMPFS_CHUNK_SIZE;
+		else
+		{
+			uint64_t start = (uint64_t)slot * TMPFS_CHUNK_SIZE;
+			used = inode->size <= start ? 0 : (size_t)min(inode->size - start, TMPFS_CHUNK_SIZE);
+		}
+		tmpfs_free_chunk(fs, chunk, used);
+		tmpfs_set_slot(fs, inode, slot, 0);
+	}
+	/* All slots in the indirect chunk are cleared now, so it is still all zero */
+	if (first_slot <= TMPFS_DIRECT_CHUNKS && inode->indirect)
+	{
+		tmpfs_free_chunk(fs, inode->indirect, 0);
+		inode->indirect = 0;
+	}
+	if (inode->chunk_slots > first_slot)
+		inode->chunk_slots = first_slot;
+}
+
+static size_t tmpfs_read_data(struct tmpfs *fs, struct tmpfs_inode *inode, void *buf, size_t count, uint64_t offset)
+{
+	if (offset >= inode->size)
+		return 0;
+	if (count > inode->size - offset)
+		count = (size_t)(inode->size - offset);
+	char *p = (char *)buf;
+	size_t done = 0;
+	while (done < count)
+	{
+		uint32_t slot = (uint32_t)(offset / TMPFS_CHUNK_SIZE);
+		size_t chunk_offset = (size_t)(offset % TMPFS_CHUNK_SIZE);
+		size_t len = min(count - done, TMPFS_CHUNK_SIZE - chunk_offset);
+		uint32_t chunk = tmpfs_get_slot(fs, inode, slot);
+		if (chunk)
+		{
+			char *view = tmpfs_get_chunk_view(fs, chunk);
+			if (!view)
+				return done > 0 ? done : -EIO;
+			memcpy(p, view + chunk_offset, len);
+		}
+		else
+			memset(p, 0, len);
+		p += len;
+		offset += len;
+		done += len;
+	}
+	return done;
+}
+
+static size_t tmpfs_write_data(struct tmpfs *fs, struct tmpfs_inode *inode, const void *buf, size_t count, uint64_t offset)
+{
+	if (count == 0)
+		return 0;
+	if (offset >= TMPFS_MAX_FILE_SIZE)
+		return -EFBIG;
+	if (count > TMPFS_MAX_FILE_SIZE - offset)
+		count = (size_t)(TMPFS_MAX_FILE_SIZE - offset);
+	const char *p = (const char *)buf;
+	size_t done = 0;
+	while (done < count)
+	{
+		uint32_t slot = (uint32_t)(offset / TMPFS_CHUNK_SIZE);
+		size_t chunk_offset = (size_t)(offset % TMPFS_CHUNK_SIZE);
+		size_t len = min(count - done, TMPFS_CHUNK_SIZE - chunk_offset);
+		uint32_t chunk = tmpfs_get_or_alloc_slot(fs, inode, slot);
+		if (!chunk)
+			break;
+		char *view = tmpfs_get_chunk_view(fs, chunk);
+		if (!view)
+			break;
+		memcpy(view + chunk_offset, p, len);
+		p += len;
+		offset += len;
+		done += len;
+	}
+	if (done == 0)
+		return -ENOSPC;
+	if (offset > inode->size)
+		inode->size = offset;
+	inode->mtime = inode->ctime = tmpfs_now();
+	return done;
+}
+
+static void tmpfs_resize(struct tmpfs *fs, struct tmpfs_inode *inode, uint64_t length)
+{
+	if (length < inode->size)
+	{
+		uint32_t slot = (uint32_t)(length / TMPFS_CHUNK_SIZE);
+		size_t chunk_offset = (size_t)(length % TMPFS_CHUNK_SIZE);
+		if (inode->flags & TMPFS_INODE_MAPPED)
+		{
+			/* The chunks may be mapped by others, only clear their content */
+			for (; slot < inode->chunk_slots; slot++, chunk_offset = 0)
+			{
+				uint32_t chunk = tmpfs_get_slot(fs, inode, slot);
+				char *view;
+				if (chunk && (view = tmpfs_get_chunk_view(fs, chunk)))
+					memset(view + chunk_offset, 0, TMPFS_CHUNK_SIZE - chunk_offset);
+			}
+		}
+		else
+		{
+			/* Clear the tail of the last chunk so extending the file later reads zeros */
+			uint32_t chunk;
+			char *view;
+			if (chunk_offset > 0 && (chunk = tmpfs_get_slot(fs, inode, slot)) && (view = tmpfs_get_chunk_view(fs, chunk)))
+			{
+				size_t end = (size_t)min(inode->size - (uint64_t)slot * TMPFS_CHUNK_SIZE, TMPFS_CHUNK_SIZE);
+				memset(view + chunk_offset, 0, end - chunk_offset);
+			}
+			tmpfs_free_chunks(fs, inode, (uint32_t)((length + TMPFS_CHUNK_SIZE - 1) / TMPFS_CHUNK_SIZE));
+		}
+	}
+	inode->size = length;
+	inode->mtime = inode->ctime = tmpfs_now();
+}
+
+/* Inodes */
+
+static uint32_t tmpfs_alloc_inode(struct tmpfs *fs, uint32_t mode)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	if (shared->used_inodes >= TMPFS_MAX_INODES - 1)
+		tmpfs_reclaim_orphans(fs);
+	for (uint32_t i = 0; i < TMPFS_MAX_INODES - 1; i++)
+	{
+		uint32_t ino = (shared->inode_hint + i) % (TMPFS_MAX_INODES - 1) + 1;
+		struct tmpfs_inode *inode = &shared->inodes[ino];
+		if (inode->mode == 0)
+		{
+			memset(inode, 0, sizeof(struct tmpfs_inode));
+			inode->mode = mode;
+			inode->atime = inode->mtime = inode->ctime = tmpfs_now();
+			shared->inode_hint = ino;
+			shared->used_inodes++;
+			return ino;
+		}
+	}
+	return 0;
+}
+
+/* Free an inode if it is no longer referenced by any directory entry or open file */
+static void tmpfs_put_inode(struct tmpfs *fs, uint32_t ino)
+{
+	struct tmpfs_inode *inode = &fs->shared->inodes[ino];
+	if (inode->nlink > 0 || tmpfs_inode_in_use(fs, ino))
+		return;
+	tmpfs_free_chunks(fs, inode, 0);
+	inode->mode = 0;
+	fs->shared->used_inodes--;
+}
+
+/* Free unlinked inodes whose last user is gone without closing them (i.e. killed)
+ * Called with the exclusive lock held when running out of space, return whether anything is freed.
+ */
+static int tmpfs_reclaim_orphans(struct tmpfs *fs)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	uint32_t used_inodes = shared->used_inodes;
+	for (uint32_t ino = 1; ino < TMPFS_MAX_INODES; ino++)
+	{
+		struct tmpfs_inode *inode = &shared->inodes[ino];
+		if (inode->mode && inode->nlink == 0)
+			tmpfs_put_inode(fs, ino);
+	}
+	if (shared->used_inodes == used_inodes)
+		return 0;
+	log_info("tmpfs: Reclaimed %d orphaned inodes.\n", used_inodes - shared->used_inodes);
+	return 1;
+}
+
+/* Directory entries */
+
+static uint32_t tmpfs_hash(uint32_t parent, const char *name, int namelen)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261U ^ parent;
+	for (int i = 0; i < namelen; i++)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619U;
+	}
+	return hash % TMPFS_HASH_SIZE;
+}
+
+static uint32_t tmpfs_lookup(struct tmpfs *fs, uint32_t parent, const char *name, int namelen)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	for (uint32_t d = shared->hash[tmpfs_hash(parent, name, namelen)]; d; d = shared->dentries[d].next_hash)
+	{
+		struct tmpfs_dentry *dentry = &shared->dentries[d];
+		if (dentry->parent == parent && dentry->namelen == namelen && !memcmp(dentry->name, name, namelen))
+			return d;
+	}
+	return 0;
+}
+
+static void tmpfs_link_dentry(struct tmpfs *fs, uint32_t d, uint32_t parent, const char *name, int namelen)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	struct tmpfs_dentry *dentry = &shared->dentries[d];
+	struct tmpfs_inode *dir = &shared->inodes[parent];
+	dentry->parent = parent;
+	dentry->namelen = namelen;
+	memcpy(dentry->name, name, namelen);
+	dentry->name[namelen] = 0;
+	uint32_t hash = tmpfs_hash(parent, name, namelen);
+	dentry->next_hash = shared->hash[hash];
+	shared->hash[hash] = d;
+	dentry->prev_sibling = 0;
+	dentry->next_sibling = dir->first_child;
+	if (dir->first_child)
+		shared->dentries[dir->first_child].prev_sibling = d;
+	dir->first_child = d;
+	dir->child_count++;
+	dir->mtime = dir->ctime = tmpfs_now();
+}
+
+static void tmpfs_unlink_dentry(struct tmpfs *fs, uint32_t d)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	struct tmpfs_dentry *dentry = &shared->dentries[d];
+	struct tmpfs_inode *dir = &shared->inodes[dentry->parent];
+	uint32_t *p = &shared->hash[tmpfs_hash(dentry->parent, dentry->name, dentry->namelen)];
+	while (*p != d)
+		p = &shared->dentries[*p].next_hash;
+	*p = dentry->next_hash;
+	if (dentry->prev_sibling)
+		shared->dentries[dentry->prev_sibling].next_sibling = dentry->next_sibling;
+	else
+		dir->first_child = dentry->next_sibling;
+	if (dentry->next_sibling)
+		shared->dentries[dentry->next_sibling].prev_sibling = dentry->prev_sibling;
+	dir->child_count--;
+	dir->mtime = dir->ctime = tmpfs_now();
+	/* Invalidate getdents() cursors and rename() references */
+	dentry->generation++;
+}
+
+static uint32_t tmpfs_add_dentry(struct tmpfs *fs, uint32_t parent, const char *name, int namelen, uint32_t ino)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	for (uint32_t i = 0; i < TMPFS_MAX_DENTRIES - 1; i++)
+	{
+		uint32_t d = (shared->dentry_hint + i) % (TMPFS_MAX_DENTRIES - 1) + 1;
+		if (shared->dentries[d].inode == 0)
+		{
+			shared->dentries[d].inode = ino;
+			tmpfs_link_dentry(fs, d, parent, name, namelen);
+			shared->dentry_hint = d;
+			return d;
+		}
+	}
+	return 0;
+}
+
+static void tmpfs_remove_dentry(struct tmpfs *fs, uint32_t d)
+{
+	tmpfs_unlink_dentry(fs, d);
+	fs->shared->dentries[d].inode = 0;
+}
+
+/* Walk all but the last component of a path
+ * Returns the inode of the parent directory, or a negative error code
+ */
+static int tmpfs_walk_parent(struct tmpfs *fs, const char *path, const char **name, int *namelen)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	uint32_t ino = TMPFS_ROOT_INODE;
+	for (;;)
+	{
+		const char *end = path;
+		while (*end && *end != '/')
+			end++;
+		if (end - path > TMPFS_NAME_MAX)
+			return -ENAMETOOLONG;
+		if (*end == 0)
+		{
+			*name = path;
+			*namelen = (int)(end - path);
+			return ino;
+		}
+		uint32_t d = tmpfs_lookup(fs, ino, path, (int)(end - path));
+		if (!d)
+			return -ENOENT;
+		ino = shared->dentries[d].inode;
+		if (!S_ISDIR(shared->inodes[ino].mode))
+			return -ENOTDIR;
+		path = end + 1;
+	}
+}
+
+/* Create a new inode and link it into a directory */
+static int tmpfs_create(struct tmpfs *fs, uint32_t parent, const char *name, int namelen, uint32_t mode, uint32_t *out_dentry)
+{
+	struct tmpfs_shared *shared = fs->shared;
+	uint32_t ino = tmpfs_alloc_inode(fs, mode);
+	if (!ino)
+		return -ENOSPC;
+	uint32_t d = tmpfs_add_dentry(fs, parent, name, namelen, ino);
+	if (!d)
+	{
+		tmpfs_put_inode(fs, ino);
+		return -ENOSPC;
+	}
+	struct tmpfs_inode *inode = &shared->inodes[ino];
+	if (S_ISDIR(mode))
+	{
+		inode->nlink = 2;
+		inode->dentry = d;
+		shared->inodes[parent].nlink++;
+	}
+	else
+		inode->nlink = 1;
+	*out_dentry = d;
+	return 0;
+}
+
+static int tmpfs_read_symlink(struct tmpfs *fs, struct tmpfs_inode *inode, char *target, int buflen)
+{
+	size_t r = tmpfs_read_data(fs, inode, target, buflen - 1, 0);
+	if ((intptr_t)r < 0)
+		return r;
+	target[r] = 0;
+	return r;
+}
+
+/* File operations */
+
+static void tmpfs_lock_shared(struct tmpfs *fs)
+{
+	rwlock_lock_shared(&fs->lock);
+}
+
+static void tmpfs_unlock_shared(struct tmpfs *fs)
+{
+	rwlock_unlock_shared(&fs->lock);
+}
+
+static void tmpfs_lock_exclusive(struct tmpfs *fs)
+{
+	rwlock_lock_exclusive(&fs->lock);
+}
+
+static void tmpfs_unlock_exclusive(struct tmpfs *fs)
+{
+	rwlock_unlock_exclusive(&fs->lock);
+}
+
+static int tmpfs_get_poll_status(struct file *f)
+{
+	return LINUX_POLLIN | LINUX_POLLOUT;
+}
+
+static int tmpfs_close(struct file *f)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	tmpfs_lock_exclusive(file->fs);
+	CloseHandle(file->inode_ref);
+	tmpfs_put_inode(file->fs, file->inode);
+	tmpfs_unlock_exclusive(file->fs);
+	kfree(file, sizeof(struct tmpfs_file) + file->pathlen);
+	return 0;
+}
+
+static int tmpfs_getpath(struct file *f, char *buf)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	/* Copy mountpoint */
+	int len_mountpoint = strlen(file->fs->base_fs.mountpoint);
+	memcpy(buf, file->fs->base_fs.mountpoint, len_mountpoint);
+	if (file->pathlen == 0)
+	{
+		buf[len_mountpoint] = 0;
+		return len_mountpoint;
+	}
+	if (buf[len_mountpoint - 1] != '/')
+		buf[len_mountpoint++] = '/';
+	/* Copy subpath */
+	memcpy(buf + len_mountpoint, file->pathname, file->pathlen);
+	buf[len_mountpoint + file->pathlen] = 0;
+	return len_mountpoint + file->pathlen;
+}
+
+static size_t tmpfs_pread(struct file *f, void *buf, size_t count, loff_t offset)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	if ((f->flags & O_PATH) || (f->flags & O_ACCMODE) == O_WRONLY)
+		return -EBADF;
+	if (offset < 0)
+		return -EINVAL;
+	tmpfs_lock_shared(file->fs);
+	struct tmpfs_inode *inode = &file->fs->shared->inodes[file->inode];
+	size_t r;
+	if (S_ISDIR(inode->mode))
+		r = -EISDIR;
+	else
+		r = tmpfs_read_data(file->fs, inode, buf, count, offset);
+	tmpfs_unlock_shared(file->fs);
+	return r;
+}
+
+static size_t tmpfs_read(struct file *f, void *buf, size_t count)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	size_t r = tmpfs_pread(f, buf, count, file->offset);
+	if ((intptr_t)r > 0)
+		file->offset += r;
+	return r;
+}
+
+static size_t tmpfs_write_internal(struct tmpfs_file *file, const void *buf, size_t count, loff_t offset, int append)
+{
+	if ((file->base_file.flags & O_PATH) || (file->base_file.flags & O_ACCMODE) == O_RDONLY)
+		return -EBADF;
+	if (offset < 0)
+		return -EINVAL;
+	tmpfs_lock_exclusive(file->fs);
+	struct tmpfs_inode *inode = &file->fs->shared->inodes[file->inode];
+	if (append)
+		file->offset = offset = inode->size;
+	size_t r = tmpfs_write_data(file->fs, inode, buf, count, offset);
+	tmpfs_unlock_exclusive(file->fs);
+	return r;
+}
+
+static size_t tmpfs_write(struct file *f, const void *buf, size_t count)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	size_t r = tmpfs_write_internal(file, buf, count, file->offset, f->flags & O_APPEND);
+	if ((intptr_t)r > 0)
+		file->offset += r;
+	return r;
+}
+
+static size_t tmpfs_pwrite(struct file *f, const void *buf, size_t count, loff_t offset)
+{
+	return tmpfs_write_internal((struct tmpfs_file *)f, buf, count, offset, 0);
+}
+
+static size_t tmpfs_readlink(struct file *f, char *buf, size_t bufsize)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	tmpfs_lock_shared(file->fs);
+	struct tmpfs_inode *inode = &file->fs->shared->inodes[file->inode];
+	size_t r;
+	if (!S_ISLNK(inode->mode))
+		r = -EINVAL;
+	else
+		r = tmpfs_read_data(file->fs, inode, buf, bufsize, 0);
+	tmpfs_unlock_shared(file->fs);
+	return r;
+}
+
+static int tmpfs_truncate(struct file *f, loff_t length)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	if (length < 0)
+		return -EINVAL;
+	if (length > TMPFS_MAX_FILE_SIZE)
+		return -EFBIG;
+	tmpfs_lock_exclusive(file->fs);
+	struct tmpfs_inode *inode = &file->fs->shared->inodes[file->inode];
+	int r = 0;
+	if (S_ISDIR(inode->mode))
+		r = -EISDIR;
+	else if (!S_ISREG(inode->mode))
+		r = -EINVAL;
+	else
+		tmpfs_resize(file->fs, inode, length);
+	tmpfs_unlock_exclusive(file->fs);
+	return r;
+}
+
+static int tmpfs_fsync(struct file *f)
+{
+	return 0;
+}
+
+static int tmpfs_llseek(struct file *f, loff_t offset, loff_t *newoffset, int whence)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	loff_t target;
+	if (whence == SEEK_SET)
+		target = offset;
+	else if (whence == SEEK_CUR)
+		target = file->offset + offset;
+	else if (whence == SEEK_END)
+	{
+		tmpfs_lock_shared(file->fs);
+		target = file->fs->shared->inodes[file->inode].size + offset;
+		tmpfs_unlock_shared(file->fs);
+	}
+	else
+		return -EINVAL;
+	if (target < 0)
+		return -EINVAL;
+	file->offset = target;
+	if (target == 0)
+	{
+		/* Restart getdents() */
+		file->dir_position = 0;
+		file->dir_cursor = 0;
+	}
+	*newoffset = target;
+	return 0;
+}
+
+static int tmpfs_stat(struct file *f, struct newstat *buf)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	tmpfs_lock_shared(file->fs);
+	struct tmpfs_inode *inode = &file->fs->shared->inodes[file->inode];
+	INIT_STRUCT_NEWSTAT_PADDING(buf);
+	buf->st_dev = file->fs->dev;
+	buf->st_ino = file->inode;
+	buf->st_mode = inode->mode;
+	buf->st_nlink = inode->nlink;
+	buf->st_uid = 0;
+	buf->st_gid = 0;
+	buf->st_rdev = 0;
+	if (S_ISDIR(inode->mode))
+		buf->st_size = (inode->child_count + 2) * 20; /* Mimic Linux tmpfs */
+	else
+		buf->st_size = inode->size;
+	buf->st_blksize = PAGE_SIZE;
+	buf->st_blocks = ALIGN_TO(buf->st_size, PAGE_SIZE) / 512;
+	tmpfs_time_to_unix(inode->atime, &buf->st_atime, &buf->st_atime_nsec);
+	tmpfs_time_to_unix(inode->mtime, &buf->st_mtime, &buf->st_mtime_nsec);
+	tmpfs_time_to_unix(inode->ctime, &buf->st_ctime, &buf->st_ctime_nsec);
+	tmpfs_unlock_shared(file->fs);
+	return 0;
+}
+
+static int tmpfs_utimens(struct file *f, const struct timespec *times)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	tmpfs_lock_exclusive(file->fs);
+	struct tmpfs_inode *inode = &file->fs->shared->inodes[file->inode];
+	uint64_t now = tmpfs_now();
+	if (!times)
+		inode->atime = inode->mtime = now;
+	else
+	{
+		inode->atime = tmpfs_time_from_unix(&times[0]);
+		inode->mtime = tmpfs_time_from_unix(&times[1]);
+	}
+	inode->ctime = now;
+	tmpfs_unlock_exclusive(file->fs);
+	return 0;
+}
+
+static char tmpfs_dirent_type(uint32_t mode)
+{
+	if (S_ISDIR(mode))
+		return DT_DIR;
+	else if (S_ISLNK(mode))
+		return DT_LNK;
+	else
+		return DT_REG;
+}
+
+static int tmpfs_getdents(struct file *f, void *dirent, size_t count, getdents_callback *fill_callback)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	tmpfs_lock_shared(file->fs);
+	struct tmpfs_shared *shared = file->fs->shared;
+	struct tmpfs_inode *dir = &shared->inodes[file->inode];
+	if (!S_ISDIR(dir->mode))
+	{
+		tmpfs_unlock_shared(file->fs);
+		return -ENOTDIR;
+	}
+	intptr_t size = 0;
+	char *buf = (char *)dirent;
+	for (;;)
+	{
+		const char *name;
+		int namelen;
+		uint32_t ino;
+		char type;
+		uint32_t next = 0;
+		if (file->dir_position == 0)
+		{
+			name = ".";
+			namelen = 1;
+			ino = file->inode;
+			type = DT_DIR;
+		}
+		else if (file->dir_position == 1)
+		{
+			name = "..";
+			namelen = 2;
+			ino = dir->dentry ? shared->dentries[dir->dentry].parent : file->inode;
+			type = DT_DIR;
+		}
+		else
+		{
+			uint32_t d = file->dir_cursor;
+			if (file->dir_position == 2)
+				d = dir->first_child;
+			else if (!d || shared->dentries[d].generation != file->dir_cursor_generation)
+			{
+				/* The cursor entry was removed, find our position by counting from the beginning */
+				d = dir->first_child;
+				for (uint32_t i = 2; d && i < file->dir_position; i++)
+					d = shared->dentries[d].next_sibling;
+			}
+			if (!d)
+				break;
+			struct tmpfs_dentry *dentry = &shared->dentries[d];
+			name = dentry->name;
+			namelen = dentry->namelen;
+			ino = dentry->inode;
+			type = tmpfs_dirent_type(shared->inodes[ino].mode);
+			next = dentry->next_sibling;
+		}
+		intptr_t r = (*fill_callback)(buf, ino, name, namelen, type, count, GETDENTS_UTF8);
+		if (r == GETDENTS_ERR_BUFFER_OVERFLOW)
+			break;
+		if (r < 0)
+		{
+			size = r;
+			break;
+		}
+		count -= r;
+		size += r;
+		buf += r;
+		file->dir_position++;
+		if (file->dir_position > 2)
+		{
+			file->dir_cursor = next;
+			file->dir_cursor_generation = next ? shared->dentries[next].generation : 0;
+		}
+	}
+	tmpfs_unlock_shared(file->fs);
+	return size;
+}
+
+static int tmpfs_statfs(struct file *f, struct statfs64 *buf)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	struct tmpfs_shared *shared = file->fs->shared;
+	buf->f_type = TMPFS_MAGIC;
+	buf->f_bsize = PAGE_SIZE;
+	buf->f_blocks = (uint64_t)shared->max_chunks * TMPFS_PAGES_PER_CHUNK;
+	buf->f_bfree = (uint64_t)(shared->max_chunks - shared->used_chunks) * TMPFS_PAGES_PER_CHUNK;
+	buf->f_bavail = buf->f_bfree;
+	buf->f_files = TMPFS_MAX_INODES - 1;
+	buf->f_ffree = TMPFS_MAX_INODES - 1 - shared->used_inodes;
+	buf->f_fsid.val[0] = file->fs->dev;
+	buf->f_fsid.val[1] = 0;
+	buf->f_namelen = TMPFS_NAME_MAX;
+	buf->f_frsize = PAGE_SIZE;
+	buf->f_flags = 0;
+	buf->f_spare[0] = 0;
+	buf->f_spare[1] = 0;
+	buf->f_spare[2] = 0;
+	buf->f_spare[3] = 0;
+	return 0;
+}
+
+static HANDLE tmpfs_get_section(struct file *f, loff_t offset, loff_t *section_offset)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	if (offset < 0 || offset % TMPFS_CHUNK_SIZE || offset >= TMPFS_MAX_FILE_SIZE)
+		return NULL;
+	tmpfs_lock_exclusive(file->fs);
+	struct tmpfs_inode *inode = &file->fs->shared->inodes[file->inode];
+	HANDLE section = NULL;
+	if (S_ISREG(inode->mode))
+	{
+		uint32_t chunk = tmpfs_get_or_alloc_slot(file->fs, inode, (uint32_t)(offset / TMPFS_CHUNK_SIZE));
+		if (chunk)
+		{
+			inode->flags |= TMPFS_INODE_MAPPED;
+			*section_offset = (loff_t)(chunk - 1) * TMPFS_CHUNK_SIZE;
+			section = file->fs->data_section;
+		}
+	}
+	tmpfs_unlock_exclusive(file->fs);
+	return section;
+}
+
+static const struct file_ops tmpfs_ops =
+{
+	.get_poll_status = tmpfs_get_poll_status,
+	.close = tmpfs_close,
+	.getpath = tmpfs_getpath,
+	.read = tmpfs_read,
+	.write = tmpfs_write,
+	.pread = tmpfs_pread,
+	.pwrite = tmpfs_pwrite,
+	.readlink = tmpfs_readlink,
+	.truncate = tmpfs_truncate,
+	.fsync = tmpfs_fsync,
+	.llseek = tmpfs_llseek,
+	.stat = tmpfs_stat,
+	.utimens = tmpfs_utimens,
+	.getdents = tmpfs_getdents,
+	.statfs = tmpfs_statfs,
+	.get_section = tmpfs_get_section,
+};
+
+/* File system operations */
+
+static int tmpfs_open(struct file_system *fs, const char *path, int flags, int mode, struct file **fp, char *target, int buflen)
+{
+	struct tmpfs *tmpfs = (struct tmpfs *)fs;
+	struct tmpfs_shared *shared = tmpfs->shared;
+	int writable = !(flags & O_PATH) && (flags & O_ACCMODE) != O_RDONLY;
+	int exclusive = (flags & O_CREAT) || ((flags & O_TRUNC) && writable);
+	if (exclusive)
+		tmpfs_lock_exclusive(tmpfs);
+	else
+		tmpfs_lock_shared(tmpfs);
+	int r = 0;
+	uint32_t ino, d = 0;
+	if (*path == 0)
+		ino = TMPFS_ROOT_INODE;
+	else
+	{
+		const char *name;
+		int namelen;
+		int parent = tmpfs_walk_parent(tmpfs, path, &name, &namelen);
+		if (parent < 0)
+		{
+			r = parent;
+			goto out;
+		}
+		d = tmpfs_lookup(tmpfs, parent, name, namelen);
+		if (!d)
+		{
+			if (!(flags & O_CREAT))
+			{
+				r = -ENOENT;
+				goto out;
+			}
+			if ((r = tmpfs_create(tmpfs, parent, name, namelen, S_IFREG | (mode & 07777), &d)) < 0)
+				goto out;
+		}
+		else if ((flags & O_CREAT) && (flags & O_EXCL))
+		{
+			r = -EEXIST;
+			goto out;
+		}
+		ino = shared->dentries[d].inode;
+	}
+	struct tmpfs_inode *inode = &shared->inodes[ino];
+	if (S_ISLNK(inode->mode))
+	{
+		if (!(flags & O_NOFOLLOW))
+		{
+			r = tmpfs_read_symlink(tmpfs, inode, target, buflen);
+			if (r >= 0)
+				r = 1;
+			goto out;
+		}
+		if (!(flags & O_PATH))
+		{
+			log_info("Specified O_NOFOLLOW but not O_PATH, returning ELOOP.\n");
+			r = -ELOOP;
+			goto out;
+		}
+	}
+	else if (S_ISDIR(inode->mode))
+	{
+		if (writable)
+		{
+			r = -EISDIR;
+			goto out;
+		}
+	}
+	else if (flags & O_DIRECTORY)
+	{
+		r = -ENOTDIR;
+		goto out;
+	}
+	else if ((flags & O_TRUNC) && writable)
+		tmpfs_resize(tmpfs, inode, 0);
+
+	if (fp)
+	{
+		/* The inode reference is an inheritable handle, so it is inherited by forked children as well */
+		HANDLE inode_ref = tmpfs_ref_inode(tmpfs, ino);
+		if (!inode_ref)
+		{
+			r = -ENOMEM;
+			goto out;
+		}
+		int pathlen = strlen(path);
+		struct tmpfs_file *file = (struct tmpfs_file *)kmalloc(sizeof(struct tmpfs_file) + pathlen);
+		file->base_file.op_vtable = &tmpfs_ops;
+		file->base_file.ref = 1;
+		file->base_file.flags = flags;
+		file->fs = tmpfs;
+		file->inode = ino;
+		file->inode_ref = inode_ref;
+		file->dentry = d;
+		file->dentry_generation = shared->dentries[d].generation;
+		file->offset = 0;
+		file->dir_position = 0;
+		file->dir_cursor = 0;
+		file->dir_cursor_generation = 0;
+		file->pathlen = pathlen;
+		memcpy(file->pathname, path, pathlen);
+		*fp = (struct file *)file;
+	}
+out:
+	if (exclusive)
+		tmpfs_unlock_exclusive(tmpfs);
+	else
+		tmpfs_unlock_shared(tmpfs);
+	return r;
+}
+
+static int tmpfs_symlink(struct file_system *fs, const char *target, const char *linkpath)
+{
+	struct tmpfs *tmpfs = (struct tmpfs *)fs;
+	int targetlen = strlen(target);
+	if (targetlen >= PATH_MAX)
+		return -ENAMETOOLONG;
+	if (*linkpath == 0)
+		return -EEXIST;
+	tmpfs_lock_exclusive(tmpfs);
+	const char *name;
+	int namelen;
+	uint32_t d;
+	int r = tmpfs_walk_parent(tmpfs, linkpath, &name, &namelen);
+	if (r < 0)
+		goto out;
+	if (tmpfs_lookup(tmpfs, r, name, namelen))
+	{
+		r = -EEXIST;
+		goto out;
+	}
+	if ((r = tmpfs_create(tmpfs, r, name, namelen, S_IFLNK | 0777, &d)) < 0)
+		goto out;
+	uint32_t ino = tmpfs->shared->dentries[d].inode;
+	size_t written = tmpfs_write_data(tmpfs, &tmpfs->shared->inodes[ino], target, targetlen, 0);
+	if (written != targetlen)
+	{
+		tmpfs_remove_dentry(tmpfs, d);
+		tmpfs->shared->inodes[ino].nlink = 0;
+		tmpfs_put_inode(tmpfs, ino);
+		r = -ENOSPC;
+	}
+out:
+	tmpfs_unlock_exclusive(tmpfs);
+	return r;
+}
+
+static int tmpfs_link(struct file_system *fs, struct file *f, const char *newpath)
+{
+	struct tmpfs *tmpfs = (struct tmpfs *)fs;
+	if (f->op_vtable != &tmpfs_ops || ((struct tmpfs_file *)f)->fs != tmpfs)
+		return -EXDEV;
+	if (*newpath == 0)
+		return -EEXIST;
+	uint32_t ino = ((struct tmpfs_file *)f)->inode;
+	tmpfs_lock_exclusive(tmpfs);
+	struct tmpfs_inode *inode = &tmpfs->shared->inodes[ino];
+	const char *name;
+	int namelen;
+	int r;
+	if (S_ISDIR(inode->mode))
+		r = -EPERM;
+	else if (inode->nlink == 0)
+		r = -ENOENT;
+	else if ((r = tmpfs_walk_parent(tmpfs, newpath, &name, &namelen)) >= 0)
+	{
+		if (tmpfs_lookup(tmpfs, r, name, namelen))
+			r = -EEXIST;
+		else if (!tmpfs_add_dentry(tmpfs, r, name, namelen, ino))
+			r = -ENOSPC;
+		else
+		{
+			inode->nlink++;
+			inode->ctime = tmpfs_now();
+			r = 0;
+		}
+	}
+	tmpfs_unlock_exclusive(tmpfs);
+	return r;
+}
+
+static int tmpfs_unlink(struct file_system *fs, const char *pathname)
+{
+	struct tmpfs *tmpfs = (struct tmpfs *)fs;
+	if (*pathname == 0)
+		return -EISDIR;
+	tmpfs_lock_exclusive(tmpfs);
+	const char *name;
+	int namelen;
+	int r = tmpfs_walk_parent(tmpfs, pathname, &name, &namelen);
+	if (r >= 0)
+	{
+		uint32_t d = tmpfs_lookup(tmpfs, r, name, namelen);
+		if (!d)
+			r = -ENOENT;
+		else
+		{
+			uint32_t ino = tmpfs->shared->dentries[d].inode;
+			struct tmpfs_inode *inode = &tmpfs->shared->inodes[ino];
+			if (S_ISDIR(inode->mode))
+				r = -EISDIR;
+			else
+			{
+				tmpfs_remove_dentry(tmpfs, d);
+				inode->nlink--;
+				inode->ctime = tmpfs_now();
+				tmpfs_put_inode(tmpfs, ino);
+				r = 0;
+			}
+		}
+	}
+	tmpfs_unlock_exclusive(tmpfs);
+	return r;
+}
+
+/* Unlink an empty directory, the directory entry must be already removed from its parent */
+static void tmpfs_drop_directory(struct tmpfs *fs, uint32_t ino, uint32_t parent)
+{
+	fs->shared->inodes[ino].nlink = 0;
+	fs->shared->inodes[parent].nlink--;
+	tmpfs_put_inode(fs, ino);
+}
+
+static int tmpfs_rename(struct file_system *fs, struct file *f, const char *newpath)
+{
+	struct tmpfs *tmpfs = (struct tmpfs *)fs;
+	struct tmpfs_file *file = (struct tmpfs_file *)f;
+	if (f->op_vtable != &tmpfs_ops || file->fs != tmpfs)
+		return -EXDEV;
+	if (file->dentry == 0 || *newpath == 0)
+		return -EBUSY;
+	tmpfs_lock_exclusive(tmpfs);
+	struct tmpfs_shared *shared = tmpfs->shared;
+	struct tmpfs_dentry *dentry = &shared->dentries[file->dentry];
+	const char *name;
+	int namelen;
+	int r;
+	if (dentry->inode != file->inode || dentry->generation != file->dentry_generation)
+	{
+		/* The source was removed or renamed after we opened it */
+		r = -ENOENT;
+		goto out;
+	}
+	if ((r = tmpfs_walk_parent(tmpfs, newpath, &name, &namelen)) < 0)
+		goto out;
+	uint32_t new_parent = r;
+	uint32_t old_parent = dentry->parent;
+	int is_dir = S_ISDIR(shared->inodes[file->inode].mode);
+	if (is_dir)
+	{
+		/* A directory cannot be moved into itself */
+		for (uint32_t ino = new_parent; ino != TMPFS_ROOT_INODE; ino = shared->dentries[shared->inodes[ino].dentry].parent)
+			if (ino == file->inode)
+			{
+				r = -EINVAL;
+				goto out;
+			}
+	}
+	uint32_t target = tmpfs_lookup(tmpfs, new_parent, name, namelen);
+	if (target)
+	{
+		uint32_t target_ino = shared->dentries[target].inode;
+		struct tmpfs_inode *target_inode = &shared->inodes[target_ino];
+		if (target_ino == file->inode)
+		{
+			r = 0;
+			goto out;
+		}
+		if (is_dir)
+		{
+			if (!S_ISDIR(target_inode->mode))
+			{
+				r = -ENOTDIR;
+				goto out;
+			}
+			if (target_inode->child_count > 0)
+			{
+				r = -ENOTEMPTY;
+				goto out;
+			}
+			tmpfs_remove_dentry(tmpfs, target);
+			tmpfs_drop_directory(tmpfs, target_ino, new_parent);
+		}
+		else
+		{
+			if (S_ISDIR(target_inode->mode))
+			{
+				r = -EISDIR;
+				goto out;
+			}
+			tmpfs_remove_dentry(tmpfs, target);
+			target_inode->nlink--;
+			tmpfs_put_inode(tmpfs, target_ino);
+		}
+	}
+	tmpfs_unlink_dentry(tmpfs, file->dentry);
+	tmpfs_link_dentry(tmpfs, file->dentry, new_parent, name, namelen);
+	/* The entry is reused, keep our reference valid */
+	file->dentry_generation = dentry->generation;
+	if (is_dir && old_parent != new_parent)
+	{
+		shared->inodes[old_parent].nlink--;
+		shared->inodes[new_parent].nlink++;
+	}
+	shared->inodes[file->inode].ctime = tmpfs_now();
+	r = 0;
+out:
+	tmpfs_unlock_exclusive(tmpfs);
+	return r;
+}
+
+static int tmpfs_mkdir(struct file_system *fs, const char *pathname, int mode)
+{
+	struct tmpfs *tmpfs = (struct tmpfs *)fs;
+	if (*pathname == 0)
+		return -EEXIST;
+	tmpfs_lock_exclusive(tmpfs);
+	const char *name;
+	int namelen;
+	uint32_t d;
+	int r = tmpfs_walk_parent(tmpfs, pathname, &name, &namelen);
+	if (r >= 0)
+	{
+		if (tmpfs_lookup(tmpfs, r, name, namelen))
+			r = -EEXIST;
+		else
+			r = tmpfs_create(tmpfs, r, name, namelen, S_IFDIR | (mode & 07777), &d);
+	}
+	tmpfs_unlock_exclusive(tmpfs);
+	return r;
+}
+
+static int tmpfs_rmdir(struct file_system *fs, const char *pathname)
+{
+	struct tmpfs *tmpfs = (struct tmpfs *)fs;
+	if (*pathname == 0)
+		return -EBUSY;
+	tmpfs_lock_exclusive(tmpfs);
+	const char *name;
+	int namelen;
+	int r = tmpfs_walk_parent(tmpfs, pathname, &name, &namelen);
+	if (r >= 0)
+	{
+		uint32_t parent = r;
+		uint32_t d = tmpfs_lookup(tmpfs, parent, name, namelen);
+		if (!d)
+			r = -ENOENT;
+		else
+		{
+			uint32_t ino = tmpfs->shared->dentries[d].inode;
+			struct tmpfs_inode *inode = &tmpfs->shared->inodes[ino];
+			if (!S_ISDIR(inode->mode))
+				r = -ENOTDIR;
+			else if (inode->child_count > 0)
+				r = -ENOTEMPTY;
+			else
+			{
+				tmpfs_remove_dentry(tmpfs, d);
+				tmpfs_drop_directory(tmpfs, ino, parent);
+				r = 0;
+			}
+		}
+	}
+	tmpfs_unlock_exclusive(tmpfs);
+	return r;
+}
+
+/* Get the id of the logon session of the current process */
+static LUID tmpfs_get_logon_id()
+{
+	LUID id = { 0 };
+	HANDLE token;
+	if (OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+	{
+		TOKEN_STATISTICS stats;
+		DWORD len;
+		if (GetTokenInformation(token, TokenStatistics, &stats, sizeof(stats), &len))
+			id = stats.AuthenticationId;
+		else
+			log_error("tmpfs: GetTokenInformation() failed, error code: %d\n", GetLastError());
+		CloseHandle(token);
+	}
+	else
+		log_error("tmpfs: OpenProcessToken() failed, error code: %d\n", GetLastError());
+	return id;
+}
+
+static int tmpfs_map_shared(struct tmpfs *fs)
+{
+	fs->shared = (struct tmpfs_shared *)MapViewOfFile(fs->shared_section, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(struct tmpfs_shared));
+	if (!fs->shared)
+	{
+		log_error("tmpfs: Mapping metadata section failed, error code: %d\n", GetLastError());
+		return 0;
+	}
+	WCHAR event_name[128];
+	tmpfs_object_name(fs, event_name, "_lock");
+	rwlock_init(&fs->lock, &fs->shared->lock, event_name);
+	memset(fs->views, 0, sizeof(fs->views));
+	return 1;
+}
+
+static void tmpfs_fs_after_fork(struct file_system *fs)
+{
+	/* Section handles are inherited, but views are not */
+	tmpfs_map_shared((struct tmpfs *)fs);
+}
+
+/* Number of chunks for a size limit, 0 for the default limit */
+static uint32_t tmpfs_size_to_chunks(uint64_t size)
+{
+	if (size == 0)
+		size = TMPFS_DEFAULT_SIZE;
+	return (uint32_t)min((size + TMPFS_CHUNK_SIZE - 1) / TMPFS_CHUNK_SIZE, TMPFS_MAX_CHUNKS);
+}
+
+int tmpfs_parse_size(const char *data, uint64_t *size)
+{
+	/* Sizes larger than the maximum are clamped, this also keeps the computation from overflowing */
+	const uint64_t max_size = (uint64_t)TMPFS_MAX_CHUNKS * TMPFS_CHUNK_SIZE;
+	*size = 0;
+	for (const char *p = data; p && *p; )
+	{
+		if (!strncmp(p, "size=", 5))
+		{
+			p += 5;
+			const char *digits = p;
+			uint64_t value = 0;
+			for (; *p >= '0' && *p <= '9'; p++)
+				value = min(value * 10 + (*p - '0'), max_size);
+			if (p == digits)
+				return -EINVAL;
+			int shift = 0;
+			if (*p == 'k' || *p == 'K')
+				shift = 10;
+			else if (*p == 'm' || *p == 'M')
+				shift = 20;
+			else if (*p == 'g' || *p == 'G')
+				shift = 30;
+			if (shift)
+			{
+				value = min(value, max_size >> shift) << shift;
+				p++;
+			}
+			else if (*p == '%')
+			{
+				/* Percentage of physical memory */
+				MEMORYSTATUSEX memory;
+				memory.dwLength = sizeof(memory);
+				if (!GlobalMemoryStatusEx(&memory))
+					return -EINVAL;
+				uint64_t percent = memory.ullTotalPhys / 100;
+				value = value > max_size / percent ? max_size : percent * value;
+				p++;
+			}
+			if (*p && *p != ',')
+				return -EINVAL;
+			*size = value;
+		}
+		while (*p && *p != ',')
+			p++;
+		if (*p == ',')
+			p++;
+	}
+	return 0;
+}
+
+static int tmpfs_remount(struct file_system *fs, unsigned long flags, const void *data)
+{
+	struct tmpfs *tmpfs = (struct tmpfs *)fs;
+	uint64_t size;
+	int r = tmpfs_parse_size((const char *)data, &size);
+	if (r < 0 || size == 0)
+		return r; /* Keep the current limit if no size is given */
+	uint32_t max_chunks = tmpfs_size_to_chunks(size);
+	tmpfs_lock_exclusive(tmpfs);
+	if (tmpfs->shared->used_chunks > max_chunks)
+		r = -EBUSY;
+	else
+	{
+		tmpfs->shared->max_chunks = max_chunks;
+		log_info("tmpfs: Size limit of \"%s\" changed to %d chunks.\n", fs->mountpoint, max_chunks);
+	}
+	tmpfs_unlock_exclusive(tmpfs);
+	return r;
+}
+
+struct file_system *tmpfs_alloc(const char *mountpoint, const char *name, uint64_t size)
+{
+	uint32_t max_chunks = tmpfs_size_to_chunks(size);
+	uint64_t section_size = (uint64_t)TMPFS_MAX_CHUNKS * TMPFS_CHUNK_SIZE;
+
+	struct tmpfs *fs = (struct tmpfs *)kmalloc(sizeof(struct tmpfs));
+	fs->base_fs.mountpoint = mountpoint;
+	fs->base_fs.open = tmpfs_open;
+	fs->base_fs.symlink = tmpfs_symlink;
+	fs->base_fs.link = tmpfs_link;
+	fs->base_fs.unlink = tmpfs_unlink;
+	fs->base_fs.rename = tmpfs_rename;
+	fs->base_fs.mkdir = tmpfs_mkdir;
+	fs->base_fs.rmdir = tmpfs_rmdir;
+	fs->base_fs.after_fork = tmpfs_fs_after_fork;
+	fs->base_fs.remount = tmpfs_remount;
+	strncpy(fs->name, name, sizeof(fs->name) - 1);
+	fs->name[sizeof(fs->name) - 1] = 0;
+	LUID logon_id = tmpfs_get_logon_id();
+	ksprintf(fs->object_prefix, "flinux_tmpfs_%x%08x_%s", logon_id.HighPart, logon_id.LowPart, fs->name);
+	/* Give each instance its own device number */
+	fs->dev = mkdev(0, 0x20 + tmpfs_hash(0, fs->name, strlen(fs->name)) % 0xE0);
+
+	SECURITY_ATTRIBUTES attr;
+	attr.nLength = sizeof(SECURITY_ATTRIBUTES);
+	attr.bInheritHandle = TRUE;
+	attr.lpSecurityDescriptor = NULL;
+	WCHAR section_name[128];
+	tmpfs_object_name(fs, section_name, "");
+	fs->shared_section = CreateFileMappingW(INVALID_HANDLE_VALUE, &attr, PAGE_READWRITE,
+		0, sizeof(struct tmpfs_shared), section_name);
+	if (!fs->shared_section)
+	{
+		log_error("tmpfs: Creating metadata section failed, error code: %d\n", GetLastError());
+		kfree(fs, sizeof(struct tmpfs));
+		return NULL;
+	}
+	int created = GetLastError() != ERROR_ALREADY_EXISTS;
+	if (!tmpfs_map_shared(fs))
+	{
+		CloseHandle(fs->shared_section);
+		kfree(fs, sizeof(struct tmpfs));
+		return NULL;
+	}
+	if (!created)
+	{
+		/* Another process is creating the instance, wait until it is done */
+		while (!fs->shared->initialized)
+			Sleep(0);
+	}
+	tmpfs_object_name(fs, section_name, "_data");
+	fs->data_section = CreateFileMappingW(INVALID_HANDLE_VALUE, &attr, PAGE_EXECUTE_READWRITE | SEC_RESERVE,
+		(DWORD)(section_size >> 32), (DWORD)section_size, section_name);
+	if (!fs->data_section)
+	{
+		log_error("tmpfs: Creating data section failed, error code: %d\n", GetLastError());
+		UnmapViewOfFile(fs->shared);
+		CloseHandle(fs->shared_section);
+		kfree(fs, sizeof(struct tmpfs));
+		return NULL;
+	}
+	if (created)
+	{
+		struct tmpfs_shared *shared = fs->shared;
+		shared->max_chunks = max_chunks;
+		struct tmpfs_inode *root = &shared->inodes[TMPFS_ROOT_INODE];
+		root->mode = S_IFDIR | 01777;
+		root->nlink = 2;
+		root->atime = root->mtime = root->ctime = tmpfs_now();
+		shared->used_inodes = 1;
+		InterlockedExchange(&shared->initialized, 1);
+	}
+	return (struct file_system *)fs;
+}
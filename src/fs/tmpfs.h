@@ -0,0 +1,35 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <fs/file.h>
+
+#include <stdint.h>
+
+/* Create a tmpfs instance
+ * Instances with the same name share their content between all processes.
+ * size is the maximum size of file content in bytes, 0 for the default limit.
+ */
+struct file_system *tmpfs_alloc(const char *mountpoint, const char *name, uint64_t size);
+
+/* Parse the "size=" option in tmpfs mount data, size is set to 0 if it is not present
+ * Returns 0 on success, -EINVAL if the value is malformed.
+ */
+int tmpfs_parse_size(const char *data, uint64_t *size);
@@ -579,6 +579,8 @@ do_component:;
 		case VIRTUALFS_TYPE_CUSTOM:
 		{
 			struct virtualfs_custom_desc *desc = (struct virtualfs_custom_desc *)base_desc;
+			if (desc->open)
+				return desc->open(tag, flags, p);
 			*p = desc->alloc();
 			return 0;
 		}
@@ -624,6 +626,14 @@ struct file_system *virtualfs_alloc(const char *mountpoint, const struct virtual
 	struct virtualfs *fs = (struct virtualfs *)kmalloc(sizeof(struct virtualfs));
 	fs->base_fs.mountpoint = mountpoint;
 	fs->base_fs.open = virtualfs_open;
+	fs->base_fs.symlink = NULL;
+	fs->base_fs.link = NULL;
+	fs->base_fs.unlink = NULL;
+	fs->base_fs.rename = NULL;
+	fs->base_fs.mkdir = NULL;
+	fs->base_fs.rmdir = NULL;
+	fs->base_fs.after_fork = NULL;
+	fs->base_fs.remount = NULL;
 	fs->dir = dir;
 	return (struct file_system *)fs;
 }
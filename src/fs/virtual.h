@@ -77,12 +77,14 @@ struct virtualfs_directory_desc
 /* To use this desc, implement a custom file allocation function.
  * Call virtualfs_custom_file_init() in it.
  * Set the file_ops.stat vptr to virtualfs_custom_file_stat().
+ * If opening the file can fail or depends on the entry tag, implement open() instead.
  */
 struct virtualfs_custom_desc
 {
 	int type;
 	int device;
 	struct file *(*alloc)();
+	int (*open)(int tag, int flags, struct file **f);
 };
 #define VIRTUALFS_CUSTOM(_device, _alloc) \
 	{ \
@@ -90,6 +92,12 @@ struct virtualfs_custom_desc
 		.device = _device, \
 		.alloc = _alloc, \
 	}
+#define VIRTUALFS_CUSTOM_OPEN(_device, _open) \
+	{ \
+		.type = VIRTUALFS_TYPE_CUSTOM, \
+		.device = _device, \
+		.open = _open, \
+	}
 
 /* VIRTUALFS_TYPE_CHAR */
 struct virtualfs_char_desc
@@ -18,6 +18,8 @@
  */
 
 #include <common/errno.h>
+#include <common/fadvise.h>
+#include <common/falloc.h>
 #include <common/fcntl.h>
 #include <common/fs.h>
 #include <fs/winfs.h>
@@ -31,22 +33,68 @@
 #include <ntdll.h>
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <winioctl.h>
 #include <limits.h>
 
 #define WINFS_SYMLINK_HEADER		"!<SYMLINK>\379\378"
 #define WINFS_SYMLINK_HEADER_LEN	(sizeof(WINFS_SYMLINK_HEADER) - 1)
 
+struct winfs
+{
+	struct file_system base_fs;
+	/* Windows directory of the file system root without the "\??\" prefix,
+	 * the current directory is used when empty (i.e. the root file system, changed by chroot()) */
+	int rootlen;
+	WCHAR root[];
+};
+
 struct winfs_file
 {
 	struct file base_file;
+	struct winfs *fs;
 	HANDLE handle;
+	HANDLE overlapped_handle; /* For io_uring, opened on first use, INVALID_HANDLE_VALUE if not possible */
+	int advice; /* POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL or POSIX_FADV_RANDOM, set by fadvise() */
+	struct winfs_cache *cache; /* pread() cache, allocated on first use */
 	int restart_scan; /* for getdents() */
 	int pathlen;
 	char pathname[]; /* Not necessary null-terminated */
 };
 
+/* Read cache for pread()
+ * Loaders and ELF parsers issue many small pread() calls on the same file. Each open file gets a
+ * cache of WINFS_CACHE_PAGES pages which are filled into a ring of page slots. A miss on a sequential
+ * stream reads ahead a growing number of pages with a single ReadFile() call, unless told otherwise
+ * by fadvise().
+ * Only files opened read only are cached, which also rules out writable shared mappings of the file.
+ * Writes, truncate and fallocate through any winfs file of this process invalidate all caches. Changes
+ * made by other processes (including forked ones) or through shared mappings of another file description
+ * are not seen until the page is evicted, but reading past a page which ended at end of file always
+ * goes to disk, so appended data is picked up.
+ * Files opened with O_DIRECT bypass the cache.
+ */
+#define WINFS_CACHE_PAGES			(BLOCK_SIZE / PAGE_SIZE)
+#define WINFS_CACHE_MAX_READAHEAD	(WINFS_CACHE_PAGES / 2)
+#define WINFS_CACHE_BYPASS_SIZE		(WINFS_CACHE_MAX_READAHEAD * PAGE_SIZE)
+
+struct winfs_cache_slot
+{
+	loff_t page; /* File page number, -1 if the slot is empty */
+	size_t len; /* Valid bytes, less than PAGE_SIZE only for the page containing end of file */
+};
+
+struct winfs_cache
+{
+	char *data;
+	int head; /* Next slot to fill */
+	int readahead; /* Number of pages to read on a miss */
+	loff_t next_offset; /* Offset following the last read, to detect sequential access */
+	LONG generation; /* Value of winfs_write_generation the cached pages are valid for */
+	struct winfs_cache_slot slots[WINFS_CACHE_PAGES];
+};
+
 /* Convert an utf-8 file name to NT file name, return converted name length in characters, no NULL terminator is appended */
-static int filename_to_nt_pathname(const char *filename, WCHAR *buf, int buf_size)
+static int filename_to_nt_pathname(struct winfs *fs, const char *filename, WCHAR *buf, int buf_size)
 {
 	if (buf_size < 4)
 		return 0;
@@ -57,21 +105,46 @@ static int filename_to_nt_pathname(const char *filename, WCHAR *buf, int buf_siz
 	buf += 4;
 	buf_size -= 4;
 	int out_size = 4;
-	int len = (DWORD)GetCurrentDirectoryW(buf_size, buf);
+	int len;
+	if (fs->rootlen)
+	{
+		if (fs->rootlen > buf_size)
+			return 0;
+		memcpy(buf, fs->root, fs->rootlen * sizeof(WCHAR));
+		len = fs->rootlen;
+	}
+	else
+		len = (DWORD)GetCurrentDirectoryW(buf_size, buf);
 	buf += len;
 	out_size += len;
 	buf_size -= len;
 	if (filename[0] == 0)
 		return out_size;
-	*buf++ = L'\\';
-	out_size++;
-	buf_size--;
+	/* The root of a volume already ends with a backslash */
+	if (buf[-1] != L'\\')
+	{
+		*buf++ = L'\\';
+		out_size++;
+		buf_size--;
+	}
 	int fl = utf8_to_utf16_filename(filename, strlen(filename), buf, buf_size);
 	if (fl == 0)
 		return 0;
 	return out_size + fl;
 }
 
+/* Convert an utf-8 file name to a NULL terminated Win32 file name, return converted name length in characters */
+static int filename_to_win32_pathname(struct winfs *fs, const char *filename, WCHAR *buf, int buf_size)
+{
+	int len = filename_to_nt_pathname(fs, filename, buf, buf_size - 1);
+	if (len == 0)
+		return 0;
+	/* "\??\" -> "\\?\" */
+	buf[1] = L'\\';
+	buf[len] = 0;
+	return len;
+}
+
 static int cached_sid_initialized;
 static char cached_sid_buffer[256];
 static PSID cached_sid;
@@ -229,8 +302,15 @@ static int winfs_read_symlink(HANDLE hFile, char *target, int buflen)
 static int winfs_close(struct file *f)
 {
 	struct winfs_file *winfile = (struct winfs_file *)f;
+	if (winfile->overlapped_handle && winfile->overlapped_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(winfile->overlapped_handle);
 	if (CloseHandle(winfile->handle))
 	{
+		if (winfile->cache)
+		{
+			mm_munmap(winfile->cache->data, BLOCK_SIZE);
+			kfree(winfile->cache, sizeof(struct winfs_cache));
+		}
 		kfree(winfile, sizeof(struct winfs_file) + winfile->pathlen);
 		return 0;
 	}
@@ -241,10 +321,20 @@ static int winfs_close(struct file *f)
 static int winfs_getpath(struct file *f, char *buf)
 {
 	struct winfs_file *winfile = (struct winfs_file *)f;
-	buf[0] = '/'; /* the mountpoint */
-	memcpy(buf + 1, winfile->pathname, winfile->pathlen);
-	buf[1 + winfile->pathlen] = 0;
-	return winfile->pathlen + 1;
+	/* Copy mountpoint */
+	const char *mountpoint = winfile->fs->base_fs.mountpoint;
+	int len_mountpoint = strlen(mountpoint);
+	memcpy(buf, mountpoint, len_mountpoint);
+	if (winfile->pathlen == 0)
+	{
+		buf[len_mountpoint] = 0;
+		return len_mountpoint;
+	}
+	if (buf[len_mountpoint - 1] != '/')
+		buf[len_mountpoint++] = '/';
+	memcpy(buf + len_mountpoint, winfile->pathname, winfile->pathlen);
+	buf[len_mountpoint + winfile->pathlen] = 0;
+	return len_mountpoint + winfile->pathlen;
 }
 
 static size_t winfs_read(struct file *f, void *buf, size_t count)
@@ -270,9 +360,26 @@ static size_t winfs_read(struct file *f, void *buf, size_t count)
 	return num_read;
 }
 
+/* Incremented on every modification of a winfs file by any flinux process
+ * It lives in the global shared area, so writes by a forked child or another
+ * shell also invalidate the caches of this process. */
+static volatile LONG *winfs_write_generation;
+
+void winfs_init()
+{
+	winfs_write_generation = (volatile LONG *)mm_global_shared_alloc(sizeof(LONG));
+}
+
+/* Invalidate the pread() caches of all files, they may refer to the file being modified */
+void winfs_cache_invalidate()
+{
+	InterlockedIncrement(winfs_write_generation);
+}
+
 static size_t winfs_write(struct file *f, const void *buf, size_t count)
 {
 	struct winfs_file *winfile = (struct winfs_file *) f;
+	winfs_cache_invalidate();
 	size_t num_written = 0;
 	OVERLAPPED overlapped;
 	overlapped.Internal = 0;
@@ -296,9 +403,8 @@ static size_t winfs_write(struct file *f, const void *buf, size_t count)
 	return num_written;
 }
 
-static size_t winfs_pread(struct file *f, void *buf, size_t count, loff_t offset)
+static size_t winfs_pread_direct(struct winfs_file *winfile, void *buf, size_t count, loff_t offset)
 {
-	struct winfs_file *winfile = (struct winfs_file *) f;
 	size_t num_read = 0;
 	while (count > 0)
 	{
@@ -326,9 +432,126 @@ static size_t winfs_pread(struct file *f, void *buf, size_t count, loff_t offset
 	return num_read;
 }
 
+static struct winfs_cache *winfs_cache_alloc()
+{
+	char *data = (char *)mm_mmap(NULL, BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
+		INTERNAL_MAP_TOPDOWN | INTERNAL_MAP_NORESET, NULL, 0);
+	if ((uintptr_t)data >= (uintptr_t)-4096)
+	{
+		log_warning("Allocating winfs read cache failed.\n");
+		return NULL;
+	}
+	struct winfs_cache *cache = (struct winfs_cache *)kmalloc(sizeof(struct winfs_cache));
+	cache->data = data;
+	cache->head = 0;
+	cache->readahead = 1;
+	cache->next_offset = -1;
+	cache->generation = *winfs_write_generation;
+	for (int i = 0; i < WINFS_CACHE_PAGES; i++)
+		cache->slots[i].page = -1;
+	return cache;
+}
+
+static struct winfs_cache_slot *winfs_cache_lookup(struct winfs_cache *cache, loff_t page)
+{
+	for (int i = 0; i < WINFS_CACHE_PAGES; i++)
+		if (cache->slots[i].page == page)
+			return &cache->slots[i];
+	return NULL;
+}
+
+/* Read a run of pages into consecutive slots with one call, return the slot of the first page */
+static int winfs_cache_fill(struct winfs_file *winfile, loff_t page, int pages, struct winfs_cache_slot **first_slot)
+{
+	struct winfs_cache *cache = winfile->cache;
+	/* Drop stale copies of the pages being read */
+	for (int i = 0; i < WINFS_CACHE_PAGES; i++)
+		if (cache->slots[i].page >= page && cache->slots[i].page < page + pages)
+			cache->slots[i].page = -1;
+	if (cache->head + pages > WINFS_CACHE_PAGES)
+		cache->head = 0;
+	int first = cache->head;
+	size_t r = winfs_pread_direct(winfile, cache->data + first * PAGE_SIZE, pages * PAGE_SIZE, page * PAGE_SIZE);
+	if ((intptr_t)r < 0)
+		return (int)r;
+	for (int i = 0; i < pages; i++)
+	{
+		struct winfs_cache_slot *slot = &cache->slots[first + i];
+		size_t len = r > i * PAGE_SIZE ? min(r - i * PAGE_SIZE, PAGE_SIZE) : 0;
+		/* Pages wholly past end of file are not kept, except the requested one */
+		if (i > 0 && len == 0)
+			slot->page = -1;
+		else
+		{
+			slot->page = page + i;
+			slot->len = len;
+		}
+	}
+	cache->head = first + pages;
+	*first_slot = &cache->slots[first];
+	return 0;
+}
+
+static size_t winfs_cache_read(struct winfs_file *winfile, char *buf, size_t count, loff_t offset)
+{
+	struct winfs_cache *cache = winfile->cache;
+	LONG generation = *winfs_write_generation;
+	if (cache->generation != generation)
+	{
+		for (int i = 0; i < WINFS_CACHE_PAGES; i++)
+			cache->slots[i].page = -1;
+		cache->generation = generation;
+	}
+	if (winfile->advice == POSIX_FADV_RANDOM)
+		cache->readahead = 1;
+	else if (winfile->advice == POSIX_FADV_SEQUENTIAL)
+		cache->readahead = WINFS_CACHE_MAX_READAHEAD;
+	else if (offset == cache->next_offset)
+		cache->readahead = min(cache->readahead * 2, WINFS_CACHE_MAX_READAHEAD);
+	else
+		cache->readahead = 1;
+	size_t num_read = 0;
+	while (num_read < count)
+	{
+		loff_t pos = offset + num_read;
+		loff_t page = pos / PAGE_SIZE;
+		size_t page_offset = pos % PAGE_SIZE;
+		struct winfs_cache_slot *slot = winfs_cache_lookup(cache, page);
+		if (!slot || page_offset >= slot->len)
+		{
+			/* Miss, or reading past the end of a page which may have grown since */
+			int pages = (int)((page_offset + count - num_read + PAGE_SIZE - 1) / PAGE_SIZE);
+			pages = min(max(pages, cache->readahead), WINFS_CACHE_PAGES);
+			int r = winfs_cache_fill(winfile, page, pages, &slot);
+			if (r < 0)
+				return num_read > 0 ? num_read : r;
+			if (page_offset >= slot->len) /* End of file */
+				break;
+		}
+		size_t n = min(count - num_read, slot->len - page_offset);
+		memcpy(buf + num_read, cache->data + (slot - cache->slots) * PAGE_SIZE + page_offset, n);
+		num_read += n;
+		if (slot->len < PAGE_SIZE) /* End of file */
+			break;
+	}
+	cache->next_offset = offset + num_read;
+	return num_read;
+}
+
+static size_t winfs_pread(struct file *f, void *buf, size_t count, loff_t offset)
+{
+	struct winfs_file *winfile = (struct winfs_file *) f;
+	if ((f->flags & O_DIRECT) || (f->flags & O_ACCMODE) != O_RDONLY || count >= WINFS_CACHE_BYPASS_SIZE)
+		return winfs_pread_direct(winfile, buf, count, offset);
+	if (!winfile->cache && !(winfile->cache = winfs_cache_alloc()))
+		return winfs_pread_direct(winfile, buf, count, offset);
+	return winfs_cache_read(winfile, (char *)buf, count, offset);
+}
+
 static size_t winfs_pwrite(struct file *f, const void *buf, size_t count, loff_t offset)
 {
 	struct winfs_file *winfile = (struct winfs_file *) f;
+	winfs_cache_invalidate();
 	size_t num_written = 0;
 	while (count > 0)
 	{
@@ -364,6 +587,7 @@ static size_t winfs_readlink(struct file *f, char *target, size_t buflen)
 static int winfs_truncate(struct file *f, loff_t length)
 {
 	struct winfs_file *winfile = (struct winfs_file *) f;
+	winfs_cache_invalidate();
 	/* TODO: Correct errno */
 	FILE_END_OF_FILE_INFORMATION info;
 	info.EndOfFile.QuadPart = length;
@@ -602,8 +826,101 @@ static int winfs_statfs(struct file *f, struct statfs64 *buf)
 	return 0;
 }
 
+static int winfs_fallocate(struct file *f, int mode, loff_t offset, loff_t len)
+{
+	struct winfs_file *winfile = (struct winfs_file *) f;
+	winfs_cache_invalidate();
+	IO_STATUS_BLOCK status_block;
+	NTSTATUS status;
+	FILE_STANDARD_INFORMATION standard_info;
+	status = NtQueryInformationFile(winfile->handle, &status_block, &standard_info, sizeof(standard_info), FileStandardInformation);
+	if (!NT_SUCCESS(status))
+	{
+		log_warning("NtQueryInformationFile(FileStandardInformation) failed, status: %x\n", status);
+		return -EIO;
+	}
+	if (standard_info.Directory)
+		return -ENODEV;
+	if (offset > LLONG_MAX - len)
+		return -EFBIG;
+	loff_t end = offset + len;
+	loff_t size = standard_info.EndOfFile.QuadPart;
+
+	if (mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))
+	{
+		/* FSCTL_SET_ZERO_DATA never extends the file, only the part inside the file needs zeroing.
+		 * On a sparse file the zeroed range is deallocated, which is what FALLOC_FL_PUNCH_HOLE wants. */
+		if (offset < size)
+		{
+			DWORD bytes;
+			if ((mode & FALLOC_FL_PUNCH_HOLE) && !DeviceIoControl(winfile->handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL))
+			{
+				log_warning("FSCTL_SET_SPARSE failed, error code: %d\n", GetLastError());
+				return -EOPNOTSUPP;
+			}
+			FILE_ZERO_DATA_INFORMATION zero_info;
+			zero_info.FileOffset.QuadPart = offset;
+			zero_info.BeyondFinalZero.QuadPart = min(end, size);
+			if (!DeviceIoControl(winfile->handle, FSCTL_SET_ZERO_DATA, &zero_info, sizeof(zero_info), NULL, 0, &bytes, NULL))
+			{
+				log_warning("FSCTL_SET_ZERO_DATA failed, error code: %d\n", GetLastError());
+				return -EOPNOTSUPP;
+			}
+		}
+		if (mode & FALLOC_FL_PUNCH_HOLE)
+			return 0;
+	}
+
+	/* Preallocate clusters so following writes do not extend the file piece by piece.
+	 * Note NTFS releases allocation past the end of file when the last handle is closed,
+	 * so FALLOC_FL_KEEP_SIZE only lasts as long as the file is open. */
+	if (end > standard_info.AllocationSize.QuadPart)
+	{
+		FILE_ALLOCATION_INFORMATION allocation_info;
+		allocation_info.AllocationSize.QuadPart = end;
+		status = NtSetInformationFile(winfile->handle, &status_block, &allocation_info, sizeof(allocation_info), FileAllocationInformation);
+		if (!NT_SUCCESS(status))
+		{
+			log_warning("NtSetInformationFile(FileAllocationInformation) failed, status: %x\n", status);
+			return -ENOSPC;
+		}
+	}
+	if (!(mode & FALLOC_FL_KEEP_SIZE) && end > size)
+	{
+		FILE_END_OF_FILE_INFORMATION eof_info;
+		eof_info.EndOfFile.QuadPart = end;
+		status = NtSetInformationFile(winfile->handle, &status_block, &eof_info, sizeof(eof_info), FileEndOfFileInformation);
+		if (!NT_SUCCESS(status))
+		{
+			log_warning("NtSetInformationFile(FileEndOfFileInformation) failed, status: %x\n", status);
+			return -ENOSPC;
+		}
+	}
+	return 0;
+}
+
+static int winfs_fadvise(struct file *f, loff_t offset, loff_t len, int advice)
+{
+	struct winfs_file *winfile = (struct winfs_file *) f;
+	/* The cache manager only takes access pattern hints at open time, and reopening the handle would
+	 * break sharing the file position with forked processes. Just record the hint for winfs_cache_read().
+	 * Windows does not let us prefetch or drop cached pages of a range either. */
+	if (advice == POSIX_FADV_NORMAL || advice == POSIX_FADV_SEQUENTIAL || advice == POSIX_FADV_RANDOM)
+		winfile->advice = advice;
+	return 0;
+}
+
+static void winfs_after_fork(struct file *f)
+{
+	struct winfs_file *winfile = (struct winfs_file *)f;
+	/* The overlapped handle is not inherited */
+	if (winfile->overlapped_handle != INVALID_HANDLE_VALUE)
+		winfile->overlapped_handle = NULL;
+}
+
 static struct file_ops winfs_ops = 
 {
+	.after_fork = winfs_after_fork,
 	.close = winfs_close,
 	.getpath = winfs_getpath,
 	.read = winfs_read,
@@ -618,6 +935,8 @@ static struct file_ops winfs_ops =
 	.utimens = winfs_utimens,
 	.getdents = winfs_getdents,
 	.statfs = winfs_statfs,
+	.fallocate = winfs_fallocate,
+	.fadvise = winfs_fadvise,
 };
 
 static int winfs_symlink(struct file_system *fs, const char *target, const char *linkpath)
@@ -625,7 +944,7 @@ static int winfs_symlink(struct file_system *fs, const char *target, const char
 	HANDLE handle;
 	WCHAR wlinkpath[PATH_MAX];
 
-	if (utf8_to_utf16_filename(linkpath, strlen(linkpath) + 1, wlinkpath, PATH_MAX) <= 0)
+	if (filename_to_win32_pathname((struct winfs *)fs, linkpath, wlinkpath, PATH_MAX) <= 0)
 		return -ENOENT;
 
 	log_info("CreateFileW(): %s\n", linkpath);
@@ -661,13 +980,15 @@ static int winfs_symlink(struct file_system *fs, const char *target, const char
 
 static int winfs_link(struct file_system *fs, struct file *f, const char *newpath)
 {
+	if (!winfs_is_winfile(f) || ((struct winfs_file *)f)->fs != (struct winfs *)fs)
+		return -EXDEV;
 	struct winfs_file *winfile = (struct winfs_file *) f;
 	NTSTATUS status;
 	char buf[sizeof(FILE_LINK_INFORMATION) + PATH_MAX * 2];
 	FILE_LINK_INFORMATION *info = (FILE_LINK_INFORMATION *)buf;
 	info->ReplaceIfExists = FALSE;
 	info->RootDirectory = NULL;
-	info->FileNameLength = 2 * filename_to_nt_pathname(newpath, info->FileName, PATH_MAX);
+	info->FileNameLength = 2 * filename_to_nt_pathname((struct winfs *)fs, newpath, info->FileName, PATH_MAX);
 	if (info->FileNameLength == 0)
 		return -ENOENT;
 	IO_STATUS_BLOCK status_block;
@@ -683,7 +1004,7 @@ static int winfs_link(struct file_system *fs, struct file *f, const char *newpat
 static int winfs_unlink(struct file_system *fs, const char *pathname)
 {
 	WCHAR wpathname[PATH_MAX];
-	int len = filename_to_nt_pathname(pathname, wpathname, PATH_MAX);
+	int len = filename_to_nt_pathname((struct winfs *)fs, pathname, wpathname, PATH_MAX);
 	if (len <= 0)
 		return -ENOENT;
 
@@ -739,13 +1060,15 @@ static int winfs_unlink(struct file_system *fs, const char *pathname)
 
 static int winfs_rename(struct file_system *fs, struct file *f, const char *newpath)
 {
+	if (!winfs_is_winfile(f) || ((struct winfs_file *)f)->fs != (struct winfs *)fs)
+		return -EXDEV;
 	struct winfs_file *winfile = (struct winfs_file *)f;
 	char buf[sizeof(FILE_RENAME_INFORMATION) + PATH_MAX * 2];
 	NTSTATUS status;
 	FILE_RENAME_INFORMATION *info = (FILE_RENAME_INFORMATION *)buf;
 	info->ReplaceIfExists = TRUE; /* TODO: This should be worked on to provide true Linux semantics (refer to unlink()) */
 	info->RootDirectory = NULL;
-	info->FileNameLength = 2 * filename_to_nt_pathname(newpath, info->FileName, PATH_MAX);
+	info->FileNameLength = 2 * filename_to_nt_pathname((struct winfs *)fs, newpath, info->FileName, PATH_MAX);
 	if (info->FileNameLength == 0)
 		return -ENOENT;
 	IO_STATUS_BLOCK status_block;
@@ -762,7 +1085,7 @@ static int winfs_mkdir(struct file_system *fs, const char *pathname, int mode)
 {
 	WCHAR wpathname[PATH_MAX];
 
-	if (utf8_to_utf16_filename(pathname, strlen(pathname) + 1, wpathname, PATH_MAX) <= 0)
+	if (filename_to_win32_pathname((struct winfs *)fs, pathname, wpathname, PATH_MAX) <= 0)
 		return -ENOENT;
 	if (!CreateDirectoryW(wpathname, NULL))
 	{
@@ -781,7 +1104,7 @@ static int winfs_mkdir(struct file_system *fs, const char *pathname, int mode)
 static int winfs_rmdir(struct file_system *fs, const char *pathname)
 {
 	WCHAR wpathname[PATH_MAX];
-	if (utf8_to_utf16_filename(pathname, strlen(pathname) + 1, wpathname, PATH_MAX) <= 0)
+	if (filename_to_win32_pathname((struct winfs *)fs, pathname, wpathname, PATH_MAX) <= 0)
 		return -ENOENT;
 	if (!RemoveDirectoryW(wpathname))
 	{
@@ -797,13 +1120,13 @@ static int winfs_rmdir(struct file_system *fs, const char *pathname)
  * == 0 => Opening file succeeded
  *  > 0 => It is a symlink which needs to be redirected (target written)
  */
-static int open_file(HANDLE *hFile, const char *pathname, DWORD desired_access, DWORD create_disposition,
+static int open_file(struct winfs *fs, HANDLE *hFile, const char *pathname, DWORD desired_access, DWORD create_disposition,
 	int flags, BOOL bInherit, char *target, int buflen)
 {
 	WCHAR buf[PATH_MAX];
 	UNICODE_STRING name;
 	name.Buffer = buf;
-	name.MaximumLength = name.Length = 2 * filename_to_nt_pathname(pathname, buf, PATH_MAX);
+	name.MaximumLength = name.Length = 2 * filename_to_nt_pathname(fs, pathname, buf, PATH_MAX);
 	if (name.Length == 0)
 		return -ENOENT;
 
@@ -915,7 +1238,7 @@ static int winfs_open(struct file_system *fs, const char *pathname, int flags, i
 		create_disposition = FILE_OPEN_IF;
 	else
 		create_disposition = FILE_OPEN;
-	int r = open_file(&handle, pathname, desired_access, create_disposition, flags, fp != NULL, target, buflen);
+	int r = open_file((struct winfs *)fs, &handle, pathname, desired_access, create_disposition, flags, fp != NULL, target, buflen);
 	if (r < 0 || r == 1)
 		return r;
 	if ((flags & O_TRUNC) && ((flags & O_WRONLY) || (flags & O_RDWR)))
@@ -936,7 +1259,11 @@ static int winfs_open(struct file_system *fs, const char *pathname, int flags, i
 		file->base_file.op_vtable = &winfs_ops;
 		file->base_file.ref = 1;
 		file->base_file.flags = flags;
+		file->fs = (struct winfs *)fs;
 		file->handle = handle;
+		file->overlapped_handle = NULL;
+		file->advice = POSIX_FADV_NORMAL;
+		file->cache = NULL;
 		file->restart_scan = 1;
 		file->pathlen = pathlen;
 		memcpy(file->pathname, pathname, pathlen);
@@ -947,15 +1274,13 @@ static int winfs_open(struct file_system *fs, const char *pathname, int flags, i
 	return 0;
 }
 
-struct winfs
+struct file_system *winfs_alloc(const char *mountpoint, const WCHAR *root)
 {
-	struct file_system base_fs;
-};
-
-struct file_system *winfs_alloc()
-{
-	struct winfs *fs = (struct winfs *)kmalloc(sizeof(struct winfs));
-	fs->base_fs.mountpoint = "/";
+	int rootlen = root ? wcslen(root) : 0;
+	struct winfs *fs = (struct winfs *)kmalloc(sizeof(struct winfs) + rootlen * sizeof(WCHAR));
+	fs->base_fs.mountpoint = mountpoint;
+	fs->rootlen = rootlen;
+	memcpy(fs->root, root, rootlen * sizeof(WCHAR));
 	fs->base_fs.open = winfs_open;
 	fs->base_fs.symlink = winfs_symlink;
 	fs->base_fs.link = winfs_link;
@@ -963,6 +1288,8 @@ struct file_system *winfs_alloc()
 	fs->base_fs.rename = winfs_rename;
 	fs->base_fs.mkdir = winfs_mkdir;
 	fs->base_fs.rmdir = winfs_rmdir;
+	fs->base_fs.after_fork = NULL;
+	fs->base_fs.remount = NULL;
 	return (struct file_system *)fs;
 }
 
@@ -970,3 +1297,49 @@ int winfs_is_winfile(struct file *f)
 {
 	return f->op_vtable == &winfs_ops;
 }
+
+int winfs_get_windows_path(struct file *f, WCHAR *buf, int buf_size)
+{
+	struct winfs_file *winfile = (struct winfs_file *)f;
+	char pathname[PATH_MAX];
+	memcpy(pathname, winfile->pathname, winfile->pathlen);
+	pathname[winfile->pathlen] = 0;
+	int len = filename_to_nt_pathname(winfile->fs, pathname, buf, buf_size);
+	if (len == 0)
+		return 0;
+	/* Strip "\??\" prefix */
+	len -= 4;
+	memmove(buf, buf + 4, len * sizeof(WCHAR));
+	return len;
+}
+
+HANDLE winfs_get_overlapped_handle(struct file *f, HANDLE port)
+{
+	if (f->op_vtable != &winfs_ops)
+		return NULL;
+	struct winfs_file *winfile = (struct winfs_file *)f;
+	if (!winfile->overlapped_handle)
+	{
+		DWORD desired_access;
+		if (f->flags & O_PATH)
+			desired_access = 0;
+		else if (f->flags & O_RDWR)
+			desired_access = GENERIC_READ | GENERIC_WRITE;
+		else if (f->flags & O_WRONLY)
+			desired_access = GENERIC_WRITE;
+		else
+			desired_access = GENERIC_READ;
+		HANDLE handle = desired_access ? ReOpenFile(winfile->handle, desired_access,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_OVERLAPPED) : INVALID_HANDLE_VALUE;
+		if (handle != INVALID_HANDLE_VALUE && !CreateIoCompletionPort(handle, port, 0, 0))
+		{
+			log_warning("CreateIoCompletionPort() failed, error code: %d\n", GetLastError());
+			CloseHandle(handle);
+			handle = INVALID_HANDLE_VALUE;
+		}
+		winfile->overlapped_handle = handle;
+	}
+	if (winfile->overlapped_handle == INVALID_HANDLE_VALUE)
+		return NULL;
+	return winfile->overlapped_handle;
+}
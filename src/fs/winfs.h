@@ -21,5 +21,16 @@
 
 #include <fs/file.h>
 
-struct file_system *winfs_alloc();
+void winfs_init();
+/* Allocate a winfs instance mounted at mountpoint which maps the given Windows directory.
+ * If root is NULL, the current directory is used */
+struct file_system *winfs_alloc(const char *mountpoint, const WCHAR *root);
 int winfs_is_winfile(struct file *f);
+/* Get the full Windows path of a winfs file without the NT prefix, return length in characters */
+int winfs_get_windows_path(struct file *f, WCHAR *buf, int buf_size);
+/* Invalidate the pread() caches, for writes which do not go through the file operations */
+void winfs_cache_invalidate();
+/* Get a handle of a winfs file for overlapped I/O completed through port, or NULL if f is not a
+ * winfs file or can not be reopened (e.g. a directory). The handle is opened and associated with
+ * port on first use, and closed with the file. */
+HANDLE winfs_get_overlapped_handle(struct file *f, HANDLE port);
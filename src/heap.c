@@ -88,7 +88,8 @@ static struct bucket *alloc_bucket(int objsize)
 	/* Set up the chain of free objects */
 	char *c = (char *)b + ALIGN(sizeof(struct bucket), sizeof(void *)); /* Align to machine word size */
 	b->first_free = c;
-	while (c + objsize < (char *)b + BLOCK_SIZE)
+	/* The last object must also end within the block */
+	while (c + 2 * objsize <= (char *)b + BLOCK_SIZE)
 	{
 		*(char **)c = c + objsize;
 		c += objsize;
@@ -146,9 +147,6 @@ void *kmalloc(int size)
 
 void kfree(void *mem, int size)
 {
-	/* Find memory bucket */
-	void *bucket_addr = (void *)((size_t) mem & (-PAGE_SIZE));
-
 	/* Find pool */
 	int p = -1;
 	for (int i = 0; i < POOL_COUNT; i++)
@@ -163,12 +161,14 @@ void kfree(void *mem, int size)
 		return;
 	}
 
-	/* Loop over the chain to find the corresponding bucket */
+	/* Loop over the chain to find the bucket containing the object
+	 * Buckets are only page aligned, objects past the first page cannot be mapped to it by masking
+	 */
 	struct bucket *previous = NULL;
 	struct bucket *current = heap->pools[p].first;
 	while (current)
 	{
-		if (current != bucket_addr)
+		if ((char *)mem < (char *)current || (char *)mem >= (char *)current + BLOCK_SIZE)
 		{
 			previous = current;
 			current = current->next_bucket;
@@ -179,9 +179,10 @@ void kfree(void *mem, int size)
 		current->first_free = mem;
 		current->ref_cnt--;
 
-		if (!current->ref_cnt)
+		if (!current->ref_cnt && (previous || current->next_bucket))
 		{
-			/* Bucket empty, free it */
+			/* Bucket empty, free it unless it is the only one left in the pool,
+			 * a single object being allocated and freed repeatedly would map and unmap it each time */
 			if (!previous)
 				heap->pools[p].first = current->next_bucket;
 			else
@@ -0,0 +1,52 @@
+#include <lib/chacha20.h>
+
+#define ROTL32(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+	do { \
+		a += b; d ^= a; d = ROTL32(d, 16); \
+		c += d; b ^= c; b = ROTL32(b, 12); \
+		a += b; d ^= a; d = ROTL32(d, 8); \
+		c += d; b ^= c; b = ROTL32(b, 7); \
+	} while (0)
+
+void chacha20_block(const uint32_t key[8], uint32_t counter, const uint32_t nonce[3], uint8_t out[CHACHA20_BLOCK_SIZE])
+{
+	uint32_t input[16], x[16];
+	/* "expand 32-byte k" */
+	input[0] = 0x61707865;
+	input[1] = 0x3320646e;
+	input[2] = 0x79622d32;
+	input[3] = 0x6b206574;
+	for (int i = 0; i < 8; i++)
+		input[4 + i] = key[i];
+	input[12] = counter;
+	input[13] = nonce[0];
+	input[14] = nonce[1];
+	input[15] = nonce[2];
+
+	for (int i = 0; i < 16; i++)
+		x[i] = input[i];
+	for (int i = 0; i < 10; i++)
+	{
+		/* Column round */
+		QUARTERROUND(x[0], x[4], x[8], x[12]);
+		QUARTERROUND(x[1], x[5], x[9], x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		/* Diagonal round */
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8], x[13]);
+		QUARTERROUND(x[3], x[4], x[9], x[14]);
+	}
+	/* Serialize in little endian */
+	for (int i = 0; i < 16; i++)
+	{
+		uint32_t v = x[i] + input[i];
+		out[i * 4 + 0] = (uint8_t)v;
+		out[i * 4 + 1] = (uint8_t)(v >> 8);
+		out[i * 4 + 2] = (uint8_t)(v >> 16);
+		out[i * 4 + 3] = (uint8_t)(v >> 24);
+	}
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+#define CHACHA20_KEY_SIZE		32
+#define CHACHA20_BLOCK_SIZE		64
+
+/* Generate one ChaCha20 keystream block (RFC 7539) for a 256-bit key, 32-bit block counter and 96-bit nonce */
+void chacha20_block(const uint32_t key[8], uint32_t counter, const uint32_t nonce[3], uint8_t out[CHACHA20_BLOCK_SIZE]);
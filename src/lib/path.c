@@ -0,0 +1,88 @@
+#include <lib/path.h>
+
+char *path_start(const char *dirpath, const char **pathname, char *out)
+{
+	char *end = out;
+	if (**pathname == '/')
+	{
+		/* Absolute */
+		(*pathname)++;
+		return end;
+	}
+	/* Relative: Copy dirpath */
+	if (out == dirpath)
+	{
+		/* Whoa, not even need to copy anything */
+		while (*end)
+			end++;
+	}
+	else
+	{
+		while (*dirpath)
+			*end++ = *dirpath++;
+	}
+	if (end > out && end[-1] == '/')
+		end--;
+	return end;
+}
+
+int path_next(const char **pathname, char *start, char **end)
+{
+	const char *p = *pathname;
+	char *e = *end;
+	while (*p)
+	{
+		if (p[0] == '/')
+			p++;
+		else if (p[0] == '.' && p[1] == '/')
+			p += 2;
+		else if (p[0] == '.' && p[1] == '.' && p[2] == '/')
+		{
+			p += 3;
+			e = path_remove_last(start, e);
+		}
+		else
+		{
+			*e++ = '/';
+			/* Append current component */
+			while (*p && *p != '/')
+				*e++ = *p++;
+			if (*p == '/')
+			{
+				*pathname = p + 1;
+				*end = e;
+				return PATH_COMPONENT;
+			}
+			/* Normalize last component if it is "." or ".." */
+			if (e[-1] == '.' && e[-2] == '/')
+				e -= 2;
+			else if (e[-1] == '.' && e[-2] == '.' && e[-3] == '/')
+				e = path_remove_last(start, e - 3);
+		}
+	}
+	*pathname = p;
+	*end = e;
+	return PATH_END;
+}
+
+char *path_remove_last(char *start, char *end)
+{
+	if (end > start)
+		for (end--; *end != '/'; end--);
+	return end;
+}
+
+int path_finish(char *start, char *end)
+{
+	if (end == start)
+		*end++ = '/'; /* Return "/" instead of empty string */
+	*end = 0;
+	return (int)(end - start);
+}
+
+int path_normalize(const char *dirpath, const char *pathname, char *out)
+{
+	char *end = path_start(dirpath, &pathname, out);
+	while (path_next(&pathname, out, &end) == PATH_COMPONENT);
+	return path_finish(out, end);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+/* Lexical normalization of Linux paths, shared by the VFS path resolution.
+ * Does not access any file system and can be built and tested on any host.
+ *
+ * While building, a normalized path is absolute without a trailing slash,
+ * the root directory being the empty string. ".." at the root stays at the root.
+ */
+
+#define PATH_END		0	/* Pathname is fully consumed */
+#define PATH_COMPONENT	1	/* A non final component was appended */
+
+/* Start normalizing pathname relative to dirpath (an absolute path) into out
+ * dirpath may be aliased with out. Returns the end of the normalized path.
+ */
+char *path_start(const char *dirpath, const char **pathname, char *out);
+
+/* Consume pathname until a non final component is appended to the normalized path [start, *end)
+ * "." and ".." are applied to the path and not reported.
+ */
+int path_next(const char **pathname, char *start, char **end);
+
+/* Remove the last component of the normalized path [start, end), returns the new end */
+char *path_remove_last(char *start, char *end);
+
+/* Terminate the normalized path, an empty path becomes "/". Returns its length */
+int path_finish(char *start, char *end);
+
+/* Normalize pathname relative to dirpath without resolving symlinks, returns the length of out */
+int path_normalize(const char *dirpath, const char *pathname, char *out);
@@ -0,0 +1,134 @@
+#include <common/errno.h>
+#include <lib/uring.h>
+
+/* Both x86 and x86-64 do not reorder stores with other stores or loads with other loads,
+ * a compiler barrier suffices to order the ring entries with the head and tail updates */
+#ifdef _MSC_VER
+#include <intrin.h>
+#define uring_barrier()	_ReadWriteBarrier()
+#else
+#define uring_barrier()	__asm__ __volatile__("" ::: "memory")
+#endif
+
+size_t uring_sq_size(uint32_t entries)
+{
+	return sizeof(struct uring_sq) + entries * sizeof(uint32_t);
+}
+
+size_t uring_cq_size(uint32_t entries)
+{
+	return sizeof(struct uring_cq) + entries * sizeof(struct io_uring_cqe);
+}
+
+void uring_attach(struct uring *ring, void *sq, void *cq, const struct io_uring_sqe *sqes)
+{
+	ring->sq = (volatile struct uring_sq *)sq;
+	ring->cq = (volatile struct uring_cq *)cq;
+	ring->sqes = sqes;
+}
+
+void uring_init(struct uring *ring, void *sq, void *cq, const struct io_uring_sqe *sqes, uint32_t sq_entries, uint32_t cq_entries)
+{
+	uring_attach(ring, sq, cq, sqes);
+	ring->sq_entries = sq_entries;
+	ring->cq_entries = cq_entries;
+	ring->sq_head = 0;
+	ring->cq_tail = 0;
+	ring->completions = 0;
+	ring->sq->ring_mask = sq_entries - 1;
+	ring->sq->ring_entries = sq_entries;
+	ring->cq->ring_mask = cq_entries - 1;
+	ring->cq->ring_entries = cq_entries;
+}
+
+int uring_post(struct uring *ring, uint64_t user_data, int32_t res)
+{
+	volatile struct uring_cq *cq = ring->cq;
+	ring->completions++;
+	if (ring->cq_tail - cq->head >= ring->cq_entries)
+	{
+		cq->overflow++;
+		return 0;
+	}
+	volatile struct io_uring_cqe *cqe = &cq->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+	/* Publish the entry */
+	uring_barrier();
+	cq->tail = ++ring->cq_tail;
+	return 1;
+}
+
+void uring_complete(struct uring *ring, const struct io_uring_sqe *sqe, int32_t res)
+{
+	if (res >= 0 && (sqe->flags & IOSQE_CQE_SKIP_SUCCESS))
+		return;
+	uring_post(ring, sqe->user_data, res);
+}
+
+uint32_t uring_cq_ready(const struct uring *ring)
+{
+	return ring->cq_tail - ring->cq->head;
+}
+
+void uring_submit_begin(struct uring_submit *submit, struct uring *ring, uint32_t to_submit)
+{
+	submit->ring = ring;
+	submit->head = ring->sq_head;
+	submit->tail = ring->sq->tail;
+	/* Read the entries after the tail */
+	uring_barrier();
+	submit->submitted = 0;
+	submit->to_submit = to_submit;
+	submit->in_link = 0;
+	submit->link_failed = 0;
+}
+
+int uring_submit_next(struct uring_submit *submit, struct io_uring_sqe *sqe, int *linked)
+{
+	struct uring *ring = submit->ring;
+	while (submit->submitted < submit->to_submit && submit->head != submit->tail)
+	{
+		uint32_t index = ring->sq->array[submit->head & (ring->sq_entries - 1)];
+		submit->head++;
+		if (index >= ring->sq_entries)
+		{
+			ring->sq->dropped++;
+			continue;
+		}
+		/* Copy the entry so the guest can reuse it immediately */
+		*sqe = ring->sqes[index];
+		submit->submitted++;
+		int in_link = submit->in_link;
+		submit->in_link = (sqe->flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK)) != 0;
+		if (in_link && submit->link_failed)
+		{
+			uring_post(ring, sqe->user_data, -ECANCELED);
+			if (!submit->in_link)
+				submit->link_failed = 0;
+			continue;
+		}
+		submit->link_failed = 0;
+		*linked = in_link || submit->in_link;
+		return 1;
+	}
+	return 0;
+}
+
+void uring_submit_complete(struct uring_submit *submit, const struct io_uring_sqe *sqe, int32_t res)
+{
+	if (res < 0 && submit->in_link && !(sqe->flags & IOSQE_IO_HARDLINK))
+		submit->link_failed = 1;
+	uring_complete(submit->ring, sqe, res);
+}
+
+uint32_t uring_submit_end(struct uring_submit *submit)
+{
+	struct uring *ring = submit->ring;
+	ring->sq_head = submit->head;
+	/* The entries were copied before they are released */
+	uring_barrier();
+	ring->sq->head = submit->head;
+	return submit->submitted;
+}
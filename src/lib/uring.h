@@ -0,0 +1,85 @@
+#pragma once
+
+#include <common/io_uring.h>
+
+#include <stddef.h>
+
+/* Submission and completion rings of the io_uring emulation
+ * Implements the memory layout shared with the guest, consumption of the submission queue
+ * including link chains, and posting to the completion queue. Executing the requests is up to
+ * the caller. Does not depend on Windows and can be built and tested on any host.
+ *
+ * The guest can write anything to the shared memory at any time, so the ring sizes are never
+ * read back from it and entries are copied out before use.
+ */
+
+struct uring_sq
+{
+	uint32_t head;
+	uint32_t tail;
+	uint32_t ring_mask;
+	uint32_t ring_entries;
+	uint32_t flags;
+	uint32_t dropped;
+	uint32_t array[];
+};
+
+struct uring_cq
+{
+	uint32_t head;
+	uint32_t tail;
+	uint32_t ring_mask;
+	uint32_t ring_entries;
+	uint32_t overflow;
+	uint32_t flags;
+	uint64_t reserved;
+	struct io_uring_cqe cqes[];
+};
+
+struct uring
+{
+	volatile struct uring_sq *sq;
+	volatile struct uring_cq *cq;
+	const struct io_uring_sqe *sqes;
+	uint32_t sq_entries, cq_entries; /* Powers of two */
+	uint32_t sq_head, cq_tail; /* Our copies, the guest only reads them */
+	uint32_t completions; /* Number of completions so far, including overflowed ones */
+};
+
+/* Size of the submission or completion ring with the given number of entries */
+size_t uring_sq_size(uint32_t entries);
+size_t uring_cq_size(uint32_t entries);
+
+/* Set up the rings in zero initialized memory */
+void uring_init(struct uring *ring, void *sq, void *cq, const struct io_uring_sqe *sqes, uint32_t sq_entries, uint32_t cq_entries);
+/* Use a new mapping of initialized rings, e.g. after fork */
+void uring_attach(struct uring *ring, void *sq, void *cq, const struct io_uring_sqe *sqes);
+
+/* Post a completion, returns 0 if the completion queue is full and the completion is dropped */
+int uring_post(struct uring *ring, uint64_t user_data, int32_t res);
+/* Post the completion of a request unless IOSQE_CQE_SKIP_SUCCESS suppresses it */
+void uring_complete(struct uring *ring, const struct io_uring_sqe *sqe, int32_t res);
+/* Number of completions not yet consumed by the guest */
+uint32_t uring_cq_ready(const struct uring *ring);
+
+/* Consumption of the submission queue
+ * uring_submit_next() copies out the next entry. If it is part of a link chain (linked to the
+ * previous entry or linking to the next one) the caller must complete it with uring_submit_complete()
+ * before fetching the next entry. Other entries may also be completed later with uring_complete().
+ * Entries linked to a failed request are completed with -ECANCELED and not returned.
+ */
+struct uring_submit
+{
+	struct uring *ring;
+	uint32_t head, tail;
+	uint32_t submitted, to_submit;
+	int in_link; /* The last entry links to the next one */
+	int link_failed; /* A request in the current link chain failed */
+};
+
+void uring_submit_begin(struct uring_submit *submit, struct uring *ring, uint32_t to_submit);
+/* Fetch the next entry, returns 0 if there are no more entries to submit */
+int uring_submit_next(struct uring_submit *submit, struct io_uring_sqe *sqe, int *linked);
+void uring_submit_complete(struct uring_submit *submit, const struct io_uring_sqe *sqe, int32_t res);
+/* Release the consumed entries to the guest, returns the number of submitted entries */
+uint32_t uring_submit_end(struct uring_submit *submit);
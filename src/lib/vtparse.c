@@ -0,0 +1,155 @@
+#include <lib/vtparse.h>
+#include <lib/vtscan.h>
+
+/* Larger parameters are clamped to avoid overflow */
+#define VT_MAX_PARAM_VALUE	65535
+
+void vt_parser_init(struct vt_parser *parser)
+{
+	parser->state = VT_GROUND;
+}
+
+static void csi_begin(struct vt_parser *parser)
+{
+	for (int i = 0; i < VT_MAX_PARAMS; i++)
+		parser->params[i] = 0;
+	parser->param_count = 0;
+	parser->prefix = 0;
+	parser->state = VT_CSI;
+}
+
+static void escape(struct vt_parser *parser, const struct vt_callbacks *callbacks, char ch)
+{
+	switch (ch)
+	{
+	case '[':
+		csi_begin(parser);
+		break;
+
+	case ']':
+		parser->params[0] = 0;
+		parser->string_len = 0;
+		parser->state = VT_OSC_PARAM;
+		break;
+
+	case '(':
+	case ')':
+	case '#':
+		parser->intermediate = ch;
+		parser->state = VT_ESCAPE_INTERMEDIATE;
+		break;
+
+	default:
+		parser->state = VT_GROUND;
+		callbacks->escape(0, ch);
+	}
+}
+
+static void csi(struct vt_parser *parser, const struct vt_callbacks *callbacks, char ch)
+{
+	if (ch >= '0' && ch <= '9')
+	{
+		int *param = &parser->params[parser->param_count];
+		if (*param <= VT_MAX_PARAM_VALUE)
+			*param = 10 * *param + (ch - '0');
+	}
+	else if (ch == ';')
+	{
+		/* Excess parameters are dropped */
+		if (parser->param_count + 1 < VT_MAX_PARAMS)
+			parser->param_count++;
+	}
+	else if (ch == '?' || ch == '>' || ch == '=' || ch == '<')
+		parser->prefix = ch;
+	else
+	{
+		/* Final character, unknown ones are reported as well */
+		parser->state = VT_GROUND;
+		callbacks->csi(parser, ch);
+	}
+}
+
+static void osc(struct vt_parser *parser, const struct vt_callbacks *callbacks, char ch)
+{
+	if (parser->state == VT_OSC_PARAM)
+	{
+		if (ch >= '0' && ch <= '9')
+		{
+			if (parser->params[0] <= VT_MAX_PARAM_VALUE)
+				parser->params[0] = parser->params[0] * 10 + (ch - '0');
+		}
+		else if (ch == ';')
+			parser->state = VT_OSC_STRING;
+		else
+			parser->state = VT_GROUND;
+	}
+	else if (ch == 7) /* BEL, marks the end */
+	{
+		parser->state = VT_GROUND;
+		callbacks->osc(parser->params[0], parser->string, parser->string_len);
+	}
+	else if (parser->string_len < VT_MAX_STRING)
+		parser->string[parser->string_len++] = ch;
+}
+
+void vt_parse(struct vt_parser *parser, const struct vt_callbacks *callbacks, const char *buf, size_t count)
+{
+	size_t i = 0;
+	while (i < count)
+	{
+		if (parser->state == VT_GROUND)
+		{
+			/* Output the text run before the next control character in one go */
+			size_t len = vt_find_control(buf + i, count - i);
+			if (len > 0)
+			{
+				callbacks->print(buf + i, len);
+				i += len;
+				continue;
+			}
+		}
+		char ch = buf[i++];
+		switch (ch)
+		{
+		case 0x1B: /* Escape, also aborts the current sequence */
+			parser->state = VT_ESCAPE;
+			continue;
+
+		/* These are executed even in the middle of a sequence */
+		case '\b':
+		case '\t':
+		case '\n':
+		case '\v':
+		case '\f':
+		case '\r':
+		case 0x0E: /* Shift Out */
+		case 0x0F: /* Shift In */
+			callbacks->execute(ch);
+			continue;
+		}
+		switch (parser->state)
+		{
+		case VT_GROUND:
+			callbacks->execute(ch);
+			break;
+
+		case VT_ESCAPE:
+			escape(parser, callbacks, ch);
+			break;
+
+		case VT_ESCAPE_INTERMEDIATE:
+			parser->state = VT_GROUND;
+			callbacks->escape(parser->intermediate, ch);
+			break;
+
+		case VT_CSI:
+			csi(parser, callbacks, ch);
+			break;
+
+		case VT_OSC_PARAM:
+		case VT_OSC_STRING:
+			osc(parser, callbacks, ch);
+			break;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+
+/* State machine of the VT output parser.
+ * It splits a byte stream into text runs, control characters and escape sequences, and
+ * hands them to the callbacks. It does not depend on the console and can be built and
+ * benchmarked on any host. The parser state contains no pointers, so it can be placed
+ * in memory shared between processes. */
+
+#define VT_MAX_PARAMS		16
+#define VT_MAX_STRING		256
+
+enum vt_state
+{
+	VT_GROUND,
+	VT_ESCAPE, /* After ESC */
+	VT_ESCAPE_INTERMEDIATE, /* After ESC and one of "()#" */
+	VT_CSI, /* After ESC [ */
+	VT_OSC_PARAM, /* After ESC ], parsing the command number */
+	VT_OSC_STRING, /* After ESC ] n ;, collecting the string */
+};
+
+struct vt_parser
+{
+	int state;
+	int params[VT_MAX_PARAMS];
+	int param_count; /* Index of the last parameter, parameters not given are 0 */
+	char prefix; /* Private prefix after CSI, e.g. '?', '>' */
+	char intermediate; /* Intermediate character of an escape sequence */
+	int string_len;
+	char string[VT_MAX_STRING];
+};
+
+struct vt_callbacks
+{
+	/* A run of characters without control characters, may contain partial UTF-8 sequences */
+	void (*print)(const char *buf, size_t count);
+	/* A C0 control character, other than ESC */
+	void (*execute)(char ch);
+	/* "ESC ch" or "ESC intermediate ch", intermediate is 0 if not present */
+	void (*escape)(char intermediate, char ch);
+	/* "ESC [ params ch", parameters are in parser->params and may be modified */
+	void (*csi)(struct vt_parser *parser, char ch);
+	/* "ESC ] command ; string BEL" */
+	void (*osc)(int command, const char *string, int len);
+};
+
+/* Reset the parser to the ground state */
+void vt_parser_init(struct vt_parser *parser);
+
+/* Feed a buffer to the parser */
+void vt_parse(struct vt_parser *parser, const struct vt_callbacks *callbacks, const char *buf, size_t count);
@@ -0,0 +1,79 @@
+#include <lib/vtscan.h>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define VT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef VT_USE_SSE2
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static __forceinline int lowest_bit(unsigned int mask)
+{
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+}
+#else
+#define lowest_bit(mask)	__builtin_ctz(mask)
+#endif
+
+size_t vt_find_control(const char *buf, size_t count)
+{
+	const __m128i limit = _mm_set1_epi8(0x1F);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		/* Unsigned saturating subtraction yields zero iff the byte is <= 0x1F */
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(v, limit), zero));
+		if (mask)
+			return i + lowest_bit(mask);
+	}
+	for (; i < count; i++)
+		if ((unsigned char)buf[i] < 0x20)
+			return i;
+	return count;
+}
+
+size_t vt_scan_ascii(const char *buf, size_t count)
+{
+	const __m128i low = _mm_set1_epi8(0x1F);
+	const __m128i high = _mm_set1_epi8(0x7F);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		/* Signed comparison, bytes >= 0x80 are negative and fail the first test */
+		__m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, high));
+		unsigned int mask = ~_mm_movemask_epi8(printable) & 0xFFFF;
+		if (mask)
+			return i + lowest_bit(mask);
+	}
+	for (; i < count; i++)
+		if ((unsigned char)buf[i] < 0x20 || (unsigned char)buf[i] >= 0x7F)
+			return i;
+	return count;
+}
+
+#else
+
+size_t vt_find_control(const char *buf, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		if ((unsigned char)buf[i] < 0x20)
+			return i;
+	return count;
+}
+
+size_t vt_scan_ascii(const char *buf, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		if ((unsigned char)buf[i] < 0x20 || (unsigned char)buf[i] >= 0x7F)
+			return i;
+	return count;
+}
+
+#endif
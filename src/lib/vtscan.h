@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Byte scanning primitives for the VT output parser.
+ * These do not depend on the console and can be built and benchmarked on any host. */
+
+/* Return the index of the first C0 control character (< 0x20), or count if there is none */
+size_t vt_find_control(const char *buf, size_t count);
+
+/* Return the length of the leading run of printable ASCII characters (0x20 - 0x7E) */
+size_t vt_scan_ascii(const char *buf, size_t count);
@@ -119,17 +119,40 @@ void main()
 	envp[4] = NULL;
 	char *buffer_base = (char*)(envp + env_size + 1);
 
-	const char *filename = NULL;
-	for (int i = 1; i < argc; i++)
+	/* Parse options */
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
 	{
-		if (argv[i][0] == '-')
+		if (!strcmp(argv[i], "--bind") && i + 2 < argc)
 		{
+			/* --bind <windows-dir> <guest-dir> */
+			WCHAR path[PATH_MAX];
+			if (!MultiByteToWideChar(CP_ACP, 0, argv[i + 1], -1, path, PATH_MAX)
+				|| vfs_mount_windows(path, argv[i + 2]) < 0)
+			{
+				kprintf("Mounting \"%s\" on \"%s\" failed.\n", argv[i + 1], argv[i + 2]);
+				ExitProcess(1);
+			}
+			i += 2;
 		}
-		else if (!filename)
-			filename = argv[i];
+		else if (!strcmp(argv[i], "--tmpfs") && i + 1 < argc)
+		{
+			/* --tmpfs <guest-dir> */
+			if (vfs_mount("tmpfs", argv[i + 1], "tmpfs", 0, NULL) < 0)
+			{
+				kprintf("Mounting tmpfs on \"%s\" failed.\n", argv[i + 1]);
+				ExitProcess(1);
+			}
+			i++;
+		}
+		else
+			break;
 	}
-	if (filename)
-		do_execve(filename, argc - 1, argv + 1, env_size, envp, buffer_base, NULL);
-	kprintf("Usage: flinux <executable> [arguments]\n");
+	if (i < argc && argv[i][0] != '-')
+		do_execve(argv[i], argc - i, argv + i, env_size, envp, buffer_base, NULL);
+	kprintf("Usage: flinux [options] <executable> [arguments]\n");
+	kprintf("Options:\n");
+	kprintf("  --bind <windows-dir> <guest-dir>  Mount a Windows directory into the guest tree\n");
+	kprintf("  --tmpfs <guest-dir>               Mount a new tmpfs instance\n");
 	ExitProcess(1);
 }
@@ -0,0 +1,201 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <rwlock.h>
+#include <log.h>
+
+#include <stdbool.h>
+
+/* Number of busy-wait iterations before falling back to the kernel event */
+#define RWLOCK_SPIN_COUNT	256
+/* Milliseconds to wait on the event before checking for abandoned holds */
+#define RWLOCK_RECOVERY_TIMEOUT	1000
+
+/* Wakeup protocol
+ *
+ * A waiter increments `waiters' before its final acquire attempt, and an unlocker
+ * reads `waiters' after it has released the lock word. Both are interlocked (full barrier)
+ * operations, so at least one side observes the other and the wakeup cannot be lost.
+ * The event is auto-reset and wakes only one waiter, so a reader which acquires the
+ * lock after waking passes the wakeup on to the next waiter.
+ */
+
+/* Abandoned lock recovery
+ *
+ * A holder records its Windows process id after acquiring the lock word and clears it
+ * before releasing, so a recorded id always corresponds to a hold. A process killed in the
+ * few instructions between the two steps leaks its hold, as does a reader when all
+ * RWLOCK_MAX_HOLDERS slots are in use; both are rare enough to be acceptable.
+ * Windows process ids can be reused, a reused id just looks alive and is left alone.
+ */
+
+void rwlock_init(struct rwlock *lock, volatile struct rwlock_shared *shared, LPCWSTR event_name)
+{
+	lock->shared = shared;
+	lock->owner_id = (LONG)GetCurrentProcessId();
+	SECURITY_ATTRIBUTES attr;
+	attr.nLength = sizeof(SECURITY_ATTRIBUTES);
+	attr.bInheritHandle = TRUE;
+	attr.lpSecurityDescriptor = NULL;
+	/* Opens the existing event if another process already created it */
+	lock->event = CreateEventW(&attr, FALSE, FALSE, event_name);
+	if (lock->event == NULL)
+		log_error("rwlock: CreateEventW() failed, error code: %d\n", GetLastError());
+}
+
+void rwlock_shutdown(struct rwlock *lock)
+{
+	CloseHandle(lock->event);
+}
+
+static __forceinline bool try_lock_shared(volatile struct rwlock_shared *shared)
+{
+	LONG state = shared->state;
+	return state >= 0 && InterlockedCompareExchange(&shared->state, state + 1, state) == state;
+}
+
+static __forceinline bool try_lock_exclusive(volatile struct rwlock_shared *shared)
+{
+	return InterlockedCompareExchange(&shared->state, -1, 0) == 0;
+}
+
+static __forceinline void wake_waiter(struct rwlock *lock)
+{
+	if (lock->shared->waiters > 0)
+		SetEvent(lock->event);
+}
+
+static bool is_process_alive(LONG id)
+{
+	HANDLE handle = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)id);
+	if (handle == NULL)
+		return GetLastError() != ERROR_INVALID_PARAMETER; /* Access denied means it exists */
+	DWORD result = WaitForSingleObject(handle, 0);
+	CloseHandle(handle);
+	return result != WAIT_OBJECT_0;
+}
+
+static void add_reader(struct rwlock *lock)
+{
+	int start = lock->owner_id % RWLOCK_MAX_HOLDERS;
+	for (int i = 0; i < RWLOCK_MAX_HOLDERS; i++)
+	{
+		int slot = (start + i) % RWLOCK_MAX_HOLDERS;
+		if (lock->shared->readers[slot] == 0 &&
+			InterlockedCompareExchange(&lock->shared->readers[slot], lock->owner_id, 0) == 0)
+			return;
+	}
+}
+
+static void remove_reader(struct rwlock *lock)
+{
+	int start = lock->owner_id % RWLOCK_MAX_HOLDERS;
+	for (int i = 0; i < RWLOCK_MAX_HOLDERS; i++)
+	{
+		int slot = (start + i) % RWLOCK_MAX_HOLDERS;
+		if (lock->shared->readers[slot] == lock->owner_id &&
+			InterlockedCompareExchange(&lock->shared->readers[slot], 0, lock->owner_id) == lock->owner_id)
+			return;
+	}
+}
+
+/* Release holds of dead processes, returns whether anything is released */
+static bool rwlock_recover(struct rwlock *lock)
+{
+	volatile struct rwlock_shared *shared = lock->shared;
+	if (InterlockedCompareExchange(&shared->recovering, 1, 0) != 0)
+		return false;
+	bool recovered = false;
+	LONG writer = shared->writer;
+	if (writer && !is_process_alive(writer) && InterlockedCompareExchange(&shared->writer, 0, writer) == writer)
+	{
+		log_warning("rwlock: Recovered exclusive lock abandoned by process %d.\n", writer);
+		InterlockedCompareExchange(&shared->state, 0, -1);
+		recovered = true;
+	}
+	for (int i = 0; i < RWLOCK_MAX_HOLDERS; i++)
+	{
+		LONG reader = shared->readers[i];
+		if (reader && !is_process_alive(reader) && InterlockedCompareExchange(&shared->readers[i], 0, reader) == reader)
+		{
+			log_warning("rwlock: Recovered shared lock abandoned by process %d.\n", reader);
+			InterlockedDecrement(&shared->state);
+			recovered = true;
+		}
+	}
+	InterlockedExchange(&shared->recovering, 0);
+	return recovered;
+}
+
+static void rwlock_wait(struct rwlock *lock, bool (*try_lock)(volatile struct rwlock_shared *))
+{
+	for (;;)
+	{
+		for (int i = 0; i < RWLOCK_SPIN_COUNT; i++)
+		{
+			if (try_lock(lock->shared))
+				return;
+			YieldProcessor();
+		}
+		InterlockedIncrement(&lock->shared->waiters);
+		if (try_lock(lock->shared))
+		{
+			InterlockedDecrement(&lock->shared->waiters);
+			return;
+		}
+		DWORD result = WaitForSingleObject(lock->event, RWLOCK_RECOVERY_TIMEOUT);
+		InterlockedDecrement(&lock->shared->waiters);
+		if (result == WAIT_TIMEOUT && rwlock_recover(lock))
+			SetEvent(lock->event); /* Other waiters may be able to proceed as well */
+	}
+}
+
+void rwlock_lock_shared(struct rwlock *lock)
+{
+	if (try_lock_shared(lock->shared))
+	{
+		add_reader(lock);
+		return;
+	}
+	rwlock_wait(lock, try_lock_shared);
+	add_reader(lock);
+	/* Pass the wakeup on so other waiting readers can join us */
+	wake_waiter(lock);
+}
+
+void rwlock_unlock_shared(struct rwlock *lock)
+{
+	remove_reader(lock);
+	if (InterlockedDecrement(&lock->shared->state) == 0)
+		wake_waiter(lock);
+}
+
+void rwlock_lock_exclusive(struct rwlock *lock)
+{
+	if (!try_lock_exclusive(lock->shared))
+		rwlock_wait(lock, try_lock_exclusive);
+	lock->shared->writer = lock->owner_id;
+}
+
+void rwlock_unlock_exclusive(struct rwlock *lock)
+{
+	InterlockedExchange(&lock->shared->writer, 0);
+	InterlockedExchange(&lock->shared->state, 0);
+	wake_waiter(lock);
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of Foreign Linux.
+ *
+ * Copyright (C) 2014, 2015 Xiangyan Sun <wishstudio@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+/* Lightweight interprocess reader/writer lock
+ *
+ * The lock word lives in a shared memory area (i.e. allocated by mm_global_shared_alloc())
+ * and works with zero initialization. Uncontended lock and unlock operations are a few
+ * interlocked instructions. A named auto-reset event is only touched when there are waiters.
+ *
+ * Like an abandoned mutex, a lock held by a process which dies (e.g. killed by
+ * TerminateProcess()) is recovered: every holder records its Windows process id, and a
+ * waiter which has waited for too long releases the holds of dead processes.
+ */
+#define RWLOCK_MAX_HOLDERS	64
+struct rwlock_shared
+{
+	/* -1: Held by a writer, 0: Free, >0: Number of readers */
+	LONG state;
+	/* Number of processes currently waiting on the event */
+	LONG waiters;
+	/* Non-zero when a process is running abandoned lock recovery */
+	LONG recovering;
+	/* Windows process id of the writer */
+	LONG writer;
+	/* Windows process ids of the readers, zero means a free slot */
+	LONG readers[RWLOCK_MAX_HOLDERS];
+};
+
+struct rwlock
+{
+	volatile struct rwlock_shared *shared;
+	HANDLE event;
+	LONG owner_id;
+};
+
+void rwlock_init(struct rwlock *lock, volatile struct rwlock_shared *shared, LPCWSTR event_name);
+void rwlock_shutdown(struct rwlock *lock);
+
+void rwlock_lock_shared(struct rwlock *lock);
+void rwlock_unlock_shared(struct rwlock *lock);
+void rwlock_lock_exclusive(struct rwlock *lock);
+void rwlock_unlock_exclusive(struct rwlock *lock);
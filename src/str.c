@@ -24,6 +24,11 @@
 #include <Windows.h>
 #include <stdarg.h>
 
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define STR_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #define BUFFER_SIZE	4096
 char buffer[BUFFER_SIZE];
 
@@ -260,6 +265,78 @@ static __forceinline int utf16_count_len(uint32_t codepoint)
 		return 2;
 }
 
+#ifdef STR_USE_SSE2
+/* ASCII fast paths
+ * Each of these processes a block of 16 characters, and returns 0 without touching the
+ * output if the block contains characters which need the generic conversion path.
+ * ASCII characters are the same in UTF-8 and UTF-16, only widening/narrowing is needed.
+ */
+
+static __forceinline int ascii16_check_utf8(const char *data)
+{
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)data)) == 0;
+}
+
+static __forceinline int ascii16_utf8_to_utf16(const char *data, uint16_t *out)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)data);
+	if (_mm_movemask_epi8(v))
+		return 0;
+	__m128i zero = _mm_setzero_si128();
+	_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(v, zero));
+	_mm_storeu_si128((__m128i *)(out + 8), _mm_unpackhi_epi8(v, zero));
+	return 1;
+}
+
+static __forceinline int ascii16_utf8_to_utf16_filename(const char *data, uint16_t *out)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)data);
+	__m128i zero = _mm_setzero_si128();
+	/* Characters transformed to the private use area, see filename_transform_chars */
+	__m128i special = _mm_cmpeq_epi8(_mm_subs_epu8(v, _mm_set1_epi8(0x1F)), zero);
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('?')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+	/* The sign bit of v marks non ASCII characters */
+	if (_mm_movemask_epi8(_mm_or_si128(special, v)))
+		return 0;
+	/* Path separators */
+	__m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+	v = _mm_or_si128(_mm_andnot_si128(slash, v), _mm_and_si128(slash, _mm_set1_epi8('\\')));
+	_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(v, zero));
+	_mm_storeu_si128((__m128i *)(out + 8), _mm_unpackhi_epi8(v, zero));
+	return 1;
+}
+
+static __forceinline int ascii16_check_utf16(const uint16_t *data, __m128i *a, __m128i *b)
+{
+	*a = _mm_loadu_si128((const __m128i *)data);
+	*b = _mm_loadu_si128((const __m128i *)(data + 8));
+	__m128i high = _mm_and_si128(_mm_or_si128(*a, *b), _mm_set1_epi16((short)0xFF80));
+	return _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF;
+}
+
+/* Also used for filenames: no ASCII characters are transformed in this direction */
+static __forceinline int ascii16_utf16_to_utf8(const uint16_t *data, char *out)
+{
+	__m128i a, b;
+	if (!ascii16_check_utf16(data, &a, &b))
+		return 0;
+	_mm_storeu_si128((__m128i *)out, _mm_packus_epi16(a, b));
+	return 1;
+}
+
+static __forceinline int ascii16_count_utf16(const uint16_t *data)
+{
+	__m128i a, b;
+	return ascii16_check_utf16(data, &a, &b);
+}
+#endif
+
 int utf8_to_utf16(const char *data, int srclen, uint16_t *outdata, int dstlen)
 {
 	const char *last = data + srclen;
@@ -269,6 +346,15 @@ int utf8_to_utf16(const char *data, int srclen, uint16_t *outdata, int dstlen)
 	{
 		while (data < last)
 		{
+#ifdef STR_USE_SSE2
+			if (last - data >= 16 && outlast - outdata >= 16 && ascii16_utf8_to_utf16(data, outdata))
+			{
+				data += 16;
+				outdata += 16;
+				outlen += 16;
+				continue;
+			}
+#endif
 			uint32_t codepoint = utf8_read_increment(&data, last);
 			if (codepoint == -1)
 				return -1;
@@ -282,6 +368,14 @@ int utf8_to_utf16(const char *data, int srclen, uint16_t *outdata, int dstlen)
 	{
 		while (data < last)
 		{
+#ifdef STR_USE_SSE2
+			if (last - data >= 16 && ascii16_check_utf8(data))
+			{
+				data += 16;
+				outlen += 16;
+				continue;
+			}
+#endif
 			uint32_t codepoint = utf8_read_increment(&data, last);
 			if (codepoint == -1)
 				return -1;
@@ -300,10 +394,19 @@ int utf8_to_utf16_filename(const char *data, int srclen, uint16_t *outdata, int
 	{
 		while (data < last)
 		{
+#ifdef STR_USE_SSE2
+			if (last - data >= 16 && outlast - outdata >= 16 && ascii16_utf8_to_utf16_filename(data, outdata))
+			{
+				data += 16;
+				outdata += 16;
+				outlen += 16;
+				continue;
+			}
+#endif
 			uint32_t codepoint = utf8_read_increment(&data, last);
 			if (codepoint == -1)
 				return -1;
-			if (codepoint <= 0x80)
+			if (codepoint < 0x80)
 				codepoint = filename_transform_chars[codepoint];
 			int r = utf16_write_increment(codepoint, &outdata, outlast);
 			if (r < 0)
@@ -315,10 +418,18 @@ int utf8_to_utf16_filename(const char *data, int srclen, uint16_t *outdata, int
 	{
 		while (data < last)
 		{
+#ifdef STR_USE_SSE2
+			if (last - data >= 16 && ascii16_check_utf8(data))
+			{
+				data += 16;
+				outlen += 16;
+				continue;
+			}
+#endif
 			uint32_t codepoint = utf8_read_increment(&data, last);
 			if (codepoint == -1)
 				return -1;
-			if (codepoint <= 0x80)
+			if (codepoint < 0x80)
 				codepoint = filename_transform_chars[codepoint];
 			outlen += utf16_count_len(codepoint);
 		}
@@ -335,6 +446,15 @@ int utf16_to_utf8(const uint16_t *data, int srclen, char *outdata, int dstlen)
 	{
 		while (data < last)
 		{
+#ifdef STR_USE_SSE2
+			if (last - data >= 16 && outlast - outdata >= 16 && ascii16_utf16_to_utf8(data, outdata))
+			{
+				data += 16;
+				outdata += 16;
+				outlen += 16;
+				continue;
+			}
+#endif
 			uint32_t codepoint = utf16_read_increment(&data, last);
 			if (codepoint == -1)
 				return -1;
@@ -348,6 +468,14 @@ int utf16_to_utf8(const uint16_t *data, int srclen, char *outdata, int dstlen)
 	{
 		while (data < last)
 		{
+#ifdef STR_USE_SSE2
+			if (last - data >= 16 && ascii16_count_utf16(data))
+			{
+				data += 16;
+				outlen += 16;
+				continue;
+			}
+#endif
 			uint32_t codepoint = utf16_read_increment(&data, last);
 			if (codepoint == -1)
 				return -1;
@@ -366,6 +494,15 @@ int utf16_to_utf8_filename(const uint16_t *data, int srclen, char *outdata, int
 	{
 		while (data < last)
 		{
+#ifdef STR_USE_SSE2
+			if (last - data >= 16 && outlast - outdata >= 16 && ascii16_utf16_to_utf8(data, outdata))
+			{
+				data += 16;
+				outdata += 16;
+				outlen += 16;
+				continue;
+			}
+#endif
 			uint32_t codepoint = utf16_read_increment(&data, last);
 			if (codepoint == -1)
 				return -1;
@@ -381,6 +518,14 @@ int utf16_to_utf8_filename(const uint16_t *data, int srclen, char *outdata, int
 	{
 		while (data < last)
 		{
+#ifdef STR_USE_SSE2
+			if (last - data >= 16 && ascii16_count_utf16(data))
+			{
+				data += 16;
+				outlen += 16;
+				continue;
+			}
+#endif
 			uint32_t codepoint = utf16_read_increment(&data, last);
 			if (codepoint == -1)
 				return -1;
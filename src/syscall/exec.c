@@ -22,7 +22,6 @@
 #include <common/errno.h>
 #include <common/fcntl.h>
 #include <dbt/x86.h>
-#include <fs/winfs.h>
 #include <syscall/exec.h>
 #include <syscall/mm.h>
 #include <syscall/process.h>
@@ -83,6 +82,9 @@ static void run(struct binfmt *binary, int argc, char *argv[], int env_size, cha
 	AUX_VEC(AT_FLAGS, 0);
 	AUX_VEC(AT_SECURE, 0);
 	AUX_VEC(AT_RANDOM, random_bytes);
+#ifndef _WIN64
+	AUX_VEC(AT_SYSINFO, dbt_get_vsyscall());
+#endif
 	AUX_VEC(AT_PAGESZ, PAGE_SIZE);
 	AUX_VEC(AT_PHDR, executable->load_base + executable->eh.e_phoff);
 	AUX_VEC(AT_PHENT, executable->eh.e_phentsize);
@@ -134,6 +136,15 @@ static void run(struct binfmt *binary, int argc, char *argv[], int env_size, cha
 	dbt_run(entrypoint, (size_t)stack);
 }
 
+/* Only regular files on file systems which support pread() can be executed */
+static int is_executable_file(struct file *f)
+{
+	struct newstat stat;
+	if (!f->op_vtable->pread || !f->op_vtable->stat || f->op_vtable->stat(f, &stat) < 0)
+		return 0;
+	return S_ISREG(stat.st_mode);
+}
+
 static int load_elf(struct file *f, struct binfmt *binary)
 {
 	Elf_Ehdr eh;
@@ -263,7 +274,7 @@ static int load_elf(struct file *f, struct binfmt *binary)
 			int r = vfs_openat(AT_FDCWD, path, O_RDONLY, 0, &fi);
 			if (r < 0)
 				return r;
-			if (!winfs_is_winfile(fi))
+			if (!is_executable_file(fi))
 			{
 				vfs_release(fi);
 				return -EACCES;
@@ -323,7 +334,7 @@ static int load_script(struct file *f, struct binfmt *binary)
 	int r = vfs_openat(AT_FDCWD, executable, O_RDONLY, 0, &fe);
 	if (r < 0)
 		return r;
-	if (!winfs_is_winfile(fe))
+	if (!is_executable_file(fe))
 	{
 		vfs_release(fe);
 		return -EACCES;
@@ -344,7 +355,7 @@ int do_execve(const char *filename, int argc, char *argv[], int env_size, char *
 	r = vfs_openat(AT_FDCWD, filename, O_RDONLY, 0, &f);
 	if (r < 0)
 		return r;
-	if (!winfs_is_winfile(f))
+	if (!is_executable_file(f))
 	{
 		vfs_release(f);
 		return -EACCES;
@@ -21,6 +21,8 @@
 #include <common/types.h>
 #include <common/ptrace.h>
 #include <dbt/x86.h>
+#include <fs/io_uring.h>
+#include <fs/random.h>
 #include <syscall/fork.h>
 #include <syscall/mm.h>
 #include <syscall/process.h>
@@ -59,7 +61,9 @@ __declspec(noreturn) static void fork_child()
 	signal_afterfork();
 	process_afterfork(fork->stack_base, fork->pid);
 	tls_afterfork();
+	io_uring_afterfork();
 	vfs_afterfork();
+	random_afterfork();
 	dbt_init();
 	if (fork->ctid)
 		*(pid_t *)fork->ctid = fork->pid;
@@ -119,6 +119,9 @@ struct map_entry
 	};
 };
 
+/* Flags of map_entry which are not internal flags of mm_mmap() */
+#define MAP_ENTRY_SHARED	0x10000	/* Blocks are views of a file's backing section, never do copy-on-write */
+
 static int map_entry_cmp(const struct rb_node *l, const struct rb_node *r)
 {
 	struct map_entry *left = rb_entry(l, struct map_entry, tree);
@@ -147,6 +150,8 @@ struct mm_data
 	struct rb_tree entry_tree;
 	struct slist entry_free_list;
 	struct map_entry entries[MAX_MMAP_COUNT];
+	/* Map entry of the last successful mm_check_read()/mm_check_write(), NULL if none */
+	struct map_entry *last_check_entry;
 
 	/* Section handle count for each table */
 	uint16_t section_table_handle_count[SECTION_TABLE_COUNT];
@@ -199,6 +204,8 @@ static struct map_entry *new_map_entry()
 
 static void free_map_entry(struct map_entry *entry)
 {
+	if (mm->last_check_entry == entry)
+		mm->last_check_entry = NULL;
 	slist_add(&mm->entry_free_list, &entry->free_list);
 }
 
@@ -235,6 +242,7 @@ static void split_map_entry(struct map_entry *e, size_t last_page_of_first_entry
 		ne->offset_pages = e->offset_pages + (ne->start_page - e->start_page);
 	}
 	ne->prot = e->prot;
+	ne->flags = e->flags;
 	e->end_page = last_page_of_first_entry;
 	rb_add(&mm->entry_tree, &ne->tree, map_entry_cmp);
 }
@@ -249,7 +257,9 @@ static void free_map_entry_blocks(struct map_entry *e)
 	size_t end_block = GET_BLOCK_OF_PAGE(e->end_page);
 
 	/* The first block and last block may be shared with previous/next entry
-	 * We should mark corresponding pages in such blocks as PAGE_NOACCESS instead of free them */
+	 * We should mark corresponding pages in such blocks as PAGE_NOACCESS instead of free them
+	 * For MAP_SHARED entries the neighbor is always another part of the same mapping, the view
+	 * of the block is unmapped when its last part is gone */
 	if (prev && GET_BLOCK_OF_PAGE(rb_entry(prev, struct map_entry, tree)->end_page) == start_block)
 	{
 		/* First block is shared, just make it inaccessible */
@@ -298,6 +308,7 @@ void mm_init()
 	slist_init(&mm->entry_free_list);
 	for (size_t i = 0; i + 1 < MAX_MMAP_COUNT; i++)
 		slist_add(&mm->entry_free_list, &mm->entries[i].free_list);
+	mm->last_check_entry = NULL;
 	mm->brk = 0;
 	/* Initialize section handle table */
 	mm_section_handle = VirtualAlloc(NULL, BLOCK_COUNT * sizeof(HANDLE), MEM_RESERVE | MEM_TOP_DOWN, PAGE_READWRITE);
@@ -415,6 +426,40 @@ void mm_update_brk(void *brk)
 #endif
 }
 
+/* Pages occupied by a map entry
+ * A MAP_SHARED entry occupies its blocks entirely, as pages unmapped from a block which is
+ * still partly mapped are part of the file's view, they must not be reused by other mappings.
+ */
+static __forceinline size_t entry_first_page(struct map_entry *e)
+{
+	if (e->flags & MAP_ENTRY_SHARED)
+		return GET_FIRST_PAGE_OF_BLOCK(GET_BLOCK_OF_PAGE(e->start_page));
+	return e->start_page;
+}
+
+static __forceinline size_t entry_last_page(struct map_entry *e)
+{
+	if (e->flags & MAP_ENTRY_SHARED)
+		return GET_LAST_PAGE_OF_BLOCK(GET_BLOCK_OF_PAGE(e->end_page));
+	return e->end_page;
+}
+
+/* Check whether a block is a view of a MAP_SHARED mapping */
+static int is_shared_block(size_t block)
+{
+	size_t first_page = GET_FIRST_PAGE_OF_BLOCK(block);
+	size_t last_page = GET_LAST_PAGE_OF_BLOCK(block);
+	for (struct rb_node *cur = start_node(first_page); cur; cur = rb_next(cur))
+	{
+		struct map_entry *e = rb_entry(cur, struct map_entry, tree);
+		if (e->start_page > last_page)
+			break;
+		if (e->end_page >= first_page && (e->flags & MAP_ENTRY_SHARED))
+			return 1;
+	}
+	return 0;
+}
+
 /* Find 'count' consecutive free pages, return 0 if not found */
 static size_t find_free_pages(size_t count)
 {
@@ -422,10 +467,11 @@ static size_t find_free_pages(size_t count)
 	for (struct rb_node *cur = rb_first(&mm->entry_tree); cur; cur = rb_next(cur))
 	{
 		struct map_entry *e = rb_entry(cur, struct map_entry, tree);
-		if (e->start_page >= last && e->start_page - last >= count)
+		size_t start_page = entry_first_page(e), end_page = entry_last_page(e);
+		if (start_page >= last && start_page - last >= count)
 			return last;
-		else if (e->end_page >= last)
-			last = e->end_page + 1;
+		else if (end_page >= last)
+			last = end_page + 1;
 		if (last >= GET_PAGE(ADDRESS_ALLOCATION_HIGH))
 			return 0;
 	}
@@ -442,10 +488,11 @@ static size_t find_free_pages_topdown(size_t count)
 	for (struct rb_node *cur = rb_last(&mm->entry_tree); cur; cur = rb_prev(cur))
 	{
 		struct map_entry *e = rb_entry(cur, struct map_entry, tree);
-		if (e->end_page <= last && e->end_page + count <= last)
+		size_t start_page = entry_first_page(e), end_page = entry_last_page(e);
+		if (end_page <= last && end_page + count <= last)
 			return last - count;
-		else if (e->start_page <= last)
-			last = e->start_page - 1;
+		else if (start_page <= last)
+			last = start_page - 1;
 		if (last <= GET_PAGE(ADDRESS_ALLOCATION_LOW))
 			return 0;
 	}
@@ -727,25 +774,9 @@ static int take_block_ownership(size_t block)
 	return 1;
 }
 
-static int handle_cow_page_fault(void *addr)
+/* Apply the protection flags of all map entries in the block */
+static int set_block_protection(size_t block)
 {
-	struct map_entry *entry = find_map_entry(addr);
-	if (entry == NULL)
-	{
-		log_warning("No corresponding map entry found.\n");
-		return 0;
-	}
-	if ((entry->prot & PROT_WRITE) == 0)
-	{
-		log_warning("Address %p (page %p) not writable.\n", addr, GET_PAGE(addr));
-		return 0;
-	}
-	size_t block = GET_BLOCK(addr);
-
-	if (!take_block_ownership(block))
-		return 0;
-
-	/* We're the only owner of the section now, change page protection flags */
 	size_t start_page = GET_FIRST_PAGE_OF_BLOCK(block);
 	size_t end_page = GET_LAST_PAGE_OF_BLOCK(block);
 	for (struct rb_node *cur = start_node(start_page); cur; cur = rb_next(cur))
@@ -768,6 +799,31 @@ static int handle_cow_page_fault(void *addr)
 			}
 		}
 	}
+	return 1;
+}
+
+static int handle_cow_page_fault(void *addr)
+{
+	struct map_entry *entry = find_map_entry(addr);
+	if (entry == NULL)
+	{
+		log_warning("No corresponding map entry found.\n");
+		return 0;
+	}
+	if ((entry->prot & PROT_WRITE) == 0)
+	{
+		log_warning("Address %p (page %p) not writable.\n", addr, GET_PAGE(addr));
+		return 0;
+	}
+	size_t block = GET_BLOCK(addr);
+
+	/* Shared mappings are always writable in place, the write protection only comes from mprotect() */
+	if (!(entry->flags & MAP_ENTRY_SHARED) && !take_block_ownership(block))
+		return 0;
+
+	/* We're the only owner of the section now, change page protection flags */
+	if (!set_block_protection(block))
+		return 0;
 	log_info("CoW section %p successfully duplicated.\n", block);
 	return 1;
 }
@@ -825,6 +881,148 @@ int mm_handle_page_fault(void *addr)
 		return handle_on_demand_page_fault(addr);
 }
 
+int mm_patch_code(void *addr, const void *data, size_t size)
+{
+	struct map_entry *entry = find_map_entry(addr);
+	if (entry == NULL || (entry->flags & MAP_ENTRY_SHARED) || !(entry->prot & PROT_EXEC))
+		return 0;
+	size_t block = GET_BLOCK(addr);
+	if (GET_BLOCK((size_t)addr + size - 1) != block || GET_PAGE((size_t)addr + size - 1) > entry->end_page)
+		return 0;
+	if (!get_section_handle(block) && !handle_on_demand_page_fault(addr))
+		return 0;
+	/* Patched code must never be seen by other processes sharing the section */
+	if (!take_block_ownership(block))
+		return 0;
+	DWORD oldProtect;
+	if (!VirtualProtect(addr, size, PAGE_EXECUTE_READWRITE, &oldProtect))
+	{
+		log_error("VirtualProtect(0x%p, 0x%p) failed, error code: %d.\n", addr, size, GetLastError());
+		return 0;
+	}
+	memcpy(addr, data, size);
+	FlushInstructionCache(GetCurrentProcess(), addr, size);
+	return set_block_protection(block);
+}
+
+/* Page probing routines in stubs.asm, used for memory not managed by mm (e.g. the process stack) */
+int mm_probe_read(const void *addr, size_t size);
+int mm_probe_write(void *addr, size_t size);
+
+/* Find the map entry containing the given page, starting from the entry of the last check */
+static struct map_entry *find_check_entry(size_t page)
+{
+	struct map_entry *e = mm->last_check_entry;
+	if (e && page >= e->start_page && page <= e->end_page)
+		return e;
+	struct map_entry probe;
+	probe.start_page = page;
+	struct rb_node *node = rb_upper_bound(&mm->entry_tree, &probe.tree, map_entry_cmp);
+	if (!node)
+		return NULL;
+	e = rb_entry(node, struct map_entry, tree);
+	if (page > e->end_page)
+		return NULL;
+	return e;
+}
+
+/* Check the given range against the map entries
+ * Returns 1 if the range is fully mapped with the desired protection, 0 if it is mapped without it,
+ * and -1 if the range is not (fully) managed by mm */
+static int check_map_entries(size_t start_page, size_t end_page, int prot)
+{
+	struct map_entry *e = find_check_entry(start_page);
+	if (!e)
+		return -1;
+	mm->last_check_entry = e;
+	for (;;)
+	{
+		if ((e->prot & prot) != prot)
+			return 0;
+		if (end_page <= e->end_page)
+			return 1;
+		struct rb_node *next = rb_next(&e->tree);
+		if (!next)
+			return -1;
+		struct map_entry *ne = rb_entry(next, struct map_entry, tree);
+		if (ne->start_page != e->end_page + 1)
+			return -1;
+		e = ne;
+	}
+}
+
+/* Make sure all blocks in the range are loaded so Windows APIs can access them without faulting */
+static int load_blocks(size_t start_page, size_t end_page, int write)
+{
+	size_t start_block = GET_BLOCK_OF_PAGE(start_page);
+	size_t end_block = GET_BLOCK_OF_PAGE(end_page);
+	for (size_t i = start_block; i <= end_block; i++)
+	{
+		size_t page = max(start_page, GET_FIRST_PAGE_OF_BLOCK(i));
+		if (!get_section_handle(i))
+		{
+			if (!handle_on_demand_page_fault(GET_PAGE_ADDRESS(page)))
+				return 0;
+		}
+		/* The block may still be copy-on-write, a single write fault takes ownership of the whole block */
+		else if (write && !mm_probe_write(GET_PAGE_ADDRESS(page), 1))
+			return 0;
+	}
+	return 1;
+}
+
+static int check_range(const void *addr, size_t size, int prot)
+{
+	if (size == 0)
+		return 1;
+	size_t last = (size_t)addr + size - 1;
+	if (last < (size_t)addr)
+		return 0;
+	int r = check_map_entries(GET_PAGE(addr), GET_PAGE(last), prot);
+	if (r == -1)
+		return (prot & PROT_WRITE) ? mm_probe_write((void *)addr, size) : mm_probe_read(addr, size);
+	if (r == 0)
+	{
+		log_warning("check_range(%p, %p): insufficient protection.\n", addr, size);
+		return 0;
+	}
+	return load_blocks(GET_PAGE(addr), GET_PAGE(last), prot & PROT_WRITE);
+}
+
+int mm_check_read(const void *addr, size_t size)
+{
+	return check_range(addr, size, PROT_READ);
+}
+
+int mm_check_write(void *addr, size_t size)
+{
+	return check_range(addr, size, PROT_WRITE);
+}
+
+/* Get the backing section of a block in a MAP_SHARED entry, and the offset of the block in it */
+static HANDLE get_shared_block_section(struct map_entry *e, size_t block, LARGE_INTEGER *section_offset)
+{
+	/* The entry may start in the middle of the block after a split, but the block itself is always fully mapped */
+	loff_t offset = ((loff_t)e->offset_pages - (loff_t)e->start_page + (loff_t)GET_FIRST_PAGE_OF_BLOCK(block)) * PAGE_SIZE;
+	loff_t section_offset_value;
+	HANDLE section = e->f->op_vtable->get_section(e->f, offset, &section_offset_value);
+	section_offset->QuadPart = section_offset_value;
+	return section;
+}
+
+static int map_shared_block(HANDLE process, HANDLE section, size_t block, LARGE_INTEGER *section_offset)
+{
+	PVOID base_addr = GET_BLOCK_ADDRESS(block);
+	SIZE_T view_size = BLOCK_SIZE;
+	NTSTATUS status = NtMapViewOfSection(section, process, &base_addr, 0, BLOCK_SIZE, section_offset, &view_size, ViewUnmap, 0, PAGE_EXECUTE_READWRITE);
+	if (!NT_SUCCESS(status))
+	{
+		log_error("NtMapViewOfSection() failed. Address: %p, Status: %x\n", base_addr, status);
+		return 0;
+	}
+	return 1;
+}
+
 int mm_fork(HANDLE process)
 {
 	/* Copy mm_data struct */
@@ -867,10 +1065,20 @@ int mm_fork(HANDLE process)
 			HANDLE handle = get_section_handle(i);
 			if (handle)
 			{
+				LARGE_INTEGER section_offset, *p_section_offset = NULL;
+				if (e->flags & MAP_ENTRY_SHARED)
+				{
+					if (!get_shared_block_section(e, i, &section_offset))
+					{
+						log_error("mm_fork(): Get backing section of shared block %p failed.\n", i);
+						return 0;
+					}
+					p_section_offset = &section_offset;
+				}
 				PVOID base_addr = GET_BLOCK_ADDRESS(i);
 				SIZE_T view_size = BLOCK_SIZE;
 				NTSTATUS status;
-				status = NtMapViewOfSection(handle, process, &base_addr, 0, BLOCK_SIZE, NULL, &view_size, ViewUnmap, 0, PAGE_EXECUTE_READWRITE);
+				status = NtMapViewOfSection(handle, process, &base_addr, 0, BLOCK_SIZE, p_section_offset, &view_size, ViewUnmap, 0, PAGE_EXECUTE_READWRITE);
 				if (!NT_SUCCESS(status))
 				{
 					log_error("mm_fork(): Map failed: %p, status code: %x\n", base_addr, status);
@@ -881,8 +1089,8 @@ int mm_fork(HANDLE process)
 			}
 		}
 		last_block = end_block;
-		/* Disable write permission */
-		if ((e->prot & PROT_WRITE) > 0)
+		/* Disable write permission, shared mappings are not copy-on-write */
+		if ((e->prot & PROT_WRITE) > 0 && !(e->flags & MAP_ENTRY_SHARED))
 		{
 			if (!mm_change_protection(process, e->start_page, e->end_page, e->prot & ~PROT_WRITE))
 				return 0;
@@ -902,6 +1110,87 @@ void mm_afterfork()
 	map_global_shared_section();
 }
 
+/* MAP_SHARED mapping of a file which provides its backing section object
+ * Views can only be mapped at allocation granularity, so the address and the file offset must
+ * be block aligned, and the mapping is extended to whole blocks. This way the blocks are never
+ * shared with other mappings.
+ */
+static void *mm_mmap_shared(void *addr, size_t length, int prot, int flags, int internal_flags, struct file *f, off_t offset_pages)
+{
+	if (offset_pages % PAGES_PER_BLOCK)
+	{
+		log_error("MAP_SHARED: File offset not aligned to block boundary.\n");
+		return (void*)-EINVAL;
+	}
+	length = ALIGN_TO_BLOCK(length);
+	if (flags & MAP_FIXED)
+	{
+		if (!IS_ALIGNED(addr, BLOCK_SIZE))
+		{
+			log_error("MAP_SHARED: MAP_FIXED address not aligned to block boundary.\n");
+			return (void*)-EINVAL;
+		}
+		mm_munmap(addr, length);
+	}
+	else
+	{
+		/* Find a free range large enough to contain all the blocks */
+		size_t alloc_page;
+		if (internal_flags & INTERNAL_MAP_TOPDOWN)
+			alloc_page = find_free_pages_topdown(GET_PAGE(length) + PAGES_PER_BLOCK - 1);
+		else
+			alloc_page = find_free_pages(GET_PAGE(length) + PAGES_PER_BLOCK - 1);
+		if (!alloc_page)
+		{
+			log_error("Cannot find free pages.\n");
+			return (void*)-ENOMEM;
+		}
+		addr = (void *)ALIGN_TO_BLOCK(GET_PAGE_ADDRESS(alloc_page));
+	}
+
+	struct map_entry *entry = new_map_entry();
+	entry->start_page = GET_PAGE(addr);
+	entry->end_page = GET_PAGE((size_t)addr + length - 1);
+	entry->f = f;
+	entry->offset_pages = offset_pages;
+	entry->prot = prot;
+	entry->flags = MAP_ENTRY_SHARED;
+	if (internal_flags & INTERNAL_MAP_NORESET)
+		entry->flags |= INTERNAL_MAP_NORESET;
+	vfs_ref(f);
+	rb_add(&mm->entry_tree, &entry->tree, map_entry_cmp);
+
+	size_t start_block = GET_BLOCK(addr);
+	size_t end_block = GET_BLOCK((size_t)addr + length - 1);
+	for (size_t i = start_block; i <= end_block; i++)
+	{
+		LARGE_INTEGER section_offset;
+		HANDLE section = get_shared_block_section(entry, i, &section_offset);
+		HANDLE handle;
+		if (!section || !DuplicateHandle(GetCurrentProcess(), section, GetCurrentProcess(), &handle, 0, TRUE, DUPLICATE_SAME_ACCESS))
+		{
+			log_error("MAP_SHARED: Get backing section of block %p failed.\n", i);
+			mm_munmap(addr, length);
+			return (void*)-ENOMEM;
+		}
+		if (!map_shared_block(NtCurrentProcess(), handle, i, &section_offset))
+		{
+			NtClose(handle);
+			mm_munmap(addr, length);
+			return (void*)-ENOMEM;
+		}
+		add_section_handle(i, handle);
+		if (prot != (PROT_READ | PROT_WRITE | PROT_EXEC))
+		{
+			/* Each view is a separate allocation, protection must be changed one by one */
+			DWORD oldProtect;
+			VirtualProtect(GET_BLOCK_ADDRESS(i), BLOCK_SIZE, prot_linux2win(prot), &oldProtect);
+		}
+	}
+	log_info("Allocated shared memory: [%p, %p)\n", addr, (size_t)addr + length);
+	return addr;
+}
+
 void *mm_mmap(void *addr, size_t length, int prot, int flags, int internal_flags, struct file *f, off_t offset_pages)
 {
 	if (length == 0)
@@ -911,6 +1200,8 @@ void *mm_mmap(void *addr, size_t length, int prot, int flags, int internal_flags
 		|| (size_t)addr + length < ADDRESS_SPACE_LOW || (size_t)addr + length >= ADDRESS_SPACE_HIGH
 		|| (size_t)addr + length < (size_t)addr)
 		return (void*)-EINVAL;
+	if ((flags & MAP_SHARED) && !(flags & MAP_ANONYMOUS) && f && f->op_vtable->get_section)
+		return mm_mmap_shared(addr, length, prot, flags, internal_flags, f, offset_pages);
 	if (flags & MAP_SHARED)
 	{
 		log_error("MAP_SHARED is not supported yet.\n");
@@ -948,6 +1239,14 @@ void *mm_mmap(void *addr, size_t length, int prot, int flags, int internal_flags
 		log_warning("Not aligned addr with MAP_FIXED.\n");
 		return (void*)-EINVAL;
 	}
+	if ((flags & MAP_FIXED)
+		&& ((!IS_ALIGNED(addr, BLOCK_SIZE) && is_shared_block(GET_BLOCK(addr)))
+			|| (!IS_ALIGNED((size_t)addr + length, BLOCK_SIZE) && is_shared_block(GET_BLOCK((size_t)addr + length - 1)))))
+	{
+		/* The block is a view of a file and is not entirely replaced, pages in it cannot be backed by anything else */
+		log_error("MAP_FIXED: Address range overlaps a block of a MAP_SHARED mapping.\n");
+		return (void*)-EINVAL;
+	}
 
 	size_t start_page = GET_PAGE(addr);
 	size_t end_page = GET_PAGE((size_t)addr + length - 1);
@@ -68,6 +68,8 @@ int mm_check_read_string(const char *addr);
 int mm_check_write(void *addr, size_t size);
 
 int mm_handle_page_fault(void *addr);
+/* Overwrite instructions in a private executable mapping, returns 0 on failure */
+int mm_patch_code(void *addr, const void *data, size_t size);
 int mm_fork(HANDLE process);
 void mm_afterfork();
 
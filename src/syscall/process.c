@@ -31,8 +31,10 @@
 #include <datetime.h>
 #include <log.h>
 #include <ntdll.h>
+#include <rwlock.h>
 #include <str.h>
 
+#include <intrin.h>
 #include <stdbool.h>
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
@@ -57,9 +59,18 @@ struct process
 	HANDLE sigwrite;
 };
 
+#define PROCESS_BITMAP_WORDS	(MAX_PROCESS_COUNT / 32)
 struct process_shared_data
 {
+	/* Lock for process slots */
+	struct rwlock_shared lock;
+	/* Hint for next pid allocation, not protected by the lock */
 	pid_t last_allocated_process;
+	/* Bitmap of allocated pids, manipulated with interlocked operations only
+	 * No lock is held across updates, so a process dying at any point cannot leave it inconsistent.
+	 * The pid of a killed process is released by its parent when it is reaped, like a normal exit.
+	 */
+	LONG pid_bitmap[PROCESS_BITMAP_WORDS];
 	struct process processes[MAX_PROCESS_COUNT]; /* The zero slot is never used */
 };
 
@@ -73,15 +84,12 @@ struct process_data
 	int child_count;
 	struct slist child_list, child_freelist;
 	struct child_process child[MAX_CHILD_COUNT];
-	/* Mutex for process_shared */
-	/* You have to lock this mutex on the following scenarios:
-	 * 1. When writing to shared area
-	 * 2. When reading process slots other than the current process
-	 *
-	 * TODO: It's better to have a lightweight interprocess RW lock.
-	 * Windows only provides an intraprocess one.
+	/* Lock for process_shared */
+	/* You have to lock this exclusively when writing to process slots,
+	 * and shared when reading process slots other than the current process.
+	 * Pid allocation does not need the lock, it is done on pid_bitmap atomically.
 	 */
-	HANDLE shared_mutex;
+	struct rwlock shared_lock;
 } _process;
 
 static struct process_data *const process = &_process;
@@ -94,36 +102,62 @@ static void process_init_private()
 	for (int i = 0; i < MAX_CHILD_COUNT; i++)
 		slist_add(&process->child_freelist, &process->child[i].list);
 	process_shared = (volatile struct process_shared_data *)mm_global_shared_alloc(sizeof(struct process_shared_data));
-	SECURITY_ATTRIBUTES attr;
-	attr.nLength = sizeof(SECURITY_ATTRIBUTES);
-	attr.bInheritHandle = TRUE;
-	attr.lpSecurityDescriptor = NULL;
-	process->shared_mutex = CreateMutexW(&attr, FALSE, L"flinux_process_shared_writer");
+	rwlock_init(&process->shared_lock, &process_shared->lock, L"flinux_process_shared_lock");
 }
 
 static void process_lock_shared()
 {
-	WaitForSingleObject(process->shared_mutex, INFINITE);
+	rwlock_lock_shared(&process->shared_lock);
 }
 
 static void process_unlock_shared()
 {
-	ReleaseMutex(process->shared_mutex);
+	rwlock_unlock_shared(&process->shared_lock);
+}
+
+static void process_lock_exclusive()
+{
+	rwlock_lock_exclusive(&process->shared_lock);
+}
+
+static void process_unlock_exclusive()
+{
+	rwlock_unlock_exclusive(&process->shared_lock);
 }
 
 /* Allocate a new process in the global process table, return slot id */
 static pid_t process_alloc()
 {
-	/* Note that pid starts from 1, but initial value of last_allocated_process is zero */
-	for (int i = 1; i < MAX_PROCESS_COUNT; i++)
+	/* Note that pid starts from 1, but initial value of last_allocated_process is zero
+	 * We search the bitmap starting from the pid next to the last allocated one, to avoid quickly reusing pids
+	 */
+	pid_t start = process_shared->last_allocated_process + 1;
+	if (start >= MAX_PROCESS_COUNT)
+		start = 1;
+	int start_word = start / 32;
+	/* The first word is visited twice, first for bits after start, finally for bits before start */
+	for (int i = 0; i <= PROCESS_BITMAP_WORDS; i++)
 	{
-		pid_t cur = process_shared->last_allocated_process + i;
-		if (cur >= MAX_PROCESS_COUNT)
-			cur -= MAX_PROCESS_COUNT - 1;
-		if (process_shared->processes[cur].status == PROCESS_NOTEXIST)
+		int word = (start_word + i) % PROCESS_BITMAP_WORDS;
+		unsigned long mask = 0xFFFFFFFFUL;
+		if (i == 0)
+			mask <<= start % 32;
+		else if (i == PROCESS_BITMAP_WORDS)
+			mask = ~(mask << (start % 32));
+		if (word == 0)
+			mask &= ~1UL; /* pid 0 is never used */
+		unsigned long free_bits;
+		while ((free_bits = ~(unsigned long)process_shared->pid_bitmap[word] & mask))
 		{
-			process_shared->last_allocated_process = cur;
-			return cur;
+			unsigned long bit;
+			_BitScanForward(&bit, free_bits);
+			if (!InterlockedBitTestAndSet(&process_shared->pid_bitmap[word], bit))
+			{
+				pid_t pid = word * 32 + bit;
+				process_shared->last_allocated_process = pid;
+				return pid;
+			}
+			/* Someone else took it, try the next free bit */
 		}
 	}
 	log_error("Process table full.\n");
@@ -131,13 +165,22 @@ static pid_t process_alloc()
 	return 0;
 }
 
+/* Release a process slot in the global process table */
+static void process_free(pid_t pid)
+{
+	process_lock_exclusive();
+	process_shared->processes[pid].status = PROCESS_NOTEXIST;
+	process_unlock_exclusive();
+	InterlockedBitTestAndReset(&process_shared->pid_bitmap[pid / 32], pid % 32);
+}
+
 void process_init()
 {
 	process_init_private();
 	process->stack_base = VirtualAlloc(NULL, STACK_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
 	/* Allocate global process table slot */
-	process_lock_shared();
 	pid_t pid = process_alloc();
+	process_lock_exclusive();
 	if (pid == 1)
 	{
 		/* INIT process does not exist, create it now */
@@ -148,7 +191,9 @@ void process_init()
 		process_shared->processes[1].sid = 1;
 		process_shared->processes[1].sigwrite = NULL;
 		/* Done, allocate a new pid for current process */
+		process_unlock_exclusive();
 		pid = process_alloc();
+		process_lock_exclusive();
 	}
 	process_shared->processes[pid].status = PROCESS_RUNNING;
 	process_shared->processes[pid].win_pid = GetCurrentProcessId();
@@ -156,7 +201,7 @@ void process_init()
 	process_shared->processes[pid].pgid = pid;
 	process_shared->processes[pid].sid = pid;
 	process_shared->processes[pid].sigwrite = signal_get_process_sigwrite();
-	process_unlock_shared();
+	process_unlock_exclusive();
 	process->pid = pid;
 	log_info("PID: %d\n", pid);
 }
@@ -186,15 +231,15 @@ pid_t process_add_child(DWORD win_pid, HANDLE handle)
 		__debugbreak();
 	}
 	/* Allocate a new process table entry */
-	process_lock_shared();
 	pid_t pid = process_alloc();
+	process_lock_exclusive();
 	process_shared->processes[pid].status = PROCESS_RUNNING;
 	process_shared->processes[pid].win_pid = win_pid;
 	process_shared->processes[pid].pgid = process_shared->processes[process->pid].pgid;
 	process_shared->processes[pid].ppid = process->pid;
 	process_shared->processes[pid].sid = process_shared->processes[process->pid].sid;
 	process_shared->processes[pid].sigwrite = NULL;
-	process_unlock_shared();
+	process_unlock_exclusive();
 
 	struct child_process *proc = slist_entry(slist_next(&process->child_freelist), struct child_process, list);
 	slist_remove(&process->child_freelist, &proc->list);
@@ -296,6 +341,7 @@ static pid_t process_wait(pid_t pid, int *status, int options, struct rusage *ru
 	GetExitCodeProcess(proc->hProcess, &exitCode);
 	CloseHandle(proc->hProcess);
 	pid = proc->pid;
+	process_free(pid);
 	log_info("pid: %d exit code: %d\n", pid, exitCode);
 	if (status)
 		*status = W_EXITCODE(exitCode, 0);
@@ -673,17 +719,46 @@ DEFINE_SYSCALL(prlimit64, pid_t, pid, int, resource, const struct rlimit64 *, ne
 DEFINE_SYSCALL(getcpu, unsigned int *, cpu, unsigned int *, node, void *, tcache)
 {
 	log_info("getcpu(%p, %p, %p)\n", cpu, node, tcache);
+	if (cpu && !mm_check_write(cpu, sizeof(unsigned int)))
+		return -EFAULT;
+	if (node && !mm_check_write(node, sizeof(unsigned int)))
+		return -EFAULT;
+	PROCESSOR_NUMBER number;
+	GetCurrentProcessorNumberEx(&number);
 	if (cpu)
-		*cpu = 0;
+		*cpu = number.Group * 64 + number.Number;
 	if (node)
-		*node = 0;
+	{
+		USHORT node_number;
+		if (GetNumaProcessorNodeEx(&number, &node_number))
+			*node = node_number;
+		else
+			*node = 0;
+	}
 	return 0;
 }
 
+/* Since we does not support multithreading at the time, applications are told about one cpu only,
+ * so they do not size thread pools to the number of cores (i.e. ffmpeg).
+ * This is the first cpu we are allowed to run on, so it follows sched_setaffinity().
+ * Both sched_getaffinity() and /sys/devices/system/cpu/online report it.
+ */
+int process_get_cpu()
+{
+	ULONG_PTR process_mask, system_mask;
+	int cpu = 0;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+	{
+		while (cpu < sizeof(ULONG_PTR) * 8 - 1 && !(process_mask & ((ULONG_PTR)1 << cpu)))
+			cpu++;
+	}
+	return cpu;
+}
+
 DEFINE_SYSCALL(sched_getaffinity, pid_t, pid, size_t, cpusetsize, uint8_t *, mask)
 {
 	log_info("sched_getaffinity(%d, %d, %p)\n", pid, cpusetsize, mask);
-	if (pid != 0)
+	if (pid != 0 && pid != process->pid)
 	{
 		log_error("pid != 0.\n");
 		return -ESRCH;
@@ -693,23 +768,41 @@ DEFINE_SYSCALL(sched_getaffinity, pid_t, pid, size_t, cpusetsize, uint8_t *, mas
 		return -EFAULT;
 	for (int i = 0; i < bytes; i++)
 		mask[i] = 0;
-	/* TODO: Applications (i.e. ffmpeg) use this to detect the number of cpus and enable multithreading
-	 * on cpu with multiple cores.
-	 * Since we does not support multithreading at the time, we just report back one bit to let them
-	 * think we only have one core and give up multithreading.
-	 */
-	mask[0] = 1;
-#if 0
-	GROUP_AFFINITY affinity;
-	GetThreadGroupAffinity(GetCurrentThread(), &affinity);
-	int size = min(sizeof(uintptr_t), cpusetsize) * 8;
-	for (int i = 0; i < size; i++)
-		if (affinity.Mask & (1 << i))
-			mask[i / 8] |= 1 << i;
-#endif
+	/* TODO: Report the real mask once multithreading is supported */
+	int cpu = process_get_cpu();
+	if (cpu / 8 < bytes)
+		mask[cpu / 8] = 1 << (cpu % 8);
 	return sizeof(uintptr_t);
 }
 
+DEFINE_SYSCALL(sched_setaffinity, pid_t, pid, size_t, cpusetsize, const uint8_t *, mask)
+{
+	log_info("sched_setaffinity(%d, %d, %p)\n", pid, cpusetsize, mask);
+	if (pid != 0 && pid != process->pid)
+	{
+		log_error("Setting affinity of other processes is not supported.\n");
+		return -ESRCH;
+	}
+	if (!mm_check_read(mask, cpusetsize))
+		return -EFAULT;
+	/* Only processor group 0 is supported */
+	ULONG_PTR affinity = 0;
+	for (size_t i = 0; i < min(cpusetsize, sizeof(ULONG_PTR)); i++)
+		affinity |= (ULONG_PTR)mask[i] << (i * 8);
+	ULONG_PTR process_mask, system_mask;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+		return -EINVAL;
+	affinity &= system_mask;
+	if (!affinity)
+		return -EINVAL;
+	if (!SetProcessAffinityMask(GetCurrentProcess(), affinity))
+	{
+		log_warning("SetProcessAffinityMask() failed, error code: %d\n", GetLastError());
+		return -EINVAL;
+	}
+	return 0;
+}
+
 DEFINE_SYSCALL(set_tid_address, int *, tidptr)
 {
 	log_info("set_tid_address(tidptr=%p)\n", tidptr);
@@ -48,3 +48,4 @@ pid_t process_get_pid();
 pid_t process_get_ppid();
 pid_t process_get_pgid(pid_t pid);
 pid_t process_get_sid();
+int process_get_cpu();
@@ -21,6 +21,7 @@
 #include <common/sigcontext.h>
 #include <common/sigframe.h>
 #include <common/signal.h>
+#include <dbt/cpuid.h>
 #include <syscall/mm.h>
 #include <syscall/process.h>
 #include <syscall/sig.h>
@@ -234,6 +235,17 @@ static DWORD WINAPI signal_thread(LPVOID parameter)
 
 void fpu_fxsave(void *save_area);
 void fpu_fxrstor(void *save_area);
+void fpu_xsave(void *save_area, uint32_t mask_low, uint32_t mask_high);
+void fpu_xrstor(void *save_area, uint32_t mask_low, uint32_t mask_high);
+
+/* State components saved in signal frames with XSAVE, 0 if only FXSAVE state is needed */
+static uint64_t fpu_xstate_mask;
+static uint32_t fpu_xstate_size;
+
+/* Size of the legacy FXSAVE region, the XSAVE header follows it */
+#define FXSAVE_SIZE		512
+#define XSAVE_HDR_SIZE	64
+
 void signal_restorer();
 static void signal_save_sigcontext(struct sigcontext *sc, struct syscall_context *context, void *fpstate, uint32_t mask)
 {
@@ -267,12 +279,22 @@ void signal_setup_handler(struct syscall_context *context)
 	int sig = signal->current_siginfo.si_signo;
 	uintptr_t sp = context->esp;
 	/* TODO: Make fpstate layout the same as in Linux kernel */
-	/* Allocate fpstate space */
-	sp -= sizeof(struct fpstate);
+	/* Allocate fpstate space, the guest may use AVX state when CPUID reports it */
+	if (fpu_xstate_mask)
+		sp -= fpu_xstate_size;
+	else
+		sp -= sizeof(struct fpstate);
 	/* Align fpstate to 512 byte boundary */
 	sp = sp & -512UL;
 	void *fpstate = (void*)sp;
-	fpu_fxsave(fpstate);
+	if (fpu_xstate_mask)
+	{
+		/* XSAVE only writes XSTATE_BV of the header, XRSTOR faults on garbage in the rest */
+		memset((char *)fpstate + FXSAVE_SIZE, 0, XSAVE_HDR_SIZE);
+		fpu_xsave(fpstate, (uint32_t)fpu_xstate_mask, (uint32_t)(fpu_xstate_mask >> 32));
+	}
+	else
+		fpu_fxsave(fpstate);
 
 	/* Allocate sigcontext space */
 	sp -= sizeof(struct rt_sigframe);
@@ -363,7 +385,10 @@ DEFINE_SYSCALL(rt_sigreturn, uintptr_t, bx, uintptr_t, cx, uintptr_t, dx, uintpt
 		return -EFAULT;
 	}
 	/* TODO: Check validity of fpstate */
-	fpu_fxrstor(frame->uc.uc_mcontext.fpstate);
+	if (fpu_xstate_mask)
+		fpu_xrstor(frame->uc.uc_mcontext.fpstate, (uint32_t)fpu_xstate_mask, (uint32_t)(fpu_xstate_mask >> 32));
+	else
+		fpu_fxrstor(frame->uc.uc_mcontext.fpstate);
 	EnterCriticalSection(&signal->mutex);
 	signal->mask = frame->uc.uc_sigmask;
 	send_pending_signal();
@@ -375,6 +400,7 @@ DEFINE_SYSCALL(rt_sigreturn, uintptr_t, bx, uintptr_t, cx, uintptr_t, dx, uintpt
 static void signal_init_private()
 {
 	/* Initialize private structures and handles */
+	dbt_get_xstate(&fpu_xstate_mask, &fpu_xstate_size);
 	sigemptyset(&signal->pending);
 	if (!create_pipe(&signal->sigread, &signal->sigwrite))
 	{
@@ -451,6 +477,19 @@ int signal_kill(pid_t pid, siginfo_t *info)
 	}
 }
 
+/* Raise a fault signal for the faulting instruction of the current thread.
+ * The instruction can not be restarted, so like a blocked or ignored fault
+ * signal on Linux, the default action is taken.
+ */
+void signal_fault(siginfo_t *info)
+{
+	log_error("Fault signal %d at address 0x%p.\n", info->si_signo, info->_sifields._sigfault._addr);
+	void (*handler)(int) = signal->actions[info->si_signo].sa_handler;
+	if (handler != SIG_DFL && handler != SIG_IGN)
+		log_warning("Fault signal handlers are not supported, taking the default action.\n");
+	signal_default_handler(info);
+}
+
 DWORD signal_wait(int count, HANDLE *handles, DWORD milliseconds)
 {
 	HANDLE h[MAXIMUM_WAIT_OBJECTS];
@@ -36,6 +36,7 @@ void signal_init();
 void signal_afterfork();
 void signal_shutdown();
 int signal_kill(pid_t pid, siginfo_t *siginfo);
+void signal_fault(siginfo_t *siginfo);
 DWORD signal_wait(int count, HANDLE *handles, DWORD milliseconds);
 
 #define WAIT_INTERRUPTED	0x80000000
@@ -20,13 +20,13 @@
 .model flat, C
 .code
 
-PUBLIC mm_check_read_begin, mm_check_read_end, mm_check_read_fail
-mm_check_read PROC check_addr, check_size
+PUBLIC mm_probe_read_begin, mm_probe_read_end, mm_probe_read_fail
+mm_probe_read PROC check_addr, check_size
 	mov edx, check_addr
 	mov ecx, check_size
 	jecxz SUCC
 
-mm_check_read_begin LABEL PTR
+mm_probe_read_begin LABEL PTR
 	mov al, byte ptr [edx]
 	; test first page which may be unaligned
 	
@@ -45,17 +45,17 @@ L:
 	add edx, 01000h
 	mov al, byte ptr [edx]
 	loop L
-mm_check_read_end LABEL PTR
+mm_probe_read_end LABEL PTR
 
 SUCC:
 	xor eax, eax
 	inc eax
 	ret
 
-mm_check_read_fail LABEL PTR
+mm_probe_read_fail LABEL PTR
 	xor eax, eax
 	ret
-mm_check_read ENDP
+mm_probe_read ENDP
 
 PUBLIC mm_check_read_string_begin, mm_check_read_string_end, mm_check_read_string_fail
 mm_check_read_string PROC check_addr
@@ -79,13 +79,13 @@ mm_check_read_string_fail LABEL PTR
 	ret
 mm_check_read_string ENDP
 
-PUBLIC mm_check_write_begin, mm_check_write_end, mm_check_write_fail
-mm_check_write PROC check_addr, check_size
+PUBLIC mm_probe_write_begin, mm_probe_write_end, mm_probe_write_fail
+mm_probe_write PROC check_addr, check_size
 	mov edx, check_addr
 	mov ecx, check_size
 	jecxz SUCC
 	
-mm_check_write_begin LABEL PTR
+mm_probe_write_begin LABEL PTR
 	mov al, byte ptr [edx]
 	mov byte ptr [edx], al
 	; test first page which may be unaligned
@@ -106,17 +106,17 @@ L:
 	mov al, byte ptr [edx]
 	mov byte ptr [edx], al
 	loop L
-mm_check_write_end LABEL PTR
+mm_probe_write_end LABEL PTR
 
 SUCC:
 	xor eax, eax
 	inc eax
 	ret
 
-mm_check_write_fail LABEL PTR
+mm_probe_write_fail LABEL PTR
 	xor eax, eax
 	ret
-mm_check_write ENDP
+mm_probe_write ENDP
 
 fpu_fxsave PROC save_area
 	mov eax, save_area
@@ -130,6 +130,22 @@ fpu_fxrstor PROC save_area
 	ret
 fpu_fxrstor ENDP
 
+fpu_xsave PROC save_area, mask_low, mask_high
+	mov ecx, save_area
+	mov eax, mask_low
+	mov edx, mask_high
+	xsave [ecx]
+	ret
+fpu_xsave ENDP
+
+fpu_xrstor PROC save_area, mask_low, mask_high
+	mov ecx, save_area
+	mov eax, mask_low
+	mov edx, mask_high
+	xrstor [ecx]
+	ret
+fpu_xrstor ENDP
+
 OPTION PROLOGUE: NONE
 OPTION EPILOGUE: NONE
 ; this function will be translated by dbt before run
@@ -140,14 +140,14 @@ restore_context PROC ; ctx: QWORD
 
 restore_context ENDP
 
-PUBLIC mm_check_read_begin, mm_check_read_end, mm_check_read_fail
-mm_check_read PROC ; check_addr: QWORD, check_size: QWORD
+PUBLIC mm_probe_read_begin, mm_probe_read_end, mm_probe_read_fail
+mm_probe_read PROC ; check_addr: QWORD, check_size: QWORD
 	xchg rcx, rdx
 	; rcx = check_size
 	; rdx = check_addr
 	jrcxz SUCC
 
-mm_check_read_begin LABEL PTR
+mm_probe_read_begin LABEL PTR
 	mov al, byte ptr [rdx]
 	; test first page which may be unaligned
 	
@@ -166,17 +166,17 @@ L:
 	add rdx, 01000h
 	mov al, byte ptr [rdx]
 	loop L
-mm_check_read_end LABEL PTR
+mm_probe_read_end LABEL PTR
 
 SUCC:
 	xor rax, rax
 	inc eax
 	ret
 
-mm_check_read_fail LABEL PTR
+mm_probe_read_fail LABEL PTR
 	xor rax, rax
 	ret
-mm_check_read ENDP
+mm_probe_read ENDP
 
 PUBLIC mm_check_read_string_begin, mm_check_read_string_end, mm_check_read_string_fail
 mm_check_read_string PROC ; check_addr: QWORD
@@ -200,14 +200,14 @@ mm_check_read_string_fail LABEL PTR
 	ret
 mm_check_read_string ENDP
 
-PUBLIC mm_check_write_begin, mm_check_write_end, mm_check_write_fail
-mm_check_write PROC ; check_addr: QWORD, check_size: QWORD
+PUBLIC mm_probe_write_begin, mm_probe_write_end, mm_probe_write_fail
+mm_probe_write PROC ; check_addr: QWORD, check_size: QWORD
 	xchg rcx, rdx
 	; rcx = check_size
 	; rdx = check_addr
 	jrcxz SUCC
 	
-mm_check_write_begin LABEL PTR
+mm_probe_write_begin LABEL PTR
 	mov al, byte ptr [rdx]
 	mov byte ptr [rdx], al
 	; test first page which may be unaligned
@@ -228,16 +228,16 @@ L:
 	mov al, byte ptr [rdx]
 	mov byte ptr [rdx], al
 	loop L
-mm_check_write_end LABEL PTR
+mm_probe_write_end LABEL PTR
 
 SUCC:
 	xor rax, rax
 	inc eax
 	ret
 
-mm_check_write_fail LABEL PTR
+mm_probe_write_fail LABEL PTR
 	xor rax, rax
 	ret
-mm_check_write ENDP
+mm_probe_write ENDP
 
 END
@@ -18,6 +18,7 @@
  */
 
 #include <syscall/mm.h>
+#include <syscall/sig.h>
 #include <syscall/syscall.h>
 #include <syscall/syscall_dispatch.h>
 #include <syscall/tls.h>
@@ -28,9 +29,9 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
-extern void *mm_check_read_begin, *mm_check_read_end, *mm_check_read_fail;
+extern void *mm_probe_read_begin, *mm_probe_read_end, *mm_probe_read_fail;
 extern void *mm_check_read_string_begin, *mm_check_read_string_end, *mm_check_read_string_fail;
-extern void *mm_check_write_begin, *mm_check_write_end, *mm_check_write_fail;
+extern void *mm_probe_write_begin, *mm_probe_write_end, *mm_probe_write_fail;
 
 extern int sys_gettimeofday(struct timeval *tv, struct timezone *tz);
 extern intptr_t sys_time(intptr_t *t);
@@ -84,15 +85,37 @@ static LONG CALLBACK exception_handler(PEXCEPTION_POINTERS ep)
 				dispatch_syscall(ep->ContextRecord);
 				return EXCEPTION_CONTINUE_EXECUTION;
 			}
-			else
+			int r = tls_emulate_fs_access(ep->ContextRecord);
+			if (r > 0)
+				return EXCEPTION_CONTINUE_EXECUTION;
+			else if (r < 0)
+			{
+				siginfo_t info;
+				info.si_signo = SIGSEGV;
+				info.si_code = SEGV_MAPERR;
+				info.si_errno = 0;
+				info._sifields._sigfault._addr = (void *)ep->ContextRecord->Xip;
+				signal_fault(&info);
+			}
+#else
+			if (dbt_is_invalid_gs_load(ep->ContextRecord))
+			{
+				/* Like a general protection fault on Linux, no address is reported */
+				siginfo_t info;
+				info.si_signo = SIGSEGV;
+				info.si_code = SI_KERNEL;
+				info.si_errno = 0;
+				info._sifields._sigfault._addr = NULL;
+				signal_fault(&info);
+			}
 #endif
-			if (mm_handle_page_fault((void *)ep->ExceptionRecord->ExceptionInformation[1]))
+			else if (mm_handle_page_fault((void *)ep->ExceptionRecord->ExceptionInformation[1]))
 				return EXCEPTION_CONTINUE_EXECUTION;
 			void *ip = (void *)ep->ContextRecord->Xip;
-			if (ip >= &mm_check_read_begin && ip <= &mm_check_read_end)
+			if (ip >= &mm_probe_read_begin && ip <= &mm_probe_read_end)
 			{
-				ep->ContextRecord->Xip = (XWORD)&mm_check_read_fail;
-				log_warning("mm_check_read() failed at location 0x%x\n", ep->ExceptionRecord->ExceptionInformation[1]);
+				ep->ContextRecord->Xip = (XWORD)&mm_probe_read_fail;
+				log_warning("mm_probe_read() failed at location 0x%x\n", ep->ExceptionRecord->ExceptionInformation[1]);
 				return EXCEPTION_CONTINUE_EXECUTION;
 			}
 			if (ip >= &mm_check_read_string_begin && ip <= &mm_check_read_string_end)
@@ -101,10 +124,10 @@ static LONG CALLBACK exception_handler(PEXCEPTION_POINTERS ep)
 				log_warning("mm_check_read_string() failed at location 0x%x\n", ep->ExceptionRecord->ExceptionInformation[1]);
 				return EXCEPTION_CONTINUE_EXECUTION;
 			}
-			if (ip >= &mm_check_write_begin && ip <= &mm_check_write_end)
+			if (ip >= &mm_probe_write_begin && ip <= &mm_probe_write_end)
 			{
-				ep->ContextRecord->Xip = (XWORD)&mm_check_write_fail;
-				log_warning("mm_check_write() failed at location 0x%x\n", ep->ExceptionRecord->ExceptionInformation[1]);
+				ep->ContextRecord->Xip = (XWORD)&mm_probe_write_fail;
+				log_warning("mm_probe_write() failed at location 0x%x\n", ep->ExceptionRecord->ExceptionInformation[1]);
 				return EXCEPTION_CONTINUE_EXECUTION;
 			}
 		}
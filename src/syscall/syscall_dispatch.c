@@ -27,7 +27,7 @@
 
 typedef int64_t syscall_fn(int64_t rdi, int64_t rsi, int64_t rdx, int64_t r10, intptr_t r8, intptr_t r9, PCONTEXT context);
 
-#define SYSCALL_COUNT 323
+#define SYSCALL_COUNT 428
 #define SYSCALL(name) extern int64_t sys_##name(int64_t rdi, int64_t rsi, int64_t rdx, int64_t r10, intptr_t r8, intptr_t r9, PCONTEXT context);
 SYSCALL(read) /* syscall 0 */
 #include "syscall_table_x64.h"
@@ -45,7 +45,7 @@ static syscall_fn* syscall_table[SYSCALL_COUNT] =
 
 typedef int syscall_fn(int ebx, int ecx, int edx, int esi, int edi, int ebp, PCONTEXT context);
 
-#define SYSCALL_COUNT 359
+#define SYSCALL_COUNT 428
 #define SYSCALL(name) extern int sys_##name(int ebx, int ecx, int edx, int esi, int edi, int ebp, PCONTEXT context);
 #include "syscall_table_x86.h"
 #undef SYSCALL
@@ -40,14 +40,14 @@ SYSCALL(getpid)
 SYSCALL(unimplemented)
 SYSCALL(socket)
 SYSCALL(connect)
-SYSCALL(unimplemented)
+SYSCALL(accept)
 SYSCALL(sendto)
 SYSCALL(recvfrom)
 SYSCALL(sendmsg)
 SYSCALL(recvmsg)
 SYSCALL(shutdown)
-SYSCALL(unimplemented)
-SYSCALL(unimplemented)
+SYSCALL(bind)
+SYSCALL(listen)
 SYSCALL(getsockname)
 SYSCALL(getpeername)
 SYSCALL(unimplemented)
@@ -162,8 +162,8 @@ SYSCALL(chroot)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
-SYSCALL(unimplemented)
-SYSCALL(unimplemented)
+SYSCALL(mount)
+SYSCALL(umount2)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
@@ -200,7 +200,7 @@ SYSCALL(fremovexattr)
 SYSCALL(unimplemented)
 SYSCALL(time)
 SYSCALL(futex)
-SYSCALL(unimplemented)
+SYSCALL(sched_setaffinity)
 SYSCALL(sched_getaffinity)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
@@ -250,9 +250,9 @@ SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
-SYSCALL(unimplemented)
-SYSCALL(unimplemented)
-SYSCALL(unimplemented)
+SYSCALL(inotify_init)
+SYSCALL(inotify_add_watch)
+SYSCALL(inotify_rm_watch)
 SYSCALL(unimplemented)
 SYSCALL(openat)
 SYSCALL(mkdirat)
@@ -285,13 +285,13 @@ SYSCALL(unimplemented)
 SYSCALL(fallocate)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
-SYSCALL(unimplemented)
+SYSCALL(accept4)
 SYSCALL(unimplemented)
 SYSCALL(eventfd2)
 SYSCALL(unimplemented)
 SYSCALL(dup3)
 SYSCALL(pipe2)
-SYSCALL(unimplemented)
+SYSCALL(inotify_init1)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
@@ -320,3 +320,108 @@ SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(io_uring_setup)
+SYSCALL(io_uring_enter)
+SYSCALL(io_uring_register)
@@ -18,8 +18,8 @@ SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(lseek)
 SYSCALL(getpid)
-SYSCALL(unimplemented)
-SYSCALL(unimplemented)
+SYSCALL(mount)
+SYSCALL(umount)
 SYSCALL(unimplemented)
 SYSCALL(getuid)
 SYSCALL(unimplemented)
@@ -49,7 +49,7 @@ SYSCALL(unimplemented)
 SYSCALL(geteuid)
 SYSCALL(getegid)
 SYSCALL(unimplemented)
-SYSCALL(unimplemented)
+SYSCALL(umount2)
 SYSCALL(unimplemented)
 SYSCALL(ioctl)
 SYSCALL(fcntl)
@@ -238,7 +238,7 @@ SYSCALL(fremovexattr)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(futex)
-SYSCALL(unimplemented)
+SYSCALL(sched_setaffinity)
 SYSCALL(sched_getaffinity)
 SYSCALL(set_thread_area)
 SYSCALL(unimplemented)
@@ -288,9 +288,9 @@ SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
-SYSCALL(unimplemented)
-SYSCALL(unimplemented)
-SYSCALL(unimplemented)
+SYSCALL(inotify_init)
+SYSCALL(inotify_add_watch)
+SYSCALL(inotify_rm_watch)
 SYSCALL(unimplemented)
 SYSCALL(openat)
 SYSCALL(mkdirat)
@@ -329,7 +329,7 @@ SYSCALL(eventfd2)
 SYSCALL(unimplemented)
 SYSCALL(dup3)
 SYSCALL(pipe2)
-SYSCALL(unimplemented)
+SYSCALL(inotify_init1)
 SYSCALL(preadv)
 SYSCALL(pwritev)
 SYSCALL(unimplemented)
@@ -356,3 +356,72 @@ SYSCALL(getrandom)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
 SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(unimplemented)
+SYSCALL(io_uring_setup)
+SYSCALL(io_uring_enter)
+SYSCALL(io_uring_register)
@@ -117,7 +117,26 @@
  * base address for the FS segment register.
  */
 
-#define MAX_TLS_ENTRIES		0x10
+
+#ifdef _WIN64
+/* Patched fs loads jump to stubs in blocks allocated near the code. Each
+ * block begins with the gs offset of the Win32 TLS slot holding the fs base.
+ */
+#define MAX_FS_STUB_BLOCKS	16
+#define FS_STUB_SIZE		32
+/* Blocks tried in each direction from the patched code */
+#define FS_STUB_SEARCH_BLOCKS	1024
+/* Maximum distance between a block and the code using it, keeps all rel32 in range */
+#define FS_STUB_MAX_DISTANCE	0x7F000000LL
+
+struct fs_stub_block
+{
+	uint8_t *base;
+	size_t used;
+};
+
+static void tls_write_stub_slot_offset(struct fs_stub_block *block);
+#endif
 
 struct tls_data
 {
@@ -126,13 +145,37 @@ struct tls_data
 	int entry_count;
 	DWORD kernel_entries[TLS_KERNEL_ENTRY_COUNT];
 	XWORD current_kernel_values[TLS_KERNEL_ENTRY_COUNT];
+	/* fs offset of the Win32 TLS slot of each selector value, used by dbt when translating mov to gs */
+	uint16_t *selector_offsets;
+#ifdef _WIN64
+	struct fs_stub_block fs_stub_blocks[MAX_FS_STUB_BLOCKS];
+	int fs_stub_block_count;
+#endif
 };
 
 static struct tls_data *tls;
 
+static int tls_slot_to_offset(int slot);
+
+/* The table is not inherited by fork, slot numbers differ in the child anyway */
+static void tls_alloc_selector_offsets()
+{
+	tls->selector_offsets = (uint16_t *)VirtualAlloc(NULL, 65536 * sizeof(uint16_t), MEM_RESERVE | MEM_COMMIT | MEM_TOP_DOWN, PAGE_READWRITE);
+	if (!tls->selector_offsets)
+	{
+		log_error("VirtualAlloc() for TLS selector table failed.\n");
+		ExitProcess(1);
+	}
+	for (int i = 0; i < MAX_TLS_SELECTORS; i++)
+		tls->selector_offsets[i] = 0;
+	for (int i = MAX_TLS_SELECTORS; i < 65536; i++)
+		tls->selector_offsets[i] = TLS_INVALID_SELECTOR_OFFSET;
+}
+
 void tls_init()
 {
 	tls = mm_static_alloc(sizeof(struct tls_data));
+	tls_alloc_selector_offsets();
 	for (int i = 0; i < TLS_KERNEL_ENTRY_COUNT; i++)
 	{
 		tls->kernel_entries[i] = TlsAlloc();
@@ -140,11 +183,24 @@ void tls_init()
 	}
 }
 
+static void tls_update_selector_offsets(int entry)
+{
+	int offset = tls_slot_to_offset(tls->entries[entry]);
+	for (int i = 0; i < 8; i++)
+		tls->selector_offsets[(entry << 3) + i] = (uint16_t)offset;
+}
+
 void tls_reset()
 {
 	for (int i = 0; i < tls->entry_count; i++)
 		TlsFree(tls->entries[i]);
 	tls->entry_count = 0;
+	for (int i = 0; i < MAX_TLS_SELECTORS; i++)
+		tls->selector_offsets[i] = 0;
+#ifdef _WIN64
+	/* Stub blocks are ordinary mappings and are gone after mm_reset() */
+	tls->fs_stub_block_count = 0;
+#endif
 }
 
 void tls_shutdown()
@@ -175,10 +231,12 @@ void tls_afterfork()
 {
 	log_info("Restoring TLS context...\n");
 	tls = mm_static_alloc(sizeof(struct tls_data));
+	tls_alloc_selector_offsets();
 	for (int i = 0; i < tls->entry_count; i++)
 	{
 		tls->entries[i] = TlsAlloc();
 		TlsSetValue(tls->entries[i], (LPVOID)tls->current_values[i]);
+		tls_update_selector_offsets(i);
 		log_info("user entry %d value 0x%p\n", tls->entries[i], tls->current_values[i]);
 	}
 	for (int i = 0; i < TLS_KERNEL_ENTRY_COUNT; i++)
@@ -187,6 +245,11 @@ void tls_afterfork()
 		TlsSetValue(tls->kernel_entries[i], (LPVOID)tls->current_kernel_values[i]);
 		log_info("kernel entry %d value 0x%p\n", tls->kernel_entries[i], tls->current_kernel_values[i]);
 	}
+#ifdef _WIN64
+	/* The fs base slot may differ in the child, stubs inherited from the parent must use the new one */
+	for (int i = 0; i < tls->fs_stub_block_count; i++)
+		tls_write_stub_slot_offset(&tls->fs_stub_blocks[i]);
+#endif
 }
 
 static int tls_slot_to_offset(int slot)
@@ -215,6 +278,11 @@ int tls_user_entry_to_offset(int entry)
 	return tls_slot_to_offset(tls->entries[entry]);
 }
 
+const uint16_t *tls_get_selector_offset_table()
+{
+	return tls->selector_offsets;
+}
+
 /* Segment register format:
 * 15    3  2   0
 * [Index|TI|RPL]
@@ -233,6 +301,7 @@ DEFINE_SYSCALL(set_thread_area, struct user_desc *, u_info)
 		tls->entries[tls->entry_count] = slot;
 		u_info->entry_number = tls->entry_count;
 		log_info("allocated entry %d (slot %d), fs offset 0x%x\n", tls->entry_count, slot, tls_slot_to_offset(u_info->entry_number));
+		tls_update_selector_offsets(tls->entry_count);
 		tls->entry_count++;
 		TlsSetValue(slot, (LPVOID)u_info->base_addr);
 	}
@@ -241,29 +310,521 @@ DEFINE_SYSCALL(set_thread_area, struct user_desc *, u_info)
 	return 0;
 }
 
+#ifdef _WIN64
+/* x86_64 fs emulation
+ * Linux x86_64 TLS uses the fs base address set by arch_prctl(). Windows x64
+ * leaves the fs base at zero, so guest accesses like mov rax, fs:[0x28] fault
+ * on a near-null address. We keep the per-thread fs base in a kernel TLS entry
+ * and emulate the faulting instruction with it. Integer moves, movzx/movsx,
+ * the ALU group, test and inc/dec are supported; other fs relative instructions
+ * and invalid addresses raise SIGSEGV.
+ * Emulation costs an exception per access. The common loads like
+ * mov rax, fs:[0x28] are instead patched on the first fault to jump to a
+ * generated stub which reads the fs base from the TLS slot, so they only fault
+ * once. Emulation remains the fallback for anything which cannot be patched.
+ */
+
+static __forceinline DWORD64 *context_register(PCONTEXT context, int r)
+{
+	return &context->Rax + r;
+}
+
+static __forceinline uint64_t truncate_value(uint64_t value, int size)
+{
+	return size == 8 ? value : value & ((1ULL << (size * 8)) - 1);
+}
+
+static __forceinline uint64_t sign_extend(uint64_t value, int size)
+{
+	if (size == 1)
+		return (int64_t)(int8_t)value;
+	else if (size == 2)
+		return (int64_t)(int16_t)value;
+	else if (size == 4)
+		return (int64_t)(int32_t)value;
+	return value;
+}
+
+/* Byte registers 4-7 are AH, CH, DH, BH without a REX prefix, and SPL, BPL, SIL, DIL with one */
+static uint8_t *byte_register(PCONTEXT context, int r, int rex)
+{
+	if (!rex && r >= 4 && r < 8)
+		return (uint8_t *)context_register(context, r - 4) + 1;
+	return (uint8_t *)context_register(context, r);
+}
+
+static uint64_t get_register_value(PCONTEXT context, int r, int size, int rex)
+{
+	if (size == 1)
+		return *byte_register(context, r, rex);
+	return truncate_value(*context_register(context, r), size);
+}
+
+static void set_register_value(PCONTEXT context, int r, uint64_t value, int size, int rex)
+{
+	DWORD64 *reg = context_register(context, r);
+	if (size == 8)
+		*reg = value;
+	else if (size == 4) /* Zero extended */
+		*reg = (uint32_t)value;
+	else if (size == 2)
+		*reg = (*reg & ~0xFFFFULL) | (uint16_t)value;
+	else
+		*byte_register(context, r, rex) = (uint8_t)value;
+}
+
+static uint64_t load_value(void *p, int size)
+{
+	if (size == 8)
+		return *(uint64_t *)p;
+	else if (size == 4)
+		return *(uint32_t *)p;
+	else if (size == 2)
+		return *(uint16_t *)p;
+	else
+		return *(uint8_t *)p;
+}
+
+static void store_value(void *p, uint64_t value, int size)
+{
+	if (size == 8)
+		*(uint64_t *)p = value;
+	else if (size == 4)
+		*(uint32_t *)p = (uint32_t)value;
+	else if (size == 2)
+		*(uint16_t *)p = (uint16_t)value;
+	else
+		*(uint8_t *)p = (uint8_t)value;
+}
+
+/* Read an immediate of the given size, sign extended to 64 bits */
+static uint64_t parse_immediate(uint8_t **code, int size)
+{
+	uint64_t value;
+	if (size == 1)
+		value = (int64_t)*(int8_t *)*code;
+	else if (size == 2)
+		value = (int64_t)*(int16_t *)*code;
+	else
+		value = (int64_t)*(int32_t *)*code;
+	*code += size;
+	return value;
+}
+
+#define FLAG_CF		0x0001
+#define FLAG_PF		0x0004
+#define FLAG_AF		0x0010
+#define FLAG_ZF		0x0040
+#define FLAG_SF		0x0080
+#define FLAG_OF		0x0800
+
+/* Kind of result flags */
+#define RESULT_LOGIC	0
+#define RESULT_ADD		1
+#define RESULT_SUB		2
+
+/* Set flags of r = a op b, carry is the carry (borrow) into the operation by adc and sbb */
+static void set_result_flags(PCONTEXT context, uint64_t a, uint64_t b, uint64_t r, int size, int kind, int carry)
+{
+	uint64_t sign = 1ULL << (size * 8 - 1);
+	DWORD flags = context->EFlags & ~(FLAG_CF | FLAG_PF | FLAG_AF | FLAG_ZF | FLAG_SF | FLAG_OF);
+	r = truncate_value(r, size);
+	if (r == 0)
+		flags |= FLAG_ZF;
+	if (r & sign)
+		flags |= FLAG_SF;
+	uint8_t parity = (uint8_t)r;
+	parity ^= parity >> 4;
+	parity ^= parity >> 2;
+	parity ^= parity >> 1;
+	if (!(parity & 1))
+		flags |= FLAG_PF;
+	if (kind == RESULT_ADD)
+	{
+		if (r < a || (carry && r == a))
+			flags |= FLAG_CF;
+		if (~(a ^ b) & (a ^ r) & sign)
+			flags |= FLAG_OF;
+	}
+	else if (kind == RESULT_SUB)
+	{
+		if (a < b || (carry && a == b))
+			flags |= FLAG_CF;
+		if ((a ^ b) & (a ^ r) & sign)
+			flags |= FLAG_OF;
+	}
+	if (kind != RESULT_LOGIC && ((a ^ b ^ r) & 0x10))
+		flags |= FLAG_AF;
+	context->EFlags = flags;
+}
+
+/* Arithmetic operations, in the order of the reg field of group 1 instructions (80, 81, 83) */
+#define ALU_ADD		0
+#define ALU_OR		1
+#define ALU_ADC		2
+#define ALU_SBB		3
+#define ALU_AND		4
+#define ALU_SUB		5
+#define ALU_XOR		6
+#define ALU_CMP		7
+
+/* Compute a op b and set the flags, a and b are truncated to size */
+static uint64_t alu(PCONTEXT context, int op, uint64_t a, uint64_t b, int size)
+{
+	int carry = (context->EFlags & FLAG_CF) != 0;
+	uint64_t r;
+	switch (op)
+	{
+	case ALU_ADD: r = a + b; set_result_flags(context, a, b, r, size, RESULT_ADD, 0); break;
+	case ALU_ADC: r = a + b + carry; set_result_flags(context, a, b, r, size, RESULT_ADD, carry); break;
+	case ALU_SUB:
+	case ALU_CMP: r = a - b; set_result_flags(context, a, b, r, size, RESULT_SUB, 0); break;
+	case ALU_SBB: r = a - b - carry; set_result_flags(context, a, b, r, size, RESULT_SUB, carry); break;
+	case ALU_OR: r = a | b; set_result_flags(context, a, b, r, size, RESULT_LOGIC, 0); break;
+	case ALU_AND: r = a & b; set_result_flags(context, a, b, r, size, RESULT_LOGIC, 0); break;
+	default: /* ALU_XOR */ r = a ^ b; set_result_flags(context, a, b, r, size, RESULT_LOGIC, 0); break;
+	}
+	return truncate_value(r, size);
+}
+
+/* Returns 1 if the instruction is emulated, 0 if it is not an fs relative access,
+ * -1 if it is an fs relative access which can not be carried out */
+static void tls_write_stub_slot_offset(struct fs_stub_block *block)
+{
+	uint64_t offset = tls_slot_to_offset(tls->kernel_entries[TLS_ENTRY_FS_BASE]);
+	if (!mm_patch_code(block->base, &offset, sizeof(offset)))
+		log_error("Updating fs stub block %p failed.\n", block->base);
+}
+
+static struct fs_stub_block *tls_get_stub_block(uint8_t *site)
+{
+	for (int i = 0; i < tls->fs_stub_block_count; i++)
+	{
+		struct fs_stub_block *block = &tls->fs_stub_blocks[i];
+		if (block->base - site < FS_STUB_MAX_DISTANCE && site - block->base < FS_STUB_MAX_DISTANCE
+			&& block->used + FS_STUB_SIZE <= BLOCK_SIZE)
+			return block;
+	}
+	if (tls->fs_stub_block_count == MAX_FS_STUB_BLOCKS)
+		return NULL;
+	/* mm_mmap() takes no hints, probe free blocks around the code */
+	size_t site_block = (size_t)site & ~(BLOCK_SIZE - 1);
+	for (size_t i = 1; i <= FS_STUB_SEARCH_BLOCKS; i++)
+	{
+		for (int down = 0; down < 2; down++)
+		{
+			if (down && site_block <= i * BLOCK_SIZE)
+				continue;
+			size_t candidate = down ? site_block - i * BLOCK_SIZE : site_block + i * BLOCK_SIZE;
+			/* Skip ranges used by Windows which mm does not know about */
+			MEMORY_BASIC_INFORMATION info;
+			if (!VirtualQuery((LPCVOID)candidate, &info, sizeof(info)) || info.State != MEM_FREE
+				|| (size_t)info.BaseAddress + info.RegionSize < candidate + BLOCK_SIZE)
+				continue;
+			void *addr = mm_mmap((void *)candidate, BLOCK_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+				INTERNAL_MAP_NOOVERWRITE, NULL, 0);
+			if ((size_t)addr != candidate)
+				continue;
+			struct fs_stub_block *block = &tls->fs_stub_blocks[tls->fs_stub_block_count++];
+			block->base = (uint8_t *)addr;
+			block->used = FS_STUB_SIZE; /* The first stub slot holds the fs base slot offset */
+			tls_write_stub_slot_offset(block);
+			log_info("Allocated fs stub block at %p.\n", addr);
+			return block;
+		}
+	}
+	return NULL;
+}
+
+/* Replace mov r, fs:[base + disp] or mov r, fs:[disp32] with a jump to a stub:
+ * mov r64, [rip + slot offset]
+ * mov r64, gs:[r64]
+ * mov r, [base + r64 + disp]
+ * jmp next
+ */
+static int tls_patch_fs_load(uint8_t *site, uint8_t *next, int rex, int r, int base, int32_t disp)
+{
+	if (next - site < 5 || tls->kernel_entries[TLS_ENTRY_FS_BASE] >= 64)
+		return 0;
+	struct fs_stub_block *block = tls_get_stub_block(site);
+	if (!block)
+		return 0;
+	uint8_t *stub = block->base + block->used;
+	uint8_t buf[FS_STUB_SIZE], *p = buf;
+	int rex_r = (r & 8) ? 4 : 0;
+	/* mov r64, [rip + rel32] */
+	*p++ = 0x48 | rex_r;
+	*p++ = 0x8B;
+	*p++ = ((r & 7) << 3) | 5;
+	*(int32_t *)p = (int32_t)(block->base - (stub + 7));
+	p += 4;
+	/* mov r64, gs:[r64 + 0], a SIB byte makes rsp/r12 and rbp/r13 encodable as base */
+	*p++ = 0x65;
+	*p++ = 0x48 | rex_r | (rex_r >> 2);
+	*p++ = 0x8B;
+	*p++ = 0x44 | ((r & 7) << 3);
+	*p++ = 0x20 | (r & 7);
+	*p++ = 0;
+	/* mov r, [base + r64 + disp32], keeping the operand size of the original instruction */
+	*p++ = 0x40 | (rex & 8) | rex_r | (rex_r >> 1) | (base >= 8 ? 1 : 0);
+	*p++ = 0x8B;
+	*p++ = (base == -1 ? 0x04 : 0x84) | ((r & 7) << 3);
+	*p++ = ((r & 7) << 3) | (base == -1 ? 5 : (base & 7));
+	*(int32_t *)p = disp;
+	p += 4;
+	/* jmp next */
+	*p++ = 0xE9;
+	*(int32_t *)p = (int32_t)(next - (stub + (p + 4 - buf)));
+	p += 4;
+	if (!mm_patch_code(stub, buf, p - buf))
+		return 0;
+	uint8_t jmp[16];
+	jmp[0] = 0xE9;
+	*(int32_t *)(jmp + 1) = (int32_t)(stub - (site + 5));
+	for (int i = 5; i < next - site; i++)
+		jmp[i] = 0x90;
+	if (!mm_patch_code(site, jmp, next - site))
+		return 0;
+	block->used += FS_STUB_SIZE;
+	log_info("Patched fs relative load at %p to stub %p.\n", site, stub);
+	return 1;
+}
+
+int tls_emulate_fs_access(PCONTEXT context)
+{
+	uint8_t *code = (uint8_t *)context->Rip;
+	int fs = 0, opsize = 4, rex = 0, other_prefix = 0;
+	for (;; code++)
+	{
+		if (*code == 0x64)
+			fs = 1;
+		else if (*code == 0x66)
+			opsize = 2, other_prefix = 1;
+		else if (*code == 0xF0) /* LOCK, no other thread can observe the emulation in between */
+			other_prefix = 1;
+		else
+			break;
+	}
+	if (!fs)
+		return 0;
+	if ((*code & 0xF0) == 0x40)
+		rex = *code++;
+	if (rex & 8)
+		opsize = 8;
+	int opcode = *code++;
+	if (opcode == 0x0F)
+		opcode = 0x0F00 | *code++;
+	uint8_t modrm = *code++;
+	int mod = modrm >> 6, r = ((modrm >> 3) & 7) | ((rex & 4) << 1), rm = modrm & 7;
+	if (mod == 3)
+		return 0;
+	/* Effective address, base is -1 for an absolute disp32 */
+	uint64_t addr = 0;
+	int base = -1, indexed = 0;
+	int32_t disp = 0;
+	if (rm == 4)
+	{
+		uint8_t sib = *code++;
+		int index = ((sib >> 3) & 7) | ((rex & 2) << 2), scale = sib >> 6;
+		base = sib & 7;
+		if (index != 4)
+		{
+			addr += *context_register(context, index) << scale;
+			indexed = 1;
+		}
+		if (base == 5 && mod == 0)
+		{
+			base = -1;
+			disp = (int32_t)*(uint32_t *)code;
+			code += 4;
+		}
+		else
+		{
+			base |= (rex & 1) << 3;
+			addr += *context_register(context, base);
+		}
+	}
+	else if (rm == 5 && mod == 0) /* RIP relative, not used with fs */
+		return -1;
+	else
+	{
+		base = rm | ((rex & 1) << 3);
+		addr += *context_register(context, base);
+	}
+	if (mod == 1)
+		disp = (int8_t)*code++;
+	else if (mod == 2)
+	{
+		disp = (int32_t)*(uint32_t *)code;
+		code += 4;
+	}
+	addr += disp;
+	/* Loads with a displacement from a base or an absolute address are patched to jump to a stub on first use */
+	if (opcode == 0x8B && !other_prefix && !indexed && (mod != 0 || base == -1) && r != 4 && r != base
+		&& tls_patch_fs_load((uint8_t *)context->Rip, code, rex, r, base, disp))
+		return 1;
+	addr += (uint64_t)TlsGetValue(tls->kernel_entries[TLS_ENTRY_FS_BASE]);
+	void *p = (void *)addr;
+
+	if (opcode < 0x40 && (opcode & 7) < 4)
+	{
+		/* ALU r/m, r (00-01, 08-09, ...) and ALU r, r/m (02-03, 0A-0B, ...) */
+		int op = opcode >> 3, size = (opcode & 1) ? opsize : 1;
+		int to_register = (opcode & 2) != 0;
+		if (!mm_check_read(p, size) || (!to_register && op != ALU_CMP && !mm_check_write(p, size)))
+			return -1;
+		uint64_t reg = get_register_value(context, r, size, rex), mem = load_value(p, size);
+		if (to_register)
+		{
+			uint64_t value = alu(context, op, reg, mem, size);
+			if (op != ALU_CMP)
+				set_register_value(context, r, value, size, rex);
+		}
+		else
+		{
+			uint64_t value = alu(context, op, mem, reg, size);
+			if (op != ALU_CMP)
+				store_value(p, value, size);
+		}
+	}
+	else
+	{
+		switch (opcode)
+		{
+		case 0x80: /* ALU r/m8, imm8 */
+		case 0x81: /* ALU r/m, imm */
+		case 0x83: /* ALU r/m, imm8 */
+		{
+			int size = opcode == 0x80 ? 1 : opsize;
+			int op = r & 7;
+			uint64_t imm = truncate_value(parse_immediate(&code, opcode == 0x81 ? min(opsize, 4) : 1), size);
+			if (!mm_check_read(p, size) || (op != ALU_CMP && !mm_check_write(p, size)))
+				return -1;
+			uint64_t value = alu(context, op, load_value(p, size), imm, size);
+			if (op != ALU_CMP)
+				store_value(p, value, size);
+			break;
+		}
+
+		case 0x84: /* TEST r/m8, r8 */
+		case 0x85: /* TEST r/m, r */
+		{
+			int size = opcode == 0x84 ? 1 : opsize;
+			if (!mm_check_read(p, size))
+				return -1;
+			alu(context, ALU_AND, load_value(p, size), get_register_value(context, r, size, rex), size);
+			break;
+		}
+
+		case 0x8A: /* MOV r8, r/m8 */
+		case 0x8B: /* MOV r, r/m */
+		{
+			int size = opcode == 0x8A ? 1 : opsize;
+			if (!mm_check_read(p, size))
+				return -1;
+			set_register_value(context, r, load_value(p, size), size, rex);
+			break;
+		}
+
+		case 0x88: /* MOV r/m8, r8 */
+		case 0x89: /* MOV r/m, r */
+		{
+			int size = opcode == 0x88 ? 1 : opsize;
+			if (!mm_check_write(p, size))
+				return -1;
+			store_value(p, get_register_value(context, r, size, rex), size);
+			break;
+		}
+
+		case 0xC6: /* MOV r/m8, imm8 */
+		case 0xC7: /* MOV r/m, imm */
+		{
+			if (r & 7)
+				return -1;
+			int size = opcode == 0xC6 ? 1 : opsize;
+			uint64_t value = parse_immediate(&code, min(size, 4));
+			if (!mm_check_write(p, size))
+				return -1;
+			store_value(p, value, size);
+			break;
+		}
+
+		case 0x0FB6: /* MOVZX r, r/m8 */
+		case 0x0FB7: /* MOVZX r, r/m16 */
+		case 0x0FBE: /* MOVSX r, r/m8 */
+		case 0x0FBF: /* MOVSX r, r/m16 */
+		{
+			int size = (opcode & 1) ? 2 : 1;
+			if (!mm_check_read(p, size))
+				return -1;
+			uint64_t value = load_value(p, size);
+			if (opcode >= 0x0FBE)
+				value = sign_extend(value, size);
+			set_register_value(context, r, truncate_value(value, opsize), opsize, rex);
+			break;
+		}
+
+		case 0xFE: /* INC/DEC r/m8 */
+		case 0xFF: /* INC/DEC r/m */
+		{
+			if ((r & 7) > 1)
+				return -1;
+			int size = opcode == 0xFE ? 1 : opsize;
+			if (!mm_check_read(p, size) || !mm_check_write(p, size))
+				return -1;
+			/* INC and DEC do not change CF */
+			DWORD cf = context->EFlags & FLAG_CF;
+			uint64_t value = alu(context, (r & 7) ? ALU_SUB : ALU_ADD, load_value(p, size), 1, size);
+			context->EFlags = (context->EFlags & ~FLAG_CF) | cf;
+			store_value(p, value, size);
+			break;
+		}
+
+		default:
+			log_warning("Unsupported fs relative instruction at %p, opcode 0x%x.\n", (void *)context->Rip, opcode);
+			return -1;
+		}
+	}
+	context->Rip = (DWORD64)code;
+	return 1;
+}
+#endif
+
 DEFINE_SYSCALL(arch_prctl, int, code, uintptr_t, addr)
 {
 	log_info("arch_prctl(%d, 0x%p)\n", code, addr);
+#ifdef _WIN64
 	switch (code)
 	{
 	case ARCH_SET_FS:
-		log_error("ARCH_SET_FS not supported.\n");
-		return -EINVAL;
+		TlsSetValue(tls->kernel_entries[TLS_ENTRY_FS_BASE], (LPVOID)addr);
+		return 0;
 
 	case ARCH_GET_FS:
-		log_error("ARCH_GET_FS not supported.\n");
-		return -EINVAL;
+		if (!mm_check_write((void *)addr, sizeof(uintptr_t)))
+			return -EFAULT;
+		*(uintptr_t *)addr = (uintptr_t)TlsGetValue(tls->kernel_entries[TLS_ENTRY_FS_BASE]);
+		return 0;
 
 	case ARCH_SET_GS:
-		log_error("ARCH_SET_GS not supported.\n");
-		return -EINVAL;
+		/* Windows owns gs, the base is only recorded for ARCH_GET_GS */
+		log_warning("ARCH_SET_GS: gs relative accesses are not emulated.\n");
+		TlsSetValue(tls->kernel_entries[TLS_ENTRY_GS_BASE], (LPVOID)addr);
+		return 0;
 
 	case ARCH_GET_GS:
-		log_error("ARCH_GET_GS not supported.\n");
-		return -EINVAL;
+		if (!mm_check_write((void *)addr, sizeof(uintptr_t)))
+			return -EFAULT;
+		*(uintptr_t *)addr = (uintptr_t)TlsGetValue(tls->kernel_entries[TLS_ENTRY_GS_BASE]);
+		return 0;
 
 	default:
 		log_error("Unknown code.\n");
 		return -EINVAL;
 	}
+#else
+	/* Not available on i386 */
+	log_error("arch_prctl() not supported on x86.\n");
+	return -EINVAL;
+#endif
 }
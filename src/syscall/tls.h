@@ -20,8 +20,17 @@
 #pragma once
 
 #include <stdint.h>
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
 
-#define TLS_KERNEL_ENTRY_COUNT	7
+#define MAX_TLS_ENTRIES		0x10
+/* Every selector value referencing a TLS entry, whatever its TI and RPL bits */
+#define MAX_TLS_SELECTORS	(MAX_TLS_ENTRIES << 3)
+/* Selector offset of the other selector values, it lies beyond the fs segment limit
+ * so the fs load of the selected TLS slot faults */
+#define TLS_INVALID_SELECTOR_OFFSET		0xFFFF
+
+#define TLS_KERNEL_ENTRY_COUNT	9
 /* Used by dbt */
 #define TLS_ENTRY_SCRATCH		0
 #define TLS_ENTRY_GS			1
@@ -30,6 +39,9 @@
 #define TLS_ENTRY_KERNEL_ESP	4
 #define TLS_ENTRY_ESP			5
 #define TLS_ENTRY_EIP			6
+/* Used by arch_prctl() */
+#define TLS_ENTRY_FS_BASE		7
+#define TLS_ENTRY_GS_BASE		8
 
 void tls_init();
 void tls_reset();
@@ -39,3 +51,10 @@ void tls_afterfork();
 
 int tls_kernel_entry_to_offset(int entry);
 int tls_user_entry_to_offset(int entry);
+/* Table of fs offsets indexed by gs selector values, covers all 65536 values */
+const uint16_t *tls_get_selector_offset_table();
+
+#ifdef _WIN64
+/* Emulate the fs relative memory access at the faulting instruction, returns 1 if handled */
+int tls_emulate_fs_access(PCONTEXT context);
+#endif
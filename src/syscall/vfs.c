@@ -19,21 +19,29 @@
 
 #include <common/errno.h>
 #include <common/fadvise.h>
+#include <common/falloc.h>
 #include <common/fcntl.h>
+#include <common/fs.h>
+#include <common/inotify.h>
 #include <common/ioctls.h>
 #include <fs/console.h>
 #include <fs/devfs.h>
 #include <fs/eventfd.h>
+#include <fs/inotify.h>
 #include <fs/pipe.h>
 #include <fs/procfs.h>
+#include <fs/pty.h>
 #include <fs/socket.h>
 #include <fs/sysfs.h>
+#include <fs/tmpfs.h>
 #include <fs/winfs.h>
+#include <lib/path.h>
 #include <syscall/mm.h>
 #include <syscall/sig.h>
 #include <syscall/syscall.h>
 #include <syscall/vfs.h>
 #include <datetime.h>
+#include <heap.h>
 #include <log.h>
 #include <str.h>
 
@@ -63,20 +71,152 @@ struct filed
 	int cloexec;
 };
 
+/* Mount table
+
+   Mountpoints are organized as a trie of path components. Looking up a path
+   walks down the trie along the components of the path and picks the deepest
+   node with a file system mounted, so the cost only depends on the depth of
+   the path, not on the number of mounts.
+
+   Mounting over an existing mountpoint shadows the previous file system,
+   which is chained by its `next' field and becomes visible again after
+   unmounting.
+*/
+
+struct mount_node
+{
+	struct mount_node *parent, *child, *sibling;
+	struct file_system *fs; /* Top of mount stack, NULL if nothing is mounted here */
+	int namelen;
+	char name[];
+};
+
 struct vfs_data
 {
 	struct filed filed[MAX_FD_COUNT];
-	struct file_system *fs_first;
+	struct mount_node *mount_root;
 	struct file *cwd;
 	int umask;
 };
 
 static struct vfs_data *vfs;
 
+static struct mount_node *mount_node_alloc(struct mount_node *parent, const char *name, int namelen)
+{
+	struct mount_node *node = (struct mount_node *)kmalloc(sizeof(struct mount_node) + namelen);
+	node->parent = parent;
+	node->child = NULL;
+	node->fs = NULL;
+	node->namelen = namelen;
+	memcpy(node->name, name, namelen);
+	if (parent)
+	{
+		node->sibling = parent->child;
+		parent->child = node;
+	}
+	else
+		node->sibling = NULL;
+	return node;
+}
+
+static __inline const char *next_component(const char *path, int *len)
+{
+	while (*path == '/')
+		path++;
+	const char *end = path;
+	while (*end && *end != '/')
+		end++;
+	*len = (int)(end - path);
+	return path;
+}
+
+static struct mount_node *mount_find_child(struct mount_node *node, const char *name, int namelen)
+{
+	for (struct mount_node *child = node->child; child; child = child->sibling)
+		if (child->namelen == namelen && !memcmp(child->name, name, namelen))
+			return child;
+	return NULL;
+}
+
+/* Find the node exactly at a mountpoint, optionally creating missing nodes */
+static struct mount_node *mount_lookup(const char *mountpoint, int create)
+{
+	struct mount_node *node = vfs->mount_root;
+	int len;
+	for (const char *p = next_component(mountpoint, &len); len; p = next_component(p + len, &len))
+	{
+		struct mount_node *child = mount_find_child(node, p, len);
+		if (!child)
+		{
+			if (!create)
+				return NULL;
+			child = mount_node_alloc(node, p, len);
+		}
+		node = child;
+	}
+	return node;
+}
+
 static void vfs_add(struct file_system *fs)
 {
-	fs->next = vfs->fs_first;
-	vfs->fs_first = fs;
+	if (!fs)
+		return;
+	fs->mountpoint_allocated = 0;
+	struct mount_node *node = mount_lookup(fs->mountpoint, 1);
+	fs->next = node->fs;
+	node->fs = fs;
+}
+
+/* Add a file system whose mountpoint is allocated by get_mountpoint() */
+static void vfs_add_mounted(struct file_system *fs)
+{
+	if (!fs)
+		return;
+	vfs_add(fs);
+	fs->mountpoint_allocated = 1;
+}
+
+/* Detach the topmost file system at a mountpoint
+ * The file system object is never freed as open files may still reference it
+ */
+static int vfs_remove(const char *mountpoint)
+{
+	struct mount_node *node = mount_lookup(mountpoint, 0);
+	if (!node || !node->fs)
+		return -EINVAL;
+	if (node == vfs->mount_root && !node->fs->next)
+		return -EBUSY;
+	struct file_system *fs = node->fs;
+	node->fs = fs->next;
+	if (fs->mountpoint_allocated)
+	{
+		/* Paths of files still open on the detached file system become relative to its root, like Linux */
+		char *allocated = (char *)fs->mountpoint;
+		fs->mountpoint = "/";
+		fs->mountpoint_allocated = 0;
+		kfree(allocated, strlen(allocated) + 1);
+	}
+	/* Prune unused nodes */
+	while (node != vfs->mount_root && !node->fs && !node->child)
+	{
+		struct mount_node *parent = node->parent;
+		struct mount_node **p = &parent->child;
+		while (*p != node)
+			p = &(*p)->sibling;
+		*p = node->sibling;
+		kfree(node, sizeof(struct mount_node) + node->namelen);
+		node = parent;
+	}
+	return 0;
+}
+
+static void mount_after_fork(struct mount_node *node)
+{
+	for (struct file_system *fs = node->fs; fs; fs = fs->next)
+		if (fs->after_fork)
+			fs->after_fork(fs);
+	for (struct mount_node *child = node->child; child; child = child->sibling)
+		mount_after_fork(child);
 }
 
 /* Get file handle to a fd */
@@ -124,15 +264,20 @@ void vfs_init()
 	vfs = mm_static_alloc(sizeof(struct vfs_data));
 	struct file *console_in, *console_out;
 	console_init();
+	pty_init();
+	winfs_init();
 	struct file *console = console_alloc();
 	console->ref += 2;
 	vfs->filed[0].fd = console;
 	vfs->filed[1].fd = console;
 	vfs->filed[2].fd = console;
-	vfs_add(winfs_alloc());
+	vfs->mount_root = mount_node_alloc(NULL, "", 0);
+	vfs_add(winfs_alloc("/", NULL));
 	vfs_add(devfs_alloc());
 	vfs_add(procfs_alloc());
 	vfs_add(sysfs_alloc());
+	vfs_add(tmpfs_alloc("/tmp", "tmp", 0));
+	vfs_add(tmpfs_alloc("/dev/shm", "shm", 0));
 	/* Initialize CWD */
 	if (vfs_openat(AT_FDCWD, "/", O_DIRECTORY | O_PATH, 0, &vfs->cwd) < 0)
 	{
@@ -199,7 +344,11 @@ static int cmpfiled(const void *a, const void *b)
 void vfs_afterfork()
 {
 	vfs = mm_static_alloc(sizeof(struct vfs_data));
+	/* Global shared allocations must be redone in the same order as vfs_init() */
+	pty_init();
+	winfs_init();
 	console_afterfork();
+	mount_after_fork(vfs->mount_root);
 
 	int index[MAX_FD_COUNT];
 	for (int i = 0; i < MAX_FD_COUNT; i++)
@@ -300,6 +449,60 @@ DEFINE_SYSCALL(eventfd2, unsigned int, count, int, flags)
 	return fd;
 }
 
+DEFINE_SYSCALL(inotify_init1, int, flags)
+{
+	log_info("inotify_init1(%x)\n", flags);
+	struct file *f;
+	int r = inotify_alloc(&f, flags);
+	if (r < 0)
+		return r;
+	int fd = vfs_store_file(f, (flags & IN_CLOEXEC) > 0);
+	if (fd < 0)
+		vfs_release(f);
+	return fd;
+}
+
+DEFINE_SYSCALL(inotify_init)
+{
+	log_info("inotify_init()\n");
+	return sys_inotify_init1(0);
+}
+
+DEFINE_SYSCALL(inotify_add_watch, int, fd, const char *, pathname, uint32_t, mask)
+{
+	log_info("inotify_add_watch(%d, \"%s\", %x)\n", fd, pathname, mask);
+	struct file *f = vfs_get(fd);
+	if (!f)
+		return -EBADF;
+	if (!inotify_is_inotify(f))
+		return -EINVAL;
+	if (!mm_check_read_string(pathname))
+		return -EFAULT;
+	struct file *target;
+	int flags = O_PATH;
+	if (mask & IN_DONT_FOLLOW)
+		flags |= O_NOFOLLOW;
+	if (mask & IN_ONLYDIR)
+		flags |= O_DIRECTORY;
+	int r = vfs_openat(AT_FDCWD, pathname, flags, 0, &target);
+	if (r < 0)
+		return r;
+	r = inotify_add_watch(f, target, mask);
+	vfs_release(target);
+	return r;
+}
+
+DEFINE_SYSCALL(inotify_rm_watch, int, fd, int, wd)
+{
+	log_info("inotify_rm_watch(%d, %d)\n", fd, wd);
+	struct file *f = vfs_get(fd);
+	if (!f)
+		return -EBADF;
+	if (!inotify_is_inotify(f))
+		return -EINVAL;
+	return inotify_rm_watch(f, wd);
+}
+
 static int vfs_dup(int fd, int newfd, int flags)
 {
 	struct file *f = vfs_get(fd);
@@ -604,26 +807,28 @@ DEFINE_SYSCALL(llseek, int, fd, unsigned long, offset_high, unsigned long, offse
 
 static int find_filesystem(const char *path, struct file_system **out_fs, const char **out_subpath)
 {
-	struct file_system *fs;
-	for (fs = vfs->fs_first; fs; fs = fs->next)
+	/* Longest prefix match in the mount table */
+	struct mount_node *node = vfs->mount_root;
+	struct file_system *fs = node->fs;
+	const char *subpath = path;
+	int len;
+	for (const char *p = next_component(path, &len); len; p = next_component(p + len, &len))
 	{
-		const char *p = fs->mountpoint;
-		const char *subpath = path;
-		while (*p && *p == *subpath)
-		{
-			p++;
-			subpath++;
-		}
-		if (*p == 0)
+		if (!(node = mount_find_child(node, p, len)))
+			break;
+		if (node->fs)
 		{
-			*out_fs = fs;
-			*out_subpath = subpath;
-			if (**out_subpath == '/')
-				(*out_subpath)++;
-			return 1;
+			fs = node->fs;
+			subpath = p + len;
 		}
 	}
-	return 0;
+	if (!fs)
+		return 0;
+	while (*subpath == '/')
+		subpath++;
+	*out_fs = fs;
+	*out_subpath = subpath;
+	return 1;
 }
 
 /* Resolve a given path (except the last component), output the real path
@@ -638,109 +843,44 @@ static int resolve_path(const char *dirpath, const char *pathname, char *realpat
 	if (*pathname == 0)
 		return -ENOENT;
 	/* CAUTION: dirpath can be aliased with realpath */
-	if (*pathname == '/')
-	{
-		/* Absolute */
-		pathname++;
-	}
-	else
-	{
-		/* Relative: Copy dirpath */
-		if (realpath == dirpath)
-		{
-			/* Whoa, not even need to copy anything */
-			realpath += strlen(dirpath);
-		}
-		else
-		{
-			while (*dirpath)
-				*realpath++ = *dirpath++;
-		}
-		if (realpath > realpath_start && realpath[-1] == '/')
-			realpath--;
-	}
-	while (*pathname)
+	realpath = path_start(dirpath, &pathname, realpath);
+	while (path_next(&pathname, realpath_start, &realpath) == PATH_COMPONENT)
 	{
-		if (pathname[0] == '/')
-			pathname++;
-		else if (pathname[0] == '.' && pathname[1] == '/')
-			pathname += 2;
-		else if (pathname[0] == '.' && pathname[1] == '.' && pathname[2] == '/')
-		{
-			pathname += 3;
-			/* Remove last component if exists */
-			if (realpath > realpath_start)
-				for (realpath--; *realpath != '/'; realpath--);
-		}
-		else
+		/* Resolve component */
+		for (;;)
 		{
-			*realpath++ = '/';
-			/* Append current component */
-			while (*pathname && *pathname != '/')
-				*realpath++ = *pathname++;
-			if (*pathname == '/')
-			{
-				pathname++;
-				/* Resolve component */
-				for (;;)
-				{
-					struct file_system *fs;
-					char *subpath;
-					*realpath = 0;
-					if (!find_filesystem(realpath_start, &fs, &subpath))
-						return -ENOTDIR;
-					if (!fs->open)
-						return -ENOTDIR;
-					int r = fs->open(fs, subpath, O_PATH | O_DIRECTORY, 0, NULL, target, PATH_MAX);
-					if (r < 0)
-						return r;
-					else if (r == 0) /* It is a regular file, go forward */
-						break;
-					else if (r == 1)
-					{
-						/* It is a symlink */
-						if ((*symlink_remain)-- == 0)
-							return -ELOOP;
-						/* We resolve the symlink target using a recursive call */
-						/* Remove basename */
-						for (realpath--; *realpath != '/'; realpath--);
-						*realpath = 0;
-						r = resolve_path(realpath_start, target, realpath_start, symlink_remain);
-						if (r < 0)
-							return r;
-						realpath = realpath_start + r;
-						if (realpath > realpath_start && realpath[-1] == '/')
-							realpath--;
-						/* The last component is not resolved by the recursive call, solve it now */
-					}
-				}
-			}
-			else
+			struct file_system *fs;
+			char *subpath;
+			*realpath = 0;
+			if (!find_filesystem(realpath_start, &fs, &subpath))
+				return -ENOTDIR;
+			if (!fs->open)
+				return -ENOTDIR;
+			int r = fs->open(fs, subpath, O_PATH | O_DIRECTORY, 0, NULL, target, PATH_MAX);
+			if (r < 0)
+				return r;
+			else if (r == 0) /* It is a regular file, go forward */
+				break;
+			else if (r == 1)
 			{
-				/* Done */
-				/* Normalize last component if it is "." or ".." */
-				if (realpath[-1] == '.' && realpath[-2] == '/')
-				{
-					realpath -= 2;
-					break;
-				}
-				else if (realpath[-1] == '.' && realpath[-2] == '.' && realpath[-3] == '/')
-				{
-					/* Remove last component if exists */
-					realpath -= 3;
-					if (realpath - 1 > realpath_start)
-						for (realpath--; *realpath != '/'; realpath--);
-					break;
-				}
-				else
-					break;
+				/* It is a symlink */
+				if ((*symlink_remain)-- == 0)
+					return -ELOOP;
+				/* We resolve the symlink target using a recursive call */
+				/* Remove basename */
+				realpath = path_remove_last(realpath_start, realpath);
+				*realpath = 0;
+				r = resolve_path(realpath_start, target, realpath_start, symlink_remain);
+				if (r < 0)
+					return r;
+				realpath = realpath_start + r;
+				if (realpath > realpath_start && realpath[-1] == '/')
+					realpath--;
+				/* The last component is not resolved by the recursive call, solve it now */
 			}
 		}
 	}
-	if (realpath == realpath_start)
-		*realpath++ = '/'; /* Return "/" instead of empty string */
-	*realpath = 0;
-	return realpath - realpath_start;
+	return path_finish(realpath_start, realpath);
 }
 
 /* resolve_path(), *at() version */
@@ -900,8 +1040,6 @@ DEFINE_SYSCALL(linkat, int, olddirfd, const char *, oldpath, int, newdirfd, cons
 	int r = vfs_openat(olddirfd, oldpath, openflags, 0, &f);
 	if (r < 0)
 		return r;
-	if (!winfs_is_winfile(f))
-		return -EPERM;
 	char realpath[PATH_MAX];
 	int symlink_remain = MAX_SYMLINK_LEVEL;
 	r = resolve_pathat(newdirfd, newpath, realpath, &symlink_remain);
@@ -1024,8 +1162,6 @@ DEFINE_SYSCALL(renameat2, int, olddirfd, const char *, oldpath, int, newdirfd, c
 	int r = vfs_openat(olddirfd, oldpath, O_PATH | O_NOFOLLOW | __O_DELETE, 0, &f);
 	if (r < 0)
 		return r;
-	if (!winfs_is_winfile(f))
-		return -EPERM;
 	char realpath[PATH_MAX];
 	int symlink_remain = MAX_SYMLINK_LEVEL;
 	r = resolve_pathat(newdirfd, newpath, realpath, &symlink_remain);
@@ -1477,11 +1613,11 @@ DEFINE_SYSCALL(statfs64, const char *, pathname, size_t, sz, struct statfs64 *,
 DEFINE_SYSCALL(fadvise64_64, int, fd, loff_t, offset, loff_t, len, int, advice)
 {
 	log_info("fadvise64_64(%d, %lld, %lld, %d)\n", fd, offset, len, advice);
-	/* It seems windows does not support any of the fadvise semantics
-	 * We simply check the validity of parameters and return
-	 */
-	if (!vfs->filed[fd].fd)
+	struct file *f = vfs_get(fd);
+	if (!f)
 		return -EBADF;
+	if (len < 0)
+		return -EINVAL;
 	switch (advice)
 	{
 	case POSIX_FADV_NORMAL:
@@ -1490,6 +1626,9 @@ DEFINE_SYSCALL(fadvise64_64, int, fd, loff_t, offset, loff_t, len, int, advice)
 	case POSIX_FADV_WILLNEED:
 	case POSIX_FADV_DONTNEED:
 	case POSIX_FADV_NOREUSE:
+		/* The advice is only a hint, file systems without support simply ignore it */
+		if (f->op_vtable->fadvise)
+			return f->op_vtable->fadvise(f, offset, len, advice);
 		return 0;
 	}
 	return -EINVAL;
@@ -1755,6 +1894,194 @@ DEFINE_SYSCALL(chroot, const char *, pathname)
 	return 0;
 }
 
+/* Get the canonical path of an existing directory, returns the length of the path */
+static int get_directory_path(const char *target, int flags, char *path)
+{
+	struct file *f;
+	int r = vfs_openat(AT_FDCWD, target, O_PATH | O_DIRECTORY | flags, 0, &f);
+	if (r < 0)
+		return r;
+	int len = f->op_vtable->getpath(f, path);
+	vfs_release(f);
+	while (len > 1 && path[len - 1] == '/')
+		len--;
+	path[len] = 0;
+	return len;
+}
+
+/* Get the canonical path of an existing directory to be used as a mountpoint
+ * The returned string is allocated by kmalloc() and freed when the file system is unmounted
+ */
+static int get_mountpoint(const char *target, char **mountpoint)
+{
+	char path[PATH_MAX];
+	int len = get_directory_path(target, 0, path);
+	if (len < 0)
+		return len;
+	*mountpoint = (char *)kmalloc(len + 1);
+	memcpy(*mountpoint, path, len + 1);
+	return 0;
+}
+
+static int vfs_remount(const char *target, unsigned long mountflags, const void *data)
+{
+	char path[PATH_MAX];
+	int r = get_directory_path(target, 0, path);
+	if (r < 0)
+		return r;
+	struct mount_node *node = mount_lookup(path, 0);
+	if (!node || !node->fs)
+		return -EINVAL;
+	if (mountflags & MS_RDONLY)
+	{
+		log_error("Read-only mounts are not supported.\n");
+		return -EINVAL;
+	}
+	/* Other per mount flags (nosuid, noexec, atime flags, etc) have no effect on us */
+	if (mountflags & MS_BIND)
+		return 0;
+	struct file_system *fs = node->fs;
+	if (fs->remount)
+		return fs->remount(fs, mountflags, data);
+	if (data && *(const char *)data)
+	{
+		log_error("Remounting \"%s\" with options \"%s\" is not supported.\n", path, (const char *)data);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int vfs_mount(const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data)
+{
+	if ((mountflags & MS_MGC_MSK) == MS_MGC_VAL)
+		mountflags &= ~MS_MGC_MSK;
+	if (mountflags & (MS_SHARED | MS_PRIVATE | MS_SLAVE | MS_UNBINDABLE))
+	{
+		/* We have no mount namespaces, thus there is nothing to propagate */
+		return 0;
+	}
+	if (mountflags & MS_REMOUNT)
+		return vfs_remount(target, mountflags, data);
+	if (mountflags & MS_MOVE)
+	{
+		log_error("MS_MOVE not supported.\n");
+		return -EINVAL;
+	}
+	char *mountpoint;
+	struct file_system *fs;
+	if (mountflags & MS_BIND)
+	{
+		/* Bind mount a directory of a winfs file system */
+		struct file *f;
+		int r = vfs_openat(AT_FDCWD, source, O_PATH | O_DIRECTORY, 0, &f);
+		if (r < 0)
+			return r;
+		if (!winfs_is_winfile(f))
+		{
+			log_error("Bind mounting a non-winfs directory is not supported.\n");
+			vfs_release(f);
+			return -EINVAL;
+		}
+		WCHAR root[PATH_MAX];
+		int len = winfs_get_windows_path(f, root, PATH_MAX - 1);
+		vfs_release(f);
+		if (len == 0)
+			return -ENAMETOOLONG;
+		root[len] = 0;
+		if ((r = get_mountpoint(target, &mountpoint)) < 0)
+			return r;
+		fs = winfs_alloc(mountpoint, root);
+	}
+	else if (filesystemtype && !strcmp(filesystemtype, "tmpfs"))
+	{
+		static int tmpfs_id;
+		uint64_t size;
+		int r = tmpfs_parse_size((const char *)data, &size);
+		if (r < 0)
+			return r;
+		if ((r = get_mountpoint(target, &mountpoint)) < 0)
+			return r;
+		/* Each mount gets a new instance, make its name globally unique */
+		char name[32];
+		ksprintf(name, "mnt%d_%d", GetCurrentProcessId(), tmpfs_id++);
+		fs = tmpfs_alloc(mountpoint, name, size);
+		if (!fs)
+		{
+			kfree(mountpoint, strlen(mountpoint) + 1);
+			return -ENOMEM;
+		}
+	}
+	else
+	{
+		log_error("Unsupported file system type.\n");
+		return -ENODEV;
+	}
+	vfs_add_mounted(fs);
+	log_info("Mounted \"%s\".\n", mountpoint);
+	return 0;
+}
+
+int vfs_mount_windows(const WCHAR *path, const char *target)
+{
+	/* Convert to a full path in the form which could be prepended with "\??\" */
+	WCHAR buf[PATH_MAX], root[PATH_MAX];
+	DWORD len = GetFullPathNameW(path, PATH_MAX, buf, NULL);
+	if (len == 0 || len >= PATH_MAX)
+		return -ENOENT;
+	if (buf[0] == L'\\' && buf[1] == L'\\' && buf[2] == L'?' && buf[3] == L'\\')
+		memcpy(root, buf + 4, (len - 4 + 1) * sizeof(WCHAR));
+	else if (buf[0] == L'\\' && buf[1] == L'\\')
+	{
+		/* UNC path */
+		memcpy(root, L"UNC", 3 * sizeof(WCHAR));
+		memcpy(root + 3, buf + 1, len * sizeof(WCHAR));
+	}
+	else
+		memcpy(root, buf, (len + 1) * sizeof(WCHAR));
+	DWORD attributes = GetFileAttributesW(buf);
+	if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY))
+		return -ENOTDIR;
+	char *mountpoint;
+	int r = get_mountpoint(target, &mountpoint);
+	if (r < 0)
+		return r;
+	vfs_add_mounted(winfs_alloc(mountpoint, root));
+	log_info("Mounted \"%s\".\n", mountpoint);
+	return 0;
+}
+
+DEFINE_SYSCALL(mount, const char *, source, const char *, target, const char *, filesystemtype, unsigned long, mountflags, const void *, data)
+{
+	log_info("mount(\"%s\", \"%s\", \"%s\", %x, %p)\n", source, target, filesystemtype, mountflags, data);
+	if ((source && !mm_check_read_string(source)) || !mm_check_read_string(target)
+		|| (filesystemtype && !mm_check_read_string(filesystemtype)) || (data && !mm_check_read_string(data)))
+		return -EFAULT;
+	return vfs_mount(source, target, filesystemtype, mountflags, data);
+}
+
+DEFINE_SYSCALL(umount2, const char *, target, int, flags)
+{
+	log_info("umount2(\"%s\", %x)\n", target, flags);
+	if (!mm_check_read_string(target))
+		return -EFAULT;
+	if (flags & ~(MNT_FORCE | MNT_DETACH | MNT_EXPIRE | UMOUNT_NOFOLLOW))
+		return -EINVAL;
+	if ((flags & MNT_EXPIRE) && (flags & (MNT_FORCE | MNT_DETACH)))
+		return -EINVAL;
+	/* We do not track open files of a file system, all unmounts are lazy (MNT_DETACH) */
+	char path[PATH_MAX];
+	int r = get_directory_path(target, (flags & UMOUNT_NOFOLLOW) ? O_NOFOLLOW : 0, path);
+	if (r < 0)
+		return r;
+	return vfs_remove(path);
+}
+
+DEFINE_SYSCALL(umount, const char *, target)
+{
+	log_info("umount(\"%s\")\n", target);
+	return sys_umount2(target, 0);
+}
+
 DEFINE_SYSCALL(fchownat, int, dirfd, const char *, pathname, uid_t, owner, gid_t, group, int, flags)
 {
 	log_info("fchownat(%d, \"%s\", %d, %d, %x)\n", dirfd, pathname, owner, group, flags);
@@ -2035,9 +2362,24 @@ DEFINE_SYSCALL(fremovexattr, int, fd, const char *, name)
 	return -EOPNOTSUPP;
 }
 
-DEFINE_SYSCALL(fallocate, int, fd, int, mode, loff_t, offset, loff_t, len) 
+DEFINE_SYSCALL(fallocate, int, fd, int, mode, loff_t, offset, loff_t, len)
 {
-	log_info("fallocate(%d, %d, %d, %d)\n", fd, mode, offset, len);
-	log_warning("fallocate() not implemented.\n");
-	return -EOPNOTSUPP;
+	log_info("fallocate(%d, %d, %lld, %lld)\n", fd, mode, offset, len);
+	struct file *f = vfs_get(fd);
+	if (!f)
+		return -EBADF;
+	if (offset < 0 || len <= 0)
+		return -EINVAL;
+	if ((f->flags & O_ACCMODE) == O_RDONLY)
+		return -EBADF;
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))
+		return -EOPNOTSUPP;
+	if ((mode & FALLOC_FL_PUNCH_HOLE) && (mode & ~FALLOC_FL_PUNCH_HOLE) != FALLOC_FL_KEEP_SIZE)
+		return -EOPNOTSUPP;
+	if (!f->op_vtable->fallocate)
+	{
+		log_warning("fallocate() not implemented for this file.\n");
+		return -EOPNOTSUPP;
+	}
+	return f->op_vtable->fallocate(f, mode, offset, len);
 }
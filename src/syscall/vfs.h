@@ -42,6 +42,9 @@ void vfs_afterfork();
 int vfs_store_file(struct file *f, int cloexec);
 
 int vfs_openat(int dirfd, const char *pathname, int flags, int mode, struct file **f);
+int vfs_mount(const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data);
+/* Bind mount a Windows directory into the guest tree */
+int vfs_mount_windows(const WCHAR *path, const char *target);
 void vfs_close(int fd);
 struct file *vfs_get(int fd);
 void vfs_ref(struct file *f);
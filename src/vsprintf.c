@@ -33,22 +33,22 @@ static const char *uppercase = "0123456789ABCDEF";
 		int b = (base);							\
 		char nbuf[128];							\
 		type y = (x);							\
+		utype z = (utype)y;						\
 		int sign = 0;							\
 		if (IS_SIGNED(type) && y < 0)			\
 		{										\
 			sign = 1;							\
-			y = -y;								\
+			z = 0 - z;							\
 		}										\
-		utype z = (utype)y;						\
 		int len = 0;							\
-		if (y == 0)								\
+		if (z == 0)								\
 			nbuf[len++] = '0';					\
 		else									\
 		{										\
-			while (y > 0)						\
+			while (z > 0)						\
 			{									\
-				nbuf[len++] = ch[y % b];		\
-				y /= b;							\
+				nbuf[len++] = ch[z % b];		\
+				z /= b;							\
 			}									\
 		}										\
 		if (sign)								\
@@ -90,7 +90,7 @@ int kvsprintf(char *buffer, const char *format, va_list args)
 			case 'c':
 			{
 				format = f;
-				*buf++ = va_arg(args, char);
+				*buf++ = (char)va_arg(args, int);
 				continue;
 			}
 
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+#
+# Generate src/wcwidth_table.h, the two-level character width table used by
+# wcwidth() in src/wcwidth.c, from the Unicode database shipped with Python.
+#
+# Usage: python3 tools/gen_wcwidth.py > src/wcwidth_table.h
+#
+
+import sys
+import unicodedata
+
+BLOCK_SHIFT = 8
+BLOCK_SIZE = 1 << BLOCK_SHIFT
+MAX_CODEPOINT = 0x110000
+
+# Width classes, must match src/wcwidth.c
+# East Asian Ambiguous characters are narrow, like glibc does in UTF-8 locales
+WIDTH_ZERO = 0
+WIDTH_ONE = 1
+WIDTH_TWO = 2
+
+# Format characters with the Prepended_Concatenation_Mark property are visible
+PREPENDED_CONCATENATION_MARKS = set(list(range(0x0600, 0x0606)) + [0x06DD, 0x070F, 0x0890, 0x0891, 0x08E2, 0x110BD, 0x110CD])
+
+def width_class(cp):
+    if cp == 0x00AD or cp in PREPENDED_CONCATENATION_MARKS:  # SOFT HYPHEN
+        return WIDTH_ONE
+    if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:  # Hangul Jamo medial vowels and final consonants
+        return WIDTH_ZERO
+    if cp == 0x200B:  # ZERO WIDTH SPACE
+        return WIDTH_ZERO
+    ch = chr(cp)
+    if unicodedata.category(ch) in ('Mn', 'Me', 'Cf'):
+        return WIDTH_ZERO
+    if 0x20000 <= cp <= 0x2FFFD or 0x30000 <= cp <= 0x3FFFD:  # CJK ideograph planes, including unassigned
+        return WIDTH_TWO
+    if unicodedata.category(ch) == 'Cn':  # Other unassigned code points are narrow, regardless of their default EAW
+        return WIDTH_ONE
+    # Yijing Hexagram Symbols are wide in Unicode 16.0, which is newer than the Python database
+    if 0x4DC0 <= cp <= 0x4DFF:
+        return WIDTH_TWO
+    if 0x3248 <= cp <= 0x324F:  # Circled numbers on black square, ambiguous but wide in glibc like the rest of the block
+        return WIDTH_TWO
+    if unicodedata.east_asian_width(ch) in ('W', 'F'):
+        return WIDTH_TWO
+    return WIDTH_ONE
+
+def main():
+    blocks = []
+    block_index = {}
+    stage1 = []
+    for start in range(0, MAX_CODEPOINT, BLOCK_SIZE):
+        packed = bytearray(BLOCK_SIZE // 4)
+        for i in range(BLOCK_SIZE):
+            packed[i // 4] |= width_class(start + i) << (2 * (i % 4))
+        packed = bytes(packed)
+        if packed not in block_index:
+            block_index[packed] = len(blocks)
+            blocks.append(packed)
+        stage1.append(block_index[packed])
+    assert len(blocks) <= 256
+
+    out = sys.stdout
+    out.write('/* Generated by tools/gen_wcwidth.py from Unicode %s, do not edit. */\n\n' % unicodedata.unidata_version)
+    out.write('#define WCWIDTH_UNICODE_VERSION\t"%s"\n' % unicodedata.unidata_version)
+    out.write('#define WCWIDTH_BLOCK_SHIFT\t%d\n' % BLOCK_SHIFT)
+    out.write('#define WCWIDTH_MAX_CODEPOINT\t0x%X\n\n' % (MAX_CODEPOINT - 1))
+    out.write('/* Block index of each %d code points */\n' % BLOCK_SIZE)
+    out.write('static const uint8_t wcwidth_stage1[%d] = {\n' % len(stage1))
+    for i in range(0, len(stage1), 16):
+        out.write('\t' + ' '.join('%d,' % x for x in stage1[i:i + 16]) + '\n')
+    out.write('};\n\n')
+    out.write('/* Width classes of each block, 2 bits per code point */\n')
+    out.write('static const uint8_t wcwidth_stage2[%d][%d] = {\n' % (len(blocks), BLOCK_SIZE // 4))
+    for block in blocks:
+        out.write('\t{\n')
+        for i in range(0, len(block), 16):
+            out.write('\t\t' + ' '.join('0x%02X,' % x for x in block[i:i + 16]) + '\n')
+        out.write('\t},\n')
+    out.write('};\n')
+
+if __name__ == '__main__':
+    main()